@@ -4,19 +4,50 @@
 #include "protocol.h" // For MAX_FILENAME_LEN
 #include "common.h"
 #include <pthread.h>
-#include <time.h>
+#include <stddef.h>
+#include <stdint.h>
 
-#define CACHE_SIZE 16 // We can store 16 recent results
+#define CACHE_DEFAULT_CAPACITY 4096 // Entries across all shards
+#define CACHE_SHARDS           16   // Independent locks; must be a power of two
+#define CACHE_PERMS_PER_ENTRY  4    // Users whose permission is remembered per file
 
+// One user's resolved permission on a cached file
 typedef struct {
+    char username[64];     // "" = unused slot
+    PermissionType level;  // Highest permission held (owners get PERM_WRITE)
+} CachePermEntry;
+
+typedef struct CacheEntry {
     char filename[MAX_FILENAME];
-    int ss_index;
-    int is_valid;       // 0 = empty slot, 1 = valid data
-    time_t last_used_time; // For LRU eviction
+    int ss_index;          // -1 = not known yet (entry only holds permissions)
+    CachePermEntry perms[CACHE_PERMS_PER_ENTRY];
+    int next_perm;         // Round-robin slot to overwrite when perms is full
+
+    uint32_t hash;                // file_index_hash(filename)
+    struct CacheEntry* hash_next; // Chain within the shard's buckets
+    struct CacheEntry* lru_prev;  // Towards most recently used
+    struct CacheEntry* lru_next;  // Towards least recently used
 } CacheEntry;
 
+// Totals over all shards (see cache_get_stats)
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long perm_hits;
+    unsigned long perm_misses;
+    unsigned long evictions;
+    unsigned long invalidations;
+    size_t entries;
+    size_t capacity;
+} CacheStats;
+
 // --- Cache API ---
 
+/**
+ * @brief Sets the total number of entries. Call before init_cache().
+ */
+void cache_set_capacity(size_t entries);
+
 /**
  * @brief Initializes the cache.
  */
@@ -31,17 +62,42 @@ int cache_lookup(const char* filename);
 
 /**
  * @brief Adds or updates an entry in the cache.
- * If the cache is full, it evicts the least recently used entry.
+ * If the shard is full, it evicts its least recently used entry.
  * @param filename The name of the file.
  * @param ss_index The storage server index.
  */
 void cache_add(const char* filename, int ss_index);
 
 /**
- * @brief (Good to have later) Removes an entry from the cache.
- * Call this if a file is deleted or moved.
+ * @brief Looks up a remembered permission decision.
+ * @return 1 if 'username' holds at least 'permission', 0 if not,
+ *         -1 if nothing is cached for this user and file.
+ */
+int cache_lookup_permission(const char* filename, const char* username, PermissionType permission);
+
+/**
+ * @brief Remembers the highest permission 'username' holds on a file.
+ * Callers must hold whatever lock orders this against ACL changes
+ * (search.c adds under index_lock, and ACL changes invalidate under it).
+ */
+void cache_add_permission(const char* filename, int ss_index, const char* username, PermissionType level);
+
+/**
+ * @brief Removes an entry from the cache.
+ * Call this if a file is deleted or moved, or its ACL changes.
  * @param filename The name of the file to invalidate.
  */
 void cache_invalidate(const char* filename);
 
-#endif // CACHE_H
\ No newline at end of file
+/**
+ * @brief Drops every entry that points at one storage server.
+ * Used when a server is purged.
+ */
+void cache_invalidate_ss(int ss_index);
+
+/**
+ * @brief Copies the hit/miss/eviction counters into 'out'.
+ */
+void cache_get_stats(CacheStats* out);
+
+#endif // CACHE_H
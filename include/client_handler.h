@@ -5,10 +5,24 @@
 #include "executor.h" // For handle_exec_request
 
 /**
- * @brief Handles the entire lifecycle of a client connection.
- * This is the main function for the client's thread.
+ * @brief Handles the MSG_REGISTER_CLIENT handshake on a new connection.
+ * @param out_username Receives the client's username (64 bytes).
+ * @return 0 if the client is logged in, -1 if the connection should be dropped.
  */
-void handle_client_connection(int sock_fd, MessageHeader* initial_header);
+int handle_client_login(int sock_fd, MessageHeader* initial_header, char* out_username);
+
+/**
+ * @brief Routes a single request from a logged-in client.
+ * Called by a reactor worker once per received header.
+ * @return 0 if the connection stays open, -1 if the handler took
+ * ownership of the socket and closed it (MSG_EXEC).
+ */
+int handle_client_message(int sock_fd, MessageHeader* header, const char* client_username);
+
+/**
+ * @brief Closes a client socket that hung up and deregisters the user.
+ */
+void handle_client_disconnect(int sock_fd, const char* client_username);
 
 /**
  * @brief Handles a MSG_CREATE request from a client.
@@ -71,6 +85,19 @@ void handle_move_file_request(int sock_fd, MessageHeader* header, const char* cl
 void handle_move_folder_request(int sock_fd, MessageHeader* header, const char* client_username);
 void handle_view_folder_request(int sock_fd, MessageHeader* header, const char* client_username);
 
+/**
+ * @brief Handles a MSG_STATS request: this NS's metrics followed by each
+ * live SS's, as Prometheus text.
+ */
+void handle_stats_request(int sock_fd, MessageHeader* header, const char* client_username);
+
+/**
+ * @brief Handles a MSG_SEARCH_CONTENT request: asks every live SS's word
+ * index at once and answers with the matching sentences of the files the
+ * user may read, one "--> <file> (sentences ...)" line per file.
+ */
+void handle_search_content_request(int sock_fd, MessageHeader* header, const char* client_username);
+
 /**
  * @brief Handles a MSG_SS_DEAD_REPORT from a client.
  */
@@ -21,6 +21,7 @@
 #define ERR_400 "ERR_400"  // Bad request
 #define ERR_401 "ERR_401"  // Unauthorized
 #define ERR_404 "ERR_404"  // Not found
+#define ERR_421 "ERR_421"  // Misdirected: a replica refused a command meant for the primary
 #define ERR_500 "ERR_500"  // Internal error
 
 // Component identifiers for logging
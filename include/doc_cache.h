@@ -0,0 +1,70 @@
+#ifndef DOC_CACHE_H
+#define DOC_CACHE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+#include "storage_server.h" // For sentence_info_t
+
+#define DOC_CACHE_MAX_ENTRIES 128                 // Parsed documents kept in memory
+#define DOC_CACHE_MAX_BYTES   (32 * 1024 * 1024)  // Text bytes kept in memory
+
+// One whitespace-separated word of a document
+typedef struct {
+    const char* str;   // NUL-terminated (points into the document's token buffer)
+    size_t offset;     // Byte offset of the word in 'text'
+    size_t length;
+} doc_word_t;
+
+/**
+ * @brief A document split into words and sentences.
+ * Shared and read-only once published; hold it with doc_cache_acquire()
+ * and give it back with doc_release().
+ */
+typedef struct parsed_doc {
+    char* text;                  // Whole file, NUL-terminated
+    size_t length;
+    doc_word_t* words;
+    int word_count;
+    sentence_info_t* sentences;  // Word ranges; the last may lack a delimiter
+    int sentence_count;
+
+    // Private to doc_cache.c
+    char* tokens;                // Copy of text with whitespace replaced by NULs
+    int refcount;
+    ino_t ino;                   // File identity the parse was taken from
+    off_t size;
+    struct timespec mtime;
+} parsed_doc_t;
+
+/**
+ * @brief Returns the parsed form of a file, reading it only if it changed.
+ * Staleness is detected by inode, size and mtime, so edits made outside
+ * these helpers are picked up too.
+ * @return A referenced document (release it), or NULL if the file cannot be read.
+ */
+parsed_doc_t* doc_cache_acquire(const char* path);
+
+/**
+ * @brief Drops a file's cached parse. Call after writing or removing it.
+ */
+void doc_cache_invalidate(const char* path);
+
+/**
+ * @brief Parses a file without caching it (e.g. a session's swap file).
+ * @return A document with one reference, or NULL if unreadable.
+ */
+parsed_doc_t* doc_parse_file(const char* path);
+
+/**
+ * @brief Gives back a reference from doc_cache_acquire() or doc_parse_file().
+ */
+void doc_release(parsed_doc_t* doc);
+
+/**
+ * @brief Number of sentences a WRITE may target: every existing sentence,
+ * plus one new sentence if the document ends with a complete one.
+ */
+int doc_writable_sentences(const parsed_doc_t* doc);
+
+#endif // DOC_CACHE_H
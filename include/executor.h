@@ -3,10 +3,26 @@
 
 #include "protocol.h"
 
+// EXEC runs a file's content as a shell command on the NS. Commands run
+// on a small pool of their own threads, so a slow one holds neither a
+// reactor worker nor the SS control channel.
+#define EXEC_POOL_THREADS  4                // Commands running at once
+#define EXEC_QUEUE_MAX     32               // Waiting for a thread; more are refused
+#define EXEC_TIMEOUT_SEC   30               // A command still running then is killed
+#define EXEC_OUTPUT_CHUNK  (64 * 1024)      // Output is sent to the client in pieces up to this size
+#define EXEC_FLUSH_MS      50               // ...or once the command has been quiet this long
+
+/**
+ * @brief Starts the EXEC pool.
+ */
+void executor_init();
+
 /**
  * @brief Handles a MSG_EXEC request from a client.
- * This is the full orchestration function.
+ * Checks access and queues the command; the pool fetches the content,
+ * runs it and streams its output. Takes ownership of the socket, which
+ * is closed once the output is done (or on error).
  */
 void handle_exec_request(int client_sock_fd, MessageHeader* header, const char* client_username);
 
-#endif // EXECUTOR_H
\ No newline at end of file
+#endif // EXECUTOR_H
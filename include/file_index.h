@@ -0,0 +1,88 @@
+#ifndef FILE_INDEX_H
+#define FILE_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "search.h" // For FileRecord
+
+#define FILE_INDEX_INITIAL_CAPACITY 1024 // Slots; must be a power of two
+#define FILE_INDEX_MAX_LOAD_PCT     70   // Grow once this full
+
+/**
+ * @brief One open-addressing slot.
+ * The cached hash lets almost every probe skip the strcmp (and the
+ * cache miss on the record it points to).
+ */
+typedef struct {
+    uint32_t hash;
+    FileRecord* record; // NULL = empty slot
+} FileIndexSlot;
+
+/**
+ * @brief Filename -> FileRecord map (linear probing, backward-shift delete).
+ * Not internally locked; search.c guards it with index_lock.
+ */
+typedef struct {
+    FileIndexSlot* slots;
+    size_t capacity;
+    size_t count;
+} FileIndex;
+
+/**
+ * @brief Allocates an empty index.
+ * @param initial_capacity Rounded up to a power of two.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int file_index_init(FileIndex* index, size_t initial_capacity);
+
+/**
+ * @brief Frees the slot array. Records are owned by the caller.
+ */
+void file_index_destroy(FileIndex* index);
+
+/**
+ * @brief Looks up a record by exact filename.
+ * @return The record, or NULL if not present.
+ */
+FileRecord* file_index_find(const FileIndex* index, const char* filename);
+
+/**
+ * @brief Adds a record keyed by record->filename.
+ * @return 0 on success, -1 if the name is taken or the table cannot grow.
+ */
+int file_index_insert(FileIndex* index, FileRecord* record);
+
+/**
+ * @brief Unlinks a record.
+ * @return The removed record (caller frees it), or NULL if not present.
+ */
+FileRecord* file_index_remove(FileIndex* index, const char* filename);
+
+/**
+ * @brief Iterates all records in unspecified order.
+ * Start with *cursor = 0. The index must not be modified mid-walk.
+ * @return The next record, or NULL when done.
+ */
+FileRecord* file_index_next(const FileIndex* index, size_t* cursor);
+
+/**
+ * @brief The string hash the index uses (FNV-1a), for callers that keep
+ * their own tables of names.
+ */
+uint32_t file_index_hash(const char* str);
+
+/**
+ * @brief Returns a shared, immutable copy of a short string.
+ * Usernames and folder names repeat across thousands of records, so each
+ * one is stored once. Interned strings are never freed, which keeps
+ * by-value FileRecord copies valid after the live record is gone.
+ * Thread-safe.
+ */
+const char* file_index_intern(const char* str);
+
+/**
+ * @brief Bytes currently held by the intern pool (for benchmarks).
+ */
+size_t file_index_intern_bytes();
+
+#endif // FILE_INDEX_H
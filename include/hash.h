@@ -0,0 +1,21 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// FNV-1a, shared by every table keyed by a filename or word: short keys,
+// no setup, and a good enough spread for power-of-two buckets.
+
+/**
+ * @brief 32-bit FNV-1a of a NUL-terminated string.
+ */
+uint32_t fnv1a_hash(const char* str);
+
+/**
+ * @brief 64-bit FNV-1a of 'length' bytes, for keys that are not
+ * NUL-terminated or where collisions must stay rare (fingerprints).
+ */
+uint64_t fnv1a_hash64(const void* data, size_t length);
+
+#endif // HASH_H
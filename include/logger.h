@@ -3,10 +3,36 @@
 
 #include <stdio.h>
 
+// Lines are queued on a per-thread ring and written by a background
+// thread, so write_log() never touches the files itself. A process
+// killed by a signal loses at most the last LOG_FLUSH_MS of lines.
+#define LOG_RING_BYTES (64 * 1024)  // Per logging thread; power of two
+#define LOG_LINE_MAX   2048         // Longer lines are truncated
+#define LOG_FLUSH_MS   20           // Writer wakes at least this often
+
+typedef enum {
+    LOG_LEVEL_DEBUG = 0,  // "DEBUG", "CACHE", "SEARCH"
+    LOG_LEVEL_INFO,       // "INFO" and component tags
+    LOG_LEVEL_WARN,       // "WARN"
+    LOG_LEVEL_ERROR       // "ERROR", "FATAL"
+} log_level_t;
+
+// Opens the log files and starts the writer; LOG_LEVEL in the environment sets the threshold
 void init_logger(const char *ip, int port);
+
+// Username shown in this thread's lines (NULL = "N/A")
 void set_logger_username(const char *username);
+
+// Drop lines below 'level' from now on (default: log everything)
+void set_log_level(log_level_t level);
+
+// "DEBUG", "INFO", "WARN" or "ERROR" (any case); anything else is INFO
+log_level_t parse_log_level(const char *name);
+
 void write_log(const char *level, const char *format, ...);
 void write_local_log(const char *level, const char *format, ...);
+
+// Flushes queued lines and closes the files (also run at exit)
 void close_logger();
 
 #endif
@@ -0,0 +1,75 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// In-process counters, latency histograms and gauges, rendered in the
+// Prometheus text format for MSG_STATS. Recording is a handful of
+// relaxed atomic adds; nothing here takes a lock after an op's first use.
+#define METRICS_MAX_OPS     64  // Distinct operations per surface (later ones count as "OTHER")
+#define METRICS_MAX_GAUGES  16
+#define METRICS_MAX_WAITS   8
+#define METRICS_BUCKETS     24  // Latency buckets: <= 1us, 2us, 4us, ... 2^23us (~8 s), then +Inf
+
+// Where a request came in
+typedef enum {
+    METRICS_NS_CLIENT = 0,  // NS route_message: client requests
+    METRICS_SS_NS,          // SS handle_ns_commands: requests from the NS
+    METRICS_SS_DIRECT,      // SS direct-client command loop
+    METRICS_SURFACES
+} metrics_surface_t;
+
+/**
+ * @brief Monotonic clock in microseconds, for timing a request.
+ */
+uint64_t metrics_now_us(void);
+
+/**
+ * @brief Starts timing a request on this thread and clears its error mark.
+ * @return The start time to pass to metrics_end().
+ */
+uint64_t metrics_begin(void);
+
+/**
+ * @brief Flags the request this thread is handling as failed. Called
+ * where error replies are sent, so handlers need no changes.
+ */
+void metrics_mark_error(void);
+
+/**
+ * @brief Records one request: its count, whether it was marked failed,
+ * and the time since 'start_us'. 'op' must be a string literal or
+ * otherwise outlive the process.
+ */
+void metrics_end(metrics_surface_t surface, const char* op, uint64_t start_us);
+
+/**
+ * @brief Adds one sample to a named wait-time histogram (e.g. a lock).
+ */
+void metrics_observe_wait(const char* name, uint64_t micros);
+
+/**
+ * @brief Adjusts a named gauge (e.g. +1 on connect, -1 on disconnect).
+ */
+void metrics_gauge_add(const char* name, long delta);
+
+/**
+ * @brief Registers a gauge whose value is read when stats are rendered.
+ */
+void metrics_register_gauge(const char* name, double (*read)(void));
+
+/**
+ * @brief Totals every operation recorded on a surface so far (for load
+ * reports; take two readings and subtract for a rate).
+ */
+void metrics_surface_totals(metrics_surface_t surface, uint64_t* count, uint64_t* sum_us);
+
+/**
+ * @brief Renders every metric as Prometheus text, each series labelled
+ * instance="<instance>".
+ * @return malloc'd, NUL-terminated text (caller frees), or NULL if out of memory.
+ */
+char* metrics_render(const char* instance, size_t* out_length);
+
+#endif // METRICS_H
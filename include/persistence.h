@@ -4,10 +4,16 @@
 #include <time.h>
 #include "protocol.h"
 
-// Maximum number of files tracked
-#define MAX_FILES 1024
+// The file table grows on demand; its filename index starts at this many
+// buckets (power of two) and doubles whenever it fills up
+#define FILE_TABLE_INITIAL_BUCKETS 256
 
-typedef struct {
+// Metadata journal (metadata.journal beside metadata.bin)
+#define METADATA_JOURNAL_SYNC_MS  50    // Group-commit window: one fdatasync per tick
+#define METADATA_COMPACT_RECORDS  4096  // Fold the journal into metadata.bin after this many records
+#define METADATA_ACCESS_FLUSH_SEC 5     // Coalesce access-time updates this long (0 = journal each one)
+
+typedef struct FileMeta {
     char filename[256];
     long size;
     long word_count;
@@ -19,18 +25,36 @@ typedef struct {
     char folder[256];
     AclEntryPayload acl[MAX_ACL_ENTRIES];
     int acl_count;
+    int access_dirty;           // Access time changed but not yet journaled
+    uint64_t version;           // metadata epoch of the last change to this record
+    int replica;                // Read-only copy of a file whose primary is another SS
+    int replica_behind;         // (replica) The primary has changed since the last copy (not persisted)
+    int slot;                   // Position in file_table (internal)
+    struct FileMeta *hash_next; // Filename index chain (internal)
 } FileMeta;
 
-// Global in-memory metadata table
-extern FileMeta file_table[MAX_FILES];
-extern int file_count;
+/**
+ * @brief Called after a record's size, counts or access info change, with
+ * a copy of the record (the table lock is not held). Access info arrives
+ * in batches at each access flush; new records are not reported.
+ * 'content_changed' is set when the file itself was rewritten.
+ */
+typedef void (*metadata_change_hook)(const FileMeta *file, int content_changed);
 
-// Load existing metadata.txt from disk into memory
+// Load metadata.bin (or a legacy metadata.txt) into memory and replay the journal over it
+// (metadata.journal.old, left by an interrupted compaction, then metadata.journal)
 int load_metadata(const char *meta_dir);
 
-// Save current metadata table to metadata.txt
+// Save current metadata table to metadata.bin (atomic temp file + rename)
 int save_metadata(const char *meta_dir);
 
+// Route further changes through the append-only journal and start its
+// group-commit/compaction thread. Until then every change rewrites metadata.bin.
+int persist_journal_start(const char *meta_dir);
+
+// Flush coalesced access times, sync and compact the journal, stop its thread
+void persist_journal_stop(void);
+
 // Add new entry
 void add_metadata_entry(const char *meta_dir, const char *filename);
 
@@ -40,11 +64,79 @@ void remove_metadata_entry(const char *meta_dir, const char *filename);
 // Update entry when file is written to
 void update_metadata_entry(const char *meta_dir, const char *filename);
 
-FileMeta* persist_find_file(const char *filename);
+// Update entry by a known size/word change (no recount)
+void persist_adjust_counts(const char *meta_dir, const char *filename, long size_delta, long word_delta);
+
+/**
+ * @brief Copies a file's record into 'out' under the table lock. Records
+ * are freed when their file is deleted, so callers keep the copy, never
+ * a pointer into the table.
+ * @return 0 if found, -1 if there is no such record.
+ */
+int persist_get_file(const char *filename, FileMeta *out);
+
+/**
+ * @brief Copies every record, taken in one pass under the table lock.
+ * @return malloc'd array of *out_count records (NULL when there are none
+ * or memory ran out). The caller frees it.
+ */
+FileMeta* persist_snapshot_files(int *out_count);
+
+/**
+ * @brief Whether 'username' holds at least 'needed' on a file, by the
+ * NS's rule (the owner may do anything, others need an ACL entry).
+ * Direct clients may reuse a cached redirect, so the SS checks too.
+ * @return 1 if allowed, 0 if not. A file with no record or no owner yet
+ * (MSG_INTERNAL_SET_OWNER still in flight) is allowed: the NS decided.
+ */
+int persist_check_access(const char *filename, const char *username, PermissionType needed);
 void persist_set_owner(const char *meta_dir, const char *filename, const char *owner);
 void persist_set_acl(const char *meta_dir, const char *filename, const char *target_user, PermissionType permission);
 void persist_remove_acl(const char *meta_dir, const char *filename, const char *target_user);
 void persist_update_last_accessed(const char *meta_dir, const char *filename, const char *username);
 void persist_set_folder(const char *meta_dir, const char *filename, const char *foldername);
 
+/**
+ * @brief Creates or refreshes the record of a replica copy whose content
+ * is already in place, taking owner, ACL and times from the primary.
+ * Clears replica_behind. Does not run the change hook: the NS knows.
+ */
+void persist_store_replica(const char *meta_dir, const char *filename, const SSReplicaPayload *state);
+
+/**
+ * @brief Applies a REPLICA_STATE_* from the NS to a record.
+ */
+void persist_set_replica_state(const char *meta_dir, const char *filename, int state);
+
+/**
+ * @brief What a direct client may do with a file here.
+ * @return 0 if it is a primary copy (or unknown), 1 if a current replica
+ * (reads only), 2 if a replica that is behind its primary.
+ */
+int persist_replica_state(const char *filename);
+
+/**
+ * @brief Counts the files this SS holds and their total size, for the
+ * load heartbeat.
+ */
+void persist_usage(int *files, uint64_t *bytes);
+
+/**
+ * @brief Current metadata epoch: the highest record version handed out.
+ * Every change stamps the record with the next epoch, and the counter
+ * survives restarts, so "version > E" means "changed since epoch E".
+ */
+uint64_t persist_metadata_epoch(void);
+
+/**
+ * @brief Reads (creating on first use) the random id of this metadata
+ * directory. A wiped or replaced directory gets a new id, which tells
+ * the NS that epochs from before are meaningless.
+ * @return 0 on success, -1 if it could not be read or created.
+ */
+int persist_instance_id(const char *meta_dir, uint64_t *out_id);
+
+// Register a hook run on every metadata change (NULL to disable)
+void persist_set_change_hook(metadata_change_hook hook);
+
 #endif
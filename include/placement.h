@@ -0,0 +1,36 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+// Where CREATE puts a new file. storage_manager.c describes every active
+// SS as a candidate from its last heartbeat; a policy only compares
+// candidates, so adding one is a pick function plus an entry in the
+// table in placement.c.
+#define PLACEMENT_DEFAULT_POLICY "p2c"
+#define PLACEMENT_MIN_FREE_BYTES (64ull * 1024 * 1024) // Below this, used only if every SS is below it
+
+typedef struct {
+    int ss_index;
+    int has_load;       // Sent a heartbeat within SS_HEARTBEAT_STALE_SEC
+    double files;       // Held, plus placed since that heartbeat
+    double busy;        // Open direct sessions per worker thread
+    double latency_us;  // Mean direct request time
+    double free_bytes;
+} placement_candidate_t;
+
+/**
+ * @brief Selects the policy by name: "round-robin", "least-loaded" or
+ * "p2c" (weighted power of two choices).
+ * @return 0 on success, -1 if the name is unknown (policy unchanged).
+ */
+int placement_set_policy(const char* name);
+
+const char* placement_policy_name(void);
+
+/**
+ * @brief Picks a candidate with the current policy. Not thread-safe:
+ * callers hold ss_registry_mutex.
+ * @return Index into 'candidates', or -1 if count is 0.
+ */
+int placement_pick(const placement_candidate_t* candidates, int count);
+
+#endif // PLACEMENT_H
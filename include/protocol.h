@@ -54,6 +54,19 @@ typedef struct {
     char last_accessed_by[64];
 } SSMetadataPayload;
 
+// One slot of a MSG_INTERNAL_METADATA_BATCH_RESP, in request order
+typedef struct {
+    int found;              // 0 if the SS has no such file
+    SSMetadataPayload meta;
+} SSMetadataBatchEntry;
+
+// SS -> NS push whenever a file's metadata changes (request_id = 0)
+typedef struct {
+    char filename[MAX_FILENAME];
+    SSMetadataPayload meta;
+    int32_t content_changed; // The file itself changed (write, undo, revert): replicas are behind
+} SSMetadataDeltaPayload;
+
 // For ACL lists in network payloads
 typedef struct {
     char username[64];
@@ -98,6 +111,20 @@ typedef struct {
 #define MSG_MOVE_FOLDER     42 // MOVEFOLDER <src> <dst>
 #define MSG_VIEWFOLDER      43 // VIEWFOLDER <folder>
 
+// Metrics: NS and every SS, as Prometheus text (see metrics.h).
+// Client -> NS, and NS -> SS over the control channel.
+#define MSG_STATS           44
+#define MSG_STATS_RESPONSE  45 // Payload = metrics text
+
+// Content search: filename = the words to look for (all in one sentence).
+// The NS asks every SS for MSG_INTERNAL_SEARCH_CONTENT and merges what the
+// user may read into one MSG_SEARCH_RESPONSE (payload = text).
+#define MSG_SEARCH_CONTENT  46
+#define MSG_SEARCH_RESPONSE 47
+// Filename of a MSG_INTERNAL_SEARCH_RESULT or MSG_SEARCH_RESPONSE whose
+// hits may be incomplete because a server is still building its index
+#define SEARCH_INDEX_WARMING "INDEX_WARMING"
+
 // NS -> Client
 #define MSG_READ_REDIRECT   21
 #define MSG_INFO_RESPONSE   31
@@ -108,6 +135,9 @@ typedef struct {
 #define MSG_REGISTER            10
 #define MSG_REGISTER_FILE       36
 #define MSG_REGISTER_COMPLETE   37
+// Bulk file list: payload = back-to-back records from encode_file_record()
+#define MSG_REGISTER_FILE_BATCH 39
+#define SS_REGISTER_BATCH_BYTES (64 * 1024) // Max payload of one batch message
 
 // NS <-> SS (Internal)
 #define MSG_INTERNAL_READ           100
@@ -119,6 +149,27 @@ typedef struct {
 #define MSG_INTERNAL_SET_OWNER       106
 // Internal: set file's folder on SS (payload = foldername string)
 #define MSG_INTERNAL_SET_FOLDER      107
+// Batched metadata: request payload = N x char[MAX_FILENAME],
+// response payload = N x SSMetadataBatchEntry in the same order.
+#define MSG_INTERNAL_GET_METADATA_BATCH   108
+#define MSG_INTERNAL_METADATA_BATCH_RESP  109
+#define SS_METADATA_BATCH_MAX             256  // Filenames per batch message
+// Unsolicited SS -> NS: payload = SSMetadataDeltaPayload
+#define MSG_INTERNAL_METADATA_DELTA       110
+// Unsolicited SS -> NS every SS_HEARTBEAT_SEC: payload = SSHeartbeatPayload
+#define MSG_SS_HEARTBEAT                  111
+// NS -> replica SS: payload = SSReplicaPayload then the file content; ACK'd
+#define MSG_INTERNAL_REPLICATE            112
+// NS -> SS, no reply: payload = int32_t REPLICA_STATE_*
+#define MSG_INTERNAL_REPLICA_STATE        113
+#define REPLICA_STATE_PRIMARY 0 // Promoted: the copy takes writes again
+#define REPLICA_STATE_REPLICA 1 // Demoted: read-only, behind until the next MSG_INTERNAL_REPLICATE
+#define REPLICA_STATE_BEHIND  2 // The primary changed: refuse reads until the next copy
+// NS -> SS: filename = the query. Reply payload = word_index_query() text,
+// one "<filename> <sentence>...\n" line per file; filename =
+// SEARCH_INDEX_WARMING while the SS's startup build is running
+#define MSG_INTERNAL_SEARCH_CONTENT       114
+#define MSG_INTERNAL_SEARCH_RESULT        115
 
 // Checkpoint-related message types
 #define MSG_CHECKPOINT         120
@@ -143,6 +194,8 @@ typedef struct {
     uint16_t source_component;
     uint16_t dest_component;
     uint32_t payload_length;
+    uint32_t request_id;         // Echoed by the SS so NS<->SS replies can be matched; 0 = none.
+                                 // At registration: the protocol version offered (see WIRE VERSIONS)
     char filename[MAX_FILENAME]; // Use MAX_FILENAME from common.h
 } MessageHeader;
 
@@ -159,8 +212,19 @@ typedef struct {
     time_t last_accessed;
     char last_accessed_by[64];
     char folder[MAX_FILENAME];
+    int replica;            // A read-only copy; the NS knows the primary
 } SSFileRecordPayload;
 
+// MSG_INTERNAL_REPLICATE: everything a replica needs besides the content
+typedef struct {
+    char owner_username[64];
+    AclEntryPayload acl[MAX_ACL_ENTRIES];
+    int32_t acl_count;
+    char folder[MAX_FILENAME];
+    int64_t created;
+    int64_t modified;
+} SSReplicaPayload;
+
 // Payload for VIEWFOLDER request: flags + folder name
 typedef struct {
     int flags;
@@ -183,12 +247,105 @@ typedef struct {
     char last_accessed_by[64];
 } FileInfoPayload;
 
+// ------------------------------------------------------------
+//  WIRE VERSIONS
+// ------------------------------------------------------------
+// v1 sends MessageHeader as the raw struct (~272 bytes, host byte order).
+// v2 sends a 14-byte big-endian header followed by only the used bytes
+// of 'filename':
+//   [0] PROTOCOL_V2_MAGIC  [1] version  [2..3] msg_type
+//   [4] source << 4 | dest  [5] name length
+//   [6..9] request_id  [10..13] payload_length
+// Every connection starts on v1. The connecting side offers v2 by putting
+// PROTOCOL_VERSION in the request_id of its MSG_REGISTER_CLIENT or
+// MSG_REGISTER; a peer that takes it echoes the version in the ACK's
+// request_id, and both sides switch after the ACK. Old peers leave it 0.
+#define PROTOCOL_V1        1
+#define PROTOCOL_V2        2
+#define PROTOCOL_VERSION   PROTOCOL_V2
+#define PROTOCOL_V2_MAGIC  0xD0 // No v1 msg_type has this low byte
+#define PROTOCOL_V2_HEADER 14
+#define PROTOCOL_MAX_FDS   65536 // Higher fds always use v1
+
+/**
+ * @brief Sets the framing send_header() uses on 'socket_fd'. Connecting
+ * sides reset it to PROTOCOL_V1 first, since fds are reused.
+ */
+void protocol_set_version(int socket_fd, int version);
+
+/**
+ * @brief Framing of 'socket_fd': PROTOCOL_V1 unless negotiated.
+ */
+int protocol_version(int socket_fd);
+
+/**
+ * @brief Accepting side: the version to answer an offer (the request_id
+ * of MSG_REGISTER_CLIENT / MSG_REGISTER) with. Put it in the ACK's
+ * request_id, then call protocol_set_version() once the ACK is sent.
+ */
+uint32_t protocol_accept_offer(uint32_t offered);
+
 // ------------------------------------------------------------
 //  UTILITY FUNCTIONS (from protocol.c)
 // ------------------------------------------------------------
 int send_all(int socket_fd, const void *buf, size_t len);
 int recv_all(int socket_fd, void *buf, size_t len);
+
+/**
+ * @brief Sends a header in the socket's framing (see WIRE VERSIONS).
+ */
 int send_header(int socket_fd, MessageHeader *header);
+
+/**
+ * @brief Receives a header in either framing. A v2 frame also switches
+ * the socket to v2, so replies always match what the peer sent.
+ */
 int recv_header(int socket_fd, MessageHeader *header);
 
+/**
+ * @brief Appends the compact wire form of a file record to 'buf'.
+ * Strings are length-prefixed and integers are varints, so a typical
+ * record is a few dozen bytes instead of sizeof(SSFileRecordPayload).
+ * @return Bytes written, or 0 if it does not fit in 'capacity'.
+ */
+size_t encode_file_record(const SSFileRecordPayload *record, uint8_t *buf, size_t capacity);
+
+/**
+ * @brief Decodes one record written by encode_file_record() and advances '*cursor'.
+ * Over-long strings are truncated to their field; ACLs to MAX_ACL_ENTRIES.
+ * @return 0 on success, -1 if the record is truncated or malformed.
+ */
+int decode_file_record(const uint8_t **cursor, const uint8_t *end, SSFileRecordPayload *record);
+
+/**
+ * @brief Compact form of an INFO response for v2 links: like
+ * encode_file_record(), a few dozen bytes instead of sizeof(FileInfoPayload).
+ * @return Bytes written, or 0 if it does not fit in 'capacity'.
+ */
+size_t encode_file_info(const FileInfoPayload *info, uint8_t *buf, size_t capacity);
+
+/**
+ * @brief Decodes a payload written by encode_file_info().
+ * @return 0 on success, -1 if it is truncated or malformed.
+ */
+int decode_file_info(const uint8_t *buf, size_t len, FileInfoPayload *info);
+
+/**
+ * @brief Compact form of a MSG_INTERNAL_METADATA_DELTA for v2 links.
+ * @return Bytes written, or 0 if it does not fit in 'capacity'.
+ */
+size_t encode_metadata_delta(const SSMetadataDeltaPayload *delta, uint8_t *buf, size_t capacity);
+
+/**
+ * @brief Decodes a payload written by encode_metadata_delta().
+ * @return 0 on success, -1 if it is truncated or malformed.
+ */
+int decode_metadata_delta(const uint8_t *buf, size_t len, SSMetadataDeltaPayload *delta);
+
+/**
+ * @brief Short name of a message type (e.g. "READ"), for logs and metrics.
+ * @return A static string; "UNKNOWN" for unassigned types.
+ */
+const char *msg_type_name(uint32_t msg_type);
+
 #endif // PROTOCOL_H
\ No newline at end of file
@@ -0,0 +1,38 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <pthread.h>
+
+#define REACTOR_WORKER_THREADS 8   // Fixed pool that executes requests
+#define REACTOR_MAX_EVENTS 64      // epoll_wait batch size
+
+/**
+ * @brief Per-connection state kept by the reactor between requests.
+ * One of these replaces what used to be a whole thread per socket.
+ */
+typedef enum {
+    CONN_STATE_NEW,     // Accepted, first header not seen yet
+    CONN_STATE_CLIENT   // Logged-in client, waiting for next request
+} ConnectionState;
+
+typedef struct NsConnection {
+    int sock_fd;
+    ConnectionState state;
+    char username[64];
+    struct NsConnection* next; // Intrusive link for the work queue
+} NsConnection;
+
+/**
+ * @brief Creates the epoll instance and starts the worker pool.
+ * @param listen_fd A socket that is already bound and listening.
+ * @return 0 on success, -1 on failure.
+ */
+int init_reactor(int listen_fd);
+
+/**
+ * @brief Runs the event loop on the calling thread. Does not return
+ * unless epoll itself fails.
+ */
+void reactor_run();
+
+#endif // REACTOR_H
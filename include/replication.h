@@ -0,0 +1,57 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include "protocol.h"
+
+// Read-only copies of files on other Storage Servers. The primary takes
+// every write; a write's metadata push marks the replicas behind and
+// queues the file here. One worker thread then reads the primary's copy
+// over its control channel and sends it to each replica as
+// MSG_INTERNAL_REPLICATE, since Storage Servers only talk to the NS.
+// Until a replica has the current content it turns reads away, and the
+// NS sends reads only to the primary and to current replicas.
+#define NS_DEFAULT_REPLICAS 1 // Per file, besides the primary; 0 turns replication off
+
+/**
+ * @brief Starts the replication worker.
+ */
+void replication_init();
+
+/**
+ * @brief Sets how many replicas each file should have (up to
+ * NS_MAX_REPLICAS). Call before replication_init().
+ */
+void replication_set_factor(int replicas);
+
+int replication_factor();
+
+/**
+ * @brief Queues a file's behind replicas for copying. Never blocks on
+ * the network; safe to call with index_lock held.
+ */
+void replication_enqueue(const char* filename);
+
+/**
+ * @brief Adds replicas to a file on other active servers until it has
+ * replication_factor() of them (or there are no more servers).
+ */
+void replication_add_replicas(const char* filename);
+
+/**
+ * @brief Tells replicas their copy of 'filename' is out of date, so they
+ * turn reads away until the next MSG_INTERNAL_REPLICATE.
+ */
+void replication_notify_behind(const char* filename, const int* ss_indices, int count);
+
+/**
+ * @brief Tells the SS holding a replica of 'filename' that it is now the primary.
+ */
+void replication_promoted(const char* filename, int ss_index);
+
+/**
+ * @brief Sends a metadata command the primary has already applied (ACL,
+ * folder) to every replica of the file. The replicas do not answer.
+ */
+void replication_forward(const char* filename, MessageHeader* header, const void* payload);
+
+#endif // REPLICATION_H
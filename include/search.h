@@ -2,45 +2,76 @@
 #define SEARCH_H
 
 #include "protocol.h" // For PermissionType
-#include <pthread.h>  // For pthread_mutex_t
+#include <pthread.h>  // For pthread_rwlock_t
 #include <time.h>     // For time_t
 #include "common.h"
 
 #define MAX_ACL_ENTRIES 10 // Max 10 users per file's ACL
-#define TRIE_CHAR_SET_SIZE 128 // For all ASCII characters
+#define NS_METADATA_MAX_STALENESS_SEC 60 // Default; 0 = always ask the SS
+#define NS_MAX_REPLICAS         3  // Read-only copies of a file, besides its primary
+#define NS_READ_YOUR_WRITES_SEC 30 // A file's last writer reads from the primary this long after writing
 
 // --- Data Structures ---
 
 // Represents one user's permission on a file
 typedef struct {
-    char username[64];
+    const char* username; // Interned (file_index_intern)
     PermissionType permission;
 } AclEntry;
 
+// A read-only copy of a file on another SS (see replication.h)
+typedef struct {
+    int ss_index;
+    unsigned int version; // content_version it holds; behind while != the record's
+    int suspect;          // Its SS vanished; dropped unless the SS reports the copy again
+} ReplicaRef;
+
+struct FolderNode; // Folder tree node, private to search.c
+
 // This is the main data structure for a file.
-// A pointer to this is stored in the Trie.
+// A pointer to this is stored in the file index (file_index.h).
+// Strings that repeat across records are interned pointers, so a copy
+// of a record stays valid after the original is freed.
 typedef struct {
     char filename[MAX_FILENAME];
-    char owner_username[64];
+    const char* owner_username; // Interned
     int ss_index; // Which storage server has this file
-    char folder[MAX_FILENAME];
+    const char* folder; // Interned; "" = root
     
     long word_count;
     long char_count;
     time_t created;
     time_t modified;
     time_t last_accessed;
-    char last_accessed_by[64];
+    const char* last_accessed_by; // Interned
+    time_t metadata_synced; // When the SS last confirmed the fields above (0 = never)
     
     AclEntry acl[MAX_ACL_ENTRIES];
     int acl_count;
+
+    struct FolderNode* folder_node; // Folder holding this record (maintained by search.c)
+    int folder_slot;                // Position in folder_node's file list
+    int suspect;                    // Its SS disconnected; kept until it re-syncs or times out
+
+    // Replicas. ss_index above is the primary, which takes every write.
+    ReplicaRef replicas[NS_MAX_REPLICAS];
+    int replica_count;
+    unsigned int content_version;   // Bumped whenever the primary's content changes
+    int provisional;                // ss_index holds a replica whose primary has not registered: read-only
+    int replication_queued;
+    int announce_primary;           // ss_index was promoted while away; told once it is back
+    const char* last_writer;        // Interned; see NS_READ_YOUR_WRITES_SEC
+    time_t last_write;
 } FileRecord;
 
-// The Trie Node structure
-typedef struct TrieNode {
-    struct TrieNode* children[TRIE_CHAR_SET_SIZE];
-    FileRecord* file_info; // NULL if not the end of a file
-} TrieNode;
+// What the replication worker needs to bring a file's replicas up to date
+typedef struct {
+    int primary;
+    unsigned int version;           // content_version being copied
+    int targets[NS_MAX_REPLICAS];   // Replicas behind it
+    int target_count;
+    SSReplicaPayload state;         // Owner, ACL, folder and times for the replicas' records
+} ReplicaSyncJob;
 
 
 // --- Functions ---
@@ -70,7 +101,7 @@ int search_remove_permission(const char* filename, const char* owner_username, c
 int search_delete_file(const char* filename, const char* username);
 
 /**
- * @brief Gets a copy of a file's details from the Trie.
+ * @brief Gets a copy of a file's details from the index.
  * This is thread-safe.
  * @param filename The file to look up.
  * @param record_copy A pointer to a FileRecord struct to copy data into.
@@ -79,7 +110,80 @@ int search_delete_file(const char* filename, const char* username);
 int search_get_file_details(const char* filename, FileRecord* record_copy);
 
 /**
- * @brief Traverses the entire Trie and builds a formatted string of files.
+ * @brief Overwrites a file's counts and timestamps with values from its SS.
+ * Used for pushed metadata deltas and fetched metadata alike.
+ */
+void search_apply_metadata(const char* filename, const SSMetadataPayload* meta);
+
+/**
+ * @brief Sets how long pushed/fetched metadata may be served from memory.
+ * @param seconds Maximum age; 0 makes INFO and VIEW -l always ask the SS.
+ */
+void search_set_metadata_staleness(int seconds);
+
+/**
+ * @brief Checks whether a record's metadata is recent enough to serve as-is.
+ * @return 1 if fresh, 0 if it should be re-fetched from the SS.
+ */
+int search_metadata_is_fresh(const FileRecord* record);
+
+/**
+ * @brief Lists the servers a read of 'filename' by 'username' may go to:
+ * the primary first, then every replica holding the current content
+ * (none for the file's last writer within NS_READ_YOUR_WRITES_SEC).
+ * @param replica_count Receives how many replicas the file has, current or not.
+ * @return Number of servers written to 'out', or -1 if the file is not found.
+ */
+int search_get_read_servers(const char* filename, const char* username, int* out, int max, int* replica_count);
+
+/**
+ * @brief Remembers who last opened 'filename' for writing (read-your-writes).
+ */
+void search_note_writer(const char* filename, const char* username);
+
+/**
+ * @brief Lists every server holding a copy: the primary first, then the replicas.
+ * @return Number written to 'out', or -1 if the file is not found.
+ */
+int search_get_copies(const char* filename, int* out, int max);
+
+/**
+ * @brief Applies a metadata push from an SS. From the primary it is
+ * taken whole, and a content change puts every replica behind (and queues
+ * the file for replication); from a replica only access info is kept.
+ * @param behind Receives the replicas now behind.
+ * @return How many were written to 'behind'.
+ */
+int search_apply_delta(int ss_index, const SSMetadataDeltaPayload* delta, int* behind, int max_behind);
+
+/**
+ * @brief Adds a replica of 'filename' on 'ss_index' (behind until copied)
+ * and queues the copy.
+ * @return 0 on success, -1 if not found, already a copy there, or full.
+ */
+int search_add_replica(const char* filename, int ss_index);
+
+/**
+ * @brief Starts a replication job for a queued file.
+ * @return Number of replicas to copy to (0 if none is behind), or -1 if
+ * the file is gone.
+ */
+int search_begin_replication(const char* filename, ReplicaSyncJob* job);
+
+/**
+ * @brief Records that a replica now holds content 'version'.
+ */
+void search_replica_synced(const char* filename, int ss_index, unsigned int version);
+
+/**
+ * @brief Called once a registering SS's channel is open: queues the
+ * files it holds a copy of for replication, and tells it about files it
+ * was promoted to primary of while it was away.
+ */
+void search_server_ready(int ss_index);
+
+/**
+ * @brief Walks the index and builds a formatted string of files.
  * This is a complex, recursive function.
  * @param username The user asking for the list.
  * @param flags A bitmask of VIEW_FLAG_ALL and VIEW_FLAG_LONG.
@@ -89,22 +193,45 @@ int search_get_file_details(const char* filename, FileRecord* record_copy);
  */
 int search_get_file_list(const char* username, int flags, char* out_buffer, int buffer_size);
 /**
- * @brief Traverses the entire Trie and deletes all file records
+ * @brief Walks the index and deletes all file records
  * associated with a specific, dead storage server.
+ * A file with a replica elsewhere is kept, promoting the replica, and
+ * the dead server is dropped from other files' replica sets.
  * @param ss_index The index of the SS to purge.
  */
 void search_purge_by_ss(int ss_index);
 
+/**
+ * @brief Marks every record of a disconnected SS suspect instead of
+ * purging it, so it stays listed until the SS re-registers.
+ * @return Number of records marked.
+ */
+int search_mark_ss_suspect(int ss_index);
+
+/**
+ * @brief Ends a re-registration of an SS whose records were suspect.
+ * After a delta sync the unchanged records are confirmed; after a full
+ * sync any record the SS did not resend is purged.
+ */
+void search_finish_resync(int ss_index, int delta);
+
 // ... (after search_get_file_details)
 
 /**
- * @brief Rebuilds a file record in the Trie from an SS.
+ * @brief Rebuilds a file record in the index from an SS.
  * This is used on SS registration to populate the NS.
  * @param ss_index The index of the SS that owns this file.
  * @param file_payload The full file record from the SS.
  */
 void search_rebuild_add_file(int ss_index, SSFileRecordPayload* file_payload);
 
+/**
+ * @brief Bulk form of search_rebuild_add_file() for one registration batch.
+ * Takes the index lock once for the whole batch.
+ * @return Number of records added or refreshed (conflicts are skipped).
+ */
+int search_rebuild_add_files(int ss_index, const SSFileRecordPayload* records, int count);
+
 // Folder APIs
 // Represents a folder move update for notifying SSes
 typedef struct {
@@ -113,7 +240,9 @@ typedef struct {
     int ss_index;
 } MoveFileUpdate;
 
+// Create a folder. Missing parents are implied (they hold paths but are not listed). Returns 0 or -1 if it exists.
 int search_add_folder(const char* foldername, const char* owner_username);
+// Returns 0 if the folder was created with search_add_folder, -1 otherwise.
 int search_find_folder(const char* foldername);
 // Move/rename a folder and update contained files. Returns number of updated files or -1 on error.
 int search_move_folder(const char* src, const char* dst, const char* owner_username, MoveFileUpdate* out_updates, int max_updates);
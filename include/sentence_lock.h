@@ -0,0 +1,40 @@
+#ifndef SENTENCE_LOCK_H
+#define SENTENCE_LOCK_H
+
+#include <stddef.h>
+
+#define SENTENCE_LOCK_BUCKETS     256   // Power of two; one mutex + wait queue each
+#define SENTENCE_LOCK_FD_STRIPES  64    // Power of two; guards the fd -> lock index
+#define SENTENCE_LOCK_MAX_WAIT_MS 10000 // Upper bound on a queued WRITE acquire
+
+/**
+ * @brief Takes the WRITE lock on one sentence of a file for a client.
+ * If another client holds it, waits up to 'timeout_ms' for it to be
+ * released (0 = fail immediately). Re-acquiring a lock the client
+ * already holds succeeds.
+ * @return 0 if held, -1 if still held by another client, -2 on allocation failure.
+ */
+int sentence_lock_acquire(const char* filename, int sentence_num, int client_fd, int timeout_ms);
+
+/**
+ * @brief Releases one lock held by a client and wakes its waiters.
+ */
+void sentence_lock_release(const char* filename, int sentence_num, int client_fd);
+
+/**
+ * @brief Releases every lock a client holds (e.g., on disconnect).
+ */
+void sentence_lock_release_client(int client_fd);
+
+/**
+ * @brief Finds the sentence a client is currently writing.
+ * @return 1 and fills filename/sentence_num if it holds a lock, 0 otherwise.
+ */
+int sentence_lock_held_by(int client_fd, char* filename, size_t filename_size, int* sentence_num);
+
+/**
+ * @brief Checks whether any sentence of a file is locked.
+ */
+int sentence_lock_file_busy(const char* filename);
+
+#endif // SENTENCE_LOCK_H
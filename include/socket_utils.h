@@ -4,6 +4,8 @@
 // This header only needs to declare the functions.
 // The .c file handles the includes like <arpa/inet.h>
 
+#define DEFAULT_LISTEN_BACKLOG 128 // Pending connections the kernel may queue
+
 /**
  * @brief Creates a new TCP socket.
  * Exits on failure.
@@ -21,11 +23,19 @@ void bind_socket(int sockfd, int port);
 
 /**
  * @brief Sets a socket to listen for incoming connections.
- * Exits on failure.
+ * Uses DEFAULT_LISTEN_BACKLOG. Exits on failure.
  * @param sockfd The socket file descriptor.
  */
 void listen_socket(int sockfd);
 
+/**
+ * @brief Sets a socket to listen with an explicit accept backlog.
+ * Exits on failure.
+ * @param sockfd The socket file descriptor.
+ * @param backlog Length of the kernel's pending-connection queue.
+ */
+void listen_socket_backlog(int sockfd, int backlog);
+
 /**
  * @brief Accepts a new connection on a listening socket.
  * @param sockfd The listening socket file descriptor.
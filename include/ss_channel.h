@@ -0,0 +1,85 @@
+#ifndef SS_CHANNEL_H
+#define SS_CHANNEL_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "protocol.h"
+#include "storage_manager.h"
+
+#define SS_CALL_TIMEOUT_MS     10000              // Max wait for one SS response
+#define SS_MAX_RESPONSE_BYTES  (64 * 1024 * 1024) // Larger payloads mean a broken stream
+
+/**
+ * @brief One request waiting for its response on an SS control channel.
+ * Matched to the response by MessageHeader.request_id.
+ */
+typedef struct SSPendingCall {
+    uint32_t request_id;
+    int state;                  // 0 = waiting, 1 = answered, -1 = channel failed
+    MessageHeader response;
+    void* payload;              // malloc'd, NUL-terminated, response.payload_length bytes
+    pthread_cond_t cond;
+    struct SSChannel* channel;
+    struct SSPendingCall* next;
+} SSPendingCall;
+
+/**
+ * @brief The multiplexed NS<->SS control connection.
+ * Any number of threads may have calls in flight; sends are serialized
+ * by send_mutex (held only while writing one message) and a single
+ * reader thread routes every response to its waiting caller.
+ */
+typedef struct SSChannel {
+    int sock_fd;
+    int ss_index;
+    int dead;                   // Set once the reader has seen the link fail
+    int refcount;               // Registry + reader + in-flight callers
+    uint32_t next_request_id;
+    pthread_mutex_t send_mutex;
+    pthread_mutex_t pending_mutex;
+    SSPendingCall* pending;
+    pthread_t reader_tid;
+} SSChannel;
+
+/**
+ * @brief Attaches a channel to a registered SS and starts its reader.
+ * Called once the SS has finished its file-list sync.
+ * @return 0 on success, -1 on failure.
+ */
+int ss_channel_open(StorageServerInfo* ss, int ss_index, int sock_fd);
+
+/**
+ * @brief Detaches the channel from its registry slot and wakes its reader.
+ * Called by remove_storage_server (registry mutex NOT held).
+ */
+void ss_channel_shutdown(SSChannel* channel);
+
+/**
+ * @brief Sends a request and returns a handle to wait on.
+ * Fills in req->request_id. Does not wait for the response.
+ * @return The pending call, or NULL if the channel is down.
+ */
+SSPendingCall* ss_call_begin(StorageServerInfo* ss, MessageHeader* req, const void* payload);
+
+/**
+ * @brief Waits for a call started with ss_call_begin and frees the handle.
+ * @param resp Receives the response header.
+ * @param resp_payload If non-NULL, receives the malloc'd payload (caller frees).
+ * @return 0 on success, -1 on timeout or channel failure.
+ */
+int ss_call_end(SSPendingCall* call, MessageHeader* resp, void** resp_payload, int timeout_ms);
+
+/**
+ * @brief Synchronous request/response: ss_call_begin + ss_call_end.
+ * @return 0 on success, -1 on failure (the caller must not reuse the reply).
+ */
+int ss_call(StorageServerInfo* ss, MessageHeader* req, const void* payload,
+            MessageHeader* resp, void** resp_payload);
+
+/**
+ * @brief Sends a message the SS does not answer (e.g. MSG_INTERNAL_SET_OWNER).
+ * @return 0 on success, -1 on failure.
+ */
+int ss_send_oneway(StorageServerInfo* ss, MessageHeader* req, const void* payload);
+
+#endif // SS_CHANNEL_H
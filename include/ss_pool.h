@@ -0,0 +1,60 @@
+#ifndef SS_POOL_H
+#define SS_POOL_H
+
+#include "protocol.h"
+
+// Client-side reuse of Storage Server sessions. Opening one costs a TCP
+// connect plus the USER handshake, so a finished session is parked here
+// and handed out again for the next command to the same SS. Redirects
+// are cached as well, letting a repeat command skip the NS: the SS checks
+// permissions itself, and callers drop a cached redirect the SS refuses.
+#define SS_POOL_MAX_IDLE        8   // Parked sessions, across all servers
+#define SS_POOL_IDLE_SEC        20  // Parked longer: closed (the SS drops idle sessions at SS_DIRECT_IDLE_SEC)
+#define REDIRECT_CACHE_ENTRIES  128 // Direct-mapped by filename hash
+#define REDIRECT_CACHE_TTL_SEC  60  // Re-ask the NS after this long regardless
+
+// ss_pool_acquire() failures
+#define SS_POOL_CONNECT_FAILED -1
+#define SS_POOL_BUSY           -2   // ERR_503: every SS worker is taken
+#define SS_POOL_REJECTED       -3   // Any other handshake reply
+
+/**
+ * @brief Sets the username sent in the USER handshake of new sessions.
+ */
+void ss_pool_init(const char* username);
+
+/**
+ * @brief Returns an authenticated session to 'ss', reusing a parked one
+ * when it is still open.
+ * @param reused Set to 1 if the session was parked (it may still have been
+ * closed by the SS in the meantime), 0 if it was just opened.
+ * @return The socket, or one of the SS_POOL_* failures.
+ */
+int ss_pool_acquire(const SSReadPayload* ss, int* reused);
+
+/**
+ * @brief Hands a session back. Pass reusable = 0 unless the last reply
+ * was read in full and the session is idle (not in WRITE mode or mid-stream).
+ */
+void ss_pool_release(const SSReadPayload* ss, int fd, int reusable);
+
+/**
+ * @brief Sends EXIT on every parked session and closes it.
+ */
+void ss_pool_close_all(void);
+
+/**
+ * @brief Looks up where 'filename' was last found.
+ * @return 1 and fills *out on a fresh hit, 0 otherwise.
+ */
+int redirect_cache_lookup(const char* filename, SSReadPayload* out);
+
+void redirect_cache_store(const char* filename, const SSReadPayload* ss);
+void redirect_cache_invalidate(const char* filename);
+
+/**
+ * @brief Drops every cached redirect to one server (e.g. it stopped answering).
+ */
+void redirect_cache_invalidate_server(const SSReadPayload* ss);
+
+#endif // SS_POOL_H
@@ -4,16 +4,41 @@
 #include "protocol.h"
 #include <pthread.h>
 
-#define MAX_STORAGE_SERVERS 10
+#define DEFAULT_MAX_STORAGE_SERVERS 64 // Registry slots unless set by storage_manager_set_capacity()
 #define MAX_FILES_PER_SERVER 100
+#define SS_SUSPECT_GRACE_SEC 60 // Keep a vanished SS's files listed this long (0 = purge at once)
+#define SS_HEARTBEAT_SEC       5  // SS load report period
+#define SS_HEARTBEAT_STALE_SEC 15 // No report for this long: placement avoids the SS
 
 // This is the data structure for the SS registration payload
 typedef struct {
     char ip_addr[64];
     int client_facing_port;
-    // We can add the file list here later
+    uint64_t instance_id;   // Random id of the SS's metadata directory
+    uint64_t epoch;         // SS metadata epoch as of this registration
+    int32_t file_count;     // Files the SS holds
 } SSRegistrationPayload;
 
+// Payload of MSG_SS_HEARTBEAT: the SS's load, for placing new files
+typedef struct {
+    int32_t file_count;
+    int32_t active_clients;     // Open direct sessions
+    int32_t active_streams;
+    int32_t worker_threads;     // Direct sessions it can serve at once
+    uint64_t disk_used_bytes;   // Size of the files it holds
+    uint64_t disk_free_bytes;   // Free space where they are stored
+    uint32_t requests;          // Direct requests since the previous heartbeat
+    uint32_t latency_us;        // Their mean service time
+} SSHeartbeatPayload;
+
+// Payload of the NS's ACK to MSG_REGISTER: which records to send
+typedef struct {
+    int32_t delta;          // 1 = send only records with version > since_epoch
+    uint64_t since_epoch;   // Epoch of the last completed sync (if delta)
+} SSRegistrationAckPayload;
+
+
+struct SSChannel; // Defined in ss_channel.h
 
 // This struct holds the server's state on the Name Server
 typedef struct {
@@ -21,21 +46,44 @@ typedef struct {
     char ip_addr[64];
     int client_facing_port;
     int is_active;
-    pthread_mutex_t socket_mutex; // <-- ADD THIS
+    struct SSChannel* channel; // Multiplexed control channel, NULL until synced
+    // Reconnect state. While is_suspect the SS is gone but its files stay
+    // listed (marked suspect) so a quick re-registration can send a delta.
+    uint64_t instance_id;
+    uint64_t synced_epoch;     // SS epoch at the last completed sync
+    uint64_t pending_epoch;    // Epoch of the sync in progress
+    int is_suspect;
+    int suspect_files;         // Records marked suspect when it vanished
+    time_t suspect_since;
+    int is_reclaiming;         // Suspect files being purged; slot not yet free
+    int resync;                // Sync in progress: -1 = fresh slot, 0 = full, 1 = delta
+    // Load as of the last heartbeat (zeroed on registration)
+    SSHeartbeatPayload load;
+    time_t last_heartbeat;     // 0 = none yet
+    int placed_since_heartbeat; // New files sent here that 'load' does not count yet
+    int reads_since_heartbeat;  // Read redirects sent here since then
     // char file_list[MAX_FILES_PER_SERVER][MAX_FILENAME];
     // int file_count;
 } StorageServerInfo;
 
 
 // --- Global Data ---
-// A global registry of all storage servers
-extern StorageServerInfo ss_registry[MAX_STORAGE_SERVERS];
+// A global registry of all storage servers, ss_registry_capacity slots
+// allocated once by init_storage_manager() (slot pointers stay valid)
+extern StorageServerInfo* ss_registry;
+extern int ss_registry_capacity;
 // A mutex to protect the global registry
 extern pthread_mutex_t ss_registry_mutex;
 
 
 // --- Functions ---
 
+/**
+ * @brief Sets how many storage servers can be registered at once.
+ * Call before init_storage_manager(); <= 0 keeps the default.
+ */
+void storage_manager_set_capacity(int max_servers);
+
 // Sets up the storage manager
 void init_storage_manager();
 
@@ -48,9 +96,28 @@ int register_storage_server(int sock_fd, MessageHeader* header);
 // Removes a storage server from the registry by its socket FD
 void remove_storage_server(int sock_fd);
 
-// Finds an active storage server for a new file (for CREATE)
+// Finds an active storage server for a new file (for CREATE), per the placement policy
 StorageServerInfo* get_ss_for_new_file();
 
+/**
+ * @brief Like get_ss_for_new_file(), for a replica: never one of 'exclude'
+ * (the servers that already hold the file).
+ * @return The server, or NULL if no other server is active.
+ */
+StorageServerInfo* get_ss_for_replica(const int* exclude, int exclude_count);
+
+/**
+ * @brief Picks the server to send a read to among copies of one file:
+ * the less busy of two sampled from the active ones in 'ss_indices'.
+ * @return The chosen ss_index, or -1 if none of them is active.
+ */
+int storage_manager_pick_reader(const int* ss_indices, int count);
+
+/**
+ * @brief Records a MSG_SS_HEARTBEAT from the SS on a slot.
+ */
+void storage_manager_record_heartbeat(int ss_index, const SSHeartbeatPayload* load);
+
 /**
  * @brief Gets a pointer to an active storage server by its index. (for READ)
  * @param ss_index The index in the ss_registry.
@@ -4,15 +4,6 @@
 #include <sys/stat.h>
 #include <time.h>
 
-// Sentence caching structure
-typedef struct sentence_cache_entry {
-    int sentence_num;
-    int start_word_idx;
-    int end_word_idx;
-    char delimiter;
-    long file_modified_time;
-} sentence_cache_entry_t;
-
 // Enhanced sentence boundary tracking structure
 typedef struct sentence_info {
     int start_word_idx;  // Starting word index of this sentence
@@ -0,0 +1,60 @@
+#ifndef STREAM_ENGINE_H
+#define STREAM_ENGINE_H
+
+#include "doc_cache.h"
+
+// STREAM sessions are paced by one engine thread instead of a sleeping
+// worker each. Streams sit on a timer wheel; a tick sends the next word
+// of every stream due in that slot (words that came due together go out
+// in one sendmsg), and epoll covers STOP/PAUSE/RESUME and sockets that
+// could not take a whole reply.
+#define STREAM_TICK_MS             10     // Timer wheel resolution
+#define STREAM_WHEEL_SLOTS         256    // Power of two; longer delays take extra laps
+#define STREAM_DEFAULT_INTERVAL_MS 100    // Between words, unless the client asks otherwise
+#define STREAM_MAX_INTERVAL_MS     10000
+#define STREAM_MAX_SESSIONS        4096
+
+/**
+ * @brief Called on the engine thread once a stream is over (completed,
+ * stopped or the client went away). The socket is blocking again and
+ * belongs to the caller, as does the input buffer with whatever the client
+ * sent after its last control line.
+ */
+typedef void (*stream_done_fn)(void* owner, int fd);
+
+/**
+ * @brief Starts the engine thread.
+ * @return 0 on success, -1 on failure.
+ */
+int stream_engine_init(void);
+
+/**
+ * @brief Streams 'doc' word by word to 'fd', starting with
+ * "OK_200 STREAM_START" and ending with "STREAM_COMPLETE".
+ * On success the engine owns the socket and the document reference
+ * until it calls 'done'.
+ * @param interval_ms Delay before each word (rounded up to a tick).
+ * @param filename, username Only used in log lines.
+ * @param in_buf, in_length, in_capacity The session's input buffer.
+ * STOP/PAUSE/RESUME lines are read through it (including any already in
+ * it), so nothing the client sent after them is lost.
+ * @return 0 if started, -1 if STREAM_MAX_SESSIONS are running (nothing
+ * was sent and the caller keeps the socket and the reference).
+ */
+int stream_engine_start(int fd, parsed_doc_t* doc, int interval_ms,
+                        const char* filename, const char* username,
+                        char* in_buf, size_t* in_length, size_t in_capacity,
+                        stream_done_fn done, void* owner);
+
+/**
+ * @brief Number of streams currently running.
+ */
+int stream_engine_active(void);
+
+/**
+ * @brief Stops the engine thread and drops unfinished streams without
+ * calling their 'done' (their sockets are closed with the other clients).
+ */
+void stream_engine_shutdown(void);
+
+#endif // STREAM_ENGINE_H
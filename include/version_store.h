@@ -0,0 +1,73 @@
+#ifndef VERSION_STORE_H
+#define VERSION_STORE_H
+
+#include <stddef.h>
+#include <time.h>
+
+// Per document, versions/<file>.vpack holds the stored bytes and
+// versions/<file>.vidx a fixed-width index, however many versions exist.
+#define VERSION_KEYFRAME_INTERVAL 16   // Longest delta chain before a version is stored whole
+#define VERSION_DEDUP_WINDOW      64   // Recent versions checked for identical content
+#define VERSION_STORE_STRIPES     64   // Power of two; one mutex per group of files
+
+typedef enum {
+    VERSION_UNDO = 1,        // Content before an edit (ETIRW, REVERT); popped by UNDO
+    VERSION_CHECKPOINT = 2   // Named by CHECKPOINT; restored by REVERT
+} version_kind_t;
+
+// One version as reported by version_store_list()
+typedef struct {
+    char tag[256];
+    char user[128];
+    time_t created;
+    size_t size;
+} version_info_t;
+
+/**
+ * @brief Records 'content' as a new version of 'filename'.
+ * Identical content already in the store is shared rather than written
+ * again; otherwise it is stored as a delta against the previous version.
+ * @param tag Checkpoint name (ignored for VERSION_UNDO).
+ * @param created Timestamp to record (0 = now).
+ * @return 1 on success, -2 if a checkpoint with 'tag' exists, -1 on I/O error.
+ */
+int version_store_push(const char* versions_dir, const char* filename, version_kind_t kind,
+                       const char* tag, const char* user, const char* content, size_t length,
+                       time_t created);
+
+/**
+ * @brief Takes the newest version not yet undone and marks it undone.
+ * @param out_content Set to a malloc'd copy (NUL-terminated) on success.
+ * @param user Filled with who made that version, if non-NULL.
+ * @return 1 on success, 0 if there is nothing left to undo, -1 on error.
+ */
+int version_store_undo(const char* versions_dir, const char* filename,
+                       char** out_content, size_t* out_length, char* user, size_t user_size);
+
+/**
+ * @brief Loads a checkpoint's content.
+ * @param out_content Set to a malloc'd copy (NUL-terminated) on success.
+ * @return 1 on success, 0 if no such checkpoint, -1 on error.
+ */
+int version_store_checkpoint(const char* versions_dir, const char* filename, const char* tag,
+                             char** out_content, size_t* out_length);
+
+/**
+ * @brief Lists a file's versions of one kind, oldest first.
+ * @param out Set to a malloc'd array (free it), or NULL if there are none.
+ * @return Number of entries, or -1 on error.
+ */
+int version_store_list(const char* versions_dir, const char* filename, version_kind_t kind,
+                       version_info_t** out);
+
+/**
+ * @brief Reports whether a file has any stored versions.
+ */
+int version_store_exists(const char* versions_dir, const char* filename);
+
+/**
+ * @brief Deletes every stored version of a file.
+ */
+void version_store_drop(const char* versions_dir, const char* filename);
+
+#endif // VERSION_STORE_H
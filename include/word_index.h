@@ -0,0 +1,51 @@
+#ifndef WORD_INDEX_H
+#define WORD_INDEX_H
+
+#include <stddef.h>
+
+// Inverted index over the documents this SS holds: word -> (file, sentence).
+// Words are folded to lowercase letters and digits, so "World." matches
+// "world". Every indexed sentence keeps a fingerprint of its text; an
+// update diffs the file's new parse against them and re-indexes only the
+// sentences between the unchanged prefix and suffix, so a commit costs
+// what it changed rather than the whole document.
+#define WORD_INDEX_MAX_WORD  64   // Longer words are indexed by their first bytes
+#define WORD_INDEX_MAX_TERMS 8    // Words per query; the rest are ignored
+#define WORD_INDEX_MAX_HITS  1000 // Sentences per answer
+#define WORD_INDEX_UPDATE_STRIPES 64 // Per-file update locks (power of two)
+
+/**
+ * @brief Starts indexing every file in the metadata table on a background
+ * thread. Updates may run meanwhile; files they reach first are skipped.
+ * @return 0 if the thread started, -1 if the index was built inline instead.
+ */
+int word_index_start_build(const char* files_dir);
+
+/**
+ * @brief Whether the startup build has finished. Until it has, a query
+ * only sees the files indexed so far.
+ */
+int word_index_ready(void);
+
+/**
+ * @brief Brings a file's entry up to date with its current contents.
+ * Call after every change to the file (commit, undo, revert, replica copy).
+ * @return Sentences re-indexed, or -1 if the file cannot be read (its
+ * entry is dropped).
+ */
+int word_index_update(const char* filename, const char* path);
+
+/**
+ * @brief Drops a deleted file from the index.
+ */
+void word_index_remove(const char* filename);
+
+/**
+ * @brief Finds the sentences that contain every word of 'query'.
+ * @return malloc'd text, one "<filename> <sentence> <sentence>...\n" line
+ * per file with 1-based sentence numbers ("" if nothing matches), or
+ * NULL if out of memory. The caller frees it.
+ */
+char* word_index_query(const char* query, size_t* out_length);
+
+#endif // WORD_INDEX_H
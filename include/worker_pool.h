@@ -0,0 +1,52 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <pthread.h>
+
+#define DEFAULT_SS_WORKER_THREADS 16   // Concurrent direct-client sessions
+#define DEFAULT_SS_JOB_QUEUE_SIZE 64   // Accepted sockets waiting for a worker
+#define SS_DIRECT_IDLE_SEC        30   // Idle session (not in WRITE mode) closed after this long
+#define SS_DIRECT_PARK_MS         10   // Idle this long between commands: the worker parks the session
+#define SS_PARK_TICK_MS           250  // Park thread wake-up: idle expiry and retries of a full queue
+#define SS_NS_READ_THREADS        4    // Threads serving the NS's MSG_INTERNAL_READs (EXEC, replication)
+
+/**
+ * @brief Function run by a worker for each job. Owns the job pointer.
+ */
+typedef void (*worker_job_fn)(void* job);
+
+/**
+ * @brief Starts a fixed pool of worker threads fed by a bounded FIFO, and
+ * the thread that watches parked jobs (see worker_pool_park()).
+ * @param num_workers Number of threads to start.
+ * @param queue_capacity Maximum number of jobs waiting for a worker.
+ * @param handler Function every worker runs on a dequeued job.
+ * @param idle_handler Run on the park thread for a parked job whose
+ * socket stayed quiet; it owns the job.
+ * @return 0 on success, -1 on failure.
+ */
+int init_worker_pool(int num_workers, int queue_capacity, worker_job_fn handler,
+                     worker_job_fn idle_handler);
+
+/**
+ * @brief Queues a job without blocking.
+ * @return 0 if queued, -1 if the queue is full (caller keeps ownership).
+ */
+int worker_pool_submit(void* job);
+
+/**
+ * @brief Hands a job back without a worker while its socket is idle.
+ * The job is queued again once 'fd' is readable or hung up, or given to
+ * the idle handler if nothing arrives within 'idle_sec'. A readable job
+ * that finds the queue full keeps its place and is retried every
+ * SS_PARK_TICK_MS until then.
+ * @return 0 if parked (the pool owns the job), -1 if not (caller keeps it).
+ */
+int worker_pool_park(int fd, void* job, int idle_sec);
+
+/**
+ * @brief Wakes all workers and tells them to exit once the queue drains.
+ */
+void shutdown_worker_pool();
+
+#endif // WORKER_POOL_H
@@ -0,0 +1,71 @@
+#ifndef WRITE_SESSION_H
+#define WRITE_SESSION_H
+
+#include <stddef.h>
+
+#define WRITE_SWAP_FLUSH_EDITS 16 // Word edits between crash-buffer flushes (0 = never flush)
+#define WRITE_COMMIT_STRIPES   64 // Power of two; commits to files in different stripes run in parallel
+
+/**
+ * @brief One client's open WRITE on a sentence.
+ * The locked sentence is held in memory as words and edited in place; the
+ * document itself is only touched again at ETIRW.
+ */
+typedef struct {
+    int active;
+    char filename[256];
+    int sentence_num;       // 1-based
+    char** words;           // malloc'd words, without the closing delimiter
+    int word_count;
+    int word_capacity;
+    char delimiter;         // '.', '!', '?' or '\0' for an open sentence
+    int dirty;              // Any edit since begin
+    int edits_since_flush;
+    char swap_path[512];    // Crash buffer holding the sentence text
+} write_session_t;
+
+/**
+ * @brief Loads sentence 'sentence_num' of a file into a new session.
+ * A sentence past the end of the document starts out empty. Any session
+ * still held in 'session' (which must be zeroed or ended) is ended first.
+ * @return 0 on success, -1 if the file cannot be read or memory runs out.
+ */
+int write_session_begin(write_session_t* session, const char* orig_path, const char* filename,
+                        int sentence_num, const char* swap_path);
+
+/**
+ * @brief Inserts the words of 'content' before word 'word_idx' (1-based).
+ * @param err Receives a protocol error line on failure.
+ * @return 0 on success, -1 if the index is out of range or memory runs out.
+ */
+int write_session_insert(write_session_t* session, int word_idx, const char* content,
+                         char* err, size_t err_size);
+
+/**
+ * @brief Renders the edited sentence ("w1 w2 ... wN<delimiter>").
+ * @return malloc'd string (caller frees), or NULL if out of memory.
+ */
+char* write_session_render(const write_session_t* session, size_t* out_length);
+
+/**
+ * @brief Splices the edited sentence into the file's latest contents.
+ * Only the bytes of the target sentence are replaced; the result goes to
+ * a temporary file that is synced and renamed over the original.
+ * @param size_delta Receives the change in file size (bytes).
+ * @param word_delta Receives the change in word count.
+ * @return 0 on success, -1 if the file could not be rewritten.
+ */
+int write_session_commit(write_session_t* session, const char* orig_path,
+                         long* size_delta, long* word_delta);
+
+/**
+ * @brief Writes the sentence to the crash buffer if it has pending edits.
+ */
+void write_session_flush(write_session_t* session);
+
+/**
+ * @brief Frees the session and removes its crash buffer.
+ */
+void write_session_end(write_session_t* session);
+
+#endif // WRITE_SESSION_H
@@ -0,0 +1,215 @@
+/*
+ * index_bench: memory use and lookup latency of the Name Server's file
+ * index (file_index.c) against the 128-way trie it replaced.
+ *
+ * Usage: ./index_bench [num_files] [num_lookups]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "file_index.h"
+
+#define DEFAULT_BENCH_FILES   100000
+#define DEFAULT_BENCH_LOOKUPS 1000000
+#define BENCH_OWNERS          50
+
+// =========================================================================
+//  LEGACY TRIE (the layout search.c used before the hash index)
+// =========================================================================
+
+#define LEGACY_CHAR_SET_SIZE 128
+
+typedef struct {
+    char username[64];
+    PermissionType permission;
+} LegacyAclEntry;
+
+typedef struct {
+    char filename[MAX_FILENAME];
+    char owner_username[64];
+    int ss_index;
+    char folder[MAX_FILENAME];
+    long word_count;
+    long char_count;
+    time_t created;
+    time_t modified;
+    time_t last_accessed;
+    char last_accessed_by[64];
+    LegacyAclEntry acl[MAX_ACL_ENTRIES];
+    int acl_count;
+} LegacyFileRecord;
+
+typedef struct LegacyTrieNode {
+    struct LegacyTrieNode* children[LEGACY_CHAR_SET_SIZE];
+    LegacyFileRecord* file_info;
+} LegacyTrieNode;
+
+static size_t legacy_node_count = 0;
+
+static LegacyTrieNode* legacy_create_node() {
+    LegacyTrieNode* node = calloc(1, sizeof(LegacyTrieNode));
+    if (node == NULL) {
+        fprintf(stderr, "Out of memory building trie\n");
+        exit(EXIT_FAILURE);
+    }
+    legacy_node_count++;
+    return node;
+}
+
+static void legacy_insert(LegacyTrieNode* root, const char* filename, const char* owner) {
+    LegacyTrieNode* current = root;
+    for (int i = 0; filename[i] != '\0'; i++) {
+        int index = (int)filename[i];
+        if (index < 0 || index >= LEGACY_CHAR_SET_SIZE) continue;
+        if (current->children[index] == NULL) {
+            current->children[index] = legacy_create_node();
+        }
+        current = current->children[index];
+    }
+    LegacyFileRecord* record = calloc(1, sizeof(LegacyFileRecord));
+    strncpy(record->filename, filename, MAX_FILENAME - 1);
+    strncpy(record->owner_username, owner, 64 - 1);
+    current->file_info = record;
+}
+
+static LegacyFileRecord* legacy_find(LegacyTrieNode* root, const char* filename) {
+    LegacyTrieNode* current = root;
+    for (int i = 0; filename[i] != '\0'; i++) {
+        int index = (int)filename[i];
+        if (index < 0 || index >= LEGACY_CHAR_SET_SIZE) continue;
+        if (current->children[index] == NULL) return NULL;
+        current = current->children[index];
+    }
+    return current->file_info;
+}
+
+// =========================================================================
+//  TIMING
+// =========================================================================
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    double mean_ns;
+    double p50_ns;
+    double p99_ns;
+} LookupStats;
+
+// Batches of lookups are timed together so clock overhead stays small;
+// the percentiles are over per-batch averages.
+#define LOOKUP_BATCH 64
+
+static const void* volatile sink; // Keeps lookups from being optimized out
+
+static LookupStats time_lookups(int use_index, LegacyTrieNode* root, FileIndex* index,
+                                char (*names)[MAX_FILENAME], int num_files, long num_lookups) {
+    long batches = num_lookups / LOOKUP_BATCH;
+    double* samples = malloc(sizeof(double) * (batches > 0 ? batches : 1));
+    unsigned int seed = 12345;
+    double total = 0;
+
+    for (long b = 0; b < batches; b++) {
+        int picks[LOOKUP_BATCH];
+        for (int k = 0; k < LOOKUP_BATCH; k++) picks[k] = rand_r(&seed) % num_files;
+
+        double start = now_ns();
+        for (int k = 0; k < LOOKUP_BATCH; k++) {
+            if (use_index) sink = file_index_find(index, names[picks[k]]);
+            else sink = legacy_find(root, names[picks[k]]);
+        }
+        double elapsed = now_ns() - start;
+        samples[b] = elapsed / LOOKUP_BATCH;
+        total += elapsed;
+    }
+
+    LookupStats stats = {0, 0, 0};
+    if (batches > 0) {
+        qsort(samples, batches, sizeof(double), compare_doubles);
+        stats.mean_ns = total / (batches * LOOKUP_BATCH);
+        stats.p50_ns = samples[batches / 2];
+        stats.p99_ns = samples[(long)(batches * 0.99)];
+    }
+    free(samples);
+    return stats;
+}
+
+// =========================================================================
+//  MAIN
+// =========================================================================
+
+int main(int argc, char* argv[]) {
+    int num_files = argc > 1 ? atoi(argv[1]) : DEFAULT_BENCH_FILES;
+    long num_lookups = argc > 2 ? atol(argv[2]) : DEFAULT_BENCH_LOOKUPS;
+    if (num_files <= 0 || num_lookups <= 0) {
+        fprintf(stderr, "Usage: %s [num_files] [num_lookups]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char (*names)[MAX_FILENAME] = malloc((size_t)num_files * MAX_FILENAME);
+    if (names == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    char owners[BENCH_OWNERS][64];
+    for (int i = 0; i < BENCH_OWNERS; i++) snprintf(owners[i], sizeof(owners[i]), "user%02d", i);
+    for (int i = 0; i < num_files; i++) {
+        snprintf(names[i], MAX_FILENAME, "%s_report_%07d.txt", owners[i % BENCH_OWNERS], i);
+    }
+
+    // --- Build the legacy trie ---
+    double start = now_ns();
+    LegacyTrieNode* root = legacy_create_node();
+    for (int i = 0; i < num_files; i++) legacy_insert(root, names[i], owners[i % BENCH_OWNERS]);
+    double trie_build_ms = (now_ns() - start) / 1e6;
+    size_t trie_bytes = legacy_node_count * sizeof(LegacyTrieNode) +
+                        (size_t)num_files * sizeof(LegacyFileRecord);
+
+    // --- Build the hash index ---
+    start = now_ns();
+    FileIndex index;
+    if (file_index_init(&index, FILE_INDEX_INITIAL_CAPACITY) == -1) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < num_files; i++) {
+        FileRecord* record = calloc(1, sizeof(FileRecord));
+        strncpy(record->filename, names[i], MAX_FILENAME - 1);
+        record->owner_username = file_index_intern(owners[i % BENCH_OWNERS]);
+        record->folder = "";
+        record->last_accessed_by = "";
+        file_index_insert(&index, record);
+    }
+    double index_build_ms = (now_ns() - start) / 1e6;
+    size_t index_bytes = index.capacity * sizeof(FileIndexSlot) +
+                         index.count * sizeof(FileRecord) + file_index_intern_bytes();
+
+    // --- Lookups ---
+    LookupStats trie_stats = time_lookups(0, root, NULL, names, num_files, num_lookups);
+    LookupStats index_stats = time_lookups(1, NULL, &index, names, num_files, num_lookups);
+
+    printf("index_bench: %d files, %ld lookups (allocator overhead not counted)\n\n",
+           num_files, num_lookups);
+    printf("%-12s %14s %12s %10s %10s %10s\n",
+           "structure", "memory (MB)", "build (ms)", "mean (ns)", "p50 (ns)", "p99 (ns)");
+    printf("%-12s %14.1f %12.1f %10.1f %10.1f %10.1f\n", "trie",
+           trie_bytes / (1024.0 * 1024.0), trie_build_ms,
+           trie_stats.mean_ns, trie_stats.p50_ns, trie_stats.p99_ns);
+    printf("%-12s %14.1f %12.1f %10.1f %10.1f %10.1f\n", "hash index",
+           index_bytes / (1024.0 * 1024.0), index_build_ms,
+           index_stats.mean_ns, index_stats.p50_ns, index_stats.p99_ns);
+    printf("\ntrie nodes: %zu (%zu bytes each), record: %zu -> %zu bytes\n",
+           legacy_node_count, sizeof(LegacyTrieNode),
+           sizeof(LegacyFileRecord), sizeof(FileRecord));
+    return 0;
+}
@@ -0,0 +1,738 @@
+/*
+ * load_bench: drives a running Name Server and its Storage Servers over
+ * the real wire protocol from many concurrent simulated users, and
+ * reports throughput and p50/p99/p999 latency per operation.
+ *
+ * Usage: ./load_bench <ns_ip> <ns_port> [options]
+ *   -u <users>      Concurrent users, one NS connection each (default 16)
+ *   -d <seconds>    Length of the measured run (default 10)
+ *   -m <mix>        Operation weights, e.g. "read=50,write=20,create=5,stream=5,info=10,view=10"
+ *   -f <docs>       Shared documents created before the run (default 32)
+ *   -s <min>-<max>  Document sizes in bytes, log-uniform (default 256-16384)
+ *   -H <percent>    Share of document operations aimed at one hot document (default 10)
+ *   -k              Keep the documents instead of deleting them afterwards
+ *
+ * Users log in as bench_0 .. bench_9 (a file's ACL only holds
+ * MAX_ACL_ENTRIES names); bench_0 owns the shared documents and grants
+ * the others write access. Every operation is timed end to end the way
+ * the client performs it, including the NS redirect and the direct SS
+ * connection. STREAM is timed to the first word: the SS paces words
+ * 0.1 s apart, so the whole transfer would only measure that delay.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "protocol.h"
+#include "socket_utils.h"
+
+#define DEFAULT_BENCH_USERS    16
+#define DEFAULT_BENCH_SECONDS  10
+#define DEFAULT_BENCH_DOCS     32
+#define DEFAULT_BENCH_MIN_SIZE 256
+#define DEFAULT_BENCH_MAX_SIZE 16384
+#define DEFAULT_BENCH_HOT_PCT  10
+#define BENCH_USERNAMES        MAX_ACL_ENTRIES // bench_0 (owner) + 9 grantees
+#define BENCH_WRITE_WAIT_MS    3000            // Same as the client's WRITE queueing
+#define BENCH_WORDS_PER_SENTENCE 10
+#define BENCH_CHUNK_BYTES      1500            // Per insert line; the SS reads 2 KB at a time
+#define SS_LINE_MAX            512
+
+typedef enum {
+    OP_CREATE = 0,
+    OP_READ,
+    OP_WRITE,
+    OP_STREAM,
+    OP_INFO,
+    OP_VIEW,
+    OP_COUNT
+} bench_op_t;
+
+static const char* op_names[OP_COUNT] = { "CREATE", "READ", "WRITE", "STREAM", "INFO", "VIEW -l" };
+static const char* op_keys[OP_COUNT]  = { "create", "read", "write", "stream", "info", "view" };
+
+// Operation results
+#define OP_OK          0
+#define OP_FAILED     -1  // The server answered with an error
+#define OP_DISCONNECT -2  // The NS connection is gone
+
+typedef struct {
+    uint64_t* samples;  // Latencies in microseconds
+    size_t count;
+    size_t capacity;
+    unsigned long errors;
+} op_samples_t;
+
+typedef struct {
+    int id;
+    char username[64];
+    int ns_sock;
+    unsigned int seed;
+    int created;        // Files made by CREATE, deleted after the run
+    op_samples_t ops[OP_COUNT];
+} bench_user_t;
+
+typedef struct {
+    char name[MAX_FILENAME];
+    int sentences;
+} bench_doc_t;
+
+// A direct SS connection with a small read buffer, since a reply line
+// and the start of a file body can arrive in one segment
+typedef struct {
+    int fd;
+    char buf[8192];
+    size_t start;
+    size_t end;
+} ss_conn_t;
+
+static const char* g_ns_ip;
+static int g_ns_port;
+static int g_users = DEFAULT_BENCH_USERS;
+static int g_seconds = DEFAULT_BENCH_SECONDS;
+static int g_doc_count = DEFAULT_BENCH_DOCS;
+static long g_min_size = DEFAULT_BENCH_MIN_SIZE;
+static long g_max_size = DEFAULT_BENCH_MAX_SIZE;
+static int g_hot_pct = DEFAULT_BENCH_HOT_PCT;
+static int g_keep = 0;
+static int g_weights[OP_COUNT] = { 5, 50, 20, 5, 10, 10 };
+static int g_weight_total = 100;
+
+static char g_prefix[32];       // Per-run file name prefix, so runs never collide
+static bench_doc_t* g_docs;     // g_docs[0] is the hot document
+static pthread_barrier_t g_start_barrier;
+static struct timespec g_deadline;
+
+static const char* words[] = {
+    "alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel",
+    "india", "juliet", "kilo", "lima", "mike", "november", "oscar", "papa"
+};
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static int past_deadline(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec > g_deadline.tv_sec ||
+           (ts.tv_sec == g_deadline.tv_sec && ts.tv_nsec >= g_deadline.tv_nsec);
+}
+
+static void record(op_samples_t* op, uint64_t micros, int failed) {
+    if (op->count == op->capacity) {
+        size_t capacity = op->capacity ? op->capacity * 2 : 1024;
+        uint64_t* grown = realloc(op->samples, capacity * sizeof(uint64_t));
+        if (grown == NULL) return;
+        op->samples = grown;
+        op->capacity = capacity;
+    }
+    op->samples[op->count++] = micros;
+    if (failed) op->errors++;
+}
+
+// =========================================================================
+//  NAME SERVER REQUESTS
+// =========================================================================
+
+/**
+ * @brief Reads a reply payload, keeping up to 'out_size' bytes of it.
+ * @return 0 on success, -1 if the connection failed.
+ */
+static int recv_payload(int sock, uint32_t length, void* out, size_t out_size) {
+    char scratch[4096];
+    size_t keep = length < out_size ? length : out_size;
+    if (keep > 0 && recv_all(sock, out, keep) == -1) return -1;
+    for (size_t left = length - keep; left > 0;) {
+        size_t chunk = left < sizeof(scratch) ? left : sizeof(scratch);
+        if (recv_all(sock, scratch, chunk) == -1) return -1;
+        left -= chunk;
+    }
+    return 0;
+}
+
+/**
+ * @brief Sends one request to the NS and reads its reply.
+ * @return 0 with *resp filled in, or -1 if the connection failed.
+ */
+static int ns_request(int sock, uint32_t msg_type, const char* filename,
+                      const void* payload, uint32_t payload_length,
+                      MessageHeader* resp, void* out, size_t out_size) {
+    MessageHeader header;
+    memset(&header, 0, sizeof(header));
+    header.msg_type = msg_type;
+    header.source_component = COMPONENT_CLIENT;
+    header.payload_length = payload_length;
+    if (filename) strncpy(header.filename, filename, MAX_FILENAME - 1);
+    if (msg_type == MSG_REGISTER_CLIENT) header.request_id = PROTOCOL_VERSION; // Offer v2, like the client
+
+    if (send_header(sock, &header) == -1) return -1;
+    if (payload_length > 0 && send_all(sock, payload, payload_length) == -1) return -1;
+    if (recv_header(sock, resp) == -1) return -1;
+    return recv_payload(sock, resp->payload_length, out, out_size);
+}
+
+static int ns_login(bench_user_t* user) {
+    user->ns_sock = create_socket();
+    if (connect_socket_no_exit(user->ns_sock, g_ns_ip, g_ns_port) == -1) {
+        close(user->ns_sock);
+        user->ns_sock = -1;
+        return -1;
+    }
+    protocol_set_version(user->ns_sock, PROTOCOL_V1);
+    MessageHeader resp;
+    if (ns_request(user->ns_sock, MSG_REGISTER_CLIENT, user->username, NULL, 0, &resp, NULL, 0) == -1 ||
+        resp.msg_type != MSG_ACK) {
+        close(user->ns_sock);
+        user->ns_sock = -1;
+        return -1;
+    }
+    if (resp.request_id == PROTOCOL_V2) protocol_set_version(user->ns_sock, PROTOCOL_V2);
+    return 0;
+}
+
+/**
+ * @brief A request answered by a bare MSG_ACK (CREATE, DELETE, ADD_ACCESS).
+ */
+static int ns_acked(bench_user_t* user, uint32_t msg_type, const char* filename,
+                    const void* payload, uint32_t payload_length) {
+    MessageHeader resp;
+    if (ns_request(user->ns_sock, msg_type, filename, payload, payload_length, &resp, NULL, 0) == -1) {
+        return OP_DISCONNECT;
+    }
+    return resp.msg_type == MSG_ACK ? OP_OK : OP_FAILED;
+}
+
+// =========================================================================
+//  STORAGE SERVER SESSIONS
+// =========================================================================
+
+static int ss_send_line(ss_conn_t* c, const char* format, ...) {
+    char line[BENCH_CHUNK_BYTES + 64];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= sizeof(line)) return -1;
+    return send_all(c->fd, line, (size_t)n);
+}
+
+static int ss_fill(ss_conn_t* c) {
+    if (c->start == c->end) c->start = c->end = 0;
+    ssize_t n = recv(c->fd, c->buf + c->end, sizeof(c->buf) - c->end, 0);
+    if (n <= 0) return -1;
+    c->end += (size_t)n;
+    return 0;
+}
+
+/**
+ * @brief Reads one '\n'-terminated reply line (newline stripped).
+ */
+static int ss_read_line(ss_conn_t* c, char* line, size_t size) {
+    for (;;) {
+        // Some replies are sent with their terminating NUL; skip it
+        while (c->start < c->end && c->buf[c->start] == '\0') c->start++;
+        char* nl = memchr(c->buf + c->start, '\n', c->end - c->start);
+        if (nl) {
+            size_t length = (size_t)(nl - (c->buf + c->start));
+            size_t copy = length < size - 1 ? length : size - 1;
+            memcpy(line, c->buf + c->start, copy);
+            line[copy] = '\0';
+            c->start += length + 1;
+            return 0;
+        }
+        if (c->end == sizeof(c->buf)) {
+            if (c->start == 0) return -1; // Line longer than the buffer
+            memmove(c->buf, c->buf + c->start, c->end - c->start);
+            c->end -= c->start;
+            c->start = 0;
+        }
+        if (ss_fill(c) == -1) return -1;
+    }
+}
+
+static int ss_skip(ss_conn_t* c, long count) {
+    while (count > 0) {
+        if (c->start == c->end && ss_fill(c) == -1) return -1;
+        size_t have = c->end - c->start;
+        size_t take = (long)have < count ? have : (size_t)count;
+        c->start += take;
+        count -= (long)take;
+    }
+    return 0;
+}
+
+static void ss_close(ss_conn_t* c, int say_exit) {
+    if (say_exit) send_all(c->fd, "EXIT\n", 5);
+    close(c->fd);
+}
+
+/**
+ * @brief Asks the NS where 'filename' lives and opens a session there,
+ * as the client does for READ, WRITE and STREAM.
+ */
+static int ss_open(bench_user_t* user, uint32_t msg_type, const char* filename, ss_conn_t* c) {
+    MessageHeader resp;
+    SSReadPayload redirect;
+    memset(&redirect, 0, sizeof(redirect));
+    if (ns_request(user->ns_sock, msg_type, filename, NULL, 0, &resp, &redirect, sizeof(redirect)) == -1) {
+        return OP_DISCONNECT;
+    }
+    if (resp.msg_type != MSG_READ_REDIRECT) return OP_FAILED;
+
+    c->fd = create_socket();
+    c->start = c->end = 0;
+    if (connect_socket_no_exit(c->fd, redirect.ip_addr, redirect.port) == -1) {
+        close(c->fd);
+        return OP_FAILED;
+    }
+    char line[SS_LINE_MAX];
+    if (ss_send_line(c, "USER %s\n", user->username) == -1 ||
+        ss_read_line(c, line, sizeof(line)) == -1 || strncmp(line, "OK_200", 6) != 0) {
+        close(c->fd);
+        return OP_FAILED;
+    }
+    return OP_OK;
+}
+
+// =========================================================================
+//  OPERATIONS
+// =========================================================================
+
+static bench_doc_t* pick_doc(bench_user_t* user) {
+    if (g_doc_count == 0 || (int)(rand_r(&user->seed) % 100) < g_hot_pct) return &g_docs[0];
+    return &g_docs[1 + rand_r(&user->seed) % g_doc_count];
+}
+
+static int op_create(bench_user_t* user) {
+    char filename[MAX_FILENAME];
+    snprintf(filename, sizeof(filename), "%s_u%d_%d.txt", g_prefix, user->id, user->created);
+    int rc = ns_acked(user, MSG_CREATE, filename, NULL, 0);
+    if (rc == OP_OK) user->created++;
+    return rc;
+}
+
+static int op_read(bench_user_t* user) {
+    const char* name = pick_doc(user)->name;
+    ss_conn_t c;
+    int rc = ss_open(user, MSG_READ, name, &c);
+    if (rc != OP_OK) return rc;
+
+    char line[SS_LINE_MAX];
+    long length = 0;
+    rc = OP_FAILED;
+    if (ss_send_line(&c, "READ %s\n", name) == 0 &&
+        ss_read_line(&c, line, sizeof(line)) == 0) {
+        if (sscanf(line, "OK_200 FILE_CONTENT %ld", &length) == 1) {
+            if (ss_skip(&c, length) == 0) rc = OP_OK;
+        } else if (strncmp(line, "OK_200", 6) == 0) {
+            rc = OP_OK; // Empty file
+        }
+    }
+    ss_close(&c, 1);
+    return rc;
+}
+
+static int op_write(bench_user_t* user) {
+    bench_doc_t* doc = pick_doc(user);
+    ss_conn_t c;
+    int rc = ss_open(user, MSG_WRITE, doc->name, &c);
+    if (rc != OP_OK) return rc;
+
+    int sentence = 1 + (int)(rand_r(&user->seed) % (unsigned)(doc->sentences > 0 ? doc->sentences : 1));
+    char line[SS_LINE_MAX];
+    rc = OP_FAILED;
+    if (ss_send_line(&c, "WRITE %s %d %d\n", doc->name, sentence, BENCH_WRITE_WAIT_MS) == 0 &&
+        ss_read_line(&c, line, sizeof(line)) == 0 && strncmp(line, "OK_200", 6) == 0) {
+        if (ss_send_line(&c, "1 %s\n", words[rand_r(&user->seed) % (sizeof(words) / sizeof(words[0]))]) == 0 &&
+            ss_read_line(&c, line, sizeof(line)) == 0 && strncmp(line, "OK_200", 6) == 0) {
+            rc = OP_OK;
+        }
+        // Always end the session so the sentence lock is released
+        if (ss_send_line(&c, "ETIRW\n") == -1 || ss_read_line(&c, line, sizeof(line)) == -1 ||
+            strncmp(line, "OK_200 WRITE COMPLETED", 22) != 0) {
+            rc = OP_FAILED;
+        }
+    }
+    ss_close(&c, 1);
+    return rc;
+}
+
+static int op_stream(bench_user_t* user) {
+    const char* name = pick_doc(user)->name;
+    ss_conn_t c;
+    int rc = ss_open(user, MSG_STREAM, name, &c);
+    if (rc != OP_OK) return rc;
+
+    char line[SS_LINE_MAX];
+    rc = OP_FAILED;
+    if (ss_send_line(&c, "STREAM %s\n", name) == 0 && ss_read_line(&c, line, sizeof(line)) == 0) {
+        if (strncmp(line, "OK_200 STREAM_START", 19) == 0) {
+            // The first word either came with the status line or is next
+            if (c.start < c.end || ss_fill(&c) == 0) rc = OP_OK;
+            send_all(c.fd, "STOP\n", 5);
+        } else if (strncmp(line, "OK_200", 6) == 0) {
+            rc = OP_OK; // Empty file
+        }
+    }
+    ss_close(&c, 0);
+    return rc;
+}
+
+static int op_info(bench_user_t* user) {
+    MessageHeader resp;
+    if (ns_request(user->ns_sock, MSG_INFO, pick_doc(user)->name, NULL, 0, &resp, NULL, 0) == -1) {
+        return OP_DISCONNECT;
+    }
+    return resp.msg_type == MSG_INFO_RESPONSE ? OP_OK : OP_FAILED;
+}
+
+static int op_view(bench_user_t* user) {
+    ViewPayload payload;
+    payload.flags = VIEW_FLAG_LONG;
+    MessageHeader resp;
+    if (ns_request(user->ns_sock, MSG_VIEW, NULL, &payload, sizeof(payload), &resp, NULL, 0) == -1) {
+        return OP_DISCONNECT;
+    }
+    return resp.msg_type == MSG_VIEW_RESPONSE ? OP_OK : OP_FAILED;
+}
+
+static int (*const op_funcs[OP_COUNT])(bench_user_t*) = {
+    op_create, op_read, op_write, op_stream, op_info, op_view
+};
+
+static bench_op_t pick_op(bench_user_t* user) {
+    int roll = (int)(rand_r(&user->seed) % (unsigned)g_weight_total);
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (roll < g_weights[op]) return (bench_op_t)op;
+        roll -= g_weights[op];
+    }
+    return OP_READ;
+}
+
+static void* user_thread(void* arg) {
+    bench_user_t* user = (bench_user_t*)arg;
+    int logged_in = ns_login(user) == 0;
+    if (!logged_in) fprintf(stderr, "User %d: could not log in to the Name Server\n", user->id);
+    pthread_barrier_wait(&g_start_barrier); // Everyone is logged in
+    pthread_barrier_wait(&g_start_barrier); // g_deadline is set
+    if (!logged_in) return NULL;
+
+    while (!past_deadline()) {
+        bench_op_t op = pick_op(user);
+        uint64_t started = now_us();
+        int rc = op_funcs[op](user);
+        record(&user->ops[op], now_us() - started, rc != OP_OK);
+        if (rc == OP_DISCONNECT) {
+            close(user->ns_sock);
+            if (ns_login(user) == -1) {
+                fprintf(stderr, "User %d: lost the Name Server connection\n", user->id);
+                return NULL;
+            }
+        }
+    }
+
+    if (!g_keep) {
+        char filename[MAX_FILENAME];
+        for (int i = 0; i < user->created; i++) {
+            snprintf(filename, sizeof(filename), "%s_u%d_%d.txt", g_prefix, user->id, i);
+            ns_acked(user, MSG_DELETE, filename, NULL, 0);
+        }
+    }
+    close(user->ns_sock);
+    return NULL;
+}
+
+// =========================================================================
+//  SETUP
+// =========================================================================
+
+/**
+ * @brief Fills an empty document with roughly 'size' bytes of ten-word
+ * sentences through one WRITE session.
+ * @return Number of sentences written, or -1 on failure.
+ */
+static int populate_doc(bench_user_t* owner, const char* name, long size) {
+    ss_conn_t c;
+    if (ss_open(owner, MSG_WRITE, name, &c) != OP_OK) return -1;
+
+    char line[SS_LINE_MAX];
+    if (ss_send_line(&c, "WRITE %s 1 %d\n", name, BENCH_WRITE_WAIT_MS) == -1 ||
+        ss_read_line(&c, line, sizeof(line)) == -1 || strncmp(line, "OK_200", 6) != 0) {
+        ss_close(&c, 1);
+        return -1;
+    }
+
+    char chunk[BENCH_CHUNK_BYTES + 32];
+    long written = 0;
+    int word_count = 0;
+    int failed = 0;
+    while (written < size && !failed) {
+        size_t length = 0;
+        int chunk_words = 0;
+        while (length < BENCH_CHUNK_BYTES && written + (long)length < size) {
+            const char* word = words[rand_r(&owner->seed) % (sizeof(words) / sizeof(words[0]))];
+            int ends_sentence = (word_count + chunk_words + 1) % BENCH_WORDS_PER_SENTENCE == 0;
+            length += (size_t)snprintf(chunk + length, sizeof(chunk) - length, "%s%s%s",
+                                       length ? " " : "", word, ends_sentence ? "." : "");
+            chunk_words++;
+        }
+        if (ss_send_line(&c, "%d %s\n", word_count + 1, chunk) == -1 ||
+            ss_read_line(&c, line, sizeof(line)) == -1 || strncmp(line, "OK_200", 6) != 0) {
+            failed = 1;
+            break;
+        }
+        word_count += chunk_words;
+        written += (long)length + 1;
+    }
+    if (ss_send_line(&c, "ETIRW\n") == -1 || ss_read_line(&c, line, sizeof(line)) == -1 ||
+        strncmp(line, "OK_200 WRITE COMPLETED", 22) != 0) {
+        failed = 1;
+    }
+    ss_close(&c, 1);
+    if (failed) return -1;
+    return (word_count + BENCH_WORDS_PER_SENTENCE - 1) / BENCH_WORDS_PER_SENTENCE;
+}
+
+static long pick_size(unsigned int* seed) {
+    if (g_max_size <= g_min_size) return g_min_size;
+    double u = (double)rand_r(seed) / ((double)RAND_MAX + 1.0);
+    return (long)exp(log((double)g_min_size) + u * (log((double)g_max_size) - log((double)g_min_size)));
+}
+
+static int setup_docs(bench_user_t* owner) {
+    g_docs = calloc((size_t)g_doc_count + 1, sizeof(bench_doc_t));
+    if (g_docs == NULL) return -1;
+
+    for (int i = 0; i <= g_doc_count; i++) {
+        bench_doc_t* doc = &g_docs[i];
+        if (i == 0) snprintf(doc->name, sizeof(doc->name), "%s_hot.txt", g_prefix);
+        else snprintf(doc->name, sizeof(doc->name), "%s_%d.txt", g_prefix, i);
+
+        if (ns_acked(owner, MSG_CREATE, doc->name, NULL, 0) != OP_OK) {
+            fprintf(stderr, "Could not create %s\n", doc->name);
+            return -1;
+        }
+        doc->sentences = populate_doc(owner, doc->name, pick_size(&owner->seed));
+        if (doc->sentences < 0) {
+            fprintf(stderr, "Could not fill %s\n", doc->name);
+            return -1;
+        }
+        for (int u = 1; u < BENCH_USERNAMES && u < g_users; u++) {
+            AccessControlPayload grant;
+            memset(&grant, 0, sizeof(grant));
+            snprintf(grant.target_username, sizeof(grant.target_username), "bench_%d", u);
+            grant.permission = PERM_WRITE;
+            if (ns_acked(owner, MSG_ADD_ACCESS, doc->name, &grant, sizeof(grant)) != OP_OK) {
+                fprintf(stderr, "Could not grant bench_%d access to %s\n", u, doc->name);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void teardown_docs(bench_user_t* owner) {
+    for (int i = 0; i <= g_doc_count; i++) {
+        if (g_docs[i].name[0] != '\0') ns_acked(owner, MSG_DELETE, g_docs[i].name, NULL, 0);
+    }
+}
+
+// =========================================================================
+//  REPORT
+// =========================================================================
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_ms(const uint64_t* sorted, size_t n, double p) {
+    if (n == 0) return 0.0;
+    size_t rank = (size_t)ceil(p * (double)n);
+    if (rank < 1) rank = 1;
+    return (double)sorted[rank - 1] / 1000.0;
+}
+
+static void print_row(const char* name, uint64_t* samples, size_t n, unsigned long errors, double seconds) {
+    qsort(samples, n, sizeof(uint64_t), compare_u64);
+    printf("%-8s %9zu %8lu %10.1f %9.3f %9.3f %9.3f %9.3f\n",
+           name, n, errors, (double)n / seconds,
+           percentile_ms(samples, n, 0.50), percentile_ms(samples, n, 0.99),
+           percentile_ms(samples, n, 0.999), n ? (double)samples[n - 1] / 1000.0 : 0.0);
+}
+
+static void report(bench_user_t* users, double seconds) {
+    printf("\n%d users, %.1f s, %d docs + 1 hot (%d%% of doc ops), sizes %ld-%ld bytes\n\n",
+           g_users, seconds, g_doc_count, g_hot_pct, g_min_size, g_max_size);
+    printf("%-8s %9s %8s %10s %9s %9s %9s %9s\n",
+           "op", "count", "errors", "ops/s", "p50 ms", "p99 ms", "p999 ms", "max ms");
+
+    size_t total_count = 0;
+    unsigned long total_errors = 0;
+    for (int op = 0; op < OP_COUNT; op++) {
+        for (int u = 0; u < g_users; u++) total_count += users[u].ops[op].count;
+    }
+
+    // Each operation's samples are merged across users, then appended to the total
+    uint64_t* all = malloc((total_count ? total_count : 1) * sizeof(uint64_t));
+    size_t all_n = 0;
+    for (int op = 0; op < OP_COUNT; op++) {
+        size_t n = 0;
+        unsigned long errors = 0;
+        for (int u = 0; u < g_users; u++) {
+            n += users[u].ops[op].count;
+            errors += users[u].ops[op].errors;
+        }
+        if (n == 0 || all == NULL) continue;
+        uint64_t* merged = all + all_n;
+        for (int u = 0; u < g_users; u++) {
+            memcpy(all + all_n, users[u].ops[op].samples, users[u].ops[op].count * sizeof(uint64_t));
+            all_n += users[u].ops[op].count;
+        }
+        total_errors += errors;
+        print_row(op_names[op], merged, n, errors, seconds);
+    }
+    if (all) {
+        print_row("TOTAL", all, all_n, total_errors, seconds);
+        free(all);
+    }
+}
+
+// =========================================================================
+//  MAIN
+// =========================================================================
+
+static int parse_mix(const char* mix) {
+    int weights[OP_COUNT] = {0};
+    char* copy = strdup(mix);
+    char* saveptr = NULL;
+    for (char* item = strtok_r(copy, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        char* eq = strchr(item, '=');
+        int found = 0;
+        if (eq) {
+            *eq = '\0';
+            for (int op = 0; op < OP_COUNT; op++) {
+                if (strcmp(item, op_keys[op]) == 0) {
+                    weights[op] = atoi(eq + 1);
+                    found = weights[op] >= 0;
+                }
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "Bad mix entry '%s' (use create|read|write|stream|info|view=<weight>)\n", item);
+            free(copy);
+            return -1;
+        }
+    }
+    free(copy);
+
+    int total = 0;
+    for (int op = 0; op < OP_COUNT; op++) total += weights[op];
+    if (total <= 0) {
+        fprintf(stderr, "The mix needs at least one positive weight\n");
+        return -1;
+    }
+    memcpy(g_weights, weights, sizeof(weights));
+    g_weight_total = total;
+    return 0;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s <ns_ip> <ns_port> [-u users] [-d seconds] [-m mix] [-f docs]\n"
+                    "       [-s min-max] [-H hot_percent] [-k]\n", prog);
+    fprintf(stderr, "Example: %s 127.0.0.1 5000 -u 32 -d 20 -m read=70,write=20,info=10\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "u:d:m:f:s:H:k")) != -1) {
+        switch (opt) {
+            case 'u': g_users = atoi(optarg); break;
+            case 'd': g_seconds = atoi(optarg); break;
+            case 'm': if (parse_mix(optarg) == -1) exit(EXIT_FAILURE); break;
+            case 'f': g_doc_count = atoi(optarg); break;
+            case 's':
+                if (sscanf(optarg, "%ld-%ld", &g_min_size, &g_max_size) != 2) usage(argv[0]);
+                break;
+            case 'H': g_hot_pct = atoi(optarg); break;
+            case 'k': g_keep = 1; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2) usage(argv[0]);
+    g_ns_ip = argv[optind];
+    g_ns_port = atoi(argv[optind + 1]);
+    if (g_users < 1 || g_seconds < 1 || g_doc_count < 0 || g_min_size < 1 ||
+        g_max_size < g_min_size || g_hot_pct < 0 || g_hot_pct > 100) {
+        fprintf(stderr, "Error: users and seconds must be positive, sizes ordered, hot percent 0-100.\n");
+        exit(EXIT_FAILURE);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    snprintf(g_prefix, sizeof(g_prefix), "lb%d", (int)getpid());
+
+    bench_user_t* users = calloc((size_t)g_users, sizeof(bench_user_t));
+    bench_user_t owner;
+    memset(&owner, 0, sizeof(owner));
+    strcpy(owner.username, "bench_0");
+    owner.seed = (unsigned int)time(NULL);
+    if (users == NULL || ns_login(&owner) == -1) {
+        fprintf(stderr, "Could not log in to the Name Server at %s:%d\n", g_ns_ip, g_ns_port);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Creating %d documents...\n", g_doc_count + 1);
+    uint64_t setup_started = now_us();
+    if (setup_docs(&owner) == -1) {
+        teardown_docs(&owner);
+        exit(EXIT_FAILURE);
+    }
+    printf("Setup took %.2f s. Running %d users for %d s...\n",
+           (double)(now_us() - setup_started) / 1e6, g_users, g_seconds);
+
+    pthread_t* tids = calloc((size_t)g_users, sizeof(pthread_t));
+    pthread_barrier_init(&g_start_barrier, NULL, (unsigned)g_users + 1);
+    for (int u = 0; u < g_users; u++) {
+        users[u].id = u;
+        users[u].seed = owner.seed ^ (unsigned int)(u * 2654435761u);
+        snprintf(users[u].username, sizeof(users[u].username), "bench_%d", u % BENCH_USERNAMES);
+        if (pthread_create(&tids[u], NULL, user_thread, &users[u]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Start the clock once every user is logged in
+    pthread_barrier_wait(&g_start_barrier);
+    uint64_t run_started = now_us();
+    clock_gettime(CLOCK_MONOTONIC, &g_deadline);
+    g_deadline.tv_sec += g_seconds;
+    pthread_barrier_wait(&g_start_barrier);
+    for (int u = 0; u < g_users; u++) pthread_join(tids[u], NULL);
+    double seconds = (double)(now_us() - run_started) / 1e6;
+
+    if (!g_keep) teardown_docs(&owner);
+    close(owner.ns_sock);
+    report(users, seconds);
+
+    for (int u = 0; u < g_users; u++) {
+        for (int op = 0; op < OP_COUNT; op++) free(users[u].ops[op].samples);
+    }
+    free(users);
+    free(tids);
+    free(g_docs);
+    return 0;
+}
@@ -18,9 +18,11 @@
 #include "../../include/logger.h"
 #include "../../include/protocol.h"
 #include "../../include/socket_utils.h"
+#include "../../include/ss_pool.h"
 
 // --- Defines ---
 #define BUF_SZ 8192 // Larger buffer for file reads
+#define WRITE_LOCK_WAIT_MS 3000 // How long the SS may queue a WRITE behind another writer
 
 // --- Globals ---
 static int g_ns_socket = -1; // Persistent connection to Name Server
@@ -35,8 +37,10 @@ int connect_and_login(const char* ns_ip, int ns_port, const char* username);
 
 // Command Handlers
 void handle_proxy_command(int msg_type, const char* filename, const char* success_msg);
-void handle_redirect_command(int msg_type, const char* filename, int sentence_num);
+void handle_redirect_command(int msg_type, const char* filename, int sentence_num, const char* read_range);
 void handle_list_command();
+void handle_stats_command();
+void handle_search_command(const char* query);
 void handle_view_command(int flags);
 void handle_info_command(const char* filename);
 void handle_access_command(int msg_type, const char* filename, const char* target_user, int permission);
@@ -49,6 +53,7 @@ void handle_requestaccess_command(const char* filename, const char* permission);
 void handle_viewrequests_command(const char* filename);
 void handle_approverequest_command(const char* filename, const char* username, const char* permission);
 void handle_denyrequest_command(const char* filename, const char* username);
+void handle_ss_dead_report(SSReadPayload* dead_ss_payload);
 
 
 /**
@@ -99,6 +104,7 @@ int main(int argc, char *argv[]) {
         printf("Failed to login to Name Server. Exiting.\n");
         exit(EXIT_FAILURE);
     }
+    ss_pool_init(username);
 
     printf("Welcome, %s! You are connected to the Name Server at %s:%d.\n", username, ns_ip, ns_port);
     printf("Type 'help' for commands or 'exit' to quit.\n");
@@ -106,6 +112,7 @@ int main(int argc, char *argv[]) {
     command_loop();
 
     printf("Logging out...\n");
+    ss_pool_close_all();
     close(g_ns_socket);
     close_logger();
     return 0;
@@ -120,6 +127,7 @@ int connect_and_login(const char* ns_ip, int ns_port, const char* username) {
     
     // connect_socket exits on failure
     connect_socket(g_ns_socket, ns_ip, ns_port);
+    protocol_set_version(g_ns_socket, PROTOCOL_V1);
     write_log("INFO", "Connected to Name Server.");
     strncpy(g_username, username, 64);
     g_username[63] = '\0';
@@ -129,6 +137,7 @@ int connect_and_login(const char* ns_ip, int ns_port, const char* username) {
     memset(&login_header, 0, sizeof(login_header));
     login_header.msg_type = MSG_REGISTER_CLIENT;
     login_header.source_component = COMPONENT_CLIENT;
+    login_header.request_id = PROTOCOL_VERSION; // Offer compact framing
     strncpy(login_header.filename, username, MAX_FILENAME - 1); // Send username
 
     if (send_header(g_ns_socket, &login_header) == -1) {
@@ -144,7 +153,9 @@ int connect_and_login(const char* ns_ip, int ns_port, const char* username) {
     }
 
     if (ack_header.msg_type == MSG_ACK) {
-        write_log("INFO", "Successfully logged in as '%s'", username);
+        // An NS without v2 answers 0 and the link stays on v1
+        if (ack_header.request_id == PROTOCOL_V2) protocol_set_version(g_ns_socket, PROTOCOL_V2);
+        write_log("INFO", "Successfully logged in as '%s' (protocol v%d)", username, protocol_version(g_ns_socket));
         return 0;
     } else {
         write_log("FATAL", "Name Server did not ACK login. (Got %d)", ack_header.msg_type);
@@ -183,6 +194,16 @@ void command_loop() {
         else if (strcmp(cmd, "LIST") == 0) {
             handle_list_command();
         }
+        else if (strcmp(cmd, "STATS") == 0) {
+            handle_stats_command();
+        }
+        else if (strcmp(cmd, "SEARCH") == 0) {
+            // Every word after the command, not just the first
+            const char* query = line_buffer + strspn(line_buffer, " \t") + strlen(cmd);
+            while (*query == ' ' || *query == '\t') query++;
+            if (strlen(arg1) == 0) printf("Usage: search <word> [word...]\n");
+            else handle_search_command(query);
+        }
         else if (strcmp(cmd, "CREATE") == 0) {
             if (strlen(arg1) == 0) printf("Usage: create <filename>\n");
             else handle_proxy_command(MSG_CREATE, arg1, "File created successfully.");
@@ -196,17 +217,25 @@ void command_loop() {
             else handle_proxy_command(MSG_UNDO, arg1, "Undo successful.");
         }
         else if (strcmp(cmd, "READ") == 0) {
-            if (strlen(arg1) == 0) printf("Usage: read <filename>\n");
-            else handle_redirect_command(MSG_READ, arg1, 0);
+            char range[64] = "";
+            long start, count;
+            char unit[16] = "";
+            if (sscanf(line_buffer, "%*s %*s %ld %ld %15s", &start, &count, unit) >= 2) {
+                snprintf(range, sizeof(range), "%ld %ld %s", start, count, unit);
+            }
+            if (strlen(arg1) == 0 || (strlen(arg2) > 0 && range[0] == '\0')) {
+                printf("Usage: read <filename> [<start_sentence> <count> | <offset> <length> BYTES]\n");
+            }
+            else handle_redirect_command(MSG_READ, arg1, 0, range[0] ? range : NULL);
         }
          else if (strcmp(cmd, "STREAM") == 0) {
             if (strlen(arg1) == 0) printf("Usage: stream <filename>\n");
-            else handle_redirect_command(MSG_STREAM, arg1, 0);
+            else handle_redirect_command(MSG_STREAM, arg1, 0, NULL);
         }
         else if (strcmp(cmd, "WRITE") == 0) {
             int sent_num = atoi(arg2);
             if (strlen(arg1) == 0 || sent_num == 0) printf("Usage: write <filename> <sentence_number>\n");
-            else handle_redirect_command(MSG_WRITE, arg1, sent_num);
+            else handle_redirect_command(MSG_WRITE, arg1, sent_num, NULL);
         }
         else if (strcmp(cmd, "EXEC") == 0) {
             if (strlen(arg1) == 0) printf("Usage: exec <filename>\n");
@@ -385,6 +414,8 @@ void command_loop() {
             printf("  info <file>\n");
             printf("  view [-a, -l, -al]\n");
             printf("  list\n");
+            printf("  stats\n");
+            printf("  search <word> [word...]\n");
             printf("  addaccess <file> <-R/-W> <user>\n");
             printf("  remaccess <file> <user>\n");
             printf("  checkpoint <file> <tag>\n");
@@ -406,6 +437,112 @@ void command_loop() {
     }
 }
 
+/**
+ * @brief Asks the NS which SS holds 'filename'. 'msg_type' is MSG_READ,
+ * MSG_WRITE or MSG_STREAM (the NS checks the matching permission) or
+ * MSG_LOCATE_FILE (no permission needed).
+ * @return 0 on success, -1 otherwise (message already printed).
+ */
+static int ns_locate_file(int msg_type, const char* filename, SSReadPayload* out) {
+    MessageHeader header;
+    memset(&header, 0, sizeof(header));
+    header.msg_type = msg_type;
+    header.source_component = COMPONENT_CLIENT;
+    strncpy(header.filename, filename, MAX_FILENAME - 1);
+
+    if (send_header(g_ns_socket, &header) == -1) { write_log("ERROR", "Connection to NS lost."); return -1; }
+
+    MessageHeader resp_header;
+    if (recv_header(g_ns_socket, &resp_header) == -1) { write_log("ERROR", "Connection to NS lost."); return -1; }
+
+    if (resp_header.msg_type == MSG_ERROR) {
+        printf("Error: %s\n", resp_header.filename);
+        return -1;
+    }
+    if (resp_header.msg_type != (msg_type == MSG_LOCATE_FILE ? MSG_LOCATE_RESPONSE : MSG_READ_REDIRECT)) {
+        if (msg_type == MSG_LOCATE_FILE) {
+            printf("Error: File not found in any storage server.\n");
+            write_log("ERROR", "File %s not found in any storage server", filename);
+        } else {
+            printf("Error: Name Server sent unexpected response.\n");
+        }
+        return -1;
+    }
+    if (recv_all(g_ns_socket, out, sizeof(*out)) == -1) {
+        write_log("ERROR", "Failed to receive redirect payload.");
+        return -1;
+    }
+    write_log("INFO", "Redirected to SS at %s:%d for '%s'", out->ip_addr, out->port, filename);
+    return 0;
+}
+
+static ssize_t ss_send_command(int ss_sock, const char* command, char* reply, size_t reply_size) {
+    if (send(ss_sock, command, strlen(command), MSG_NOSIGNAL) == -1) return -1;
+    return recv(ss_sock, reply, reply_size - 1, 0);
+}
+
+/**
+ * @brief Starts 'command' on the SS holding 'filename'. The SS comes from
+ * the redirect cache when possible (else the NS, via ns_locate_file), the
+ * session from the pool, and the first reply is read here. A cached
+ * redirect that fails or is refused (file moved, deleted or access revoked)
+ * is dropped and the NS asked again, so the user sees the NS's verdict.
+ * So is a replica that refuses the command (ERR_421: read-only, or behind
+ * its primary), however it was found.
+ * @return The session socket, with the first reply in 'reply'
+ * (*reply_length bytes, NUL-terminated); or -1, message already printed.
+ * Hand the socket back with ss_pool_release().
+ */
+static int ss_begin_command(int msg_type, const char* filename, const char* command, SSReadPayload* ss,
+                            char* reply, size_t reply_size, ssize_t* reply_length) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int cached = attempt == 0 && redirect_cache_lookup(filename, ss);
+        if (!cached && ns_locate_file(msg_type, filename, ss) == -1) return -1;
+
+        int reused = 0;
+        int ss_sock = ss_pool_acquire(ss, &reused);
+        ssize_t n = ss_sock < 0 ? -1 : ss_send_command(ss_sock, command, reply, reply_size);
+        if (n <= 0 && reused) {
+            // The parked session was closed since its last use: retry on a new one
+            ss_pool_release(ss, ss_sock, 0);
+            ss_sock = ss_pool_acquire(ss, NULL);
+            n = ss_sock < 0 ? -1 : ss_send_command(ss_sock, command, reply, reply_size);
+        }
+
+        if (ss_sock < 0 || n <= 0) {
+            if (ss_sock >= 0) ss_pool_release(ss, ss_sock, 0);
+            if (cached) {
+                redirect_cache_invalidate(filename);
+                continue;
+            }
+            if (ss_sock == SS_POOL_BUSY) {
+                printf("Error: Storage server is busy. Please try again shortly.\n");
+            } else if (ss_sock == SS_POOL_REJECTED) {
+                printf("Error: Storage server rejected connection.\n");
+            } else if (ss_sock >= 0) {
+                printf("Error: Storage Server disconnected.\n");
+            } else {
+                printf("Error: Could not connect to Storage Server at %s:%d.\n", ss->ip_addr, ss->port);
+                redirect_cache_invalidate_server(ss);
+                if (msg_type != MSG_LOCATE_FILE) handle_ss_dead_report(ss);
+            }
+            return -1;
+        }
+
+        reply[n] = '\0';
+        if ((cached && (strncmp(reply, "ERR_403", 7) == 0 || strncmp(reply, "ERR_404 File not found", 22) == 0)) ||
+            (attempt == 0 && strncmp(reply, ERR_421, 7) == 0)) {
+            ss_pool_release(ss, ss_sock, 1);
+            redirect_cache_invalidate(filename);
+            continue;
+        }
+        redirect_cache_store(filename, ss);
+        *reply_length = n;
+        return ss_sock;
+    }
+    return -1;
+}
+
 /**
  * @brief Generic handler for simple proxy commands
  * (CREATE, DELETE, UNDO)
@@ -430,6 +567,7 @@ void handle_proxy_command(int msg_type, const char* filename, const char* succes
     }
 
     if (resp_header.msg_type == MSG_ACK) {
+        if (msg_type == MSG_DELETE) redirect_cache_invalidate(filename);
         printf("%s\n", success_msg);
     } else {
         printf("Error: %s\n", resp_header.filename);
@@ -503,6 +641,84 @@ void handle_list_command() {
     }
 }
 
+/**
+ * @brief Handler for STATS command: prints the NS and SS metrics (Prometheus text)
+ */
+void handle_stats_command() {
+    MessageHeader header;
+    memset(&header, 0, sizeof(header));
+    header.msg_type = MSG_STATS;
+    header.source_component = COMPONENT_CLIENT;
+
+    if (send_header(g_ns_socket, &header) == -1) { write_log("ERROR", "Connection to NS lost."); return; }
+
+    MessageHeader resp_header;
+    if (recv_header(g_ns_socket, &resp_header) == -1) { write_log("ERROR", "Connection to NS lost."); return; }
+
+    if (resp_header.msg_type == MSG_STATS_RESPONSE) {
+        if (resp_header.payload_length == 0) {
+            printf("(No stats)\n");
+            return;
+        }
+
+        char* stats_buffer = malloc(resp_header.payload_length + 1);
+        if (!stats_buffer) { printf("Internal error\n"); return; }
+        if (recv_all(g_ns_socket, stats_buffer, resp_header.payload_length) == -1) {
+            write_log("ERROR", "Failed to receive STATS payload.");
+            free(stats_buffer);
+            return;
+        }
+        stats_buffer[resp_header.payload_length] = '\0';
+
+        printf("%s", stats_buffer);
+        free(stats_buffer);
+    } else {
+        printf("Error: %s\n", resp_header.filename);
+    }
+}
+
+/**
+ * @brief Handler for SEARCH: the sentences, across every file the user
+ * may read, that contain all of the words.
+ */
+void handle_search_command(const char* query) {
+    MessageHeader header;
+    memset(&header, 0, sizeof(header));
+    header.msg_type = MSG_SEARCH_CONTENT;
+    header.source_component = COMPONENT_CLIENT;
+    strncpy(header.filename, query, MAX_FILENAME - 1);
+    header.filename[strcspn(header.filename, "\r\n")] = '\0';
+
+    if (send_header(g_ns_socket, &header) == -1) { write_log("ERROR", "Connection to NS lost."); return; }
+
+    MessageHeader resp_header;
+    if (recv_header(g_ns_socket, &resp_header) == -1) { write_log("ERROR", "Connection to NS lost."); return; }
+
+    if (resp_header.msg_type == MSG_SEARCH_RESPONSE) {
+        if (strcmp(resp_header.filename, SEARCH_INDEX_WARMING) == 0) {
+            printf("(Search index still warming up; results may be incomplete)\n");
+        }
+        if (resp_header.payload_length == 0) {
+            printf("(No matches)\n");
+            return;
+        }
+
+        char* results = malloc(resp_header.payload_length + 1);
+        if (!results) { printf("Internal error\n"); return; }
+        if (recv_all(g_ns_socket, results, resp_header.payload_length) == -1) {
+            write_log("ERROR", "Failed to receive SEARCH payload.");
+            free(results);
+            return;
+        }
+        results[resp_header.payload_length] = '\0';
+
+        printf("%s", results);
+        free(results);
+    } else {
+        printf("Error: %s\n", resp_header.filename);
+    }
+}
+
 /**
  * @brief Handler for VIEW command
  */
@@ -568,8 +784,18 @@ void handle_info_command(const char* filename) {
     if (recv_header(g_ns_socket, &resp_header) == -1) { write_log("ERROR", "Connection to NS lost."); return; }
 
     if (resp_header.msg_type == MSG_INFO_RESPONSE) {
+        // The raw struct from a v1 NS, else encode_file_info()'s compact form
         FileInfoPayload payload;
-        if (recv_all(g_ns_socket, &payload, sizeof(payload)) == -1) {
+        uint8_t compact[sizeof(FileInfoPayload)];
+        int ok;
+        if (resp_header.payload_length == sizeof(payload)) {
+            ok = recv_all(g_ns_socket, &payload, sizeof(payload)) == 0;
+        } else {
+            ok = resp_header.payload_length < sizeof(compact) &&
+                 recv_all(g_ns_socket, compact, resp_header.payload_length) == 0 &&
+                 decode_file_info(compact, resp_header.payload_length, &payload) == 0;
+        }
+        if (!ok) {
             write_log("ERROR", "Failed to receive INFO payload.");
             return;
         }
@@ -688,63 +914,27 @@ void handle_exec_command(const char* filename) {
 
 /**
  * @brief Handles the bilingual flow for READ/WRITE/STREAM
+ * @param read_range For READ, "<start> <count> [BYTES]" to fetch only a slice (NULL = whole file).
  */
-void handle_redirect_command(int msg_type, const char* filename, int sentence_num) {
-    // 1. Ask NS for redirect
-    MessageHeader header;
-    memset(&header, 0, sizeof(header));
-    header.msg_type = msg_type;
-    header.source_component = COMPONENT_CLIENT;
-    strncpy(header.filename, filename, MAX_FILENAME - 1);
-
-    if (send_header(g_ns_socket, &header) == -1) { write_log("ERROR", "Connection to NS lost."); return; }
-
-    MessageHeader resp_header;
-    if (recv_header(g_ns_socket, &resp_header) == -1) { write_log("ERROR", "Connection to NS lost."); return; }
-    
-    // 2. Check response
-    if (resp_header.msg_type == MSG_ERROR) {
-        printf("Error: %s\n", resp_header.filename);
-        return;
-    }
-    if (resp_header.msg_type != MSG_READ_REDIRECT) {
-        printf("Error: Name Server sent unexpected response.\n");
-        return;
+void handle_redirect_command(int msg_type, const char* filename, int sentence_num, const char* read_range) {
+    char buffer[BUF_SZ];
+    if (msg_type == MSG_READ && read_range) {
+        snprintf(buffer, BUF_SZ, "READ %s %s\n", filename, read_range);
+    } else if (msg_type == MSG_READ || msg_type == MSG_STREAM) {
+        snprintf(buffer, BUF_SZ, "%s %s\n", msg_type == MSG_READ ? "READ" : "STREAM", filename);
+    } else {
+        snprintf(buffer, BUF_SZ, "WRITE %s %d %d\n", filename, sentence_num, WRITE_LOCK_WAIT_MS);
     }
-    
-    // 3. Get the redirect payload
+
+    // Locate the file (cached redirect or NS), take an SS session, send the command
     SSReadPayload payload;
-    if (recv_all(g_ns_socket, &payload, sizeof(payload)) == -1) {
-        write_log("ERROR", "Failed to receive redirect payload.");
-        return;
-    }
-    
-    write_log("INFO", "Redirected to SS at %s:%d", payload.ip_addr, payload.port);
-    
-    // 4. Connect DIRECTLY to the Storage Server
-    int ss_sock = create_socket();
-    if (connect_socket_no_exit(ss_sock, payload.ip_addr, payload.port) == -1) {
-        printf("Error: Could not connect to Storage Server at %s:%d.\n", payload.ip_addr, payload.port);
-        close(ss_sock);
-        handle_ss_dead_report(&payload);
-        return;
-    }
-    
-    // 5. --- SPEAK PERSON B's TEXT PROTOCOL ---
-    char buffer[BUF_SZ];
-    
-    // 5a. Send USER handshake
-    snprintf(buffer, BUF_SZ, "USER %s\n", g_username);
-    send(ss_sock, buffer, strlen(buffer), 0);
-    recv(ss_sock, buffer, BUF_SZ - 1, 0); // Get "OK_200 USER_ACCEPTED"
-    
+    ssize_t n;
+    int ss_sock = ss_begin_command(msg_type, filename, buffer, &payload, buffer, BUF_SZ, &n);
+    if (ss_sock == -1) return;
+    int reusable = 0; // Only once the last reply was read in full
+
     // --- READ/STREAM Logic ---
     if (msg_type == MSG_READ || msg_type == MSG_STREAM) {
-        
-        char* cmd_str = (msg_type == MSG_READ) ? "READ" : "STREAM";
-        snprintf(buffer, BUF_SZ, "%s %s\n", cmd_str, filename);
-        send(ss_sock, buffer, strlen(buffer), 0);
-        
         printf("--- File Content ---\n");
         if(msg_type == MSG_STREAM) {
             // Use the word-by-word streaming logic from Person B's client
@@ -753,14 +943,10 @@ void handle_redirect_command(int msg_type, const char* filename, int sentence_nu
             fflush(stdout);
             
             while (1) {
-                ssize_t n = recv(ss_sock, buffer, BUF_SZ - 1, 0);
-                if (n <= 0) break;
-                buffer[n] = '\0';
-                
                 // Check for control messages from SS
-                if (strstr(buffer, "STREAM_COMPLETE")) break;
-                if (strstr(buffer, "OK_200 EMPTY_FILE")) break;
-                if (strstr(buffer, "ERR_")) { printf("%s", buffer); break; }
+                if (strstr(buffer, "STREAM_COMPLETE")) { reusable = 1; break; }
+                if (strstr(buffer, "OK_200 EMPTY_FILE")) { reusable = 1; break; }
+                if (strstr(buffer, "ERR_")) { printf("%s", buffer); reusable = 1; break; }
                 
                 // Process word-by-word
                 printf("%s ", buffer);
@@ -771,45 +957,50 @@ void handle_redirect_command(int msg_type, const char* filename, int sentence_nu
                 ts.tv_sec = 0;
                 ts.tv_nsec = 100000000L; // 100 million nanoseconds
                 nanosleep(&ts, NULL);
+
+                n = recv(ss_sock, buffer, BUF_SZ - 1, 0);
+                if (n <= 0) break;
+                buffer[n] = '\0';
             }
         } else {
-            // --- THIS IS THE CORRECTED READ LOGIC ---
-            // It handles partial reads and looks for the
-            // *exact* terminators your SS is sending.
+            // The SS answers "OK_200 FILE_CONTENT <bytes>\n" followed by
+            // exactly that many bytes, or a single status line.
             char read_buffer[BUF_SZ];
-            int first_packet = 1;
-            while (1) {
-                ssize_t n = recv(ss_sock, read_buffer, BUF_SZ - 1, 0);
+            size_t have = (size_t)n;
+            memcpy(read_buffer, buffer, have + 1);
+            char* eol = strchr(read_buffer, '\n');
+            while (eol == NULL && have < sizeof(read_buffer) - 1) {
+                n = recv(ss_sock, read_buffer + have, sizeof(read_buffer) - 1 - have, 0);
                 if (n <= 0) break; // Connection closed
-                read_buffer[n] = '\0';
-
-                char* content_to_print = read_buffer;
-
-                // Check for the "EMPTY" message (from your log)
-                if (strstr(content_to_print, "OK_200 EMPTY_FILE")) {
-                    break; // Just break, print nothing
-                }
+                have += n;
+                read_buffer[have] = '\0';
+                eol = strchr(read_buffer, '\n');
+            }
 
-                // Check for the "START" message (from your log)
-                if (first_packet) {
-                    char* start_ptr = strstr(content_to_print, "OK_200 FILE_CONTENT\n");
-                    if (start_ptr) {
-                        // Move the pointer past this header
-                        content_to_print = start_ptr + strlen("OK_200 FILE_CONTENT\n");
+            long remaining = 0;
+            if (eol && sscanf(read_buffer, "OK_200 FILE_CONTENT %ld", &remaining) == 1) {
+                // Whatever arrived after the header line is already body
+                size_t body = have - (size_t)(eol + 1 - read_buffer);
+                if ((long)body > remaining) body = remaining;
+                fwrite(eol + 1, 1, body, stdout);
+                remaining -= body;
+                while (remaining > 0) {
+                    size_t want = remaining < (long)sizeof(read_buffer) ? (size_t)remaining : sizeof(read_buffer);
+                    n = recv(ss_sock, read_buffer, want, 0);
+                    if (n <= 0) {
+                        printf("\nError: Storage Server closed the connection mid-file.");
+                        break;
                     }
-                    first_packet = 0;
-                }
-
-                // Check for the "END" message (from your log)
-                char* end_ptr = strstr(content_to_print, "END_OF_FILE");
-                if (end_ptr) {
-                    *end_ptr = '\0'; // NUL-terminate before the "END"
-                    printf("%s", content_to_print); // Print the last chunk
-                    break; // Exit the loop
+                    fwrite(read_buffer, 1, n, stdout);
+                    remaining -= n;
                 }
-
-                // If no terminators, just print the buffer
-                printf("%s", content_to_print);
+                reusable = remaining == 0;
+                printf("\n");
+            } else if (eol && strncmp(read_buffer, "ERR_", 4) == 0) {
+                printf("%s", read_buffer);
+                reusable = 1;
+            } else if (eol) {
+                reusable = 1; // "OK_200 EMPTY_FILE": print nothing
             }
         }
         printf("\n--- End of File ---\n");
@@ -817,20 +1008,10 @@ void handle_redirect_command(int msg_type, const char* filename, int sentence_nu
     
     // --- WRITE Logic ---
     else if (msg_type == MSG_WRITE) {
-        snprintf(buffer, BUF_SZ, "WRITE %s %d\n", filename, sentence_num);
-        send(ss_sock, buffer, strlen(buffer), 0);
-
-        ssize_t n = recv(ss_sock, buffer, BUF_SZ - 1, 0);
-        if (n <= 0) {
-            printf("Error: Storage Server disconnected.\n");
-            close(ss_sock);
-            return;
-        }
-        buffer[n] = '\0';
         printf("%s", buffer); // Print response (e.g., "OK_200 WRITE MODE" or "ERR_409")
 
         if (strncmp(buffer, "OK_200", 6) != 0) {
-            close(ss_sock); // Not OK, something went wrong
+            ss_pool_release(&payload, ss_sock, 1); // Not OK, but the session is still usable
             return;
         }
 
@@ -841,8 +1022,15 @@ void handle_redirect_command(int msg_type, const char* filename, int sentence_nu
             if (fgets(buffer, sizeof(buffer), stdin) == NULL) {
                 break;
             }
+            // The SS reads commands a line at a time
+            size_t len = strlen(buffer);
+            if (len == 0 || buffer[len - 1] != '\n') {
+                if (len == sizeof(buffer) - 1) len--;
+                buffer[len++] = '\n';
+                buffer[len] = '\0';
+            }
             
-            send(ss_sock, buffer, strlen(buffer), 0);
+            send(ss_sock, buffer, len, 0);
             
             n = recv(ss_sock, buffer, BUF_SZ - 1, 0);
             if (n <= 0) {
@@ -853,170 +1041,73 @@ void handle_redirect_command(int msg_type, const char* filename, int sentence_nu
             printf("%s", buffer); // Print "OK_200 CONTENT INSERTED" or "OK_200 WRITE COMPLETED"
             
             if (strncmp(buffer, "OK_200 WRITE COMPLETED", 22) == 0) {
+                reusable = 1;
                 break; // We're done
             }
         }
     }
     
-    // 5d. Send EXIT
-    send(ss_sock, "EXIT\n", 5, 0);
-    close(ss_sock);
+    ss_pool_release(&payload, ss_sock, reusable);
 }
 
 /**
  * @brief Handler for CHECKPOINT command - creates a checkpoint via direct SS connection
  */
 void handle_checkpoint_command(const char* filename, const char* checkpoint_tag) {
-    // First get redirect to the storage server
-    MessageHeader header;
-    memset(&header, 0, sizeof(header));
-    header.msg_type = MSG_READ; // Use READ to get SS redirect
-    header.source_component = COMPONENT_CLIENT;
-    strncpy(header.filename, filename, MAX_FILENAME - 1);
-
-    if (send_header(g_ns_socket, &header) == -1) {
-        write_log("ERROR", "Connection to NS lost.");
-        return;
-    }
-
-    MessageHeader resp_header;
-    if (recv_header(g_ns_socket, &resp_header) == -1) {
-        write_log("ERROR", "Connection to NS lost.");
-        return;
-    }
-    
-    if (resp_header.msg_type == MSG_ERROR) {
-        printf("Error: %s\n", resp_header.filename);
-        return;
-    }
-    if (resp_header.msg_type != MSG_READ_REDIRECT) {
-        printf("Error: Name Server sent unexpected response.\n");
-        return;
-    }
-    
-    // Get the redirect payload
-    SSReadPayload payload;
-    if (recv_all(g_ns_socket, &payload, sizeof(payload)) == -1) {
-        write_log("ERROR", "Failed to receive redirect payload.");
-        return;
-    }
-    
-    write_log("INFO", "Redirected to SS at %s:%d for CHECKPOINT", payload.ip_addr, payload.port);
-    
-    // Connect to Storage Server
-    int ss_sock = create_socket();
-    if (connect_socket_no_exit(ss_sock, payload.ip_addr, payload.port) == -1) {
-        printf("Error: Could not connect to Storage Server at %s:%d.\n", payload.ip_addr, payload.port);
-        close(ss_sock);
-        handle_ss_dead_report(&payload);
-        return;
-    }
-    
-    // Send USER handshake
     char buffer[BUF_SZ];
-    snprintf(buffer, BUF_SZ, "USER %s\n", g_username);
-    send(ss_sock, buffer, strlen(buffer), 0);
-    recv(ss_sock, buffer, BUF_SZ - 1, 0); // Get "OK_200 USER_ACCEPTED"
-    
-    // Send CHECKPOINT command
     snprintf(buffer, BUF_SZ, "CHECKPOINT %s %s\n", filename, checkpoint_tag);
-    send(ss_sock, buffer, strlen(buffer), 0);
-    
-    // Receive response
-    ssize_t n = recv(ss_sock, buffer, BUF_SZ - 1, 0);
-    if (n > 0) {
-        buffer[n] = '\0';
-        printf("%s", buffer);
-        
-        if (strncmp(buffer, "OK_200", 6) == 0) {
-            printf("Checkpoint '%s' created successfully for file '%s'.\n", checkpoint_tag, filename);
-        }
-    } else {
-        printf("Error: Storage Server disconnected.\n");
+
+    // Checkpoints live with the primary copy, which MSG_LOCATE_FILE always
+    // returns (a MSG_READ may be sent to a replica); the SS checks access
+    SSReadPayload payload;
+    ssize_t n;
+    int ss_sock = ss_begin_command(MSG_LOCATE_FILE, filename, buffer, &payload, buffer, BUF_SZ, &n);
+    if (ss_sock == -1) return;
+
+    printf("%s", buffer);
+    if (strncmp(buffer, "OK_200", 6) == 0) {
+        printf("Checkpoint '%s' created successfully for file '%s'.\n", checkpoint_tag, filename);
     }
-    
-    // Send EXIT and close
-    send(ss_sock, "EXIT\n", 5, 0);
-    close(ss_sock);
+    ss_pool_release(&payload, ss_sock, 1);
 }
 
 /**
  * @brief Handler for VIEWCHECKPOINT command - views a checkpoint via direct SS connection
  */
 void handle_viewcheckpoint_command(const char* filename, const char* checkpoint_tag) {
-    // Get redirect to storage server (same pattern as checkpoint)
-    MessageHeader header;
-    memset(&header, 0, sizeof(header));
-    header.msg_type = MSG_READ;
-    header.source_component = COMPONENT_CLIENT;
-    strncpy(header.filename, filename, MAX_FILENAME - 1);
-
-    if (send_header(g_ns_socket, &header) == -1) {
-        write_log("ERROR", "Connection to NS lost.");
-        return;
-    }
+    char read_buffer[BUF_SZ];
+    snprintf(read_buffer, BUF_SZ, "VIEWCHECKPOINT %s %s\n", filename, checkpoint_tag);
 
-    MessageHeader resp_header;
-    if (recv_header(g_ns_socket, &resp_header) == -1) {
-        write_log("ERROR", "Connection to NS lost.");
-        return;
-    }
-    
-    if (resp_header.msg_type == MSG_ERROR) {
-        printf("Error: %s\n", resp_header.filename);
-        return;
-    }
-    if (resp_header.msg_type != MSG_READ_REDIRECT) {
-        printf("Error: Name Server sent unexpected response.\n");
-        return;
-    }
-    
     SSReadPayload payload;
-    if (recv_all(g_ns_socket, &payload, sizeof(payload)) == -1) {
-        write_log("ERROR", "Failed to receive redirect payload.");
-        return;
-    }
-    
-    // Connect to Storage Server
-    int ss_sock = create_socket();
-    if (connect_socket_no_exit(ss_sock, payload.ip_addr, payload.port) == -1) {
-        printf("Error: Could not connect to Storage Server at %s:%d.\n", payload.ip_addr, payload.port);
-        close(ss_sock);
-        handle_ss_dead_report(&payload);
-        return;
-    }
-    
-    // Send USER handshake
-    char buffer[BUF_SZ];
-    snprintf(buffer, BUF_SZ, "USER %s\n", g_username);
-    send(ss_sock, buffer, strlen(buffer), 0);
-    recv(ss_sock, buffer, BUF_SZ - 1, 0);
-    
-    // Send VIEWCHECKPOINT command
-    snprintf(buffer, BUF_SZ, "VIEWCHECKPOINT %s %s\n", filename, checkpoint_tag);
-    send(ss_sock, buffer, strlen(buffer), 0);
+    ssize_t n;
+    int ss_sock = ss_begin_command(MSG_LOCATE_FILE, filename, read_buffer, &payload, read_buffer, BUF_SZ, &n);
+    if (ss_sock == -1) return;
     
     // Receive and display response
     printf("--- Checkpoint Content: %s ---\n", checkpoint_tag);
     
-    char read_buffer[BUF_SZ];
     int first_packet = 1;
-    while (1) {
-        ssize_t n = recv(ss_sock, read_buffer, BUF_SZ - 1, 0);
-        if (n <= 0) break;
-        read_buffer[n] = '\0';
+    int reusable = 0;
+    for (;; first_packet = 0) {
+        if (!first_packet) {
+            n = recv(ss_sock, read_buffer, BUF_SZ - 1, 0);
+            if (n <= 0) break;
+            read_buffer[n] = '\0';
+        }
 
         char* content_to_print = read_buffer;
 
         // Handle empty checkpoint
         if (strstr(content_to_print, "OK_200 EMPTY_CHECKPOINT")) {
             printf("(Checkpoint is empty)\n");
+            reusable = 1;
             break;
         }
 
         // Handle error responses
         if (strstr(content_to_print, "ERR_404")) {
             printf("Error: Checkpoint '%s' not found for file '%s'\n", checkpoint_tag, filename);
+            reusable = 1;
             break;
         }
 
@@ -1026,7 +1117,6 @@ void handle_viewcheckpoint_command(const char* filename, const char* checkpoint_
             if (start_ptr) {
                 content_to_print = start_ptr + strlen("OK_200 CHECKPOINT_CONTENT\n");
             }
-            first_packet = 0;
         }
 
         // Handle end of content
@@ -1034,6 +1124,7 @@ void handle_viewcheckpoint_command(const char* filename, const char* checkpoint_
         if (end_ptr) {
             *end_ptr = '\0';
             printf("%s", content_to_print);
+            reusable = 1;
             break;
         }
 
@@ -1041,155 +1132,55 @@ void handle_viewcheckpoint_command(const char* filename, const char* checkpoint_
     }
     
     printf("\n--- End of Checkpoint ---\n");
-    
-    // Send EXIT and close
-    send(ss_sock, "EXIT\n", 5, 0);
-    close(ss_sock);
+    ss_pool_release(&payload, ss_sock, reusable);
 }
 
 /**
  * @brief Handler for REVERT command - reverts file to a checkpoint via direct SS connection
  */
 void handle_revert_command(const char* filename, const char* checkpoint_tag) {
-    // Get redirect to storage server
-    MessageHeader header;
-    memset(&header, 0, sizeof(header));
-    header.msg_type = MSG_READ;
-    header.source_component = COMPONENT_CLIENT;
-    strncpy(header.filename, filename, MAX_FILENAME - 1);
-
-    if (send_header(g_ns_socket, &header) == -1) {
-        write_log("ERROR", "Connection to NS lost.");
-        return;
-    }
-
-    MessageHeader resp_header;
-    if (recv_header(g_ns_socket, &resp_header) == -1) {
-        write_log("ERROR", "Connection to NS lost.");
-        return;
-    }
-    
-    if (resp_header.msg_type == MSG_ERROR) {
-        printf("Error: %s\n", resp_header.filename);
-        return;
-    }
-    if (resp_header.msg_type != MSG_READ_REDIRECT) {
-        printf("Error: Name Server sent unexpected response.\n");
-        return;
-    }
-    
-    SSReadPayload payload;
-    if (recv_all(g_ns_socket, &payload, sizeof(payload)) == -1) {
-        write_log("ERROR", "Failed to receive redirect payload.");
-        return;
-    }
-    
-    // Connect to Storage Server
-    int ss_sock = create_socket();
-    if (connect_socket_no_exit(ss_sock, payload.ip_addr, payload.port) == -1) {
-        printf("Error: Could not connect to Storage Server at %s:%d.\n", payload.ip_addr, payload.port);
-        close(ss_sock);
-        handle_ss_dead_report(&payload);
-        return;
-    }
-    
-    // Send USER handshake
     char buffer[BUF_SZ];
-    snprintf(buffer, BUF_SZ, "USER %s\n", g_username);
-    send(ss_sock, buffer, strlen(buffer), 0);
-    recv(ss_sock, buffer, BUF_SZ - 1, 0);
-    
-    // Send REVERT command
     snprintf(buffer, BUF_SZ, "REVERT %s %s\n", filename, checkpoint_tag);
-    send(ss_sock, buffer, strlen(buffer), 0);
-    
-    // Receive response
-    ssize_t n = recv(ss_sock, buffer, BUF_SZ - 1, 0);
-    if (n > 0) {
-        buffer[n] = '\0';
-        printf("%s", buffer);
-        
-        if (strncmp(buffer, "OK_200", 6) == 0) {
-            printf("File '%s' successfully reverted to checkpoint '%s'.\n", filename, checkpoint_tag);
-        } else if (strstr(buffer, "ERR_404")) {
-            printf("Error: Checkpoint '%s' not found for file '%s'\n", checkpoint_tag, filename);
-        } else if (strstr(buffer, "ERR_409")) {
-            printf("Error: Cannot revert - file is currently being edited by another user.\n");
-        }
-    } else {
-        printf("Error: Storage Server disconnected.\n");
-    }
-    
-    // Send EXIT and close
-    send(ss_sock, "EXIT\n", 5, 0);
-    close(ss_sock);
+
+    SSReadPayload payload;
+    ssize_t n;
+    int ss_sock = ss_begin_command(MSG_LOCATE_FILE, filename, buffer, &payload, buffer, BUF_SZ, &n);
+    if (ss_sock == -1) return;
+
+    printf("%s", buffer);
+    if (strncmp(buffer, "OK_200", 6) == 0) {
+        printf("File '%s' successfully reverted to checkpoint '%s'.\n", filename, checkpoint_tag);
+    } else if (strstr(buffer, "ERR_404")) {
+        printf("Error: Checkpoint '%s' not found for file '%s'\n", checkpoint_tag, filename);
+    } else if (strstr(buffer, "ERR_409")) {
+        printf("Error: Cannot revert - file is currently being edited by another user.\n");
+    }
+    ss_pool_release(&payload, ss_sock, 1);
 }
 
 /**
  * @brief Handler for LISTCHECKPOINTS command - lists all checkpoints for a file
  */
 void handle_listcheckpoints_command(const char* filename) {
-    // Get redirect to storage server
-    MessageHeader header;
-    memset(&header, 0, sizeof(header));
-    header.msg_type = MSG_READ;
-    header.source_component = COMPONENT_CLIENT;
-    strncpy(header.filename, filename, MAX_FILENAME - 1);
-
-    if (send_header(g_ns_socket, &header) == -1) {
-        write_log("ERROR", "Connection to NS lost.");
-        return;
-    }
+    char read_buffer[BUF_SZ];
+    snprintf(read_buffer, BUF_SZ, "LISTCHECKPOINTS %s\n", filename);
 
-    MessageHeader resp_header;
-    if (recv_header(g_ns_socket, &resp_header) == -1) {
-        write_log("ERROR", "Connection to NS lost.");
-        return;
-    }
-    
-    if (resp_header.msg_type == MSG_ERROR) {
-        printf("Error: %s\n", resp_header.filename);
-        return;
-    }
-    if (resp_header.msg_type != MSG_READ_REDIRECT) {
-        printf("Error: Name Server sent unexpected response.\n");
-        return;
-    }
-    
     SSReadPayload payload;
-    if (recv_all(g_ns_socket, &payload, sizeof(payload)) == -1) {
-        write_log("ERROR", "Failed to receive redirect payload.");
-        return;
-    }
-    
-    // Connect to Storage Server
-    int ss_sock = create_socket();
-    if (connect_socket_no_exit(ss_sock, payload.ip_addr, payload.port) == -1) {
-        printf("Error: Could not connect to Storage Server at %s:%d.\n", payload.ip_addr, payload.port);
-        close(ss_sock);
-        handle_ss_dead_report(&payload);
-        return;
-    }
-    
-    // Send USER handshake
-    char buffer[BUF_SZ];
-    snprintf(buffer, BUF_SZ, "USER %s\n", g_username);
-    send(ss_sock, buffer, strlen(buffer), 0);
-    recv(ss_sock, buffer, BUF_SZ - 1, 0);
-    
-    // Send LISTCHECKPOINTS command
-    snprintf(buffer, BUF_SZ, "LISTCHECKPOINTS %s\n", filename);
-    send(ss_sock, buffer, strlen(buffer), 0);
+    ssize_t n;
+    int ss_sock = ss_begin_command(MSG_LOCATE_FILE, filename, read_buffer, &payload, read_buffer, BUF_SZ, &n);
+    if (ss_sock == -1) return;
     
     // Receive and display response
     printf("--- Checkpoints for %s ---\n", filename);
     
-    char read_buffer[BUF_SZ];
     int first_packet = 1;
-    while (1) {
-        ssize_t n = recv(ss_sock, read_buffer, BUF_SZ - 1, 0);
-        if (n <= 0) break;
-        read_buffer[n] = '\0';
+    int reusable = 0;
+    for (;; first_packet = 0) {
+        if (!first_packet) {
+            n = recv(ss_sock, read_buffer, BUF_SZ - 1, 0);
+            if (n <= 0) break;
+            read_buffer[n] = '\0';
+        }
 
         char* content_to_print = read_buffer;
 
@@ -1199,7 +1190,6 @@ void handle_listcheckpoints_command(const char* filename) {
             if (start_ptr) {
                 content_to_print = start_ptr + strlen("OK_200 CHECKPOINT_LIST\n");
             }
-            first_packet = 0;
         }
 
         // Handle end of list
@@ -1207,6 +1197,7 @@ void handle_listcheckpoints_command(const char* filename) {
         if (end_ptr) {
             *end_ptr = '\0';
             printf("%s", content_to_print);
+            reusable = 1;
             break;
         }
 
@@ -1214,10 +1205,7 @@ void handle_listcheckpoints_command(const char* filename) {
     }
     
     printf("--- End of List ---\n");
-    
-    // Send EXIT and close
-    send(ss_sock, "EXIT\n", 5, 0);
-    close(ss_sock);
+    ss_pool_release(&payload, ss_sock, reusable);
 }
 
 /**
@@ -1226,100 +1214,33 @@ void handle_listcheckpoints_command(const char* filename) {
 void handle_requestaccess_command(const char* filename, const char* permission) {
     write_log("INFO", "Requesting %s access to file: %s", permission, filename);
     
-    // Use MSG_LOCATE_FILE to find the storage server without access restrictions
-    MessageHeader header;
-    memset(&header, 0, sizeof(header));
-    header.msg_type = MSG_LOCATE_FILE;  // Use new message type
-    header.source_component = COMPONENT_CLIENT;
-    strncpy(header.filename, filename, MAX_FILENAME - 1);
-    
-    if (send_header(g_ns_socket, &header) == -1) {
-        printf("Error: Connection to Name Server lost.\n");
-        return;
-    }
-    
-    MessageHeader resp_header;
-    if (recv_header(g_ns_socket, &resp_header) == -1) {
-        printf("Error: Connection to Name Server lost.\n");
-        return;
-    }
-    
-    if (resp_header.msg_type == MSG_LOCATE_RESPONSE) {
-        SSReadPayload payload;  // Reuse existing payload structure
-        if (recv_all(g_ns_socket, &payload, sizeof(payload)) == -1) {
-            printf("Error: Failed to receive storage server info.\n");
-            return;
-        }
-        
-        // Connect to storage server using location info
-        int ss_socket = create_socket();
-        if (connect_socket_no_exit(ss_socket, payload.ip_addr, payload.port) == -1) {
-            printf("Error: Could not connect to storage server at %s:%d.\n", payload.ip_addr, payload.port);
-            close(ss_socket);
-            return;
-        }
-        
-        // Send user identification
-        char user_msg[256];
-        snprintf(user_msg, sizeof(user_msg), "USER %s\n", g_username);
-        send(ss_socket, user_msg, strlen(user_msg), 0);
-        
-        // Wait for user acceptance
-        char ack_buf[256];
-        ssize_t ack_received = recv(ss_socket, ack_buf, sizeof(ack_buf) - 1, 0);
-        if (ack_received <= 0) {
-            printf("Error: Storage server connection failed.\n");
-            close(ss_socket);
-            return;
-        }
-        ack_buf[ack_received] = '\0';
-        
-        if (strncmp(ack_buf, "OK_200", 6) != 0) {
-            printf("Error: Storage server rejected connection: %s", ack_buf);
-            close(ss_socket);
-            return;
-        }
-        
-        // Send requestaccess command
-        char request_cmd[512];
-        snprintf(request_cmd, sizeof(request_cmd), "REQUESTACCESS %s %s\n", filename, permission);
-        send(ss_socket, request_cmd, strlen(request_cmd), 0);
-        
-        // Receive response
-        char response[1024];
-        ssize_t bytes_received = recv(ss_socket, response, sizeof(response) - 1, 0);
-        if (bytes_received > 0) {
-            response[bytes_received] = '\0';
-            
-            if (strncmp(response, "OK_200", 6) == 0) {
-                printf("Access request submitted successfully.\n");
-                write_log("INFO", "Access request submitted: %s for %s access to %s", g_username, permission, filename);
-            } else if (strncmp(response, "ERR_400", 7) == 0) {
-                char* error_msg = strchr(response, ' ');
-                if (error_msg) error_msg++;
-                printf("Error: %s", error_msg ? error_msg : "Invalid request\n");
-            } else if (strncmp(response, "ERR_404", 7) == 0) {
-                printf("Error: File not found.\n");
-            } else if (strncmp(response, "ERR_409", 7) == 0) {
-                char* error_msg = strchr(response, ' ');
-                if (error_msg) error_msg++;
-                printf("Error: %s", error_msg ? error_msg : "Request already exists or you already have access\n");
-            } else {
-                printf("Error: %s", response);
-            }
-        } else {
-            printf("Error: No response from storage server.\n");
-        }
-        
-        // Send EXIT and close
-        send(ss_socket, "EXIT\n", 5, 0);
-        close(ss_socket);
-    } else if (resp_header.msg_type == MSG_ERROR) {
-        printf("Error: %s\n", resp_header.filename);
+    // MSG_LOCATE_FILE finds the storage server without access restrictions
+    char response[1024];
+    snprintf(response, sizeof(response), "REQUESTACCESS %s %s\n", filename, permission);
+
+    SSReadPayload payload;
+    ssize_t bytes_received;
+    int ss_socket = ss_begin_command(MSG_LOCATE_FILE, filename, response, &payload,
+                                     response, sizeof(response), &bytes_received);
+    if (ss_socket == -1) return;
+
+    if (strncmp(response, "OK_200", 6) == 0) {
+        printf("Access request submitted successfully.\n");
+        write_log("INFO", "Access request submitted: %s for %s access to %s", g_username, permission, filename);
+    } else if (strncmp(response, "ERR_400", 7) == 0) {
+        char* error_msg = strchr(response, ' ');
+        if (error_msg) error_msg++;
+        printf("Error: %s", error_msg ? error_msg : "Invalid request\n");
+    } else if (strncmp(response, "ERR_404", 7) == 0) {
+        printf("Error: File not found.\n");
+    } else if (strncmp(response, "ERR_409", 7) == 0) {
+        char* error_msg = strchr(response, ' ');
+        if (error_msg) error_msg++;
+        printf("Error: %s", error_msg ? error_msg : "Request already exists or you already have access\n");
     } else {
-        printf("Error: File not found in any storage server.\n");
-        write_log("ERROR", "REQUESTACCESS failed: File %s not found in any storage server", filename);
+        printf("Error: %s", response);
     }
+    ss_pool_release(&payload, ss_socket, 1);
 }
 
 /**
@@ -1334,114 +1255,59 @@ void handle_viewrequests_command(const char* filename) {
         return;
     }
     
-    // Use MSG_LOCATE_FILE to find the storage server
-    MessageHeader header;
-    memset(&header, 0, sizeof(header));
-    header.msg_type = MSG_LOCATE_FILE;
-    header.source_component = COMPONENT_CLIENT;
-    strncpy(header.filename, filename, MAX_FILENAME - 1);
-    
-    if (send_header(g_ns_socket, &header) == -1) {
-        printf("Error: Connection to Name Server lost.\n");
-        return;
-    }
-    
-    MessageHeader resp_header;
-    if (recv_header(g_ns_socket, &resp_header) == -1) {
-        printf("Error: Connection to Name Server lost.\n");
-        return;
-    }
-    
-    if (resp_header.msg_type == MSG_LOCATE_RESPONSE) {
-        SSReadPayload payload;
-        if (recv_all(g_ns_socket, &payload, sizeof(payload)) == -1) {
-            printf("Error: Failed to receive storage server info.\n");
-            return;
-        }
-        
-        // Connect to storage server
-        int ss_socket = create_socket();
-        if (connect_socket_no_exit(ss_socket, payload.ip_addr, payload.port) == -1) {
-            printf("Error: Could not connect to storage server at %s:%d.\n", payload.ip_addr, payload.port);
-            close(ss_socket);
-            return;
-        }
-        
-        // Send user identification
-        char user_msg[256];
-        snprintf(user_msg, sizeof(user_msg), "USER %s\n", g_username);
-        send(ss_socket, user_msg, strlen(user_msg), 0);
-        
-        // Wait for user acceptance
-        char ack_buf[256];
-        ssize_t ack_received = recv(ss_socket, ack_buf, sizeof(ack_buf) - 1, 0);
-        if (ack_received <= 0) {
-            printf("Error: Storage server connection failed.\n");
-            close(ss_socket);
-            return;
-        }
-        ack_buf[ack_received] = '\0';
+    // MSG_LOCATE_FILE finds the storage server without access restrictions
+    char response[1024];
+    snprintf(response, sizeof(response), "VIEWREQUESTS %s\n", filename);
+
+    SSReadPayload payload;
+    ssize_t bytes_received;
+    int ss_socket = ss_begin_command(MSG_LOCATE_FILE, filename, response, &payload,
+                                     response, sizeof(response), &bytes_received);
+    if (ss_socket == -1) return;
+
+    int reusable = 1;
+    if (strncmp(response, "OK_200", 6) == 0) {
+        printf("\n--- Access Requests ---\n");
         
-        // Send viewrequests command
-        char view_cmd[512];
-        snprintf(view_cmd, sizeof(view_cmd), "VIEWREQUESTS %s\n", filename);
-        send(ss_socket, view_cmd, strlen(view_cmd), 0);
+        // Continue reading the content until we see END_OF_REQUESTS
+        char content_buffer[8192] = "";
+        ssize_t total_received = 0;
+        reusable = 0;
         
-        // Receive and process response
-        char response[1024];
-        ssize_t bytes_received = recv(ss_socket, response, sizeof(response) - 1, 0);
-        if (bytes_received > 0) {
-            response[bytes_received] = '\0';
+        while (total_received < sizeof(content_buffer) - 1) {
+            char chunk[1024];
+            ssize_t chunk_received = recv(ss_socket, chunk, sizeof(chunk) - 1, 0);
+            if (chunk_received <= 0) break;
             
-            if (strncmp(response, "OK_200", 6) == 0) {
-                printf("\n--- Access Requests ---\n");
-                
-                // Continue reading the content until we see END_OF_REQUESTS
-                char content_buffer[8192] = "";
-                ssize_t total_received = 0;
-                
-                while (total_received < sizeof(content_buffer) - 1) {
-                    char chunk[1024];
-                    ssize_t chunk_received = recv(ss_socket, chunk, sizeof(chunk) - 1, 0);
-                    if (chunk_received <= 0) break;
-                    
-                    chunk[chunk_received] = '\0';
-                    
-                    // Append to content buffer
-                    if (total_received + chunk_received < sizeof(content_buffer) - 1) {
-                        strcat(content_buffer, chunk);
-                        total_received += chunk_received;
-                    }
-                    
-                    // Check for end marker
-                    if (strstr(content_buffer, "END_OF_REQUESTS")) {
-                        break;
-                    }
-                }
-                
-                // Remove end marker from output
-                char* end_marker = strstr(content_buffer, "\nEND_OF_REQUESTS");
-                if (end_marker) {
-                    *end_marker = '\0';
-                }
-                
-                printf("%s\n", content_buffer);
-                printf("--- End of Requests ---\n");
-            } else if (strncmp(response, "ERR_403", 7) == 0) {
-                printf("Error: You can only view requests for files you own.\n");
-            } else {
-                printf("Error: %s", response);
+            chunk[chunk_received] = '\0';
+            
+            // Append to content buffer
+            if (total_received + chunk_received < sizeof(content_buffer) - 1) {
+                strcat(content_buffer, chunk);
+                total_received += chunk_received;
+            }
+            
+            // Check for end marker
+            if (strstr(content_buffer, "END_OF_REQUESTS")) {
+                reusable = 1;
+                break;
             }
-        } else {
-            printf("Error: No response from storage server.\n");
         }
         
-        // Send EXIT and close
-        send(ss_socket, "EXIT\n", 5, 0);
-        close(ss_socket);
+        // Remove end marker from output
+        char* end_marker = strstr(content_buffer, "\nEND_OF_REQUESTS");
+        if (end_marker) {
+            *end_marker = '\0';
+        }
+        
+        printf("%s\n", content_buffer);
+        printf("--- End of Requests ---\n");
+    } else if (strncmp(response, "ERR_403", 7) == 0) {
+        printf("Error: You can only view requests for files you own.\n");
     } else {
-        printf("Error: File not found in any storage server.\n");
+        printf("Error: %s", response);
     }
+    ss_pool_release(&payload, ss_socket, reusable);
 }
 
 /**
@@ -1450,86 +1316,28 @@ void handle_viewrequests_command(const char* filename) {
 void handle_approverequest_command(const char* filename, const char* username, const char* permission) {
     write_log("INFO", "Approving %s access for user %s on file: %s", permission, username, filename);
     
-    // Use MSG_LOCATE_FILE to find the storage server
-    MessageHeader header;
-    memset(&header, 0, sizeof(header));
-    header.msg_type = MSG_LOCATE_FILE;
-    header.source_component = COMPONENT_CLIENT;
-    strncpy(header.filename, filename, MAX_FILENAME - 1);
-    
-    if (send_header(g_ns_socket, &header) == -1) {
-        printf("Error: Connection to Name Server lost.\n");
-        return;
-    }
-    
-    MessageHeader resp_header;
-    if (recv_header(g_ns_socket, &resp_header) == -1) {
-        printf("Error: Connection to Name Server lost.\n");
-        return;
-    }
-    
-    if (resp_header.msg_type == MSG_LOCATE_RESPONSE) {
-        SSReadPayload payload;
-        if (recv_all(g_ns_socket, &payload, sizeof(payload)) == -1) {
-            printf("Error: Failed to receive storage server info.\n");
-            return;
-        }
-        
-        // Connect to storage server
-        int ss_socket = create_socket();
-        if (connect_socket_no_exit(ss_socket, payload.ip_addr, payload.port) == -1) {
-            printf("Error: Could not connect to storage server at %s:%d.\n", payload.ip_addr, payload.port);
-            close(ss_socket);
-            return;
-        }
-        
-        // Send user identification
-        char user_msg[256];
-        snprintf(user_msg, sizeof(user_msg), "USER %s\n", g_username);
-        send(ss_socket, user_msg, strlen(user_msg), 0);
-        
-        // Wait for user acceptance
-        char ack_buf[256];
-        ssize_t ack_received = recv(ss_socket, ack_buf, sizeof(ack_buf) - 1, 0);
-        if (ack_received <= 0) {
-            printf("Error: Storage server connection failed.\n");
-            close(ss_socket);
-            return;
-        }
-        ack_buf[ack_received] = '\0';
-        
-        // Send approve command
-        char approve_cmd[512];
-        snprintf(approve_cmd, sizeof(approve_cmd), "APPROVEREQUEST %s %s %s\n", filename, username, permission);
-        send(ss_socket, approve_cmd, strlen(approve_cmd), 0);
-        
-        // Receive response
-        char response[1024];
-        ssize_t bytes_received = recv(ss_socket, response, sizeof(response) - 1, 0);
-        if (bytes_received > 0) {
-            response[bytes_received] = '\0';
-            
-            if (strncmp(response, "OK_200", 6) == 0) {
-                printf("Access request approved successfully.\n");
-                write_log("INFO", "Access request approved: %s granted %s access to %s", username, permission, filename);
-            } else if (strncmp(response, "ERR_403", 7) == 0) {
-                printf("Error: You don't own this file.\n");
-            } else if (strncmp(response, "ERR_404", 7) == 0) {
-                printf("Error: Access request not found.\n");
-            } else {
-                char* error_msg = response + 8; // Skip error code
-                printf("Error: %s", error_msg);
-            }
-        } else {
-            printf("Error: No response from storage server.\n");
-        }
-        
-        // Send EXIT and close
-        send(ss_socket, "EXIT\n", 5, 0);
-        close(ss_socket);
+    // MSG_LOCATE_FILE finds the storage server without access restrictions
+    char response[1024];
+    snprintf(response, sizeof(response), "APPROVEREQUEST %s %s %s\n", filename, username, permission);
+
+    SSReadPayload payload;
+    ssize_t bytes_received;
+    int ss_socket = ss_begin_command(MSG_LOCATE_FILE, filename, response, &payload,
+                                     response, sizeof(response), &bytes_received);
+    if (ss_socket == -1) return;
+
+    if (strncmp(response, "OK_200", 6) == 0) {
+        printf("Access request approved successfully.\n");
+        write_log("INFO", "Access request approved: %s granted %s access to %s", username, permission, filename);
+    } else if (strncmp(response, "ERR_403", 7) == 0) {
+        printf("Error: You don't own this file.\n");
+    } else if (strncmp(response, "ERR_404", 7) == 0) {
+        printf("Error: Access request not found.\n");
     } else {
-        printf("Error: File not found in any storage server.\n");
+        char* error_msg = response + 8; // Skip error code
+        printf("Error: %s", error_msg);
     }
+    ss_pool_release(&payload, ss_socket, 1);
 }
 
 /**
@@ -1538,84 +1346,26 @@ void handle_approverequest_command(const char* filename, const char* username, c
 void handle_denyrequest_command(const char* filename, const char* username) {
     write_log("INFO", "Denying access request for user %s on file: %s", username, filename);
     
-    // Use MSG_LOCATE_FILE to find the storage server
-    MessageHeader header;
-    memset(&header, 0, sizeof(header));
-    header.msg_type = MSG_LOCATE_FILE;
-    header.source_component = COMPONENT_CLIENT;
-    strncpy(header.filename, filename, MAX_FILENAME - 1);
-    
-    if (send_header(g_ns_socket, &header) == -1) {
-        printf("Error: Connection to Name Server lost.\n");
-        return;
-    }
-    
-    MessageHeader resp_header;
-    if (recv_header(g_ns_socket, &resp_header) == -1) {
-        printf("Error: Connection to Name Server lost.\n");
-        return;
-    }
-    
-    if (resp_header.msg_type == MSG_LOCATE_RESPONSE) {
-        SSReadPayload payload;
-        if (recv_all(g_ns_socket, &payload, sizeof(payload)) == -1) {
-            printf("Error: Failed to receive storage server info.\n");
-            return;
-        }
-        
-        // Connect to storage server
-        int ss_socket = create_socket();
-        if (connect_socket_no_exit(ss_socket, payload.ip_addr, payload.port) == -1) {
-            printf("Error: Could not connect to storage server at %s:%d.\n", payload.ip_addr, payload.port);
-            close(ss_socket);
-            return;
-        }
-        
-        // Send user identification
-        char user_msg[256];
-        snprintf(user_msg, sizeof(user_msg), "USER %s\n", g_username);
-        send(ss_socket, user_msg, strlen(user_msg), 0);
-        
-        // Wait for user acceptance
-        char ack_buf[256];
-        ssize_t ack_received = recv(ss_socket, ack_buf, sizeof(ack_buf) - 1, 0);
-        if (ack_received <= 0) {
-            printf("Error: Storage server connection failed.\n");
-            close(ss_socket);
-            return;
-        }
-        ack_buf[ack_received] = '\0';
-        
-        // Send deny command
-        char deny_cmd[512];
-        snprintf(deny_cmd, sizeof(deny_cmd), "DENYREQUEST %s %s\n", filename, username);
-        send(ss_socket, deny_cmd, strlen(deny_cmd), 0);
-        
-        // Receive response
-        char response[1024];
-        ssize_t bytes_received = recv(ss_socket, response, sizeof(response) - 1, 0);
-        if (bytes_received > 0) {
-            response[bytes_received] = '\0';
-            
-            if (strncmp(response, "OK_200", 6) == 0) {
-                printf("Access request denied successfully.\n");
-                write_log("INFO", "Access request denied: %s denied access to %s", username, filename);
-            } else if (strncmp(response, "ERR_403", 7) == 0) {
-                printf("Error: You don't own this file.\n");
-            } else if (strncmp(response, "ERR_404", 7) == 0) {
-                printf("Error: Access request not found.\n");
-            } else {
-                char* error_msg = response + 8; // Skip error code
-                printf("Error: %s", error_msg);
-            }
-        } else {
-            printf("Error: No response from storage server.\n");
-        }
-        
-        // Send EXIT and close
-        send(ss_socket, "EXIT\n", 5, 0);
-        close(ss_socket);
+    // MSG_LOCATE_FILE finds the storage server without access restrictions
+    char response[1024];
+    snprintf(response, sizeof(response), "DENYREQUEST %s %s\n", filename, username);
+
+    SSReadPayload payload;
+    ssize_t bytes_received;
+    int ss_socket = ss_begin_command(MSG_LOCATE_FILE, filename, response, &payload,
+                                     response, sizeof(response), &bytes_received);
+    if (ss_socket == -1) return;
+
+    if (strncmp(response, "OK_200", 6) == 0) {
+        printf("Access request denied successfully.\n");
+        write_log("INFO", "Access request denied: %s denied access to %s", username, filename);
+    } else if (strncmp(response, "ERR_403", 7) == 0) {
+        printf("Error: You don't own this file.\n");
+    } else if (strncmp(response, "ERR_404", 7) == 0) {
+        printf("Error: Access request not found.\n");
     } else {
-        printf("Error: File not found in any storage server.\n");
+        char* error_msg = response + 8; // Skip error code
+        printf("Error: %s", error_msg);
     }
-}
\ No newline at end of file
+    ss_pool_release(&payload, ss_socket, 1);
+}
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "../../include/ss_pool.h"
+#include "../../include/logger.h"
+#include "../../include/socket_utils.h"
+#include "../../include/hash.h"
+
+typedef struct {
+    int fd;             // -1 = free slot
+    char ip_addr[64];
+    int port;
+    time_t parked;
+} idle_session_t;
+
+typedef struct {
+    char filename[MAX_FILENAME];  // "" = empty slot
+    SSReadPayload ss;
+    time_t stored;
+} redirect_entry_t;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static idle_session_t idle[SS_POOL_MAX_IDLE]; // Slots are marked free in ss_pool_init()
+static redirect_entry_t redirects[REDIRECT_CACHE_ENTRIES];
+static char pool_username[64] = "N/A";
+
+static int same_server(const char* ip_addr, int port, const SSReadPayload* ss) {
+    return port == ss->port && strcmp(ip_addr, ss->ip_addr) == 0;
+}
+
+/**
+ * @brief Whether a parked session is still usable: the SS has neither
+ * closed it (idle timeout, restart) nor sent anything unasked.
+ */
+static int session_alive(int fd) {
+    char probe;
+    ssize_t n = recv(fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+static int user_handshake(int fd) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "USER %s\n", pool_username);
+    if (send(fd, buffer, strlen(buffer), 0) == -1) return SS_POOL_CONNECT_FAILED;
+
+    ssize_t n = recv(fd, buffer, sizeof(buffer) - 1, 0);
+    if (n <= 0) return SS_POOL_CONNECT_FAILED;
+    buffer[n] = '\0';
+    if (strncmp(buffer, "ERR_503", 7) == 0) return SS_POOL_BUSY;
+    if (strncmp(buffer, "OK_200", 6) != 0) {
+        write_log("ERROR", "Storage server rejected USER handshake: %s", buffer);
+        return SS_POOL_REJECTED;
+    }
+    return 0;
+}
+
+// =========================================================================
+//  SESSION POOL
+// =========================================================================
+
+void ss_pool_init(const char* username) {
+    pthread_mutex_lock(&pool_lock);
+    strncpy(pool_username, username, sizeof(pool_username) - 1);
+    for (int i = 0; i < SS_POOL_MAX_IDLE; i++) idle[i].fd = -1;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+int ss_pool_acquire(const SSReadPayload* ss, int* reused) {
+    time_t now = time(NULL);
+    int fd = -1;
+
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < SS_POOL_MAX_IDLE && fd == -1; i++) {
+        if (idle[i].fd == -1 || !same_server(idle[i].ip_addr, idle[i].port, ss)) continue;
+        int candidate = idle[i].fd;
+        int fresh = now - idle[i].parked <= SS_POOL_IDLE_SEC;
+        idle[i].fd = -1;
+        if (fresh && session_alive(candidate)) {
+            fd = candidate;
+        } else {
+            close(candidate);
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (fd != -1) {
+        if (reused) *reused = 1;
+        return fd;
+    }
+
+    fd = create_socket();
+    if (connect_socket_no_exit(fd, ss->ip_addr, ss->port) == -1) {
+        close(fd);
+        return SS_POOL_CONNECT_FAILED;
+    }
+    int rc = user_handshake(fd);
+    if (rc != 0) {
+        close(fd);
+        return rc;
+    }
+    if (reused) *reused = 0;
+    return fd;
+}
+
+void ss_pool_release(const SSReadPayload* ss, int fd, int reusable) {
+    if (fd < 0) return;
+    if (reusable) {
+        time_t now = time(NULL);
+        int slot = -1;
+        pthread_mutex_lock(&pool_lock);
+        for (int i = 0; i < SS_POOL_MAX_IDLE; i++) {
+            if (idle[i].fd == -1) { slot = i; break; }
+            if (slot == -1 || idle[i].parked < idle[slot].parked) slot = i; // Oldest makes room
+        }
+        int evicted = idle[slot].fd;
+        idle[slot].fd = fd;
+        strncpy(idle[slot].ip_addr, ss->ip_addr, sizeof(idle[slot].ip_addr) - 1);
+        idle[slot].ip_addr[sizeof(idle[slot].ip_addr) - 1] = '\0';
+        idle[slot].port = ss->port;
+        idle[slot].parked = now;
+        pthread_mutex_unlock(&pool_lock);
+        if (evicted == -1) return;
+        fd = evicted;
+    }
+    send(fd, "EXIT\n", 5, MSG_NOSIGNAL);
+    close(fd);
+}
+
+void ss_pool_close_all(void) {
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < SS_POOL_MAX_IDLE; i++) {
+        if (idle[i].fd == -1) continue;
+        send(idle[i].fd, "EXIT\n", 5, MSG_NOSIGNAL);
+        close(idle[i].fd);
+        idle[i].fd = -1;
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// =========================================================================
+//  REDIRECT CACHE
+// =========================================================================
+
+static redirect_entry_t* redirect_slot(const char* filename) {
+    return &redirects[fnv1a_hash(filename) % REDIRECT_CACHE_ENTRIES];
+}
+
+int redirect_cache_lookup(const char* filename, SSReadPayload* out) {
+    int hit = 0;
+    pthread_mutex_lock(&pool_lock);
+    redirect_entry_t* entry = redirect_slot(filename);
+    if (strcmp(entry->filename, filename) == 0) {
+        if (time(NULL) - entry->stored <= REDIRECT_CACHE_TTL_SEC) {
+            *out = entry->ss;
+            hit = 1;
+        } else {
+            entry->filename[0] = '\0';
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return hit;
+}
+
+void redirect_cache_store(const char* filename, const SSReadPayload* ss) {
+    if (filename == NULL || filename[0] == '\0') return;
+    pthread_mutex_lock(&pool_lock);
+    redirect_entry_t* entry = redirect_slot(filename);
+    strncpy(entry->filename, filename, MAX_FILENAME - 1);
+    entry->filename[MAX_FILENAME - 1] = '\0';
+    entry->ss = *ss;
+    entry->stored = time(NULL);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void redirect_cache_invalidate(const char* filename) {
+    pthread_mutex_lock(&pool_lock);
+    redirect_entry_t* entry = redirect_slot(filename);
+    if (strcmp(entry->filename, filename) == 0) entry->filename[0] = '\0';
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void redirect_cache_invalidate_server(const SSReadPayload* ss) {
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < REDIRECT_CACHE_ENTRIES; i++) {
+        if (redirects[i].filename[0] != '\0' && same_server(redirects[i].ss.ip_addr, redirects[i].ss.port, ss)) {
+            redirects[i].filename[0] = '\0';
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
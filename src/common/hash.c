@@ -0,0 +1,20 @@
+#include "hash.h"
+
+uint32_t fnv1a_hash(const char* str) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char* p = (const unsigned char*)str; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+uint64_t fnv1a_hash64(const void* data, size_t length) {
+    uint64_t hash = 14695981039346656037ull;
+    const unsigned char* p = data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
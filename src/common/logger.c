@@ -2,17 +2,52 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <time.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
 #include <arpa/inet.h>
 
+// Each logging thread owns a ring of length-prefixed lines. The thread
+// only ever advances 'head' and the writer thread only 'tail', so neither
+// side takes a lock on the hot path.
+#define RING_ACTIVE 0
+#define RING_EXITED 1  // Owner thread gone; reusable once drained
+#define RING_FREE   2
+
+#define RECORD_LOCAL_ONLY 0x80000000u
+
+typedef struct log_ring {
+    char data[LOG_RING_BYTES];
+    _Atomic uint64_t head;     // Bytes ever written (owner thread)
+    _Atomic uint64_t tail;     // Bytes ever consumed (writer thread)
+    _Atomic int state;
+    struct log_ring *next;
+} log_ring_t;
+
 static FILE *global_log = NULL;
 static FILE *local_log = NULL;
 static char logger_ip[64] = "0.0.0.0";
 static int logger_port = 0;
-static char logger_username[64] = "N/A";
+
+static pthread_mutex_t ring_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static log_ring_t *ring_list = NULL;
+static pthread_key_t ring_key;
+static pthread_t writer_tid;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_wake = PTHREAD_COND_INITIALIZER;
+static atomic_int logger_running = 0;
+static atomic_int min_level = LOG_LEVEL_DEBUG;
+
+static __thread log_ring_t *thread_ring = NULL;
+static __thread char thread_username[64] = "N/A";
+static __thread time_t cached_second = (time_t)-1;
+static __thread char cached_time[32];
 
 // Helper to ensure directories exist
 static void ensure_directory_exists(const char *path) {
@@ -25,6 +60,179 @@ static void ensure_directory_exists(const char *path) {
     }
 }
 
+// =========================================================================
+//  WRITER THREAD
+// =========================================================================
+
+static void ring_read(const log_ring_t *ring, uint64_t pos, void *out, size_t length) {
+    size_t at = (size_t)(pos & (LOG_RING_BYTES - 1));
+    size_t first = LOG_RING_BYTES - at < length ? LOG_RING_BYTES - at : length;
+    memcpy(out, ring->data + at, first);
+    memcpy((char *)out + first, ring->data, length - first);
+}
+
+/**
+ * @brief Writes out everything queued in every ring.
+ * @return Number of lines written.
+ */
+static int drain_rings(void) {
+    char line[LOG_LINE_MAX];
+    int written = 0;
+
+    pthread_mutex_lock(&ring_list_lock);
+    for (log_ring_t *ring = ring_list; ring; ring = ring->next) {
+        uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        while (tail < head) {
+            uint32_t record;
+            ring_read(ring, tail, &record, sizeof(record));
+            size_t length = record & ~RECORD_LOCAL_ONLY;
+            ring_read(ring, tail + sizeof(record), line, length);
+            tail += sizeof(record) + length;
+
+            if (local_log) fwrite(line, 1, length, local_log);
+            if (global_log && !(record & RECORD_LOCAL_ONLY)) fwrite(line, 1, length, global_log);
+            written++;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+        int exited = RING_EXITED;
+        if (tail == atomic_load_explicit(&ring->head, memory_order_acquire)) {
+            atomic_compare_exchange_strong(&ring->state, &exited, RING_FREE);
+        }
+    }
+    pthread_mutex_unlock(&ring_list_lock);
+
+    if (written) {
+        if (global_log) fflush(global_log);
+        if (local_log) fflush(local_log);
+    }
+    return written;
+}
+
+static void *log_writer_thread(void *arg) {
+    (void)arg;
+    while (atomic_load(&logger_running)) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += LOG_FLUSH_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&writer_lock);
+        if (atomic_load(&logger_running)) pthread_cond_timedwait(&writer_wake, &writer_lock, &deadline);
+        pthread_mutex_unlock(&writer_lock);
+        drain_rings();
+    }
+    return NULL;
+}
+
+static void wake_writer(void) {
+    pthread_cond_signal(&writer_wake);
+}
+
+// =========================================================================
+//  PRODUCER SIDE
+// =========================================================================
+
+static void release_thread_ring(void *ring) {
+    atomic_store(&((log_ring_t *)ring)->state, RING_EXITED);
+}
+
+/**
+ * @brief Returns the calling thread's ring, adopting a drained one left by
+ * an exited thread before allocating a new one.
+ */
+static log_ring_t *get_thread_ring(void) {
+    if (thread_ring) return thread_ring;
+
+    pthread_mutex_lock(&ring_list_lock);
+    log_ring_t *ring = ring_list;
+    for (; ring; ring = ring->next) {
+        int free_state = RING_FREE;
+        if (atomic_compare_exchange_strong(&ring->state, &free_state, RING_ACTIVE)) break;
+    }
+    if (ring == NULL && (ring = calloc(1, sizeof(*ring))) != NULL) {
+        ring->next = ring_list;
+        ring_list = ring;
+    }
+    pthread_mutex_unlock(&ring_list_lock);
+
+    if (ring) pthread_setspecific(ring_key, ring);
+    thread_ring = ring;
+    return ring;
+}
+
+/**
+ * @brief Maps a level tag to its severity. Unknown tags (component names
+ * such as "SEARCH_MGR") count as INFO.
+ */
+static log_level_t level_rank(const char *level) {
+    if (strcmp(level, "DEBUG") == 0 || strcmp(level, "CACHE") == 0 || strcmp(level, "SEARCH") == 0)
+        return LOG_LEVEL_DEBUG;
+    if (strcmp(level, "WARN") == 0)
+        return LOG_LEVEL_WARN;
+    if (strcmp(level, "ERROR") == 0 || strcmp(level, "FATAL") == 0)
+        return LOG_LEVEL_ERROR;
+    return LOG_LEVEL_INFO;
+}
+
+static void enqueue_line(const char *level, int local_only, const char *format, va_list args) {
+    if (!atomic_load_explicit(&logger_running, memory_order_relaxed)) return;
+    log_level_t rank = level_rank(level);
+    if ((int)rank < atomic_load_explicit(&min_level, memory_order_relaxed)) return;
+
+    time_t now = time(NULL);
+    if (now != cached_second) {
+        struct tm tm_now;
+        localtime_r(&now, &tm_now);
+        strftime(cached_time, sizeof(cached_time), "%Y-%m-%d %H:%M:%S", &tm_now);
+        cached_second = now;
+    }
+
+    char line[LOG_LINE_MAX];
+    int n = snprintf(line, sizeof(line), "[%s] [%s:%d] [USER=%s] [%s] ",
+                     cached_time, logger_ip, logger_port, thread_username, level);
+    if (n < 0) return;
+    if (n < (int)sizeof(line) - 1) {
+        int m = vsnprintf(line + n, sizeof(line) - 1 - n, format, args);
+        if (m > 0) n += m;
+    }
+    if (n > (int)sizeof(line) - 2) n = sizeof(line) - 2; // Truncated; keep the newline
+    line[n++] = '\n';
+
+    log_ring_t *ring = get_thread_ring();
+    if (ring == NULL) return;
+
+    uint32_t record = (uint32_t)n | (local_only ? RECORD_LOCAL_ONLY : 0);
+    size_t needed = sizeof(record) + (size_t)n;
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (LOG_RING_BYTES - (head - atomic_load_explicit(&ring->tail, memory_order_acquire)) < needed) {
+        // Full: rather than drop lines, wait for the writer to catch up
+        if (!atomic_load(&logger_running)) return;
+        wake_writer();
+        usleep(1000);
+    }
+
+    size_t at = (size_t)(head & (LOG_RING_BYTES - 1));
+    char staged[sizeof(record) + LOG_LINE_MAX];
+    memcpy(staged, &record, sizeof(record));
+    memcpy(staged + sizeof(record), line, (size_t)n);
+    size_t first = LOG_RING_BYTES - at < needed ? LOG_RING_BYTES - at : needed;
+    memcpy(ring->data + at, staged, first);
+    memcpy(ring->data, staged + first, needed - first);
+
+    uint64_t used = head + needed - atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + needed, memory_order_release);
+    // Warnings and errors go out promptly in case the process is about to die
+    if (used > LOG_RING_BYTES / 2 || rank >= LOG_LEVEL_WARN) wake_writer();
+}
+
+// =========================================================================
+//  PUBLIC API
+// =========================================================================
+
 // Initialize both global and local loggers
 void init_logger(const char *ip, int port) {
     strncpy(logger_ip, ip, sizeof(logger_ip) - 1);
@@ -59,80 +267,67 @@ void init_logger(const char *ip, int port) {
         exit(EXIT_FAILURE);
     }
 
-    time_t now = time(NULL);
-    // fprintf(global_log, "\n===== Storage Server %d started at %s=====\n", port, ctime(&now));
-    // fprintf(local_log, "\n===== Storage Server %d started at %s=====\n", port, ctime(&now));
-    fflush(global_log);
-    fflush(local_log);
+    const char *env_level = getenv("LOG_LEVEL");
+    if (env_level) set_log_level(parse_log_level(env_level));
+
+    pthread_key_create(&ring_key, release_thread_ring);
+    atomic_store(&logger_running, 1);
+    if (pthread_create(&writer_tid, NULL, log_writer_thread, NULL) != 0) {
+        perror("Error starting log writer thread");
+        exit(EXIT_FAILURE);
+    }
+    atexit(close_logger); // exit() from any path still flushes queued lines
 }
 
-// Allow dynamic username update when a client connects
+// Tag this thread's log lines with the user it is serving
 void set_logger_username(const char *username) {
     if (username)
-        strncpy(logger_username, username, sizeof(logger_username) - 1);
+        strncpy(thread_username, username, sizeof(thread_username) - 1);
     else
-        strncpy(logger_username, "N/A", sizeof(logger_username) - 1);
+        strncpy(thread_username, "N/A", sizeof(thread_username) - 1);
 }
 
-// Writes a log entry to both global and local log files
-void write_log(const char *level, const char *format, ...) {
-    time_t now = time(NULL);
-    char time_str[32];
-    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&now));
-
-    va_list args;
+void set_log_level(log_level_t level) {
+    atomic_store(&min_level, level);
+}
 
-    if (global_log) {
-        fprintf(global_log, "[%s] [%s:%d] [USER=%s] [%s] ",
-                time_str, logger_ip, logger_port, logger_username, level);
-        va_start(args, format);
-        vfprintf(global_log, format, args);
-        va_end(args);
-        fprintf(global_log, "\n");
-        fflush(global_log);
-    }
+log_level_t parse_log_level(const char *name) {
+    if (strcasecmp(name, "DEBUG") == 0) return LOG_LEVEL_DEBUG;
+    if (strcasecmp(name, "WARN") == 0) return LOG_LEVEL_WARN;
+    if (strcasecmp(name, "ERROR") == 0) return LOG_LEVEL_ERROR;
+    return LOG_LEVEL_INFO;
+}
 
-    if (local_log) {
-        fprintf(local_log, "[%s] [%s:%d] [USER=%s] [%s] ",
-                time_str, logger_ip, logger_port, logger_username, level);
-        va_start(args, format);
-        vfprintf(local_log, format, args);
-        va_end(args);
-        fprintf(local_log, "\n");
-        fflush(local_log);
-    }
+// Queues a log entry for both global and local log files
+void write_log(const char *level, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    enqueue_line(level, 0, format, args);
+    va_end(args);
 }
 
 // Local-only logs
 void write_local_log(const char *level, const char *format, ...) {
-    if (!local_log) return;
-
-    time_t now = time(NULL);
-    char time_str[32];
-    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&now));
-
-    fprintf(local_log, "[%s] [%s:%d] [USER=%s] [%s] ",
-            time_str, logger_ip, logger_port, logger_username, level);
-
     va_list args;
     va_start(args, format);
-    vfprintf(local_log, format, args);
+    enqueue_line(level, 1, format, args);
     va_end(args);
-
-    fprintf(local_log, "\n");
-    fflush(local_log);
 }
 
-// Close logs
+// Stop the writer, flush what is queued and close logs
 void close_logger() {
-    time_t now = time(NULL);
+    if (!atomic_exchange(&logger_running, 0)) return;
+    pthread_mutex_lock(&writer_lock);
+    pthread_cond_signal(&writer_wake);
+    pthread_mutex_unlock(&writer_lock);
+    pthread_join(writer_tid, NULL);
+    drain_rings();
+
     if (global_log) {
-       // fprintf(global_log, "===== Logger closed at %s=====\n", ctime(&now));
         fclose(global_log);
         global_log = NULL;
     }
     if (local_log) {
-       // fprintf(local_log, "===== Logger closed at %s=====\n", ctime(&now));
         fclose(local_log);
         local_log = NULL;
     }
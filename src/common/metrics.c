@@ -0,0 +1,255 @@
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+typedef struct {
+    atomic_ulong count;
+    atomic_ulong errors;
+    atomic_ulong sum_us;
+    atomic_ulong buckets[METRICS_BUCKETS + 1]; // Last one is +Inf
+} histogram_t;
+
+typedef struct {
+    const char* name;
+    histogram_t hist;
+} op_slot_t;
+
+// Slots are appended under table_lock and published by bumping 'used',
+// so lookups read a prefix of the array without locking.
+typedef struct {
+    op_slot_t slots[METRICS_MAX_OPS];
+    atomic_int used;
+} op_table_t;
+
+typedef struct {
+    const char* name;
+    atomic_long value;
+    double (*read)(void);
+} gauge_t;
+
+static const char* surface_names[METRICS_SURFACES] = { "client", "ns", "direct" };
+
+static op_table_t op_tables[METRICS_SURFACES];
+static op_table_t wait_table;
+static gauge_t gauges[METRICS_MAX_GAUGES];
+static atomic_int gauges_used = 0;
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread int request_failed = 0;
+
+uint64_t metrics_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static op_slot_t* find_slot(op_table_t* table, const char* name, int max) {
+    int used = atomic_load_explicit(&table->used, memory_order_acquire);
+    for (int i = 0; i < used; i++) {
+        if (table->slots[i].name == name || strcmp(table->slots[i].name, name) == 0) return &table->slots[i];
+    }
+
+    pthread_mutex_lock(&table_lock);
+    op_slot_t* slot = NULL;
+    used = atomic_load_explicit(&table->used, memory_order_relaxed);
+    for (int i = 0; i < used && slot == NULL; i++) {
+        if (strcmp(table->slots[i].name, name) == 0) slot = &table->slots[i];
+    }
+    if (slot == NULL) {
+        if (used < max - 1 || (used == max - 1 && strcmp(name, "OTHER") == 0)) {
+            slot = &table->slots[used];
+            slot->name = name;
+            atomic_store_explicit(&table->used, used + 1, memory_order_release);
+        }
+    }
+    pthread_mutex_unlock(&table_lock);
+    // The last slot is kept for "OTHER" so a flood of odd names stays bounded
+    return slot ? slot : find_slot(table, "OTHER", max);
+}
+
+static void histogram_add(histogram_t* h, uint64_t micros, int failed) {
+    int bucket = 0;
+    while (bucket < METRICS_BUCKETS && micros > (1ull << bucket)) bucket++;
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum_us, micros, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->buckets[bucket], 1, memory_order_relaxed);
+    if (failed) atomic_fetch_add_explicit(&h->errors, 1, memory_order_relaxed);
+}
+
+static gauge_t* find_gauge(const char* name) {
+    int used = atomic_load_explicit(&gauges_used, memory_order_acquire);
+    for (int i = 0; i < used; i++) {
+        if (gauges[i].name == name || strcmp(gauges[i].name, name) == 0) return &gauges[i];
+    }
+    pthread_mutex_lock(&table_lock);
+    gauge_t* gauge = NULL;
+    used = atomic_load_explicit(&gauges_used, memory_order_relaxed);
+    for (int i = 0; i < used && gauge == NULL; i++) {
+        if (strcmp(gauges[i].name, name) == 0) gauge = &gauges[i];
+    }
+    if (gauge == NULL && used < METRICS_MAX_GAUGES) {
+        gauge = &gauges[used];
+        gauge->name = name;
+        atomic_store_explicit(&gauges_used, used + 1, memory_order_release);
+    }
+    pthread_mutex_unlock(&table_lock);
+    return gauge;
+}
+
+// =========================================================================
+//  RECORDING
+// =========================================================================
+
+uint64_t metrics_begin(void) {
+    request_failed = 0;
+    return metrics_now_us();
+}
+
+void metrics_mark_error(void) {
+    request_failed = 1;
+}
+
+void metrics_end(metrics_surface_t surface, const char* op, uint64_t start_us) {
+    if ((unsigned)surface >= METRICS_SURFACES) return;
+    op_slot_t* slot = find_slot(&op_tables[surface], op, METRICS_MAX_OPS);
+    histogram_add(&slot->hist, metrics_now_us() - start_us, request_failed);
+    request_failed = 0;
+}
+
+void metrics_observe_wait(const char* name, uint64_t micros) {
+    histogram_add(&find_slot(&wait_table, name, METRICS_MAX_WAITS)->hist, micros, 0);
+}
+
+void metrics_gauge_add(const char* name, long delta) {
+    gauge_t* gauge = find_gauge(name);
+    if (gauge) atomic_fetch_add_explicit(&gauge->value, delta, memory_order_relaxed);
+}
+
+void metrics_register_gauge(const char* name, double (*read)(void)) {
+    gauge_t* gauge = find_gauge(name);
+    if (gauge) gauge->read = read;
+}
+
+void metrics_surface_totals(metrics_surface_t surface, uint64_t* count, uint64_t* sum_us) {
+    uint64_t c = 0, sum = 0;
+    int used = atomic_load_explicit(&op_tables[surface].used, memory_order_acquire);
+    for (int i = 0; i < used; i++) {
+        const histogram_t* h = &op_tables[surface].slots[i].hist;
+        c += atomic_load_explicit(&h->count, memory_order_relaxed);
+        sum += atomic_load_explicit(&h->sum_us, memory_order_relaxed);
+    }
+    *count = c;
+    *sum_us = sum;
+}
+
+// =========================================================================
+//  RENDERING
+// =========================================================================
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+    int failed;
+} text_t;
+
+static void append(text_t* t, const char* format, ...) {
+    if (t->failed) return;
+    for (;;) {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(t->data + t->length, t->capacity - t->length, format, args);
+        va_end(args);
+        if (n < 0) { t->failed = 1; return; }
+        if ((size_t)n < t->capacity - t->length) {
+            t->length += (size_t)n;
+            return;
+        }
+        size_t capacity = t->capacity * 2 + (size_t)n;
+        char* grown = realloc(t->data, capacity);
+        if (grown == NULL) { t->failed = 1; return; }
+        t->data = grown;
+        t->capacity = capacity;
+    }
+}
+
+static void render_histogram(text_t* t, const char* metric, const char* labels, const histogram_t* h) {
+    unsigned long cumulative = 0;
+    for (int b = 0; b <= METRICS_BUCKETS; b++) {
+        cumulative += atomic_load_explicit(&h->buckets[b], memory_order_relaxed);
+        if (b < METRICS_BUCKETS) {
+            append(t, "%s_bucket{%s,le=\"%g\"} %lu\n", metric, labels, (double)(1ull << b) / 1e6, cumulative);
+        } else {
+            append(t, "%s_bucket{%s,le=\"+Inf\"} %lu\n", metric, labels, cumulative);
+        }
+    }
+    append(t, "%s_sum{%s} %.6f\n", metric, labels,
+           (double)atomic_load_explicit(&h->sum_us, memory_order_relaxed) / 1e6);
+    append(t, "%s_count{%s} %lu\n", metric, labels, cumulative);
+}
+
+char* metrics_render(const char* instance, size_t* out_length) {
+    text_t t = { malloc(16384), 0, 16384, 0 };
+    if (t.data == NULL) return NULL;
+    t.data[0] = '\0';
+    char labels[256];
+
+    append(&t, "# TYPE docs_requests_total counter\n");
+    for (int s = 0; s < METRICS_SURFACES; s++) {
+        int used = atomic_load_explicit(&op_tables[s].used, memory_order_acquire);
+        for (int i = 0; i < used; i++) {
+            const op_slot_t* slot = &op_tables[s].slots[i];
+            append(&t, "docs_requests_total{instance=\"%s\",surface=\"%s\",op=\"%s\"} %lu\n",
+                   instance, surface_names[s], slot->name,
+                   atomic_load_explicit(&slot->hist.count, memory_order_relaxed));
+        }
+    }
+    append(&t, "# TYPE docs_request_errors_total counter\n");
+    for (int s = 0; s < METRICS_SURFACES; s++) {
+        int used = atomic_load_explicit(&op_tables[s].used, memory_order_acquire);
+        for (int i = 0; i < used; i++) {
+            const op_slot_t* slot = &op_tables[s].slots[i];
+            append(&t, "docs_request_errors_total{instance=\"%s\",surface=\"%s\",op=\"%s\"} %lu\n",
+                   instance, surface_names[s], slot->name,
+                   atomic_load_explicit(&slot->hist.errors, memory_order_relaxed));
+        }
+    }
+    append(&t, "# TYPE docs_request_duration_seconds histogram\n");
+    for (int s = 0; s < METRICS_SURFACES; s++) {
+        int used = atomic_load_explicit(&op_tables[s].used, memory_order_acquire);
+        for (int i = 0; i < used; i++) {
+            const op_slot_t* slot = &op_tables[s].slots[i];
+            snprintf(labels, sizeof(labels), "instance=\"%s\",surface=\"%s\",op=\"%s\"",
+                     instance, surface_names[s], slot->name);
+            render_histogram(&t, "docs_request_duration_seconds", labels, &slot->hist);
+        }
+    }
+
+    int waits = atomic_load_explicit(&wait_table.used, memory_order_acquire);
+    if (waits > 0) append(&t, "# TYPE docs_wait_seconds histogram\n");
+    for (int i = 0; i < waits; i++) {
+        snprintf(labels, sizeof(labels), "instance=\"%s\",wait=\"%s\"", instance, wait_table.slots[i].name);
+        render_histogram(&t, "docs_wait_seconds", labels, &wait_table.slots[i].hist);
+    }
+
+    int used = atomic_load_explicit(&gauges_used, memory_order_acquire);
+    for (int i = 0; i < used; i++) {
+        const gauge_t* gauge = &gauges[i];
+        double value = gauge->read ? gauge->read()
+                                   : (double)atomic_load_explicit(&gauge->value, memory_order_relaxed);
+        append(&t, "# TYPE docs_%s gauge\ndocs_%s{instance=\"%s\"} %g\n",
+               gauge->name, gauge->name, instance, value);
+    }
+
+    if (t.failed) {
+        free(t.data);
+        return NULL;
+    }
+    if (out_length) *out_length = t.length;
+    return t.data;
+}
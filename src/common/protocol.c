@@ -57,16 +57,345 @@ int recv_all(int socket_fd, void *buf, size_t len) {
     return 0; // Success
 }
 
+// ------------------------------------------------------------
+//  HEADER FRAMING (v1 raw struct, v2 compact)
+// ------------------------------------------------------------
+
+// Per-fd framing; 0 means PROTOCOL_V1. Written by the thread that owns the
+// fd's handshake and then only re-set to the same value, so no lock.
+static volatile uint8_t fd_versions[PROTOCOL_MAX_FDS];
+
+void protocol_set_version(int socket_fd, int version) {
+    if (socket_fd < 0 || socket_fd >= PROTOCOL_MAX_FDS) return;
+    fd_versions[socket_fd] = (uint8_t)(version == PROTOCOL_V2 ? PROTOCOL_V2 : 0);
+}
+
+int protocol_version(int socket_fd) {
+    if (socket_fd < 0 || socket_fd >= PROTOCOL_MAX_FDS) return PROTOCOL_V1;
+    return fd_versions[socket_fd] == PROTOCOL_V2 ? PROTOCOL_V2 : PROTOCOL_V1;
+}
+
+uint32_t protocol_accept_offer(uint32_t offered) {
+    return offered >= PROTOCOL_V2 ? PROTOCOL_V2 : 0;
+}
+
+static void put_be16(uint8_t *p, uint16_t v) { p[0] = (uint8_t)(v >> 8); p[1] = (uint8_t)v; }
+static void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;
+}
+static uint16_t get_be16(const uint8_t *p) { return (uint16_t)(p[0] << 8 | p[1]); }
+static uint32_t get_be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
 /**
  * @brief Sends just the message header.
  */
 int send_header(int socket_fd, MessageHeader *header) {
-    return send_all(socket_fd, header, sizeof(MessageHeader));
+    if (protocol_version(socket_fd) == PROTOCOL_V1) {
+        return send_all(socket_fd, header, sizeof(MessageHeader));
+    }
+    // One send for the whole frame, so it never goes out as two segments
+    uint8_t frame[PROTOCOL_V2_HEADER + MAX_FILENAME];
+    size_t name_len = strnlen(header->filename, MAX_FILENAME - 1);
+    frame[0] = PROTOCOL_V2_MAGIC;
+    frame[1] = PROTOCOL_V2;
+    put_be16(frame + 2, header->msg_type);
+    frame[4] = (uint8_t)((header->source_component & 0x0f) << 4 | (header->dest_component & 0x0f));
+    frame[5] = (uint8_t)name_len;
+    put_be32(frame + 6, header->request_id);
+    put_be32(frame + 10, header->payload_length);
+    memcpy(frame + PROTOCOL_V2_HEADER, header->filename, name_len);
+    return send_all(socket_fd, frame, PROTOCOL_V2_HEADER + name_len);
 }
 
 /**
  * @brief Receives just the message header.
  */
 int recv_header(int socket_fd, MessageHeader *header) {
-    return recv_all(socket_fd, header, sizeof(MessageHeader));
-}
\ No newline at end of file
+    // Two bytes tell the framings apart: a v1 header starts with the
+    // little-endian msg_type, whose high byte is always 0
+    uint8_t frame[PROTOCOL_V2_HEADER];
+    if (recv_all(socket_fd, frame, 2) == -1) return -1;
+    if (frame[0] != PROTOCOL_V2_MAGIC || frame[1] != PROTOCOL_V2) {
+        memcpy(header, frame, 2);
+        return recv_all(socket_fd, (char *)header + 2, sizeof(MessageHeader) - 2);
+    }
+
+    if (recv_all(socket_fd, frame + 2, PROTOCOL_V2_HEADER - 2) == -1) return -1;
+    memset(header, 0, sizeof(*header));
+    header->msg_type = get_be16(frame + 2);
+    header->source_component = frame[4] >> 4;
+    header->dest_component = frame[4] & 0x0f;
+    header->request_id = get_be32(frame + 6);
+    header->payload_length = get_be32(frame + 10);
+    size_t name_len = frame[5]; // At most 255, so it fits with its NUL
+    if (name_len > 0 && recv_all(socket_fd, header->filename, name_len) == -1) return -1;
+    protocol_set_version(socket_fd, PROTOCOL_V2);
+    return 0;
+}
+
+// ------------------------------------------------------------
+//  COMPACT FILE RECORDS (MSG_REGISTER_FILE_BATCH)
+// ------------------------------------------------------------
+
+static size_t put_varint(uint8_t *p, size_t room, uint64_t v) {
+    size_t n = 0;
+    do {
+        if (n == room) return 0;
+        p[n++] = (uint8_t)((v & 0x7f) | (v >= 0x80 ? 0x80 : 0));
+        v >>= 7;
+    } while (v);
+    return n;
+}
+
+static int get_varint(const uint8_t **p, const uint8_t *end, uint64_t *out) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+        uint8_t b = *(*p)++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *out = v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Zigzag keeps small negative values (e.g. an unset time) short
+static uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+static int64_t unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+static size_t put_string(uint8_t *p, size_t room, const char *s, size_t field_size) {
+    size_t len = strnlen(s, field_size);
+    size_t n = put_varint(p, room, len);
+    if (n == 0 || room - n < len) return 0;
+    memcpy(p + n, s, len);
+    return n + len;
+}
+
+static int get_string(const uint8_t **p, const uint8_t *end, char *out, size_t field_size) {
+    uint64_t len;
+    if (get_varint(p, end, &len) == -1 || len > (uint64_t)(end - *p)) return -1;
+    size_t keep = len < field_size ? (size_t)len : field_size - 1;
+    memcpy(out, *p, keep);
+    out[keep] = '\0';
+    *p += len;
+    return 0;
+}
+
+size_t encode_file_record(const SSFileRecordPayload *record, uint8_t *buf, size_t capacity) {
+    size_t used = 0, n;
+#define PUT(expr) do { if ((n = (expr)) == 0) return 0; used += n; } while (0)
+    PUT(put_string(buf + used, capacity - used, record->filename, sizeof(record->filename)));
+    PUT(put_string(buf + used, capacity - used, record->owner_username, sizeof(record->owner_username)));
+    PUT(put_string(buf + used, capacity - used, record->last_accessed_by, sizeof(record->last_accessed_by)));
+    PUT(put_string(buf + used, capacity - used, record->folder, sizeof(record->folder)));
+    int acl_count = record->acl_count < 0 ? 0 :
+                    record->acl_count > MAX_ACL_ENTRIES ? MAX_ACL_ENTRIES : record->acl_count;
+    PUT(put_varint(buf + used, capacity - used, (uint64_t)acl_count));
+    for (int i = 0; i < acl_count; i++) {
+        PUT(put_string(buf + used, capacity - used, record->acl[i].username, sizeof(record->acl[i].username)));
+        PUT(put_varint(buf + used, capacity - used, (uint64_t)record->acl[i].permission));
+    }
+    PUT(put_varint(buf + used, capacity - used, zigzag(record->word_count)));
+    PUT(put_varint(buf + used, capacity - used, zigzag(record->char_count)));
+    PUT(put_varint(buf + used, capacity - used, zigzag(record->created)));
+    PUT(put_varint(buf + used, capacity - used, zigzag(record->modified)));
+    PUT(put_varint(buf + used, capacity - used, zigzag(record->last_accessed)));
+    PUT(put_varint(buf + used, capacity - used, record->replica ? 1 : 0));
+#undef PUT
+    return used;
+}
+
+int decode_file_record(const uint8_t **cursor, const uint8_t *end, SSFileRecordPayload *record) {
+    const uint8_t *p = *cursor;
+    uint64_t v, acl_count;
+    memset(record, 0, sizeof(*record));
+    if (get_string(&p, end, record->filename, sizeof(record->filename)) == -1 ||
+        get_string(&p, end, record->owner_username, sizeof(record->owner_username)) == -1 ||
+        get_string(&p, end, record->last_accessed_by, sizeof(record->last_accessed_by)) == -1 ||
+        get_string(&p, end, record->folder, sizeof(record->folder)) == -1 ||
+        get_varint(&p, end, &acl_count) == -1) {
+        return -1;
+    }
+    for (uint64_t i = 0; i < acl_count; i++) {
+        AclEntryPayload entry;
+        if (get_string(&p, end, entry.username, sizeof(entry.username)) == -1 ||
+            get_varint(&p, end, &v) == -1) {
+            return -1;
+        }
+        entry.permission = (PermissionType)v;
+        if (record->acl_count < MAX_ACL_ENTRIES) record->acl[record->acl_count++] = entry;
+    }
+    long *counts[] = { &record->word_count, &record->char_count };
+    for (int i = 0; i < 2; i++) {
+        if (get_varint(&p, end, &v) == -1) return -1;
+        *counts[i] = (long)unzigzag(v);
+    }
+    time_t *times[] = { &record->created, &record->modified, &record->last_accessed };
+    for (int i = 0; i < 3; i++) {
+        if (get_varint(&p, end, &v) == -1) return -1;
+        *times[i] = (time_t)unzigzag(v);
+    }
+    if (get_varint(&p, end, &v) == -1) return -1;
+    record->replica = v != 0;
+    *cursor = p;
+    return 0;
+}
+
+// ------------------------------------------------------------
+//  COMPACT PAYLOADS (v2 links)
+// ------------------------------------------------------------
+
+static size_t put_meta(uint8_t *buf, size_t capacity, const SSMetadataPayload *meta) {
+    size_t used = 0, n;
+#define PUT(expr) do { if ((n = (expr)) == 0) return 0; used += n; } while (0)
+    PUT(put_varint(buf + used, capacity - used, zigzag(meta->word_count)));
+    PUT(put_varint(buf + used, capacity - used, zigzag(meta->char_count)));
+    PUT(put_varint(buf + used, capacity - used, zigzag(meta->created)));
+    PUT(put_varint(buf + used, capacity - used, zigzag(meta->last_modified)));
+    PUT(put_varint(buf + used, capacity - used, zigzag(meta->last_accessed)));
+    PUT(put_string(buf + used, capacity - used, meta->last_accessed_by, sizeof(meta->last_accessed_by)));
+#undef PUT
+    return used;
+}
+
+static int get_meta(const uint8_t **p, const uint8_t *end, SSMetadataPayload *meta) {
+    uint64_t v;
+    long *counts[] = { &meta->word_count, &meta->char_count };
+    for (int i = 0; i < 2; i++) {
+        if (get_varint(p, end, &v) == -1) return -1;
+        *counts[i] = (long)unzigzag(v);
+    }
+    time_t *times[] = { &meta->created, &meta->last_modified, &meta->last_accessed };
+    for (int i = 0; i < 3; i++) {
+        if (get_varint(p, end, &v) == -1) return -1;
+        *times[i] = (time_t)unzigzag(v);
+    }
+    return get_string(p, end, meta->last_accessed_by, sizeof(meta->last_accessed_by));
+}
+
+size_t encode_file_info(const FileInfoPayload *info, uint8_t *buf, size_t capacity) {
+    size_t used = 0, n;
+#define PUT(expr) do { if ((n = (expr)) == 0) return 0; used += n; } while (0)
+    PUT(put_string(buf + used, capacity - used, info->filename, sizeof(info->filename)));
+    PUT(put_string(buf + used, capacity - used, info->owner_username, sizeof(info->owner_username)));
+    PUT(put_string(buf + used, capacity - used, info->ss_ip, sizeof(info->ss_ip)));
+    PUT(put_varint(buf + used, capacity - used, zigzag(info->ss_port)));
+    int acl_count = info->acl_count < 0 ? 0 :
+                    info->acl_count > MAX_ACL_ENTRIES ? MAX_ACL_ENTRIES : info->acl_count;
+    PUT(put_varint(buf + used, capacity - used, (uint64_t)acl_count));
+    for (int i = 0; i < acl_count; i++) {
+        PUT(put_string(buf + used, capacity - used, info->acl[i].username, sizeof(info->acl[i].username)));
+        PUT(put_varint(buf + used, capacity - used, (uint64_t)info->acl[i].permission));
+    }
+    SSMetadataPayload meta = {
+        .word_count = info->word_count, .char_count = info->char_count,
+        .created = info->created, .last_modified = info->last_modified,
+        .last_accessed = info->last_accessed,
+    };
+    memcpy(meta.last_accessed_by, info->last_accessed_by, sizeof(meta.last_accessed_by));
+    PUT(put_meta(buf + used, capacity - used, &meta));
+#undef PUT
+    return used;
+}
+
+int decode_file_info(const uint8_t *buf, size_t len, FileInfoPayload *info) {
+    const uint8_t *p = buf, *end = buf + len;
+    uint64_t v, acl_count;
+    memset(info, 0, sizeof(*info));
+    if (get_string(&p, end, info->filename, sizeof(info->filename)) == -1 ||
+        get_string(&p, end, info->owner_username, sizeof(info->owner_username)) == -1 ||
+        get_string(&p, end, info->ss_ip, sizeof(info->ss_ip)) == -1 ||
+        get_varint(&p, end, &v) == -1 ||
+        get_varint(&p, end, &acl_count) == -1) {
+        return -1;
+    }
+    info->ss_port = (int)unzigzag(v);
+    for (uint64_t i = 0; i < acl_count; i++) {
+        AclEntryPayload entry;
+        if (get_string(&p, end, entry.username, sizeof(entry.username)) == -1 ||
+            get_varint(&p, end, &v) == -1) {
+            return -1;
+        }
+        entry.permission = (PermissionType)v;
+        if (info->acl_count < MAX_ACL_ENTRIES) info->acl[info->acl_count++] = entry;
+    }
+    SSMetadataPayload meta;
+    memset(&meta, 0, sizeof(meta));
+    if (get_meta(&p, end, &meta) == -1) return -1;
+    info->word_count = meta.word_count;
+    info->char_count = meta.char_count;
+    info->created = meta.created;
+    info->last_modified = meta.last_modified;
+    info->last_accessed = meta.last_accessed;
+    memcpy(info->last_accessed_by, meta.last_accessed_by, sizeof(info->last_accessed_by));
+    return 0;
+}
+
+size_t encode_metadata_delta(const SSMetadataDeltaPayload *delta, uint8_t *buf, size_t capacity) {
+    size_t used = 0, n;
+#define PUT(expr) do { if ((n = (expr)) == 0) return 0; used += n; } while (0)
+    PUT(put_string(buf + used, capacity - used, delta->filename, sizeof(delta->filename)));
+    PUT(put_meta(buf + used, capacity - used, &delta->meta));
+    PUT(put_varint(buf + used, capacity - used, delta->content_changed ? 1 : 0));
+#undef PUT
+    return used;
+}
+
+int decode_metadata_delta(const uint8_t *buf, size_t len, SSMetadataDeltaPayload *delta) {
+    const uint8_t *p = buf, *end = buf + len;
+    uint64_t v;
+    memset(delta, 0, sizeof(*delta));
+    if (get_string(&p, end, delta->filename, sizeof(delta->filename)) == -1 ||
+        get_meta(&p, end, &delta->meta) == -1 ||
+        get_varint(&p, end, &v) == -1) {
+        return -1;
+    }
+    delta->content_changed = v != 0;
+    return 0;
+}
+
+const char *msg_type_name(uint32_t msg_type) {
+    switch (msg_type) {
+        case MSG_ACK:                         return "ACK";
+        case MSG_ERROR:                       return "ERROR";
+        case MSG_CREATE:                      return "CREATE";
+        case MSG_READ:                        return "READ";
+        case MSG_DELETE:                      return "DELETE";
+        case MSG_REGISTER_CLIENT:             return "REGISTER_CLIENT";
+        case MSG_ADD_ACCESS:                  return "ADD_ACCESS";
+        case MSG_REM_ACCESS:                  return "REM_ACCESS";
+        case MSG_EXEC:                        return "EXEC";
+        case MSG_WRITE:                       return "WRITE";
+        case MSG_STREAM:                      return "STREAM";
+        case MSG_UNDO:                        return "UNDO";
+        case MSG_INFO:                        return "INFO";
+        case MSG_LIST:                        return "LIST";
+        case MSG_VIEW:                        return "VIEW";
+        case MSG_SS_DEAD_REPORT:              return "SS_DEAD_REPORT";
+        case MSG_CREATE_FOLDER:               return "CREATE_FOLDER";
+        case MSG_MOVE_FILE:                   return "MOVE_FILE";
+        case MSG_MOVE_FOLDER:                 return "MOVE_FOLDER";
+        case MSG_VIEWFOLDER:                  return "VIEWFOLDER";
+        case MSG_STATS:                       return "STATS";
+        case MSG_SEARCH_CONTENT:              return "SEARCH_CONTENT";
+        case MSG_INTERNAL_READ:               return "INTERNAL_READ";
+        case MSG_INTERNAL_GET_METADATA:       return "INTERNAL_GET_METADATA";
+        case MSG_INTERNAL_ADD_ACCESS:         return "INTERNAL_ADD_ACCESS";
+        case MSG_INTERNAL_REM_ACCESS:         return "INTERNAL_REM_ACCESS";
+        case MSG_INTERNAL_SET_OWNER:          return "INTERNAL_SET_OWNER";
+        case MSG_INTERNAL_SET_FOLDER:         return "INTERNAL_SET_FOLDER";
+        case MSG_INTERNAL_GET_METADATA_BATCH: return "INTERNAL_GET_METADATA_BATCH";
+        case MSG_INTERNAL_REPLICATE:          return "INTERNAL_REPLICATE";
+        case MSG_INTERNAL_REPLICA_STATE:      return "INTERNAL_REPLICA_STATE";
+        case MSG_INTERNAL_SEARCH_CONTENT:     return "INTERNAL_SEARCH_CONTENT";
+        case MSG_CHECKPOINT:                  return "CHECKPOINT";
+        case MSG_VIEWCHECKPOINT:              return "VIEWCHECKPOINT";
+        case MSG_REVERT:                      return "REVERT";
+        case MSG_LISTCHECKPOINTS:             return "LISTCHECKPOINTS";
+        case MSG_LOCATE_FILE:                 return "LOCATE_FILE";
+        default:                              return "UNKNOWN";
+    }
+}
@@ -27,7 +27,12 @@ void bind_socket(int sockfd, int port) {
 
 // Listen for incoming connections
 void listen_socket(int sockfd) {
-    if (listen(sockfd, 5) < 0) {
+    listen_socket_backlog(sockfd, DEFAULT_LISTEN_BACKLOG);
+}
+
+// Listen with a caller-chosen backlog
+void listen_socket_backlog(int sockfd, int backlog) {
+    if (listen(sockfd, backlog) < 0) {
         perror("Listen failed");
         close(sockfd);
         exit(EXIT_FAILURE);
@@ -1,96 +1,297 @@
 #include "cache.h"
 #include "logger.h"
+#include "file_index.h" // For file_index_hash
+#include <stdlib.h>
 #include <string.h>
 
-static CacheEntry cache[CACHE_SIZE];
-static pthread_mutex_t cache_mutex;
+// Each shard is an independent LRU: a chained hash table for lookup and
+// a doubly linked list for recency, over a fixed pool of entries. Lookups
+// on different shards never contend.
+typedef struct {
+    pthread_mutex_t mutex;
+    CacheEntry** buckets;
+    size_t bucket_mask;
+    CacheEntry* pool;
+    CacheEntry* free_list;  // Linked through hash_next
+    CacheEntry* lru_head;   // Most recently used
+    CacheEntry* lru_tail;   // Next to evict
+    size_t count;
+    size_t capacity;
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long perm_hits;
+    unsigned long perm_misses;
+    unsigned long evictions;
+    unsigned long invalidations;
+} CacheShard;
+
+static CacheShard shards[CACHE_SHARDS];
+static size_t configured_capacity = CACHE_DEFAULT_CAPACITY;
+
+void cache_set_capacity(size_t entries) {
+    configured_capacity = entries > 0 ? entries : 1;
+}
 
 void init_cache() {
-    pthread_mutex_init(&cache_mutex, NULL);
-    memset(cache, 0, sizeof(cache));
-    write_log("INIT", "File Cache (%d entries) initialized.", CACHE_SIZE);
+    size_t per_shard = (configured_capacity + CACHE_SHARDS - 1) / CACHE_SHARDS;
+    size_t buckets = 16;
+    while (buckets < per_shard) buckets <<= 1;
+
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        CacheShard* s = &shards[i];
+        memset(s, 0, sizeof(*s));
+        pthread_mutex_init(&s->mutex, NULL);
+        s->buckets = calloc(buckets, sizeof(CacheEntry*));
+        s->pool = calloc(per_shard, sizeof(CacheEntry));
+        if (s->buckets == NULL || s->pool == NULL) {
+            // A shard without storage just misses every time.
+            free(s->buckets);
+            free(s->pool);
+            s->buckets = NULL;
+            s->pool = NULL;
+            write_log("FATAL", "Out of memory for cache shard %d; running without it.", i);
+            continue;
+        }
+        s->bucket_mask = buckets - 1;
+        s->capacity = per_shard;
+        for (size_t k = 0; k < per_shard; k++) {
+            s->pool[k].hash_next = s->free_list;
+            s->free_list = &s->pool[k];
+        }
+    }
+    write_log("INIT", "File Cache (%zu entries in %d shards) initialized.",
+              per_shard * CACHE_SHARDS, CACHE_SHARDS);
+}
+
+// =========================================================================
+//  SHARD INTERNALS (shard mutex must be HELD)
+// =========================================================================
+
+static CacheShard* shard_for(const char* filename, uint32_t* hash) {
+    *hash = file_index_hash(filename);
+    return &shards[*hash & (CACHE_SHARDS - 1)];
+}
+
+static size_t bucket_of(const CacheShard* s, uint32_t hash) {
+    // The low bits already picked the shard.
+    return (hash / CACHE_SHARDS) & s->bucket_mask;
+}
+
+static CacheEntry* shard_find(CacheShard* s, const char* filename, uint32_t hash) {
+    if (s->buckets == NULL) return NULL;
+    for (CacheEntry* e = s->buckets[bucket_of(s, hash)]; e; e = e->hash_next) {
+        if (e->hash == hash && strcmp(e->filename, filename) == 0) return e;
+    }
+    return NULL;
+}
+
+static void lru_unlink(CacheShard* s, CacheEntry* e) {
+    if (e->lru_prev) e->lru_prev->lru_next = e->lru_next;
+    else s->lru_head = e->lru_next;
+    if (e->lru_next) e->lru_next->lru_prev = e->lru_prev;
+    else s->lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_front(CacheShard* s, CacheEntry* e) {
+    e->lru_prev = NULL;
+    e->lru_next = s->lru_head;
+    if (s->lru_head) s->lru_head->lru_prev = e;
+    s->lru_head = e;
+    if (s->lru_tail == NULL) s->lru_tail = e;
+}
+
+static void lru_touch(CacheShard* s, CacheEntry* e) {
+    if (s->lru_head == e) return;
+    lru_unlink(s, e);
+    lru_push_front(s, e);
+}
+
+static void shard_remove(CacheShard* s, CacheEntry* e) {
+    CacheEntry** link = &s->buckets[bucket_of(s, e->hash)];
+    while (*link && *link != e) link = &(*link)->hash_next;
+    if (*link) *link = e->hash_next;
+    lru_unlink(s, e);
+    e->hash_next = s->free_list;
+    s->free_list = e;
+    s->count--;
 }
 
 /**
- * @brief Finds a file in the cache. Updates its timestamp on hit.
+ * @brief Returns the entry for 'filename', claiming a free or LRU slot for it.
+ * @return The entry, or NULL if the shard has no storage.
  */
-int cache_lookup(const char* filename) {
-    pthread_mutex_lock(&cache_mutex);
-
-    int found_index = -1;
-    for (int i = 0; i < CACHE_SIZE; i++) {
-        if (cache[i].is_valid && strcmp(cache[i].filename, filename) == 0) {
-            // Cache Hit!
-            cache[i].last_used_time = time(NULL);
-            found_index = i;
-            break;
-        }
+static CacheEntry* shard_get_or_insert(CacheShard* s, const char* filename, uint32_t hash) {
+    CacheEntry* e = shard_find(s, filename, hash);
+    if (e) {
+        lru_touch(s, e);
+        return e;
+    }
+    if (s->buckets == NULL) return NULL;
+
+    if (s->free_list == NULL) {
+        shard_remove(s, s->lru_tail);
+        s->evictions++;
     }
+    e = s->free_list;
+    s->free_list = e->hash_next;
 
-    pthread_mutex_unlock(&cache_mutex);
+    memset(e, 0, sizeof(*e));
+    strncpy(e->filename, filename, MAX_FILENAME - 1);
+    e->hash = hash;
+    e->ss_index = -1;
 
-    if (found_index != -1) {
-        write_log("CACHE", "Cache HIT for '%s'", filename);
-        return cache[found_index].ss_index;
+    size_t b = bucket_of(s, hash);
+    e->hash_next = s->buckets[b];
+    s->buckets[b] = e;
+    lru_push_front(s, e);
+    s->count++;
+    return e;
+}
+
+// =========================================================================
+//  PUBLIC API
+// =========================================================================
+
+/**
+ * @brief Finds a file in the cache. Marks it most recently used on hit.
+ */
+int cache_lookup(const char* filename) {
+    uint32_t hash;
+    CacheShard* s = shard_for(filename, &hash);
+
+    pthread_mutex_lock(&s->mutex);
+    CacheEntry* e = shard_find(s, filename, hash);
+    int ss_index = -1;
+    if (e && e->ss_index != -1) {
+        lru_touch(s, e);
+        ss_index = e->ss_index; // Copied while the entry is still ours
+        s->hits++;
     } else {
-        write_log("CACHE", "Cache MISS for '%s'", filename);
-        return -1;
+        s->misses++;
     }
+    pthread_mutex_unlock(&s->mutex);
+    return ss_index;
 }
 
 /**
- * @brief Adds a file to the cache, evicting the LRU entry if full.
+ * @brief Adds a file to the cache, evicting the shard's LRU entry if full.
  */
 void cache_add(const char* filename, int ss_index) {
-    pthread_mutex_lock(&cache_mutex);
-
-    // 1. Find the slot to replace.
-    // We look for either an empty slot or the oldest (LRU) slot.
-    int lru_index = 0;
-    time_t oldest_time = time(NULL); // Default to now
-    int found_empty_slot = 0;
-
-    for (int i = 0; i < CACHE_SIZE; i++) {
-        if (!cache[i].is_valid) {
-            // Found an empty slot, use it immediately.
-            lru_index = i;
-            found_empty_slot = 1;
-            break;
-        }
-        if (cache[i].last_used_time < oldest_time) {
-            // Found an older entry
-            oldest_time = cache[i].last_used_time;
-            lru_index = i;
+    uint32_t hash;
+    CacheShard* s = shard_for(filename, &hash);
+
+    pthread_mutex_lock(&s->mutex);
+    CacheEntry* e = shard_get_or_insert(s, filename, hash);
+    if (e) {
+        if (e->ss_index != -1 && e->ss_index != ss_index) {
+            // The file moved servers; whatever we knew about it is suspect.
+            memset(e->perms, 0, sizeof(e->perms));
         }
+        e->ss_index = ss_index;
     }
+    pthread_mutex_unlock(&s->mutex);
+}
 
-    // 2. Overwrite the chosen slot (lru_index)
-    if (found_empty_slot) {
-        write_log("CACHE", "Adding '%s' to empty cache slot %d", filename, lru_index);
-    } else {
-        write_log("CACHE", "Evicting '%s' and adding '%s' to cache slot %d", 
-                  cache[lru_index].filename, filename, lru_index);
+int cache_lookup_permission(const char* filename, const char* username, PermissionType permission) {
+    uint32_t hash;
+    CacheShard* s = shard_for(filename, &hash);
+
+    pthread_mutex_lock(&s->mutex);
+    int result = -1;
+    CacheEntry* e = shard_find(s, filename, hash);
+    if (e) {
+        for (int i = 0; i < CACHE_PERMS_PER_ENTRY; i++) {
+            if (e->perms[i].username[0] != '\0' && strcmp(e->perms[i].username, username) == 0) {
+                result = e->perms[i].level >= permission;
+                lru_touch(s, e);
+                break;
+            }
+        }
     }
+    if (result == -1) s->perm_misses++;
+    else s->perm_hits++;
+    pthread_mutex_unlock(&s->mutex);
+    return result;
+}
 
-    strncpy(cache[lru_index].filename, filename, MAX_FILENAME - 1);
-    cache[lru_index].ss_index = ss_index;
-    cache[lru_index].last_used_time = time(NULL);
-    cache[lru_index].is_valid = 1;
+void cache_add_permission(const char* filename, int ss_index, const char* username, PermissionType level) {
+    uint32_t hash;
+    CacheShard* s = shard_for(filename, &hash);
 
-    pthread_mutex_unlock(&cache_mutex);
+    pthread_mutex_lock(&s->mutex);
+    CacheEntry* e = shard_get_or_insert(s, filename, hash);
+    if (e) {
+        if (e->ss_index == -1) e->ss_index = ss_index;
+
+        CachePermEntry* slot = NULL;
+        for (int i = 0; i < CACHE_PERMS_PER_ENTRY && slot == NULL; i++) {
+            if (strcmp(e->perms[i].username, username) == 0) slot = &e->perms[i];
+        }
+        for (int i = 0; i < CACHE_PERMS_PER_ENTRY && slot == NULL; i++) {
+            if (e->perms[i].username[0] == '\0') slot = &e->perms[i];
+        }
+        if (slot == NULL) {
+            slot = &e->perms[e->next_perm];
+            e->next_perm = (e->next_perm + 1) % CACHE_PERMS_PER_ENTRY;
+        }
+        strncpy(slot->username, username, sizeof(slot->username) - 1);
+        slot->username[sizeof(slot->username) - 1] = '\0';
+        slot->level = level;
+    }
+    pthread_mutex_unlock(&s->mutex);
 }
 
 /**
  * @brief Invalidates a cache entry (e.g., on file delete).
  */
 void cache_invalidate(const char* filename) {
-    pthread_mutex_lock(&cache_mutex);
-    for (int i = 0; i < CACHE_SIZE; i++) {
-        if (cache[i].is_valid && strcmp(cache[i].filename, filename) == 0) {
-            cache[i].is_valid = 0;
-            write_log("CACHE", "Invalidated '%s' from cache.", filename);
-            break;
+    uint32_t hash;
+    CacheShard* s = shard_for(filename, &hash);
+
+    pthread_mutex_lock(&s->mutex);
+    CacheEntry* e = shard_find(s, filename, hash);
+    if (e) {
+        shard_remove(s, e);
+        s->invalidations++;
+    }
+    pthread_mutex_unlock(&s->mutex);
+}
+
+void cache_invalidate_ss(int ss_index) {
+    int dropped = 0;
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        CacheShard* s = &shards[i];
+        pthread_mutex_lock(&s->mutex);
+        CacheEntry* e = s->lru_head;
+        while (e) {
+            CacheEntry* next = e->lru_next;
+            if (e->ss_index == ss_index) {
+                shard_remove(s, e);
+                s->invalidations++;
+                dropped++;
+            }
+            e = next;
         }
+        pthread_mutex_unlock(&s->mutex);
+    }
+    write_log("CACHE", "Invalidated %d entries for SS %d.", dropped, ss_index);
+}
+
+void cache_get_stats(CacheStats* out) {
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        CacheShard* s = &shards[i];
+        pthread_mutex_lock(&s->mutex);
+        out->hits += s->hits;
+        out->misses += s->misses;
+        out->perm_hits += s->perm_hits;
+        out->perm_misses += s->perm_misses;
+        out->evictions += s->evictions;
+        out->invalidations += s->invalidations;
+        out->entries += s->count;
+        out->capacity += s->capacity;
+        pthread_mutex_unlock(&s->mutex);
     }
-    pthread_mutex_unlock(&cache_mutex);
-}
\ No newline at end of file
+}
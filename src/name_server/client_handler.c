@@ -6,6 +6,9 @@
 #include "executor.h"
 #include "cache.h"
 #include "user_manager.h"
+#include "ss_channel.h"
+#include "metrics.h"
+#include "replication.h"
 #include <unistd.h> // for close()
 #include <string.h>
 #include <stdlib.h> // For malloc/free
@@ -16,6 +19,7 @@
 
 static void send_error_to_client(int sock_fd, const char* error_message) {
     write_log("ERROR", "Socket %d: %s", sock_fd, error_message);
+    metrics_mark_error();
     
     MessageHeader err_header;
     memset(&err_header, 0, sizeof(err_header));
@@ -100,27 +104,11 @@ void handle_create_request(int sock_fd, MessageHeader* header, const char* clien
     write_log("CLIENT_CMD", "Socket %d: Assigning file '%s' to SS on port %d (socket %d)",
               sock_fd, header->filename, ss->client_facing_port, ss->ss_socket_fd);
 
-    // --- LOCK SS SOCKET ---
-    pthread_mutex_lock(&ss->socket_mutex);
-
-    header->dest_component = COMPONENT_STORAGE_SERVER;
-    if (send_header(ss->ss_socket_fd, header) == -1) {
-        pthread_mutex_unlock(&ss->socket_mutex);
-        send_error_to_client(sock_fd, "Failed to communicate with storage server.");
-        remove_storage_server(ss->ss_socket_fd);
-        return;
-    }
-
     MessageHeader ss_response;
-    if (recv_header(ss->ss_socket_fd, &ss_response) == -1) {
-        pthread_mutex_unlock(&ss->socket_mutex);
+    if (ss_call(ss, header, NULL, &ss_response, NULL) == -1) {
         send_error_to_client(sock_fd, "Storage server disconnected or failed to respond.");
-        remove_storage_server(ss->ss_socket_fd);
         return;
     }
-    
-    pthread_mutex_unlock(&ss->socket_mutex);
-    // --- UNLOCK SS SOCKET ---
 
     if (ss_response.msg_type != MSG_ACK) {
         send_error_to_client(sock_fd, "Storage server failed to create the file.");
@@ -144,12 +132,10 @@ void handle_create_request(int sock_fd, MessageHeader* header, const char* clien
     owner_header.payload_length = strlen(client_username) + 1; // include null terminator
     
     // We send this to the SS, but we don't wait for an ACK.
-    pthread_mutex_lock(&ss->socket_mutex);
-    send_header(ss->ss_socket_fd, &owner_header);
-    send_all(ss->ss_socket_fd, client_username, owner_header.payload_length);
-    pthread_mutex_unlock(&ss->socket_mutex);
+    ss_send_oneway(ss, &owner_header, client_username);
     // --- END FIX 2 ---
 
+    replication_add_replicas(header->filename); // Copied once the worker gets to it
     send_ack_to_client(sock_fd);
 }
 
@@ -157,6 +143,9 @@ void handle_delete_request(int sock_fd, MessageHeader* header, const char* clien
     write_log("CLIENT_CMD", "User '%s' (Socket %d): Received MSG_DELETE for file '%s'",
               client_username, sock_fd, header->filename);
 
+    // Replicas are dropped along with the record, so note them first
+    int copies[NS_MAX_REPLICAS + 1];
+    int copy_count = search_get_copies(header->filename, copies, NS_MAX_REPLICAS + 1);
     int ss_index = search_delete_file(header->filename, client_username);
 
     if (ss_index == -1) {
@@ -167,43 +156,40 @@ void handle_delete_request(int sock_fd, MessageHeader* header, const char* clien
         send_error_to_client(sock_fd, "Access Denied (Only owner can delete).");
         return;
     }
-
-    cache_invalidate(header->filename);
+    // Drop the replicas alongside the primary, each on its own call so a
+    // copy that fails to go is logged rather than silently left behind
+    SSPendingCall* replica_calls[NS_MAX_REPLICAS + 1] = {0};
+    for (int i = 0; i < copy_count; i++) {
+        StorageServerInfo* replica = copies[i] == ss_index ? NULL : get_ss_by_index(copies[i]);
+        if (replica == NULL || !replica->is_active) continue;
+        MessageHeader delete_header = *header;
+        delete_header.payload_length = 0;
+        replica_calls[i] = ss_call_begin(replica, &delete_header, NULL);
+        if (replica_calls[i] == NULL) {
+            write_log("WARN", "Could not send DELETE for '%s' to replica SS %d.",
+                      header->filename, copies[i]);
+        }
+    }
 
     StorageServerInfo* ss = get_ss_by_index(ss_index);
+    MessageHeader ss_response;
     if (ss == NULL || !ss->is_active) {
         write_log("WARN", "File '%s' deleted from records, but SS %d is inactive.", 
                   header->filename, ss_index);
-        send_ack_to_client(sock_fd);
-        return;
-    }
-
-    // --- LOCK SS SOCKET ---
-    pthread_mutex_lock(&ss->socket_mutex);
-
-    header->dest_component = COMPONENT_STORAGE_SERVER;
-    if (send_header(ss->ss_socket_fd, header) == -1) {
-        pthread_mutex_unlock(&ss->socket_mutex);
-        write_log("ERROR", "Failed to send MSG_DELETE to SS %d.", ss_index);
-        remove_storage_server(ss->ss_socket_fd);
-        send_ack_to_client(sock_fd);
-        return;
+    } else if (ss_call(ss, header, NULL, &ss_response, NULL) == -1) {
+        write_log("ERROR", "SS %d failed to answer DELETE request.", ss_index);
+    } else if (ss_response.msg_type != MSG_ACK) {
+        write_log("ERROR", "SS %d failed to ACK delete, but file is gone from NS records.", ss_index);
     }
 
-    MessageHeader ss_response;
-    if (recv_header(ss->ss_socket_fd, &ss_response) == -1) {
-        pthread_mutex_unlock(&ss->socket_mutex);
-        write_log("ERROR", "SS %d disconnected after DELETE request.", ss_index);
-        remove_storage_server(ss->ss_socket_fd);
-        send_ack_to_client(sock_fd);
-        return;
-    }
-    
-    pthread_mutex_unlock(&ss->socket_mutex);
-    // --- UNLOCK SS SOCKET ---
-
-    if (ss_response.msg_type != MSG_ACK) {
-        write_log("ERROR", "SS %d failed to ACK delete, but file is gone from NS records.", ss_index);
+    for (int i = 0; i < copy_count; i++) {
+        if (replica_calls[i] == NULL) continue;
+        MessageHeader replica_response;
+        if (ss_call_end(replica_calls[i], &replica_response, NULL, SS_CALL_TIMEOUT_MS) == -1 ||
+            replica_response.msg_type != MSG_ACK) {
+            write_log("WARN", "Replica SS %d did not confirm DELETE of '%s'; its copy may remain.",
+                      copies[i], header->filename);
+        }
     }
 
     send_ack_to_client(sock_fd);
@@ -230,35 +216,18 @@ void handle_undo_request(int sock_fd, MessageHeader* header, const char* client_
         return;
     }
 
-    // --- LOCK SS SOCKET ---
-    pthread_mutex_lock(&ss->socket_mutex);
-
-    int ss_sock = ss->ss_socket_fd;
-    header->dest_component = COMPONENT_STORAGE_SERVER;
-    if (send_header(ss_sock, header) == -1) {
-        pthread_mutex_unlock(&ss->socket_mutex);
-        send_error_to_client(sock_fd, "Failed to communicate with storage server.");
-        remove_storage_server(ss_sock);
-        return;
-    }
-
     MessageHeader ss_response;
-    if (recv_header(ss_sock, &ss_response) == -1) {
-        pthread_mutex_unlock(&ss->socket_mutex);
+    if (ss_call(ss, header, NULL, &ss_response, NULL) == -1) {
         send_error_to_client(sock_fd, "Storage server disconnected or failed to respond.");
-        remove_storage_server(ss_sock);
         return;
     }
-    
-    pthread_mutex_unlock(&ss->socket_mutex);
-    // --- UNLOCK SS SOCKET ---
 
     if (ss_response.msg_type != MSG_ACK) {
         send_error_to_client(sock_fd, "Storage server failed to perform undo.");
         return;
     }
 
-    write_log("CLIENT_CMD", "Socket %d: SS %d ACK'd file undo.", sock_fd, ss_sock);
+    write_log("CLIENT_CMD", "Socket %d: SS %d ACK'd file undo.", sock_fd, ss_index);
     send_ack_to_client(sock_fd);
 }
 
@@ -285,43 +254,39 @@ void handle_info_request(int sock_fd, MessageHeader* header, const char* client_
     
     SSMetadataPayload metadata;
     memset(&metadata, 0, sizeof(metadata));
-    int ss_sock = ss->ss_socket_fd;
 
-    // --- LOCK SS SOCKET ---
-    pthread_mutex_lock(&ss->socket_mutex);
-
-    MessageHeader meta_req_header;
-    memset(&meta_req_header, 0, sizeof(meta_req_header));
-    meta_req_header.msg_type = MSG_INTERNAL_GET_METADATA;
-    meta_req_header.source_component = COMPONENT_NAME_SERVER;
-    strncpy(meta_req_header.filename, header->filename, MAX_FILENAME - 1);
-    
-    if (send_header(ss_sock, &meta_req_header) == -1) {
-        pthread_mutex_unlock(&ss->socket_mutex);
-        send_error_to_client(sock_fd, "Failed to communicate with storage server.");
-        remove_storage_server(ss_sock);
-        return;
-    }
-    
-    MessageHeader meta_resp_header;
-    if (recv_header(ss_sock, &meta_resp_header) == -1 || meta_resp_header.msg_type != MSG_INTERNAL_METADATA_RESP) {
-        pthread_mutex_unlock(&ss->socket_mutex);
-        send_error_to_client(sock_fd, "Storage server failed to send metadata.");
-        remove_storage_server(ss_sock);
-        return;
-    }
-
-    if (recv_all(ss_sock, &metadata, sizeof(SSMetadataPayload)) == -1) {
-        pthread_mutex_unlock(&ss->socket_mutex);
-        send_error_to_client(sock_fd, "Failed to receive metadata payload.");
-        remove_storage_server(ss_sock);
-        return;
+    if (search_metadata_is_fresh(&file_data)) {
+        // The SS pushes every change, so the trie copy is authoritative.
+        metadata.word_count = file_data.word_count;
+        metadata.char_count = file_data.char_count;
+        metadata.created = file_data.created;
+        metadata.last_modified = file_data.modified;
+        metadata.last_accessed = file_data.last_accessed;
+        strncpy(metadata.last_accessed_by, file_data.last_accessed_by, 64 - 1);
+    } else {
+        MessageHeader meta_req_header;
+        memset(&meta_req_header, 0, sizeof(meta_req_header));
+        meta_req_header.msg_type = MSG_INTERNAL_GET_METADATA;
+        strncpy(meta_req_header.filename, header->filename, MAX_FILENAME - 1);
+        
+        MessageHeader meta_resp_header;
+        void* meta_buf = NULL;
+        if (ss_call(ss, &meta_req_header, NULL, &meta_resp_header, &meta_buf) == -1) {
+            send_error_to_client(sock_fd, "Failed to communicate with storage server.");
+            return;
+        }
+        if (meta_resp_header.msg_type != MSG_INTERNAL_METADATA_RESP ||
+            meta_resp_header.payload_length != sizeof(SSMetadataPayload)) {
+            free(meta_buf);
+            send_error_to_client(sock_fd, "Storage server failed to send metadata.");
+            return;
+        }
+        memcpy(&metadata, meta_buf, sizeof(SSMetadataPayload));
+        free(meta_buf);
+        search_apply_metadata(header->filename, &metadata);
+        
+        write_log("CLIENT_CMD", "Socket %d: Got metadata from SS %d", sock_fd, file_data.ss_index);
     }
-    
-    pthread_mutex_unlock(&ss->socket_mutex);
-    // --- UNLOCK SS SOCKET ---
-    
-    write_log("CLIENT_CMD", "Socket %d: Got metadata from SS %d", sock_fd, ss_sock);
 
     FileInfoPayload payload;
     memset(&payload, 0, sizeof(payload));
@@ -349,8 +314,19 @@ void handle_info_request(int sock_fd, MessageHeader* header, const char* client_
     resp_header.dest_component = COMPONENT_CLIENT;
     resp_header.payload_length = sizeof(FileInfoPayload);
 
+    // v2 clients get the compact form; it never outgrows the struct
+    uint8_t compact[sizeof(FileInfoPayload)];
+    const void* body = &payload;
+    if (protocol_version(sock_fd) == PROTOCOL_V2) {
+        size_t length = encode_file_info(&payload, compact, sizeof(compact));
+        if (length > 0) {
+            resp_header.payload_length = (uint32_t)length;
+            body = compact;
+        }
+    }
+
     if (send_header(sock_fd, &resp_header) == -1) { return; }
-    if (send_all(sock_fd, &payload, sizeof(payload)) == -1) { return; }
+    if (send_all(sock_fd, body, resp_header.payload_length) == -1) { return; }
 
     write_log("CLIENT_CMD", "Socket %d: Sent full INFO response for '%s'",
               sock_fd, header->filename);
@@ -392,16 +368,11 @@ void handle_add_access(int sock_fd, MessageHeader* header, const char* client_us
     strncpy(ss_header.filename, header->filename, MAX_FILENAME - 1);
     ss_header.payload_length = sizeof(AccessControlPayload);
 
-    pthread_mutex_lock(&ss->socket_mutex);
-    send_header(ss->ss_socket_fd, &ss_header);
-    send_all(ss->ss_socket_fd, &payload, sizeof(payload));
-    
     // Wait for ACK from SS
     MessageHeader ss_response;
-    recv_header(ss->ss_socket_fd, &ss_response);
-    pthread_mutex_unlock(&ss->socket_mutex);
-
-    if (ss_response.msg_type == MSG_ACK) {
+    if (ss_call(ss, &ss_header, &payload, &ss_response, NULL) == 0 &&
+        ss_response.msg_type == MSG_ACK) {
+        replication_forward(header->filename, &ss_header, &payload); // Replicas check ACLs too
         send_ack_to_client(sock_fd);
     } else {
         send_error_to_client(sock_fd, "Storage server failed to update ACL.");
@@ -447,16 +418,11 @@ void handle_rem_access(int sock_fd, MessageHeader* header, const char* client_us
     ss_header.payload_length = strlen(target_username) + 1;
 
 
-    pthread_mutex_lock(&ss->socket_mutex);
-    send_header(ss->ss_socket_fd, &ss_header);
-    send_all(ss->ss_socket_fd, target_username, ss_header.payload_length);
-    
     // Wait for ACK from SS
     MessageHeader ss_response;
-    recv_header(ss->ss_socket_fd, &ss_response);
-    pthread_mutex_unlock(&ss->socket_mutex);
-
-    if (ss_response.msg_type == MSG_ACK) {
+    if (ss_call(ss, &ss_header, target_username, &ss_response, NULL) == 0 &&
+        ss_response.msg_type == MSG_ACK) {
+        replication_forward(header->filename, &ss_header, target_username);
         send_ack_to_client(sock_fd);
     } else {
         send_error_to_client(sock_fd, "Storage server failed to update ACL.");
@@ -513,6 +479,31 @@ void handle_locate_file_request(int sock_fd, MessageHeader* header, const char*
 //  COMMAND HANDLERS (REDIRECT COMMANDS)
 // =========================================================================
 
+/**
+ * @brief Chooses where a READ or STREAM goes: the primary or a current
+ * replica, whichever is less busy. Tops up the file's replicas if it has
+ * fewer than it should (e.g. none were free when it was created).
+ * @return The server, or NULL once an error has been sent.
+ */
+static StorageServerInfo* pick_read_server(int sock_fd, const char* filename, const char* username) {
+    int servers[NS_MAX_REPLICAS + 1];
+    int replica_count = 0;
+    int count = search_get_read_servers(filename, username, servers, NS_MAX_REPLICAS + 1, &replica_count);
+    if (count == -1) {
+        send_error_to_client(sock_fd, "File not found.");
+        return NULL;
+    }
+    if (replica_count < replication_factor()) replication_add_replicas(filename);
+
+    int ss_index = storage_manager_pick_reader(servers, count);
+    StorageServerInfo* ss = ss_index == -1 ? NULL : get_ss_by_index(ss_index);
+    if (ss == NULL || !ss->is_active) {
+        send_error_to_client(sock_fd, "File is on an inactive server.");
+        return NULL;
+    }
+    return ss;
+}
+
 void handle_read_request(int sock_fd, MessageHeader* header, const char* client_username) {
     write_log("CLIENT_CMD", "User '%s' (Socket %d): Received MSG_READ for file '%s'",
               client_username, sock_fd, header->filename);
@@ -522,17 +513,8 @@ void handle_read_request(int sock_fd, MessageHeader* header, const char* client_
         return;
     }
 
-    int ss_index = search_find_file(header->filename);
-    if (ss_index == -1) {
-        send_error_to_client(sock_fd, "File not found.");
-        return;
-    }
-
-    StorageServerInfo* ss = get_ss_by_index(ss_index);
-    if (ss == NULL || !ss->is_active) {
-        send_error_to_client(sock_fd, "File is on an inactive server.");
-        return;
-    }
+    StorageServerInfo* ss = pick_read_server(sock_fd, header->filename, client_username);
+    if (ss == NULL) return;
 
     SSReadPayload payload;
     memset(&payload, 0, sizeof(payload));
@@ -573,6 +555,7 @@ void handle_write_request(int sock_fd, MessageHeader* header, const char* client
         send_error_to_client(sock_fd, "File is on an inactive server.");
         return;
     }
+    search_note_writer(header->filename, client_username); // Its next reads stay on the primary
 
     SSReadPayload payload;
     memset(&payload, 0, sizeof(payload));
@@ -602,17 +585,8 @@ void handle_stream_request(int sock_fd, MessageHeader* header, const char* clien
         return;
     }
 
-    int ss_index = search_find_file(header->filename);
-    if (ss_index == -1) {
-        send_error_to_client(sock_fd, "File not found.");
-        return;
-    }
-
-    StorageServerInfo* ss = get_ss_by_index(ss_index);
-    if (ss == NULL || !ss->is_active) {
-        send_error_to_client(sock_fd, "File is on an inactive server.");
-        return;
-    }
+    StorageServerInfo* ss = pick_read_server(sock_fd, header->filename, client_username);
+    if (ss == NULL) return;
 
     SSReadPayload payload;
     memset(&payload, 0, sizeof(payload));
@@ -923,18 +897,13 @@ void handle_move_file_request(int sock_fd, MessageHeader* header, const char* cl
     strncpy(ss_header.filename, header->filename, MAX_FILENAME - 1);
     ss_header.payload_length = strlen(foldername) + 1;
 
-    pthread_mutex_lock(&ss->socket_mutex);
-    send_header(ss->ss_socket_fd, &ss_header);
-    send_all(ss->ss_socket_fd, foldername, ss_header.payload_length);
-
     // Wait for ACK from SS
     MessageHeader resp;
-    if (recv_header(ss->ss_socket_fd, &resp) == -1 || resp.msg_type != MSG_ACK) {
-        pthread_mutex_unlock(&ss->socket_mutex);
+    if (ss_call(ss, &ss_header, foldername, &resp, NULL) == -1 || resp.msg_type != MSG_ACK) {
         send_error_to_client(sock_fd, "Storage server failed to update folder.");
         return;
     }
-    pthread_mutex_unlock(&ss->socket_mutex);
+    replication_forward(header->filename, &ss_header, foldername);
 
     send_ack_to_client(sock_fd);
 }
@@ -962,7 +931,10 @@ void handle_move_folder_request(int sock_fd, MessageHeader* header, const char*
         return;
     }
 
-    // Notify each SS of changed files
+    // Notify each SS of changed files. All updates are put on the wire
+    // first and the ACKs collected afterwards, so N files cost about one
+    // round trip per server instead of N.
+    SSPendingCall** calls = calloc(updated_count > 0 ? updated_count : 1, sizeof(SSPendingCall*));
     for (int i = 0; i < updated_count; i++) {
         MoveFileUpdate *u = &updates[i];
         StorageServerInfo* ss = get_ss_by_index(u->ss_index);
@@ -971,18 +943,34 @@ void handle_move_folder_request(int sock_fd, MessageHeader* header, const char*
         MessageHeader ss_header;
         memset(&ss_header, 0, sizeof(ss_header));
         ss_header.msg_type = MSG_INTERNAL_SET_FOLDER;
-        ss_header.source_component = COMPONENT_NAME_SERVER;
         strncpy(ss_header.filename, u->filename, MAX_FILENAME - 1);
         ss_header.payload_length = strlen(u->folder) + 1;
 
-        pthread_mutex_lock(&ss->socket_mutex);
-        send_header(ss->ss_socket_fd, &ss_header);
-        send_all(ss->ss_socket_fd, u->folder, ss_header.payload_length);
-
-        // Wait for ACK
-        MessageHeader resp;
-        recv_header(ss->ss_socket_fd, &resp);
-        pthread_mutex_unlock(&ss->socket_mutex);
+        if (calls) {
+            calls[i] = ss_call_begin(ss, &ss_header, u->folder);
+        } else {
+            MessageHeader resp;
+            ss_call(ss, &ss_header, u->folder, &resp, NULL);
+        }
+    }
+    if (calls) {
+        for (int i = 0; i < updated_count; i++) {
+            if (calls[i] == NULL) continue;
+            MessageHeader resp;
+            if (ss_call_end(calls[i], &resp, NULL, SS_CALL_TIMEOUT_MS) == -1) {
+                write_log("WARN", "SS %d did not confirm folder update for '%s'.",
+                          updates[i].ss_index, updates[i].filename);
+            }
+        }
+        free(calls);
+    }
+    for (int i = 0; i < updated_count; i++) {
+        MessageHeader ss_header;
+        memset(&ss_header, 0, sizeof(ss_header));
+        ss_header.msg_type = MSG_INTERNAL_SET_FOLDER;
+        strncpy(ss_header.filename, updates[i].filename, MAX_FILENAME - 1);
+        ss_header.payload_length = strlen(updates[i].folder) + 1;
+        replication_forward(updates[i].filename, &ss_header, updates[i].folder);
     }
 
     free(updates);
@@ -1019,11 +1007,207 @@ void handle_view_folder_request(int sock_fd, MessageHeader* header, const char*
     free(list_buffer);
 }
 
+void handle_stats_request(int sock_fd, MessageHeader* header, const char* client_username) {
+    (void)header;
+    write_log("CLIENT_CMD", "User '%s' (Socket %d): Received MSG_STATS request",
+              client_username, sock_fd);
+
+    size_t length = 0;
+    char* text = metrics_render("ns", &length);
+    if (!text) { send_error_to_client(sock_fd, "Internal server error (malloc)."); return; }
+
+    // Ask every SS at once, then collect; a dead or slow SS is just left out
+    SSPendingCall** calls = calloc(ss_registry_capacity, sizeof(SSPendingCall*));
+    for (int i = 0; calls != NULL && i < ss_registry_capacity; i++) {
+        StorageServerInfo* ss = get_ss_by_index(i);
+        if (ss == NULL) continue;
+        MessageHeader req;
+        memset(&req, 0, sizeof(req));
+        req.msg_type = MSG_STATS;
+        calls[i] = ss_call_begin(ss, &req, NULL);
+    }
+    for (int i = 0; calls != NULL && i < ss_registry_capacity; i++) {
+        if (calls[i] == NULL) continue;
+        MessageHeader resp;
+        char* ss_text = NULL;
+        if (ss_call_end(calls[i], &resp, (void**)&ss_text, SS_CALL_TIMEOUT_MS) == 0 &&
+            resp.msg_type == MSG_STATS_RESPONSE && ss_text != NULL) {
+            char* grown = realloc(text, length + resp.payload_length + 1);
+            if (grown) {
+                text = grown;
+                memcpy(text + length, ss_text, resp.payload_length);
+                length += resp.payload_length;
+                text[length] = '\0';
+            }
+        }
+        free(ss_text);
+    }
+    free(calls);
+
+    MessageHeader resp_header;
+    memset(&resp_header, 0, sizeof(resp_header));
+    resp_header.msg_type = MSG_STATS_RESPONSE;
+    resp_header.source_component = COMPONENT_NAME_SERVER;
+    resp_header.dest_component = COMPONENT_CLIENT;
+    resp_header.payload_length = (uint32_t)length;
+    if (send_header(sock_fd, &resp_header) == 0 && length > 0) {
+        send_all(sock_fd, text, length);
+    }
+    free(text);
+}
+
+static int compare_lines(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// How an SS answered a search, best last: a warming SS may not have
+// indexed every file yet, so a copy that has finished its build wins
+#define SEARCH_NO_ANSWER 0
+#define SEARCH_WARMING   1
+#define SEARCH_ANSWERED  2
+
+/**
+ * @brief Turns one SS answer line ("<file> <n> <n>...") into the client's
+ * form, if 'user' may read the file and 'ss_index' is the copy to take
+ * it from: the first copy (the primary, then its replicas) with the best
+ * answer. Replicas index their copies too, so this is what drops duplicates.
+ * @return A malloc'd line, or NULL to leave the hit out.
+ */
+static char* merge_search_hit(char* line, int ss_index, const int* answered, const char* user) {
+    char* numbers = strchr(line, ' ');
+    if (numbers == NULL) return NULL;
+    *numbers++ = '\0';
+    if (!search_check_permission(line, user, PERM_READ)) return NULL;
+
+    int copies[NS_MAX_REPLICAS + 1];
+    int count = search_get_copies(line, copies, NS_MAX_REPLICAS + 1);
+    int source = -1;
+    for (int i = 0; i < count; i++) {
+        if (copies[i] < 0 || copies[i] >= ss_registry_capacity) continue;
+        if (source == -1 ? answered[copies[i]] != SEARCH_NO_ANSWER : answered[copies[i]] > answered[source]) {
+            source = copies[i];
+        }
+    }
+    if (source != ss_index) return NULL;
+
+    size_t size = strlen(line) + 2 * strlen(numbers) + 32;
+    char* out = malloc(size);
+    if (out == NULL) return NULL;
+    int length = snprintf(out, size, "--> %s (sentences ", line);
+    char* save = NULL;
+    int first = 1;
+    for (char* n = strtok_r(numbers, " ", &save); n; n = strtok_r(NULL, " ", &save)) {
+        length += snprintf(out + length, size - length, "%s%s", first ? "" : ", ", n);
+        first = 0;
+    }
+    snprintf(out + length, size - length, ")\n");
+    return out;
+}
+
+void handle_search_content_request(int sock_fd, MessageHeader* header, const char* client_username) {
+    write_log("CLIENT_CMD", "User '%s' (Socket %d): Received MSG_SEARCH_CONTENT for \"%s\"",
+              client_username, sock_fd, header->filename);
+    if (header->filename[0] == '\0') {
+        send_error_to_client(sock_fd, "Nothing to search for.");
+        return;
+    }
+
+    // Ask every SS at once, then collect; a dead or slow SS is just left out
+    SSPendingCall** calls = calloc(ss_registry_capacity, sizeof(SSPendingCall*));
+    char** answers = calloc(ss_registry_capacity, sizeof(char*));
+    int* answered = calloc(ss_registry_capacity, sizeof(int));
+    if (calls == NULL || answers == NULL || answered == NULL) {
+        free(calls);
+        free(answers);
+        free(answered);
+        send_error_to_client(sock_fd, "Internal server error (malloc).");
+        return;
+    }
+    for (int i = 0; i < ss_registry_capacity; i++) {
+        StorageServerInfo* ss = get_ss_by_index(i);
+        if (ss == NULL || !ss->is_active) continue;
+        MessageHeader req;
+        memset(&req, 0, sizeof(req));
+        req.msg_type = MSG_INTERNAL_SEARCH_CONTENT;
+        strncpy(req.filename, header->filename, MAX_FILENAME - 1);
+        calls[i] = ss_call_begin(ss, &req, NULL);
+    }
+    for (int i = 0; i < ss_registry_capacity; i++) {
+        if (calls[i] == NULL) continue;
+        MessageHeader resp;
+        char* hits = NULL;
+        if (ss_call_end(calls[i], &resp, (void**)&hits, SS_CALL_TIMEOUT_MS) == 0 &&
+            resp.msg_type == MSG_INTERNAL_SEARCH_RESULT) {
+            answered[i] = strcmp(resp.filename, SEARCH_INDEX_WARMING) == 0 ? SEARCH_WARMING : SEARCH_ANSWERED;
+            answers[i] = hits; // The channel NUL-terminates payloads
+        } else {
+            free(hits);
+        }
+    }
+    free(calls);
+    int warming = 0;
+    for (int i = 0; i < ss_registry_capacity; i++) warming |= answered[i] == SEARCH_WARMING;
+
+    // Merge, keeping only what the user may read, one line per file
+    char** lines = NULL;
+    int line_count = 0, line_capacity = 0;
+    for (int i = 0; i < ss_registry_capacity; i++) {
+        if (answers[i] == NULL) continue;
+        char* save = NULL;
+        for (char* line = strtok_r(answers[i], "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+            char* merged = merge_search_hit(line, i, answered, client_username);
+            if (merged == NULL) continue;
+            if (line_count == line_capacity) {
+                int capacity = line_capacity ? line_capacity * 2 : 16;
+                char** grown = realloc(lines, sizeof(char*) * capacity);
+                if (grown == NULL) {
+                    free(merged);
+                    break;
+                }
+                lines = grown;
+                line_capacity = capacity;
+            }
+            lines[line_count++] = merged;
+        }
+        free(answers[i]);
+    }
+    free(answers);
+    free(answered);
+
+    qsort(lines, line_count, sizeof(char*), compare_lines);
+    size_t length = 0;
+    for (int i = 0; i < line_count; i++) length += strlen(lines[i]);
+    char* text = malloc(length + 1);
+    size_t used = 0;
+    for (int i = 0; i < line_count; i++) {
+        size_t n = strlen(lines[i]);
+        if (text) memcpy(text + used, lines[i], n);
+        used += n;
+        free(lines[i]);
+    }
+    free(lines);
+    if (text == NULL) { send_error_to_client(sock_fd, "Internal server error (malloc)."); return; }
+
+    MessageHeader resp_header;
+    memset(&resp_header, 0, sizeof(resp_header));
+    resp_header.msg_type = MSG_SEARCH_RESPONSE;
+    resp_header.source_component = COMPONENT_NAME_SERVER;
+    resp_header.dest_component = COMPONENT_CLIENT;
+    if (warming) strcpy(resp_header.filename, SEARCH_INDEX_WARMING);
+    resp_header.payload_length = (uint32_t)length;
+    if (send_header(sock_fd, &resp_header) == 0 && length > 0) {
+        send_all(sock_fd, text, length);
+    }
+    free(text);
+    write_log("CLIENT_CMD", "Socket %d: Sent %d search matches for \"%s\"", sock_fd, line_count, header->filename);
+}
+
 // =========================================================================
 //  MESSAGE ROUTER
 // =========================================================================
 
 static void route_message(int sock_fd, MessageHeader* header, const char* client_username) {
+    uint64_t started = metrics_begin();
     switch (header->msg_type) {
         case MSG_CREATE:
             handle_create_request(sock_fd, header, client_username);
@@ -1091,60 +1275,71 @@ static void route_message(int sock_fd, MessageHeader* header, const char* client
         case MSG_LOCATE_FILE:
             handle_locate_file_request(sock_fd, header, client_username);
             break;
+        case MSG_STATS:
+            handle_stats_request(sock_fd, header, client_username);
+            break;
+        case MSG_SEARCH_CONTENT:
+            handle_search_content_request(sock_fd, header, client_username);
+            break;
         default:
             write_log("WARN", "Socket %d: Received unknown msg_type: %d",
                       sock_fd, header->msg_type);
             send_error_to_client(sock_fd, "Unknown command.");
             break;
     }
+    metrics_end(METRICS_NS_CLIENT, msg_type_name(header->msg_type), started);
 }
 
 // =========================================================================
 //  MAIN CLIENT HANDLER FUNCTION
 // =========================================================================
 
-void handle_client_connection(int sock_fd, MessageHeader* initial_header) {
-    char client_username[64];
-
+int handle_client_login(int sock_fd, MessageHeader* initial_header, char* out_username) {
     // 1. Authenticate (Register)
     if (initial_header->msg_type != MSG_REGISTER_CLIENT) {
         write_log("WARN", "Socket %d: First msg was %d, not MSG_REGISTER_CLIENT. Closing.",
                   sock_fd, initial_header->msg_type);
         send_error_to_client(sock_fd, "Must register username first.");
-        close(sock_fd);
-        return;
+        return -1;
     }
     
-    strncpy(client_username, initial_header->filename, 64);
-    client_username[63] = '\0';
+    strncpy(out_username, initial_header->filename, 64);
+    out_username[63] = '\0';
     write_log("CLIENT_HANDLER", "Client '%s' registered on socket %d.", 
-              client_username, sock_fd);
+              out_username, sock_fd);
 
-    // 2. Send ACK for registration
-    send_ack_to_client(sock_fd);
+    // 2. Send ACK for registration, taking up a v2 offer
+    MessageHeader ack_header;
+    memset(&ack_header, 0, sizeof(ack_header));
+    ack_header.msg_type = MSG_ACK;
+    ack_header.source_component = COMPONENT_NAME_SERVER;
+    ack_header.dest_component = COMPONENT_CLIENT;
+    ack_header.request_id = protocol_accept_offer(initial_header->request_id);
+    if (send_header(sock_fd, &ack_header) == -1) {
+        write_log("WARN", "Socket %d: Failed to send ACK to client", sock_fd);
+    }
+    if (ack_header.request_id == PROTOCOL_V2) protocol_set_version(sock_fd, PROTOCOL_V2);
 
     // 3. Register user with the global user manager
-    user_manager_register(client_username);
-    
-    // 4. Loop to receive all subsequent messages
-    MessageHeader subsequent_header;
-    int connection_alive = 1;
-    while (connection_alive && recv_header(sock_fd, &subsequent_header) == 0) {
-        
-        if (subsequent_header.msg_type == MSG_EXEC) {
-            connection_alive = 0; // The exec handler will take over
-        }
-        
-        route_message(sock_fd, &subsequent_header, client_username);
-    }
-    
-    // 5. If recv_header fails, the client disconnected
-    if (connection_alive) { 
-        write_log("CLIENT_HANDLER", "Client '%s' (Socket %d): Disconnected.", 
-                  client_username, sock_fd);
-        close(sock_fd);
+    user_manager_register(out_username);
+    return 0;
+}
+
+int handle_client_message(int sock_fd, MessageHeader* header, const char* client_username) {
+    route_message(sock_fd, header, client_username);
+
+    // The exec handler streams its output and closes the socket itself.
+    if (header->msg_type == MSG_EXEC) {
+        return -1;
     }
-    
-    // 6. Deregister user from the global list
+    return 0;
+}
+
+void handle_client_disconnect(int sock_fd, const char* client_username) {
+    write_log("CLIENT_HANDLER", "Client '%s' (Socket %d): Disconnected.", 
+              client_username, sock_fd);
+    close(sock_fd);
+
+    // Deregister user from the global list
     user_manager_deregister(client_username);
-}
\ No newline at end of file
+}
@@ -3,24 +3,31 @@
 #include "protocol.h"
 #include "search.h"
 #include "storage_manager.h"
-#include "socket_utils.h" // For connect_socket_no_exit (though we're removing it)
+#include "ss_channel.h"
+#include "metrics.h"
+#include "socket_utils.h"
 
-#include <stdio.h>    // For popen, pclose, fgets
+#include <stdio.h>
 #include <string.h>
-#include <unistd.h>   // For close()
+#include <unistd.h>   // For close(), fork(), pipe()
 #include <stdlib.h>   // For malloc/free
-#include <pthread.h>  // For pthread_mutex_lock/unlock
+#include <pthread.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/wait.h>
 #include "common.h"
 
-#define EXEC_BUFFER_SIZE 4096
-
 // Helper function from client_handler (we should move this to common)
 static void send_error_to_client(int sock_fd, const char* error_message) {
     write_log("ERROR", "Socket %d: %s", sock_fd, error_message);
-    
+    metrics_mark_error();
+
     MessageHeader err_header;
     memset(&err_header, 0, sizeof(err_header));
-    
+
     err_header.msg_type = MSG_ERROR;
     err_header.source_component = COMPONENT_NAME_SERVER;
     err_header.dest_component = COMPONENT_CLIENT;
@@ -30,112 +37,262 @@ static void send_error_to_client(int sock_fd, const char* error_message) {
     send_header(sock_fd, &err_header);
 }
 
+// One queued EXEC; owns the client socket
+typedef struct ExecJob {
+    int client_sock_fd;
+    char filename[MAX_FILENAME];
+    char username[64];
+    struct ExecJob* next;
+} ExecJob;
+
+static ExecJob* queue_head = NULL;
+static ExecJob* queue_tail = NULL;
+static int queue_length = 0;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+
+// =========================================================================
+//  RUNNING A COMMAND
+// =========================================================================
+
+static long elapsed_ms(const struct timespec* since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
 /**
- * @brief Handles a MSG_EXEC request from a client.
+ * @brief Starts 'command' under /bin/sh in its own process group, with
+ * stdout and stderr on a pipe.
+ * @return The child's pid (the read end is put in 'out_fd'), or -1.
  */
-void handle_exec_request(int client_sock_fd, MessageHeader* header, const char* client_username) {
-    write_log("CLIENT_CMD", "User '%s' (Socket %d): Received MSG_EXEC for file '%s'",
-              client_username, client_sock_fd, header->filename);
+static pid_t spawn_command(const char* command, int* out_fd) {
+    int fds[2];
+    if (pipe(fds) == -1) return -1;
+    pid_t pid = fork();
+    if (pid == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        // Only async-signal-safe calls from here: the parent has threads
+        setpgid(0, 0);
+        signal(SIGPIPE, SIG_DFL);
+        int null_fd = open("/dev/null", O_RDONLY);
+        if (null_fd != -1) dup2(null_fd, STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        // Drop the NS's sockets, so a lingering command cannot hold them open
+        long max_fd = sysconf(_SC_OPEN_MAX);
+        for (int fd = STDERR_FILENO + 1; fd < (max_fd > 0 ? max_fd : 1024); fd++) close(fd);
+        execl("/bin/sh", "sh", "-c", command, (char*)NULL);
+        _exit(127);
+    }
+    setpgid(pid, pid); // Also here, so the kill below cannot race the child's own call
+    close(fds[1]);
+    *out_fd = fds[0];
+    return pid;
+}
 
-    // 1. Check permissions
-    if (!search_check_permission(header->filename, client_username, PERM_READ)) {
-        send_error_to_client(client_sock_fd, "Access Denied (Read Permission Required).");
-        close(client_sock_fd);
+/**
+ * @brief Runs a command and forwards its output to the client in chunks
+ * of up to EXEC_OUTPUT_CHUNK, sent when full, when the command goes quiet
+ * for EXEC_FLUSH_MS, or at the end. The command is killed after
+ * EXEC_TIMEOUT_SEC, or as soon as the client goes away.
+ */
+static void run_command(int client_sock_fd, const char* command) {
+    int out_fd;
+    pid_t pid = spawn_command(command, &out_fd);
+    if (pid == -1) {
+        send_error_to_client(client_sock_fd, "Failed to execute command on server.");
         return;
     }
 
-    // 2. Find the file
-    int ss_index = search_find_file(header->filename);
-    if (ss_index == -1) {
+    char* buffer = malloc(EXEC_OUTPUT_CHUNK);
+    size_t buffered = 0;
+    int timed_out = 0, client_gone = buffer == NULL;
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    while (!client_gone) {
+        long remaining_ms = (long)EXEC_TIMEOUT_SEC * 1000 - elapsed_ms(&started);
+        if (remaining_ms <= 0) {
+            timed_out = 1;
+            break;
+        }
+        // The client sends nothing during EXEC, so its socket turns readable only when it hangs up
+        struct pollfd pfds[2] = {
+            { .fd = out_fd, .events = POLLIN },
+            { .fd = client_sock_fd, .events = POLLIN },
+        };
+        int ready = poll(pfds, 2, buffered > 0 && remaining_ms > EXEC_FLUSH_MS ? EXEC_FLUSH_MS : (int)remaining_ms);
+        if (ready == -1 && errno == EINTR) continue;
+        if (ready > 0 && pfds[1].revents) {
+            char probe;
+            if (recv(client_sock_fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT) <= 0) {
+                client_gone = 1;
+                break;
+            }
+        }
+        if (ready == 0) { // Quiet: let the client see what there is so far
+            if (buffered > 0 && send_all(client_sock_fd, buffer, buffered) == -1) client_gone = 1;
+            buffered = 0;
+            continue;
+        }
+        if (ready > 0 && pfds[0].revents == 0) continue;
+        ssize_t n = ready == -1 ? -1 : read(out_fd, buffer + buffered, EXEC_OUTPUT_CHUNK - buffered);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) break; // EOF: the command is done
+        buffered += (size_t)n;
+        if (buffered == EXEC_OUTPUT_CHUNK) {
+            if (send_all(client_sock_fd, buffer, buffered) == -1) client_gone = 1;
+            buffered = 0;
+        }
+    }
+
+    if (timed_out || client_gone) kill(-pid, SIGKILL);
+    close(out_fd);
+    waitpid(pid, NULL, 0);
+
+    if (!client_gone && buffered > 0 && send_all(client_sock_fd, buffer, buffered) == -1) client_gone = 1;
+    if (!client_gone && timed_out) {
+        char notice[64];
+        int len = snprintf(notice, sizeof(notice), "\n[Command killed after %d seconds]\n", EXEC_TIMEOUT_SEC);
+        send_all(client_sock_fd, notice, (size_t)len);
+    }
+    if (client_gone) write_log("WARN", "[EXEC] Client disconnected during output stream.");
+    if (timed_out) write_log("WARN", "[EXEC] Killed command on socket %d after %d s.", client_sock_fd, EXEC_TIMEOUT_SEC);
+    free(buffer);
+}
+
+// =========================================================================
+//  POOL
+// =========================================================================
+
+/**
+ * @brief Fetches the file's content from its primary or a current replica
+ * and runs it.
+ */
+static void execute_job(const ExecJob* job) {
+    int client_sock_fd = job->client_sock_fd;
+
+    int servers[NS_MAX_REPLICAS + 1];
+    int replica_count = 0;
+    int count = search_get_read_servers(job->filename, job->username, servers, NS_MAX_REPLICAS + 1, &replica_count);
+    if (count == -1) {
         send_error_to_client(client_sock_fd, "File not found.");
-        close(client_sock_fd);
         return;
     }
-    
-    // 3. Get the SS info
-    StorageServerInfo* ss = get_ss_by_index(ss_index);
+    int ss_index = storage_manager_pick_reader(servers, count);
+    StorageServerInfo* ss = ss_index == -1 ? NULL : get_ss_by_index(ss_index);
     if (ss == NULL || !ss->is_active) {
         send_error_to_client(client_sock_fd, "File is on an inactive server.");
-        close(client_sock_fd);
         return;
     }
 
-    // 4. --- NEW LOGIC: Use the EXISTING SS socket ---
-    int ss_sock = ss->ss_socket_fd; // Get the socket from registration
-    
-    // LOCK SS SOCKET TO ENSURE EXCLUSIVE ACCESS
-    pthread_mutex_lock(&ss->socket_mutex);
-    
-    // 5. Send the internal read request
+    // Other calls share the control channel with this one; none waits on it
     MessageHeader req_header;
     memset(&req_header, 0, sizeof(req_header));
     req_header.msg_type = MSG_INTERNAL_READ;
-    req_header.source_component = COMPONENT_NAME_SERVER;
-    strncpy(req_header.filename, header->filename, MAX_FILENAME - 1);
+    strncpy(req_header.filename, job->filename, MAX_FILENAME - 1);
 
-    if (send_header(ss_sock, &req_header) == -1) {
-        pthread_mutex_unlock(&ss->socket_mutex);
-        send_error_to_client(client_sock_fd, "Failed to send INTERNAL_READ to SS.");
-        remove_storage_server(ss_sock); // The SS is disconnected
-        close(client_sock_fd);
+    MessageHeader resp_header;
+    char* file_content = NULL;
+    if (ss_call(ss, &req_header, NULL, &resp_header, (void**)&file_content) == -1) {
+        send_error_to_client(client_sock_fd, "Failed to fetch file content from SS.");
         return;
     }
-
-    // 6. Receive the response header (MSG_INTERNAL_DATA)
-    MessageHeader resp_header;
-    if (recv_header(ss_sock, &resp_header) == -1 || resp_header.msg_type != MSG_INTERNAL_DATA) {
-        pthread_mutex_unlock(&ss->socket_mutex);
+    if (resp_header.msg_type != MSG_INTERNAL_DATA) {
+        free(file_content);
         send_error_to_client(client_sock_fd, "Did not receive valid INTERNAL_DATA from SS.");
-        remove_storage_server(ss_sock); // The SS is disconnected
-        close(client_sock_fd);
         return;
     }
+    // The channel delivers payloads NUL-terminated, ready for the shell.
 
-    // 7. Receive the payload (file content)
-    char* file_content = malloc(resp_header.payload_length + 1);
-    if (file_content == NULL) {
-        pthread_mutex_unlock(&ss->socket_mutex);
-        send_error_to_client(client_sock_fd, "Internal server error (malloc).");
-        close(client_sock_fd);
-        return;
+    write_log("EXEC", "Executing command: \"%s\"", file_content);
+    run_command(client_sock_fd, file_content);
+    free(file_content);
+}
+
+static void* exec_worker(void* arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&queue_mutex);
+        while (queue_head == NULL) pthread_cond_wait(&queue_cond, &queue_mutex);
+        ExecJob* job = queue_head;
+        queue_head = job->next;
+        if (queue_head == NULL) queue_tail = NULL;
+        queue_length--;
+        pthread_mutex_unlock(&queue_mutex);
+
+        metrics_gauge_add("exec_running", 1);
+        uint64_t started = metrics_begin();
+        execute_job(job);
+        metrics_end(METRICS_NS_CLIENT, "EXEC_RUN", started);
+        metrics_gauge_add("exec_running", -1);
+
+        close(job->client_sock_fd); // The EXEC command is a one-shot, close connection after.
+        write_log("EXEC", "Execution and streaming complete for socket %d.", job->client_sock_fd);
+        free(job);
     }
+    return NULL;
+}
 
-    if (recv_all(ss_sock, file_content, resp_header.payload_length) == -1) {
-        pthread_mutex_unlock(&ss->socket_mutex);
-        send_error_to_client(client_sock_fd, "Failed to receive file content from SS.");
-        remove_storage_server(ss_sock);
-        free(file_content);
-        close(client_sock_fd);
+void executor_init() {
+    metrics_gauge_add("exec_running", 0);
+    int started = 0;
+    for (int i = 0; i < EXEC_POOL_THREADS; i++) {
+        pthread_t worker;
+        if (pthread_create(&worker, NULL, exec_worker, NULL) != 0) break;
+        pthread_detach(worker);
+        started++;
+    }
+    if (started == 0) {
+        write_log("ERROR", "Could not start any EXEC worker; EXEC requests will wait forever.");
         return;
     }
-    file_content[resp_header.payload_length] = '\0';
-    
-    pthread_mutex_unlock(&ss->socket_mutex);
-    // --- END OF NEW LOGIC ---
+    write_log("INIT", "EXEC pool initialized (%d threads, %d queued max, %d s timeout).",
+              started, EXEC_QUEUE_MAX, EXEC_TIMEOUT_SEC);
+}
 
-    write_log("EXEC", "Executing command: \"%s\"", file_content);
+/**
+ * @brief Handles a MSG_EXEC request from a client.
+ */
+void handle_exec_request(int client_sock_fd, MessageHeader* header, const char* client_username) {
+    write_log("CLIENT_CMD", "User '%s' (Socket %d): Received MSG_EXEC for file '%s'",
+              client_username, client_sock_fd, header->filename);
 
-    // 8. Execute the content using popen
-    FILE* pipe = popen(file_content, "r");
-    free(file_content); // We're done with this buffer
-    
-    if (pipe == NULL) {
-        send_error_to_client(client_sock_fd, "Failed to execute command on server.");
+    // 1. Check permissions
+    if (!search_check_permission(header->filename, client_username, PERM_READ)) {
+        send_error_to_client(client_sock_fd, "Access Denied (Read Permission Required).");
         close(client_sock_fd);
         return;
     }
 
-    // 9. Pipe the output of popen directly to the client
-    char pipe_buffer[EXEC_BUFFER_SIZE];
-    while (fgets(pipe_buffer, sizeof(pipe_buffer), pipe) != NULL) {
-        if (send_all(client_sock_fd, pipe_buffer, strlen(pipe_buffer)) == -1) {
-            write_log("WARN", "[EXEC] Client disconnected during output stream.");
-            break; // Stop streaming
-        }
+    // 2. Hand it to the pool
+    ExecJob* job = calloc(1, sizeof(ExecJob));
+    if (job == NULL) {
+        send_error_to_client(client_sock_fd, "Internal server error.");
+        close(client_sock_fd);
+        return;
     }
+    job->client_sock_fd = client_sock_fd;
+    strncpy(job->filename, header->filename, MAX_FILENAME - 1);
+    strncpy(job->username, client_username, sizeof(job->username) - 1);
 
-    // 10. Cleanup
-    pclose(pipe);
-    close(client_sock_fd); // The EXEC command is a one-shot, close connection after.
-    write_log("EXEC", "Execution and streaming complete for socket %d.", client_sock_fd);
-}
\ No newline at end of file
+    pthread_mutex_lock(&queue_mutex);
+    if (queue_length >= EXEC_QUEUE_MAX) {
+        pthread_mutex_unlock(&queue_mutex);
+        free(job);
+        send_error_to_client(client_sock_fd, "Too many EXEC requests running; try again later.");
+        close(client_sock_fd);
+        return;
+    }
+    if (queue_tail) queue_tail->next = job;
+    else queue_head = job;
+    queue_tail = job;
+    queue_length++;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+}
@@ -0,0 +1,239 @@
+#include "file_index.h"
+#include "hash.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// =========================================================================
+//  HASHING
+// =========================================================================
+
+uint32_t file_index_hash(const char* str) {
+    return fnv1a_hash(str);
+}
+
+static size_t round_up_pow2(size_t n) {
+    size_t cap = 16;
+    while (cap < n) cap <<= 1;
+    return cap;
+}
+
+// =========================================================================
+//  FILE INDEX
+// =========================================================================
+
+int file_index_init(FileIndex* index, size_t initial_capacity) {
+    index->capacity = round_up_pow2(initial_capacity);
+    index->count = 0;
+    index->slots = calloc(index->capacity, sizeof(FileIndexSlot));
+    return index->slots ? 0 : -1;
+}
+
+void file_index_destroy(FileIndex* index) {
+    free(index->slots);
+    index->slots = NULL;
+    index->capacity = 0;
+    index->count = 0;
+}
+
+/**
+ * @brief Places a record into a table known to have room and no duplicate.
+ */
+static void place_slot(FileIndexSlot* slots, size_t mask, uint32_t hash, FileRecord* record) {
+    size_t i = hash & mask;
+    while (slots[i].record != NULL) {
+        i = (i + 1) & mask;
+    }
+    slots[i].hash = hash;
+    slots[i].record = record;
+}
+
+static int grow(FileIndex* index) {
+    size_t new_capacity = index->capacity * 2;
+    FileIndexSlot* new_slots = calloc(new_capacity, sizeof(FileIndexSlot));
+    if (new_slots == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < index->capacity; i++) {
+        if (index->slots[i].record) {
+            place_slot(new_slots, new_capacity - 1, index->slots[i].hash, index->slots[i].record);
+        }
+    }
+    free(index->slots);
+    index->slots = new_slots;
+    index->capacity = new_capacity;
+    return 0;
+}
+
+/**
+ * @brief Returns the slot holding 'filename', or -1.
+ */
+static long find_slot(const FileIndex* index, const char* filename, uint32_t hash) {
+    size_t mask = index->capacity - 1;
+    size_t i = hash & mask;
+    while (index->slots[i].record != NULL) {
+        if (index->slots[i].hash == hash &&
+            strcmp(index->slots[i].record->filename, filename) == 0) {
+            return (long)i;
+        }
+        i = (i + 1) & mask;
+    }
+    return -1;
+}
+
+FileRecord* file_index_find(const FileIndex* index, const char* filename) {
+    long slot = find_slot(index, filename, fnv1a_hash(filename));
+    return slot >= 0 ? index->slots[slot].record : NULL;
+}
+
+int file_index_insert(FileIndex* index, FileRecord* record) {
+    uint32_t hash = fnv1a_hash(record->filename);
+    if (find_slot(index, record->filename, hash) >= 0) {
+        return -1; // Already present
+    }
+    if ((index->count + 1) * 100 > index->capacity * FILE_INDEX_MAX_LOAD_PCT) {
+        if (grow(index) == -1) {
+            return -1;
+        }
+    }
+    place_slot(index->slots, index->capacity - 1, hash, record);
+    index->count++;
+    return 0;
+}
+
+FileRecord* file_index_remove(FileIndex* index, const char* filename) {
+    long found = find_slot(index, filename, fnv1a_hash(filename));
+    if (found < 0) {
+        return NULL;
+    }
+    size_t mask = index->capacity - 1;
+    size_t hole = (size_t)found;
+    FileRecord* removed = index->slots[hole].record;
+
+    // Backward-shift: pull later entries of the same probe run into the
+    // hole so lookups never need tombstones.
+    size_t j = (hole + 1) & mask;
+    while (index->slots[j].record != NULL) {
+        size_t home = index->slots[j].hash & mask;
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            index->slots[hole] = index->slots[j];
+            hole = j;
+        }
+        j = (j + 1) & mask;
+    }
+    index->slots[hole].record = NULL;
+    index->slots[hole].hash = 0;
+    index->count--;
+    return removed;
+}
+
+FileRecord* file_index_next(const FileIndex* index, size_t* cursor) {
+    while (*cursor < index->capacity) {
+        FileRecord* record = index->slots[(*cursor)++].record;
+        if (record) return record;
+    }
+    return NULL;
+}
+
+// =========================================================================
+//  STRING INTERNING
+// =========================================================================
+
+#define INTERN_ARENA_CHUNK 65536
+
+typedef struct InternArena {
+    struct InternArena* next;
+    size_t used;
+    char data[INTERN_ARENA_CHUNK];
+} InternArena;
+
+static const char** intern_slots = NULL;
+static size_t intern_capacity = 0;
+static size_t intern_count = 0;
+static InternArena* intern_arena = NULL;
+static size_t intern_bytes = 0;
+static pthread_mutex_t intern_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static char* arena_copy(const char* str, size_t len) {
+    if (len + 1 > INTERN_ARENA_CHUNK) {
+        // Oversized strings get their own allocation (never freed either).
+        char* copy = malloc(len + 1);
+        if (copy) {
+            memcpy(copy, str, len + 1);
+            intern_bytes += len + 1;
+        }
+        return copy;
+    }
+    if (intern_arena == NULL || intern_arena->used + len + 1 > INTERN_ARENA_CHUNK) {
+        InternArena* chunk = malloc(sizeof(InternArena));
+        if (chunk == NULL) return NULL;
+        chunk->next = intern_arena;
+        chunk->used = 0;
+        intern_arena = chunk;
+        intern_bytes += sizeof(InternArena);
+    }
+    char* copy = intern_arena->data + intern_arena->used;
+    memcpy(copy, str, len + 1);
+    intern_arena->used += len + 1;
+    return copy;
+}
+
+static int intern_grow() {
+    size_t new_capacity = intern_capacity ? intern_capacity * 2 : 256;
+    const char** new_slots = calloc(new_capacity, sizeof(char*));
+    if (new_slots == NULL) return -1;
+    for (size_t i = 0; i < intern_capacity; i++) {
+        if (intern_slots[i]) {
+            size_t j = fnv1a_hash(intern_slots[i]) & (new_capacity - 1);
+            while (new_slots[j]) j = (j + 1) & (new_capacity - 1);
+            new_slots[j] = intern_slots[i];
+        }
+    }
+    free(intern_slots);
+    intern_bytes += (new_capacity - intern_capacity) * sizeof(char*);
+    intern_slots = new_slots;
+    intern_capacity = new_capacity;
+    return 0;
+}
+
+const char* file_index_intern(const char* str) {
+    if (str == NULL || str[0] == '\0') {
+        return ""; // The common "no owner / root folder" case needs no lookup
+    }
+
+    pthread_mutex_lock(&intern_mutex);
+    if ((intern_count + 1) * 100 > intern_capacity * FILE_INDEX_MAX_LOAD_PCT &&
+        intern_grow() == -1) {
+        pthread_mutex_unlock(&intern_mutex);
+        return "";
+    }
+
+    size_t mask = intern_capacity - 1;
+    size_t i = fnv1a_hash(str) & mask;
+    while (intern_slots[i]) {
+        if (strcmp(intern_slots[i], str) == 0) {
+            const char* existing = intern_slots[i];
+            pthread_mutex_unlock(&intern_mutex);
+            return existing;
+        }
+        i = (i + 1) & mask;
+    }
+
+    const char* copy = arena_copy(str, strlen(str));
+    if (copy == NULL) {
+        pthread_mutex_unlock(&intern_mutex);
+        return "";
+    }
+    intern_slots[i] = copy;
+    intern_count++;
+    pthread_mutex_unlock(&intern_mutex);
+    return copy;
+}
+
+size_t file_index_intern_bytes() {
+    pthread_mutex_lock(&intern_mutex);
+    size_t bytes = intern_bytes;
+    pthread_mutex_unlock(&intern_mutex);
+    return bytes;
+}
@@ -4,6 +4,8 @@
 #include "search.h"
 #include "cache.h"
 #include "user_manager.h"
+#include "replication.h"
+#include "executor.h"
 // #include "cache.h" // Add this when you create cache.c
 
 void init_server() {
@@ -15,6 +17,8 @@ void init_server() {
     init_search_trie();
     init_cache();
     init_user_manager();
+    replication_init();
+    executor_init();
     
     write_log("INIT", "All subsystems initialized.");
 }
\ No newline at end of file
@@ -3,65 +3,40 @@
 #include "socket_utils.h"
 #include "protocol.h"
 #include "init.h"            // For init_server()
-#include "client_handler.h"  // For routing
-#include "storage_manager.h" // For routing
-
-#include <pthread.h>
-#include <stdlib.h> // For malloc, free
+#include "reactor.h"         // For the event loop
+#include "search.h"          // For search_set_metadata_staleness()
+#include "cache.h"           // For cache_set_capacity()
+#include "metrics.h"         // For the cache gauges
+#include "storage_manager.h" // For storage_manager_set_capacity()
+#include "placement.h"       // For placement_set_policy()
+#include "replication.h"     // For replication_set_factor()
+
+#include <stdlib.h>
+#include <signal.h> // For signal
 #include <unistd.h> // For close
 
-/**
- * @brief The main function for each new thread.
- * Reads the first message to identify the component, then routes to the
- * appropriate handler function which will take over the connection.
- */
-void* handle_connection(void* arg) {
-    // 1. Get socket FD from argument and free the memory
-    int sock_fd = *(int*)arg;
-    free(arg);
-
-    // 2. Detach thread so resources are freed automatically
-    pthread_detach(pthread_self());
-
-    write_log("THREAD", "New thread started to handle socket %d", sock_fd);
-
-    // 3. Read the first header to identify the connection
-    MessageHeader header;
-    if (recv_header(sock_fd, &header) == -1) {
-        // This handles clients disconnecting immediately or read errors
-        write_log("THREAD", "Socket %d disconnected or failed to read header.", sock_fd);
-        close(sock_fd);
-        return NULL;
-    }
-
-    // 4. Route to the correct handler based on who is connecting
-    switch (header.source_component) {
-        case COMPONENT_STORAGE_SERVER:
-            handle_storage_server_connection(sock_fd, &header);
-            break;
-        
-        case COMPONENT_CLIENT:
-            handle_client_connection(sock_fd, &header);
-            break;
-        
-        default:
-            write_log("WARN", "Socket %d sent unknown component type: %d. Closing.", 
-                      sock_fd, header.source_component);
-            close(sock_fd); // Unknown component, drop connection
-            break;
-    }
+// Gauges read from the lookup cache when MSG_STATS is rendered
+static double cache_hit_ratio(void) {
+    CacheStats stats;
+    cache_get_stats(&stats);
+    unsigned long lookups = stats.hits + stats.misses;
+    return lookups ? (double)stats.hits / (double)lookups : 0.0;
+}
 
-    // The handler functions are now responsible for the socket's lifecycle.
-    // This thread's job is done.
-    return NULL;
+static double cache_entries(void) {
+    CacheStats stats;
+    cache_get_stats(&stats);
+    return (double)stats.entries;
 }
 
 /**
  * @brief Main server entry point.
  */
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <ns_ip> <ns_port>\n", argv[0]);
+    if (argc < 3 || argc > 8) {
+        fprintf(stderr, "Usage: %s <ns_ip> <ns_port> [metadata_staleness_sec] [cache_entries]"
+                        " [max_storage_servers] [placement_policy] [replicas_per_file]\n", argv[0]);
+        fprintf(stderr, "Placement policies: round-robin, least-loaded, p2c (default)\n");
         fprintf(stderr, "Example: %s 127.0.0.1 5000\n", argv[0]);
         exit(EXIT_FAILURE);
     }
@@ -73,10 +48,33 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Error: Port must be between 1025 and 65535.\n");
         exit(EXIT_FAILURE);
     }
+    if (argc > 6 && placement_set_policy(argv[6]) == -1) {
+        fprintf(stderr, "Error: Unknown placement policy '%s'.\n", argv[6]);
+        exit(EXIT_FAILURE);
+    }
     
     // 1. Initialization
+    signal(SIGPIPE, SIG_IGN); // A client that hangs up mid-EXEC must not take the server down
     init_logger(ns_ip, ns_port);
+    if (argc > 4) {
+        // Size the lookup cache to the working set (see its hit/miss stats)
+        cache_set_capacity((size_t)atol(argv[4]));
+    }
+    if (argc > 5) {
+        // Registry slots are fixed once the server is up
+        storage_manager_set_capacity(atoi(argv[5]));
+    }
+    if (argc > 7) {
+        // Read-only copies per file; 0 = no replication
+        replication_set_factor(atoi(argv[7]));
+    }
     init_server(); // Call the function from init.c
+    metrics_register_gauge("cache_hit_ratio", cache_hit_ratio);
+    metrics_register_gauge("cache_entries", cache_entries);
+    if (argc > 3) {
+        // How long SS-pushed metadata is trusted before INFO/VIEW -l re-fetch it
+        search_set_metadata_staleness(atoi(argv[3]));
+    }
     
     write_log("STARTUP", "Name Server starting...");
 
@@ -95,38 +93,16 @@ int main(int argc, char *argv[]) {
     write_log("STARTUP", "Server listening on %s:%d", ns_ip, ns_port);
     printf("Name Server is running on %s:%d...\n", ns_ip, ns_port);
 
-    // 3. Main Accept Loop
-    while(1) {
-        int client_sock = accept_connection(server_sock);
-        if (client_sock < 0) {
-            write_log("ERROR", "Accept failed. Continuing...");
-            continue; // Don't crash the server, just log and continue
-        }
-
-        write_log("ACCEPT", "Accepted new connection on socket %d", client_sock);
-
-        // 4. Thread Creation
-        pthread_t thread_id;
-        
-        // We must malloc memory for the socket FD to avoid a race condition
-        // where the next loop iteration overwrites the variable
-        int* p_client_sock = malloc(sizeof(int));
-        if (p_client_sock == NULL) {
-             write_log("FATAL", "Failed to allocate memory for thread argument.");
-             close(client_sock);
-             continue;
-        }
-        *p_client_sock = client_sock;
-
-        // Create the new thread
-        if (pthread_create(&thread_id, NULL, handle_connection, p_client_sock) != 0) {
-            write_log("ERROR", "Failed to create thread for socket %d", client_sock);
-            close(client_sock);
-            free(p_client_sock); // Free memory if thread creation failed
-        }
+    // 3. Event Loop
+    // Connections are multiplexed on epoll and served by a fixed worker
+    // pool, so idle clients cost a few bytes instead of a thread each.
+    if (init_reactor(server_sock) == -1) {
+        fprintf(stderr, "Error: Failed to start the connection reactor.\n");
+        exit(EXIT_FAILURE);
     }
+    reactor_run();
 
-    // 5. Cleanup (Server never actually reaches here)
+    // 4. Cleanup (Server never actually reaches here)
     close(server_sock);
     close_logger();
     return 0;
@@ -0,0 +1,159 @@
+#include "placement.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef int (*placement_pick_fn)(const placement_candidate_t* c, const double* load, int count);
+
+static unsigned int rng_state = 0;
+
+static double random_unit(void) {
+    if (rng_state == 0) rng_state = (unsigned int)time(NULL) | 1u;
+    return (double)rand_r(&rng_state) / ((double)RAND_MAX + 1.0);
+}
+
+// =========================================================================
+//  POLICIES
+// =========================================================================
+
+static int pick_round_robin(const placement_candidate_t* c, const double* load, int count) {
+    (void)load;
+    static int last_ss = -1;
+    // The next slot after the last one used, wrapping to the lowest
+    int pick = -1, lowest = 0;
+    for (int i = 0; i < count; i++) {
+        if (c[i].ss_index < c[lowest].ss_index) lowest = i;
+        if (c[i].ss_index > last_ss && (pick == -1 || c[i].ss_index < c[pick].ss_index)) pick = i;
+    }
+    if (pick == -1) pick = lowest;
+    last_ss = c[pick].ss_index;
+    return pick;
+}
+
+static int pick_least_loaded(const placement_candidate_t* c, const double* load, int count) {
+    (void)c;
+    int best = 0;
+    for (int i = 1; i < count; i++) {
+        if (load[i] < load[best]) best = i;
+    }
+    return best;
+}
+
+/**
+ * @brief Samples two servers, weighted by free disk, and takes the less
+ * loaded. Stale loads cannot herd every CREATE onto one server the way
+ * always taking the minimum can between heartbeats.
+ */
+static int pick_p2c(const placement_candidate_t* c, const double* load, int count) {
+    if (count == 1) return 0;
+
+    double known = 0;
+    int known_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (c[i].has_load) { known += c[i].free_bytes; known_count++; }
+    }
+    double fallback = known_count > 0 && known > 0 ? known / known_count : 1.0;
+
+    double* weight = malloc(sizeof(double) * count);
+    if (weight == NULL) return pick_least_loaded(c, load, count);
+    double total = 0;
+    for (int i = 0; i < count; i++) {
+        weight[i] = c[i].has_load && known > 0 ? c[i].free_bytes : fallback;
+        if (weight[i] <= 0) weight[i] = fallback * 1e-3; // Still reachable
+        total += weight[i];
+    }
+
+    int chosen[2];
+    for (int k = 0; k < 2; k++) {
+        double target = random_unit() * total;
+        int i = 0;
+        while (i < count - 1 && (target -= weight[i]) >= 0) i++;
+        chosen[k] = i;
+        total -= weight[i];
+        weight[i] = 0; // Without replacement
+    }
+    free(weight);
+    if (chosen[1] == chosen[0]) chosen[1] = (chosen[0] + 1) % count; // Rounding at the tail
+
+    if (load[chosen[0]] == load[chosen[1]]) return chosen[random_unit() < 0.5 ? 0 : 1];
+    return load[chosen[0]] < load[chosen[1]] ? chosen[0] : chosen[1];
+}
+
+typedef struct {
+    const char* name;
+    placement_pick_fn pick;
+} placement_policy_t;
+
+static const placement_policy_t policies[] = {
+    { "round-robin",  pick_round_robin },
+    { "least-loaded", pick_least_loaded },
+    { "p2c",          pick_p2c },
+};
+
+static const placement_policy_t* current_policy = &policies[2];
+
+int placement_set_policy(const char* name) {
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (strcmp(policies[i].name, name) == 0) {
+            current_policy = &policies[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char* placement_policy_name(void) {
+    return current_policy->name;
+}
+
+// =========================================================================
+//  SCORING
+// =========================================================================
+
+int placement_pick(const placement_candidate_t* candidates, int count) {
+    if (count <= 0) return -1;
+
+    // Leave out servers short of disk, unless that is all of them
+    placement_candidate_t* c = malloc(sizeof(placement_candidate_t) * count);
+    double* load = malloc(sizeof(double) * count);
+    int* origin = malloc(sizeof(int) * count);
+    if (c == NULL || load == NULL || origin == NULL) {
+        free(c); free(load); free(origin);
+        return 0;
+    }
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        if (candidates[i].has_load && candidates[i].free_bytes < PLACEMENT_MIN_FREE_BYTES) continue;
+        origin[n] = i;
+        c[n++] = candidates[i];
+    }
+    if (n == 0) {
+        for (int i = 0; i < count; i++) { origin[i] = i; c[i] = candidates[i]; }
+        n = count;
+    }
+
+    // Each term is relative to the fleet, so ~1 means "average server":
+    // load = sessions per worker + files / mean files + latency / mean latency.
+    // A server with no recent heartbeat is taken as average for the terms
+    // it did not report.
+    double files = 0, busy = 0, latency = 0;
+    int reporting = 0;
+    for (int i = 0; i < n; i++) {
+        files += c[i].files;
+        if (c[i].has_load) { busy += c[i].busy; latency += c[i].latency_us; reporting++; }
+    }
+    double mean_files = files / n;
+    double mean_busy = reporting ? busy / reporting : 0;
+    double mean_latency = reporting ? latency / reporting : 0;
+    for (int i = 0; i < n; i++) {
+        double b = c[i].has_load ? c[i].busy : mean_busy;
+        double l = c[i].has_load ? c[i].latency_us : mean_latency;
+        load[i] = b;
+        if (mean_files > 0) load[i] += c[i].files / mean_files;
+        if (mean_latency > 0) load[i] += l / mean_latency;
+    }
+
+    int pick = origin[current_policy->pick(c, load, n)];
+    free(c); free(load); free(origin);
+    return pick;
+}
@@ -0,0 +1,269 @@
+#include "reactor.h"
+#include "logger.h"
+#include "protocol.h"
+#include "client_handler.h"
+#include "storage_manager.h"
+#include "user_manager.h"
+#include "metrics.h"
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// --- Reactor State ---
+static int epoll_fd = -1;
+static int listen_sock = -1;
+
+// Work queue of connections with a request ready to be read.
+// Every socket is armed with EPOLLONESHOT, so a connection is in the
+// queue (or being served by a worker) at most once at a time.
+static NsConnection* queue_head = NULL;
+static NsConnection* queue_tail = NULL;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+
+static pthread_t workers[REACTOR_WORKER_THREADS];
+
+// =========================================================================
+//  WORK QUEUE
+// =========================================================================
+
+static void enqueue_connection(NsConnection* conn) {
+    pthread_mutex_lock(&queue_mutex);
+    conn->next = NULL;
+    if (queue_tail) {
+        queue_tail->next = conn;
+    } else {
+        queue_head = conn;
+    }
+    queue_tail = conn;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+static NsConnection* dequeue_connection() {
+    pthread_mutex_lock(&queue_mutex);
+    while (queue_head == NULL) {
+        pthread_cond_wait(&queue_cond, &queue_mutex);
+    }
+    NsConnection* conn = queue_head;
+    queue_head = conn->next;
+    if (queue_head == NULL) {
+        queue_tail = NULL;
+    }
+    pthread_mutex_unlock(&queue_mutex);
+    conn->next = NULL;
+    return conn;
+}
+
+// =========================================================================
+//  CONNECTION HELPERS
+// =========================================================================
+
+/**
+ * @brief Re-arms a one-shot socket so the next request wakes the reactor.
+ */
+static int rearm_connection(NsConnection* conn) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.ptr = conn;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->sock_fd, &ev) == -1) {
+        write_log("ERROR", "Reactor: Failed to re-arm socket %d: %s",
+                  conn->sock_fd, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Removes a socket from the epoll set without closing it.
+ * Used when ownership of the socket is handed to another subsystem.
+ */
+static void detach_connection(NsConnection* conn) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->sock_fd, NULL);
+}
+
+static void drop_connection(NsConnection* conn) {
+    if (conn->state == CONN_STATE_CLIENT) {
+        handle_client_disconnect(conn->sock_fd, conn->username);
+        metrics_gauge_add("connected_clients", -1);
+    } else {
+        detach_connection(conn);
+        close(conn->sock_fd);
+    }
+    free(conn);
+}
+
+// =========================================================================
+//  WORKER
+// =========================================================================
+
+/**
+ * @brief Serves exactly one request on a connection, then hands it back
+ * to the reactor. This is the old per-connection thread body, split at
+ * each message boundary.
+ */
+static void serve_connection(NsConnection* conn) {
+    MessageHeader header;
+    if (recv_header(conn->sock_fd, &header) == -1) {
+        write_log("THREAD", "Socket %d disconnected or failed to read header.", conn->sock_fd);
+        drop_connection(conn);
+        return;
+    }
+
+    if (conn->state == CONN_STATE_NEW) {
+        switch (header.source_component) {
+            case COMPONENT_STORAGE_SERVER:
+                // The SS socket becomes the NS->SS control channel and is
+                // owned by the storage manager from here on.
+                detach_connection(conn);
+                handle_storage_server_connection(conn->sock_fd, &header);
+                free(conn);
+                return;
+
+            case COMPONENT_CLIENT:
+                if (handle_client_login(conn->sock_fd, &header, conn->username) == -1) {
+                    drop_connection(conn);
+                    return;
+                }
+                conn->state = CONN_STATE_CLIENT;
+                metrics_gauge_add("connected_clients", 1);
+                break;
+
+            default:
+                write_log("WARN", "Socket %d sent unknown component type: %d. Closing.",
+                          conn->sock_fd, header.source_component);
+                drop_connection(conn);
+                return;
+        }
+    } else {
+        if (handle_client_message(conn->sock_fd, &header, conn->username) == -1) {
+            // The handler took over (and closed) the socket, e.g. EXEC.
+            user_manager_deregister(conn->username);
+            metrics_gauge_add("connected_clients", -1);
+            free(conn);
+            return;
+        }
+    }
+
+    if (rearm_connection(conn) == -1) {
+        drop_connection(conn);
+    }
+}
+
+static void* worker_thread(void* arg) {
+    (void)arg;
+    while (1) {
+        NsConnection* conn = dequeue_connection();
+        serve_connection(conn);
+    }
+    return NULL;
+}
+
+// =========================================================================
+//  EVENT LOOP
+// =========================================================================
+
+static void accept_pending_connections() {
+    while (1) {
+        int client_sock = accept(listen_sock, NULL, NULL);
+        if (client_sock < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                write_log("ERROR", "Accept failed: %s. Continuing...", strerror(errno));
+            }
+            return;
+        }
+        // The fd number may have last carried a v2 peer; every connection
+        // starts out on v1 until its own handshake says otherwise.
+        protocol_set_version(client_sock, PROTOCOL_V1);
+
+        NsConnection* conn = malloc(sizeof(NsConnection));
+        if (conn == NULL) {
+            write_log("FATAL", "Failed to allocate connection state for socket %d.", client_sock);
+            close(client_sock);
+            continue;
+        }
+        memset(conn, 0, sizeof(NsConnection));
+        conn->sock_fd = client_sock;
+        conn->state = CONN_STATE_NEW;
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        ev.data.ptr = conn;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_sock, &ev) == -1) {
+            write_log("ERROR", "Reactor: Failed to watch socket %d: %s",
+                      client_sock, strerror(errno));
+            close(client_sock);
+            free(conn);
+            continue;
+        }
+
+        write_log("ACCEPT", "Accepted new connection on socket %d", client_sock);
+    }
+}
+
+int init_reactor(int listen_fd) {
+    listen_sock = listen_fd;
+
+    // The listener is drained in a loop, so it must never block the reactor.
+    int flags = fcntl(listen_sock, F_GETFL, 0);
+    if (flags == -1 || fcntl(listen_sock, F_SETFL, flags | O_NONBLOCK) == -1) {
+        write_log("FATAL", "Reactor: Failed to make listener non-blocking: %s", strerror(errno));
+        return -1;
+    }
+
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd == -1) {
+        write_log("FATAL", "Reactor: epoll_create1 failed: %s", strerror(errno));
+        return -1;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; // NULL marks the listening socket
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_sock, &ev) == -1) {
+        write_log("FATAL", "Reactor: Failed to watch listener: %s", strerror(errno));
+        return -1;
+    }
+
+    for (int i = 0; i < REACTOR_WORKER_THREADS; i++) {
+        if (pthread_create(&workers[i], NULL, worker_thread, NULL) != 0) {
+            write_log("FATAL", "Reactor: Failed to start worker %d", i);
+            return -1;
+        }
+        pthread_detach(workers[i]);
+    }
+
+    write_log("INIT", "Reactor initialized with %d worker threads.", REACTOR_WORKER_THREADS);
+    return 0;
+}
+
+void reactor_run() {
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+
+    while (1) {
+        int n = epoll_wait(epoll_fd, events, REACTOR_MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            write_log("FATAL", "Reactor: epoll_wait failed: %s", strerror(errno));
+            return;
+        }
+
+        for (int i = 0; i < n; i++) {
+            NsConnection* conn = (NsConnection*)events[i].data.ptr;
+            if (conn == NULL) {
+                accept_pending_connections();
+            } else {
+                // Readable or hung up; the worker's recv_header tells which.
+                enqueue_connection(conn);
+            }
+        }
+    }
+}
@@ -0,0 +1,188 @@
+#include "replication.h"
+#include "search.h"
+#include "storage_manager.h"
+#include "ss_channel.h"
+#include "logger.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Files waiting for the worker, oldest first. search.c calls
+// replication_enqueue with index_lock held, so queue_mutex is only ever
+// taken last.
+typedef struct ReplicationJob {
+    char filename[MAX_FILENAME];
+    struct ReplicationJob* next;
+} ReplicationJob;
+
+static ReplicationJob* queue_head = NULL;
+static ReplicationJob* queue_tail = NULL;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+
+static int replica_factor = NS_DEFAULT_REPLICAS;
+
+void replication_set_factor(int replicas) {
+    if (replicas < 0) replicas = 0;
+    if (replicas > NS_MAX_REPLICAS) replicas = NS_MAX_REPLICAS;
+    replica_factor = replicas;
+}
+
+int replication_factor() {
+    return replica_factor;
+}
+
+void replication_enqueue(const char* filename) {
+    ReplicationJob* job = calloc(1, sizeof(ReplicationJob));
+    if (job == NULL) {
+        write_log("ERROR", "[REPLICATION] Out of memory queueing '%s'", filename);
+        return;
+    }
+    strncpy(job->filename, filename, MAX_FILENAME - 1);
+
+    pthread_mutex_lock(&queue_mutex);
+    if (queue_tail) queue_tail->next = job;
+    else queue_head = job;
+    queue_tail = job;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+// =========================================================================
+//  WORKER
+// =========================================================================
+
+/**
+ * @brief Copies the primary's content of one file to its behind replicas.
+ * The copies are sent together and their ACKs collected afterwards.
+ */
+static void replicate_file(const char* filename) {
+    ReplicaSyncJob job;
+    if (search_begin_replication(filename, &job) <= 0) return; // Gone, or nothing behind
+
+    StorageServerInfo* primary = get_ss_by_index(job.primary);
+    if (primary == NULL || !primary->is_active) return; // Requeued once it is back
+
+    MessageHeader req;
+    memset(&req, 0, sizeof(req));
+    req.msg_type = MSG_INTERNAL_READ;
+    strncpy(req.filename, filename, MAX_FILENAME - 1);
+
+    MessageHeader resp;
+    char* content = NULL;
+    if (ss_call(primary, &req, NULL, &resp, (void**)&content) == -1 ||
+        resp.msg_type != MSG_INTERNAL_DATA) {
+        write_log("WARN", "[REPLICATION] Could not read '%s' from primary SS %d", filename, job.primary);
+        free(content);
+        return;
+    }
+
+    // SSReplicaPayload, then the content
+    uint32_t length = (uint32_t)sizeof(SSReplicaPayload) + resp.payload_length;
+    char* payload = malloc(length);
+    if (payload == NULL) {
+        write_log("ERROR", "[REPLICATION] Out of memory copying '%s'", filename);
+        free(content);
+        return;
+    }
+    memcpy(payload, &job.state, sizeof(SSReplicaPayload));
+    if (resp.payload_length > 0) memcpy(payload + sizeof(SSReplicaPayload), content, resp.payload_length);
+    free(content);
+
+    SSPendingCall* calls[NS_MAX_REPLICAS] = { NULL };
+    for (int i = 0; i < job.target_count; i++) {
+        StorageServerInfo* ss = get_ss_by_index(job.targets[i]);
+        if (ss == NULL || !ss->is_active) continue;
+        MessageHeader copy;
+        memset(&copy, 0, sizeof(copy));
+        copy.msg_type = MSG_INTERNAL_REPLICATE;
+        copy.payload_length = length;
+        strncpy(copy.filename, filename, MAX_FILENAME - 1);
+        calls[i] = ss_call_begin(ss, &copy, payload);
+    }
+    free(payload);
+
+    for (int i = 0; i < job.target_count; i++) {
+        if (calls[i] == NULL) continue;
+        MessageHeader ack;
+        if (ss_call_end(calls[i], &ack, NULL, SS_CALL_TIMEOUT_MS) == 0 && ack.msg_type == MSG_ACK) {
+            search_replica_synced(filename, job.targets[i], job.version);
+            write_log("REPLICATION", "Copied '%s' (version %u) from SS %d to SS %d",
+                      filename, job.version, job.primary, job.targets[i]);
+        } else {
+            write_log("WARN", "[REPLICATION] SS %d did not take its copy of '%s'", job.targets[i], filename);
+        }
+    }
+}
+
+static void* replication_worker(void* arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&queue_mutex);
+        while (queue_head == NULL) pthread_cond_wait(&queue_cond, &queue_mutex);
+        ReplicationJob* job = queue_head;
+        queue_head = job->next;
+        if (queue_head == NULL) queue_tail = NULL;
+        pthread_mutex_unlock(&queue_mutex);
+
+        replicate_file(job->filename);
+        free(job);
+    }
+    return NULL;
+}
+
+void replication_init() {
+    pthread_t worker;
+    if (pthread_create(&worker, NULL, replication_worker, NULL) != 0) {
+        write_log("ERROR", "Could not start the replication worker; replicas will not be updated.");
+        return;
+    }
+    pthread_detach(worker);
+    write_log("INIT", "Replication initialized (%d replicas per file).", replica_factor);
+}
+
+// =========================================================================
+//  REPLICA SETS
+// =========================================================================
+
+void replication_add_replicas(const char* filename) {
+    int copies[NS_MAX_REPLICAS + 1];
+    int count = search_get_copies(filename, copies, NS_MAX_REPLICAS + 1);
+    while (count > 0 && count - 1 < replica_factor) {
+        StorageServerInfo* ss = get_ss_for_replica(copies, count);
+        if (ss == NULL) return; // No other server to put one on
+        int ss_index = ss - ss_registry;
+        if (search_add_replica(filename, ss_index) == -1) return;
+        copies[count++] = ss_index;
+    }
+}
+
+static void send_replica_state(const char* filename, int ss_index, int32_t state) {
+    StorageServerInfo* ss = get_ss_by_index(ss_index);
+    if (ss == NULL || !ss->is_active) return;
+    MessageHeader header;
+    memset(&header, 0, sizeof(header));
+    header.msg_type = MSG_INTERNAL_REPLICA_STATE;
+    header.payload_length = sizeof(state);
+    strncpy(header.filename, filename, MAX_FILENAME - 1);
+    ss_send_oneway(ss, &header, &state);
+}
+
+void replication_notify_behind(const char* filename, const int* ss_indices, int count) {
+    for (int i = 0; i < count; i++) {
+        send_replica_state(filename, ss_indices[i], REPLICA_STATE_BEHIND);
+    }
+}
+
+void replication_promoted(const char* filename, int ss_index) {
+    send_replica_state(filename, ss_index, REPLICA_STATE_PRIMARY);
+}
+
+void replication_forward(const char* filename, MessageHeader* header, const void* payload) {
+    int copies[NS_MAX_REPLICAS + 1];
+    int count = search_get_copies(filename, copies, NS_MAX_REPLICAS + 1);
+    for (int i = 1; i < count; i++) { // copies[0] is the primary
+        StorageServerInfo* ss = get_ss_by_index(copies[i]);
+        if (ss != NULL && ss->is_active) ss_send_oneway(ss, header, payload);
+    }
+}
@@ -5,22 +5,47 @@
 #include <time.h>   // For strftime and localtime
 #include "cache.h"
 #include "storage_manager.h"
+#include "ss_channel.h"
 #include "protocol.h"
 #include "socket_utils.h"
-// --- Trie Implementation ---
-
-static TrieNode* root;
-static pthread_mutex_t trie_mutex;
-
-// -------------------- Folder registry --------------------
-#define MAX_FOLDERS 1024
-typedef struct {
-    char foldername[MAX_FILENAME];
-    char owner_username[64];
-} FolderRecord;
-
-static FolderRecord folder_registry[MAX_FOLDERS];
-static int folder_count = 0;
+#include "file_index.h"
+#include "replication.h"
+// --- File Index ---
+
+static FileIndex file_index;
+// Lookups, permission checks and listings take this shared; anything that
+// mutates a record or the index takes it exclusive. A listing therefore
+// sees a consistent snapshot without stalling concurrent lookups.
+static pthread_rwlock_t index_lock;
+
+// -------------------- Folder tree --------------------
+// Every folder a file lives in has a node. A node owns the lists of its
+// subfolders and files, so listing or moving a folder touches only what
+// is inside it. Nodes are also hashed by full path for direct lookup.
+// Guarded by index_lock, like the file index.
+#define FOLDER_MAP_INITIAL_BUCKETS 256
+
+typedef struct FolderNode {
+    char name[MAX_FILENAME];      // Full path; "" = root
+    const char* basename;         // Last path component (points into 'name')
+    const char* owner_username;   // Interned; "" for implied folders
+    int registered;               // Created by CREATEFOLDER (listed), or only implied by a path
+    struct FolderNode* parent;
+    struct FolderNode** children; // In creation order
+    int child_count;
+    int child_capacity;
+    FileRecord** files;           // Unordered; FileRecord.folder_slot indexes it
+    int file_count;
+    int file_capacity;
+    struct FolderNode* hash_next; // Chain in folder_buckets
+} FolderNode;
+
+static FolderNode folder_root;    // Never hashed, never freed
+static FolderNode** folder_buckets = NULL;
+static size_t folder_bucket_count = 0;
+static size_t folder_node_count = 0;
+
+static int metadata_max_staleness = NS_METADATA_MAX_STALENESS_SEC;
 
 // --- New functions for VIEW command ---
 
@@ -39,114 +64,504 @@ typedef struct {
     int ss_index;
 } FileEntry;
 
-static void collect_files_recursive(TrieNode* node, FileEntry* entries, int* count, int max_count) {
-    if (!node || *count >= max_count) return;
-    if (node->file_info) {
-        strncpy(entries[*count].filename, node->file_info->filename, MAX_FILENAME - 1);
-        entries[*count].ss_index = node->file_info->ss_index;
-        (*count)++;
+/**
+ * @brief Internal helper to find a file record.
+ * Returns a pointer to the record or NULL if not found.
+ * NOTE: This function assumes index_lock is already held (shared or exclusive).
+ */
+static FileRecord* find_file_record(const char* filename) {
+    return file_index_find(&file_index, filename);
+}
+
+// -------------------- Replica helpers --------------------
+// NOTE: everything here assumes index_lock is held exclusive, except
+// replica_find and replica_is_current, which only need it shared.
+
+static int replica_find(const FileRecord* file, int ss_index) {
+    for (int i = 0; i < file->replica_count; i++) {
+        if (file->replicas[i].ss_index == ss_index) return i;
+    }
+    return -1;
+}
+
+static int replica_is_current(const FileRecord* file, const ReplicaRef* replica) {
+    return !replica->suspect && replica->version == file->content_version;
+}
+
+static void replica_remove_at(FileRecord* file, int i) {
+    file->replicas[i] = file->replicas[--file->replica_count]; // Swap with last
+}
+
+/**
+ * @brief Hands the file to the replication worker if a reachable replica
+ * is behind and it is not queued already. A provisional primary is only
+ * a replica itself, so nothing is copied from it.
+ */
+static void queue_replication_locked(FileRecord* file) {
+    if (file->replication_queued || file->provisional) return;
+    for (int i = 0; i < file->replica_count; i++) {
+        const ReplicaRef* replica = &file->replicas[i];
+        if (!replica->suspect && replica->version != file->content_version) {
+            file->replication_queued = 1;
+            replication_enqueue(file->filename);
+            return;
+        }
+    }
+}
+
+static void collect_entry(const FileRecord* file, FileEntry* entries, int* count) {
+    if (entries == NULL) return;
+    strncpy(entries[*count].filename, file->filename, MAX_FILENAME - 1);
+    entries[*count].filename[MAX_FILENAME - 1] = '\0';
+    entries[*count].ss_index = file->ss_index;
+    (*count)++;
+}
+
+/**
+ * @brief Makes a replica the primary of a file whose primary is gone,
+ * preferring one that holds the current content and is reachable. The
+ * other replicas are recopied from it. A reachable new primary is added
+ * to 'promoted' (to be told once index_lock is released); an unreachable
+ * one is told when it comes back.
+ */
+static void promote_replica_locked(FileRecord* file, FileEntry* promoted, int* promoted_count) {
+    int best = 0, best_score = -1;
+    for (int i = 0; i < file->replica_count; i++) {
+        const ReplicaRef* replica = &file->replicas[i];
+        int score = (replica->version == file->content_version) + 2 * !replica->suspect;
+        if (score > best_score) { best = i; best_score = score; }
+    }
+    int old_ss = file->ss_index;
+    file->ss_index = file->replicas[best].ss_index;
+    file->suspect = file->replicas[best].suspect;
+    replica_remove_at(file, best);
+    file->provisional = 0;
+    file->content_version++; // The new primary's content is now the reference
+    if (file->suspect) file->announce_primary = 1;
+    else collect_entry(file, promoted, promoted_count);
+    queue_replication_locked(file);
+    cache_invalidate(file->filename);
+    write_log("SEARCH", "Promoted the replica of '%s' on SS %d (primary SS %d is gone)",
+              file->filename, file->ss_index, old_ss);
+}
+
+// -------------------- Folder tree helpers --------------------
+// NOTE: everything here assumes index_lock is held exclusive, except
+// folder_lookup, which only needs it shared.
+
+static int grow_array(void** array, int* capacity, size_t elem_size) {
+    int new_capacity = *capacity ? *capacity * 2 : 8;
+    void* grown = realloc(*array, (size_t)new_capacity * elem_size);
+    if (grown == NULL) return -1;
+    *array = grown;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static FolderNode* folder_lookup(const char* path) {
+    if (path == NULL || path[0] == '\0') return &folder_root;
+    if (folder_bucket_count == 0) return NULL;
+    size_t b = file_index_hash(path) & (folder_bucket_count - 1);
+    for (FolderNode* node = folder_buckets[b]; node; node = node->hash_next) {
+        if (strcmp(node->name, path) == 0) return node;
+    }
+    return NULL;
+}
+
+static void folder_map_insert(FolderNode* node) {
+    if (folder_node_count + 1 > folder_bucket_count) {
+        // Keep chains about one long. If this fails the old table still works.
+        size_t new_count = folder_bucket_count ? folder_bucket_count * 2 : FOLDER_MAP_INITIAL_BUCKETS;
+        FolderNode** new_buckets = calloc(new_count, sizeof(FolderNode*));
+        if (new_buckets) {
+            for (size_t i = 0; i < folder_bucket_count; i++) {
+                FolderNode* n = folder_buckets[i];
+                while (n) {
+                    FolderNode* next = n->hash_next;
+                    size_t b = file_index_hash(n->name) & (new_count - 1);
+                    n->hash_next = new_buckets[b];
+                    new_buckets[b] = n;
+                    n = next;
+                }
+            }
+            free(folder_buckets);
+            folder_buckets = new_buckets;
+            folder_bucket_count = new_count;
+        }
+    }
+    size_t b = file_index_hash(node->name) & (folder_bucket_count - 1);
+    node->hash_next = folder_buckets[b];
+    folder_buckets[b] = node;
+    folder_node_count++;
+}
+
+static void folder_map_remove(FolderNode* node) {
+    size_t b = file_index_hash(node->name) & (folder_bucket_count - 1);
+    for (FolderNode** link = &folder_buckets[b]; *link; link = &(*link)->hash_next) {
+        if (*link == node) {
+            *link = node->hash_next;
+            node->hash_next = NULL;
+            folder_node_count--;
+            return;
+        }
+    }
+}
+
+static void set_folder_name(FolderNode* node, const char* path) {
+    strncpy(node->name, path, MAX_FILENAME - 1);
+    node->name[MAX_FILENAME - 1] = '\0';
+    const char* slash = strrchr(node->name, '/');
+    node->basename = slash ? slash + 1 : node->name;
+}
+
+static int folder_add_child(FolderNode* parent, FolderNode* child) {
+    if (parent->child_count == parent->child_capacity &&
+        grow_array((void**)&parent->children, &parent->child_capacity, sizeof(FolderNode*)) == -1) {
+        return -1;
+    }
+    parent->children[parent->child_count++] = child;
+    child->parent = parent;
+    return 0;
+}
+
+static void folder_remove_child(FolderNode* parent, FolderNode* child) {
+    for (int i = 0; i < parent->child_count; i++) {
+        if (parent->children[i] == child) {
+            // Shift rather than swap so listings keep creation order
+            memmove(&parent->children[i], &parent->children[i + 1],
+                    sizeof(FolderNode*) * (parent->child_count - i - 1));
+            parent->child_count--;
+            return;
+        }
     }
-    for (int i = 0; i < TRIE_CHAR_SET_SIZE; i++) {
-        if (node->children[i]) collect_files_recursive(node->children[i], entries, count, max_count);
+}
+
+/**
+ * @brief Returns the node for 'path', creating it and any missing
+ * ancestors as implied (unlisted) folders.
+ * @return The node, or NULL if out of memory.
+ */
+static FolderNode* folder_create_path(const char* path) {
+    FolderNode* node = folder_lookup(path);
+    if (node) return node;
+
+    char parent_path[MAX_FILENAME];
+    strncpy(parent_path, path, MAX_FILENAME - 1);
+    parent_path[MAX_FILENAME - 1] = '\0';
+    char* slash = strrchr(parent_path, '/');
+    if (slash) *slash = '\0';
+    else parent_path[0] = '\0';
+
+    FolderNode* parent = folder_create_path(parent_path);
+    if (parent == NULL) return NULL;
+
+    node = calloc(1, sizeof(FolderNode));
+    if (node == NULL) return NULL;
+    set_folder_name(node, path);
+    node->owner_username = "";
+    if (folder_add_child(parent, node) == -1) {
+        free(node);
+        return NULL;
     }
+    folder_map_insert(node);
+    return node;
 }
 
-// Update a file's metadata in the trie safely (locks trie_mutex)
-static void search_update_file_metadata(const char* filename, SSMetadataPayload* meta) {
-    pthread_mutex_lock(&trie_mutex);
-    TrieNode* current = root;
-    for (int i = 0; filename[i] != '\0'; i++) {
-        int index = (int)filename[i];
-        if (index < 0 || index >= TRIE_CHAR_SET_SIZE) continue;
-        if (current->children[index] == NULL) { current = NULL; break; }
-        current = current->children[index];
+static void folder_free(FolderNode* node) {
+    folder_remove_child(node->parent, node);
+    folder_map_remove(node);
+    free(node->children);
+    free(node->files);
+    free(node);
+}
+
+/**
+ * @brief Frees implied folders that no longer hold anything, walking up.
+ */
+static void folder_prune(FolderNode* node) {
+    while (node && node != &folder_root && !node->registered &&
+           node->file_count == 0 && node->child_count == 0) {
+        FolderNode* parent = node->parent;
+        folder_free(node);
+        node = parent;
     }
-    if (current && current->file_info) {
-        current->file_info->word_count = meta->word_count;
-        current->file_info->char_count = meta->char_count;
-        current->file_info->last_accessed = meta->last_accessed;
-        current->file_info->modified = meta->last_modified;
-        strncpy(current->file_info->last_accessed_by, meta->last_accessed_by, 64 - 1);
+}
+
+/**
+ * @brief Adds a record to a folder's file list and points its 'folder' at it.
+ * @return 0 on success, -1 if out of memory (the record is then in no folder).
+ */
+static int folder_attach_file(FolderNode* node, FileRecord* file) {
+    if (node->file_count == node->file_capacity &&
+        grow_array((void**)&node->files, &node->file_capacity, sizeof(FileRecord*)) == -1) {
+        file->folder_node = NULL;
+        return -1;
     }
-    pthread_mutex_unlock(&trie_mutex);
+    file->folder_node = node;
+    file->folder_slot = node->file_count;
+    node->files[node->file_count++] = file;
+    file->folder = (node == &folder_root) ? "" : file_index_intern(node->name);
+    return 0;
 }
 
 /**
- * @brief The recursive part of the file list traversal.
- * Walks the Trie from 'node' downwards.
+ * @brief Takes a record out of its folder's file list.
+ * The caller prunes the returned folder once it is done with the tree, so
+ * a folder it is about to reuse cannot be freed underneath it.
+ * @return The folder the record was in (may be NULL).
  */
-static void traverse_for_view(TrieNode* node, ViewTraversalData* data) {
-    if (node == NULL) {
+static FolderNode* folder_detach_file(FileRecord* file) {
+    FolderNode* node = file->folder_node;
+    if (node == NULL) return NULL;
+    FileRecord* last = node->files[--node->file_count];
+    node->files[file->folder_slot] = last;
+    last->folder_slot = file->folder_slot;
+    file->folder_node = NULL;
+    return node;
+}
+
+static void collect_stale_file(const FileRecord* file, FileEntry* entries, int* count) {
+    if (search_metadata_is_fresh(file)) return;
+    strncpy(entries[*count].filename, file->filename, MAX_FILENAME - 1);
+    entries[*count].ss_index = file->ss_index;
+    (*count)++;
+}
+
+// Only files whose metadata is stale are collected; fresh ones are served from memory.
+// A non-NULL 'folder' restricts the walk to files directly in that folder.
+// NOTE: index_lock must be held.
+static void collect_stale_files(const FolderNode* folder, FileEntry* entries, int* count, int max_count) {
+    if (folder) {
+        for (int i = 0; i < folder->file_count && *count < max_count; i++) {
+            collect_stale_file(folder->files[i], entries, count);
+        }
         return;
     }
+    size_t cursor = 0;
+    FileRecord* file;
+    while (*count < max_count && (file = file_index_next(&file_index, &cursor)) != NULL) {
+        collect_stale_file(file, entries, count);
+    }
+}
 
-    // Check if the current node is a file
-    FileRecord* file = node->file_info;
-    if (file != NULL) {
-        // This node represents a file. Check permissions.
-        int has_permission = 0;
-        
-        if (data->flags & VIEW_FLAG_ALL) {
-            has_permission = 1; // -a flag, list all files
-        } else {
-            // No -a flag, check permission
-            // We can't call search_check_permission directly
-            // because it locks the mutex we are already holding.
-            
-            // 1. Check owner
-            if (strcmp(file->owner_username, data->username) == 0) {
-                has_permission = 1;
-            } else {
-                // 2. Check ACL
-                for (int i = 0; i < file->acl_count; i++) {
-                    if (strcmp(file->acl[i].username, data->username) == 0 &&
-                        file->acl[i].permission >= PERM_READ) {
-                        has_permission = 1;
-                        break;
-                    }
-                }
+// NOTE: index_lock must be held exclusive.
+static void apply_metadata_locked(FileRecord* file, const SSMetadataPayload* meta) {
+    file->word_count = meta->word_count;
+    file->char_count = meta->char_count;
+    file->last_accessed = meta->last_accessed;
+    file->modified = meta->last_modified;
+    if (meta->created != 0) file->created = meta->created;
+    file->last_accessed_by = file_index_intern(meta->last_accessed_by);
+    file->metadata_synced = time(NULL);
+}
+
+// Update a file's metadata in the index safely (takes index_lock exclusive)
+void search_apply_metadata(const char* filename, const SSMetadataPayload* meta) {
+    pthread_rwlock_wrlock(&index_lock);
+    FileRecord* file = find_file_record(filename);
+    if (file) apply_metadata_locked(file, meta);
+    pthread_rwlock_unlock(&index_lock);
+}
+
+int search_apply_delta(int ss_index, const SSMetadataDeltaPayload* delta, int* behind, int max_behind) {
+    int behind_count = 0;
+    pthread_rwlock_wrlock(&index_lock);
+    FileRecord* file = find_file_record(delta->filename);
+    if (file && file->ss_index == ss_index) {
+        apply_metadata_locked(file, &delta->meta);
+        if (delta->content_changed) {
+            file->content_version++;
+            if (file->last_writer) file->last_write = time(NULL);
+            for (int i = 0; i < file->replica_count && behind_count < max_behind; i++) {
+                if (!file->replicas[i].suspect) behind[behind_count++] = file->replicas[i].ss_index;
             }
+            queue_replication_locked(file);
         }
-        
-        // If we have permission, add it to the list
-        if (has_permission) {
-            int chars_written = 0;
-            if (data->flags & VIEW_FLAG_LONG) {
-                // -l flag: format as a table row
-                // Format: | filename | word_count | char_count | last_access_time | owner |
-                char time_str[30];
-                strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M", 
-                         localtime(&file->last_accessed));
-                
-                // Include TYPE column: 'F' for file
-                chars_written = snprintf(data->buffer + data->current_offset,
-                                         data->buffer_size - data->current_offset,
-                                         "| F | %-10s | %5ld | %5ld | %16s | %-5s |\n",
-                                         file->filename, file->word_count, file->char_count,
-                                         time_str, file->owner_username);
-            } else {
-                // Regular format: just filename with arrow
-                chars_written = snprintf(data->buffer + data->current_offset,
-                                         data->buffer_size - data->current_offset,
-                                         "--> %s\n", file->filename);
+    } else if (file && replica_find(file, ss_index) != -1) {
+        // A read on a replica: only who accessed it, and when, is news
+        if (delta->meta.last_accessed > file->last_accessed) {
+            file->last_accessed = delta->meta.last_accessed;
+            file->last_accessed_by = file_index_intern(delta->meta.last_accessed_by);
+        }
+    }
+    pthread_rwlock_unlock(&index_lock);
+    return behind_count;
+}
+
+void search_set_metadata_staleness(int seconds) {
+    metadata_max_staleness = seconds < 0 ? 0 : seconds;
+}
+
+int search_metadata_is_fresh(const FileRecord* record) {
+    if (metadata_max_staleness == 0 || record->metadata_synced == 0) return 0;
+    return (time(NULL) - record->metadata_synced) <= metadata_max_staleness;
+}
+
+static int compare_entries_by_ss(const void* a, const void* b) {
+    return ((const FileEntry*)a)->ss_index - ((const FileEntry*)b)->ss_index;
+}
+
+/**
+ * @brief Refreshes indexed metadata for a set of files from their Storage Servers.
+ * Files are grouped per SS into MSG_INTERNAL_GET_METADATA_BATCH requests of
+ * up to SS_METADATA_BATCH_MAX names. Every batch is sent before any reply is
+ * awaited, so the servers work in parallel and each costs one round trip.
+ * NOTE: index_lock must NOT be held. Reorders 'entries'.
+ */
+static void refresh_metadata_batched(FileEntry* entries, int entry_count) {
+    if (entry_count <= 0) return;
+    qsort(entries, entry_count, sizeof(FileEntry), compare_entries_by_ss);
+
+    typedef struct {
+        SSPendingCall* call;
+        int first;
+        int count;
+        int ss_index;
+    } MetadataBatch;
+
+    int max_batches = entry_count / SS_METADATA_BATCH_MAX + ss_registry_capacity + 1;
+    MetadataBatch* batches = calloc(max_batches, sizeof(MetadataBatch));
+    char (*names)[MAX_FILENAME] = malloc((size_t)SS_METADATA_BATCH_MAX * MAX_FILENAME);
+    if (batches == NULL || names == NULL) {
+        free(batches);
+        free(names);
+        return;
+    }
+
+    // 1. Send every batch
+    int batch_count = 0;
+    int i = 0;
+    while (i < entry_count && batch_count < max_batches) {
+        int ss_index = entries[i].ss_index;
+        int n = 0;
+        while (i + n < entry_count && n < SS_METADATA_BATCH_MAX &&
+               entries[i + n].ss_index == ss_index) {
+            n++;
+        }
+
+        StorageServerInfo* ss = get_ss_by_index(ss_index);
+        if (ss != NULL && ss->is_active) {
+            memset(names, 0, (size_t)n * MAX_FILENAME);
+            for (int k = 0; k < n; k++) {
+                strncpy(names[k], entries[i + k].filename, MAX_FILENAME - 1);
             }
 
-            if (data->current_offset + chars_written >= data->buffer_size) {
-                write_log("ERROR", "[SEARCH_VIEW] File list buffer too small!");
-                // Stop recursion by not updating offset
-                return;
+            MessageHeader req;
+            memset(&req, 0, sizeof(req));
+            req.msg_type = MSG_INTERNAL_GET_METADATA_BATCH;
+            req.payload_length = (uint32_t)n * MAX_FILENAME;
+
+            batches[batch_count].call = ss_call_begin(ss, &req, names);
+            batches[batch_count].first = i;
+            batches[batch_count].count = n;
+            batches[batch_count].ss_index = ss_index;
+            batch_count++;
+        }
+        i += n;
+    }
+    free(names);
+
+    // 2. Collect the replies
+    for (int b = 0; b < batch_count; b++) {
+        MetadataBatch* batch = &batches[b];
+        MessageHeader resp;
+        void* resp_buf = NULL;
+        if (ss_call_end(batch->call, &resp, &resp_buf, SS_CALL_TIMEOUT_MS) == -1) {
+            write_log("WARN", "[VIEW_REFRESH] Failed to get metadata batch of %d from SS %d",
+                      batch->count, batch->ss_index);
+            continue;
+        }
+        if (resp.msg_type != MSG_INTERNAL_METADATA_BATCH_RESP ||
+            resp.payload_length != (uint32_t)batch->count * sizeof(SSMetadataBatchEntry)) {
+            write_log("WARN", "[VIEW_REFRESH] Bad metadata batch response from SS %d", batch->ss_index);
+            free(resp_buf);
+            continue;
+        }
+
+        SSMetadataBatchEntry* results = (SSMetadataBatchEntry*)resp_buf;
+        for (int k = 0; k < batch->count; k++) {
+            if (results[k].found) {
+                search_apply_metadata(entries[batch->first + k].filename, &results[k].meta);
             }
-            data->current_offset += chars_written;
+        }
+        write_log("DEBUG", "[VIEW_REFRESH] Refreshed %d files from SS %d in one batch",
+                  batch->count, batch->ss_index);
+        free(resp_buf);
+    }
+    free(batches);
+}
+
+/**
+ * @brief Whether 'username' may see a file in a listing.
+ * We can't call search_check_permission directly
+ * because it takes the lock we are already holding.
+ */
+static int file_is_listed_for(const FileRecord* file, const char* username, int flags) {
+    if (flags & VIEW_FLAG_ALL) return 1; // -a flag, list all files
+    if (strcmp(file->owner_username, username) == 0) return 1;
+    for (int i = 0; i < file->acl_count; i++) {
+        if (strcmp(file->acl[i].username, username) == 0 &&
+            file->acl[i].permission >= PERM_READ) {
+            return 1;
         }
     }
+    return 0;
+}
+
+static int compare_records_by_name(const void* a, const void* b) {
+    return strcmp((*(FileRecord* const*)a)->filename, (*(FileRecord* const*)b)->filename);
+}
 
-    // Continue recursion for all children
-    for (int i = 0; i < TRIE_CHAR_SET_SIZE; i++) {
-        if (data->current_offset >= data->buffer_size) {
-            return; // Buffer is full
+/**
+ * @brief Collects the files directly in 'folder' that the user may see,
+ * sorted by name.
+ * NOTE: index_lock must be held for as long as the records are used.
+ * @return malloc'd array (caller frees), or NULL if empty / out of memory.
+ */
+static FileRecord** collect_listed_files(const FolderNode* folder, const char* username, int flags, int* out_count) {
+    *out_count = 0;
+    if (folder->file_count == 0) return NULL;
+    FileRecord** files = malloc(sizeof(FileRecord*) * folder->file_count);
+    if (files == NULL) return NULL;
+
+    for (int i = 0; i < folder->file_count; i++) {
+        if (file_is_listed_for(folder->files[i], username, flags)) {
+            files[(*out_count)++] = folder->files[i];
         }
-        traverse_for_view(node->children[i], data);
     }
+    qsort(files, *out_count, sizeof(FileRecord*), compare_records_by_name);
+    return files;
+}
+
+/**
+ * @brief Formats one subfolder line of a VIEW / VIEWFOLDER listing.
+ * @return Characters snprintf wanted to write.
+ */
+static int format_folder_line(const FolderNode* folder, int flags, char* buffer, int space) {
+    if (flags & VIEW_FLAG_LONG) {
+        // TYPE D for directory. table: | D | name | - | - | - | owner |
+        return snprintf(buffer, space, "| D | %-10s | %5s | %5s | %16s | %-5s |\n",
+                        folder->basename, "-", "-", "-", folder->owner_username);
+    }
+    return snprintf(buffer, space, "[D] %s\n", folder->basename);
+}
+
+/**
+ * @brief Formats one file line of a VIEW / VIEWFOLDER listing.
+ * @return Characters snprintf wanted to write.
+ */
+static int format_file_line(const FileRecord* file, int flags, char* buffer, int space) {
+    if (flags & VIEW_FLAG_LONG) {
+        // -l flag: format as a table row
+        // Format: | F | filename | word_count | char_count | last_access_time | owner |
+        char time_str[30];
+        strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M", localtime(&file->last_accessed));
+        return snprintf(buffer, space, "| F | %-10s | %5ld | %5ld | %16s | %-5s |\n",
+                        file->filename, file->word_count, file->char_count,
+                        time_str, file->owner_username);
+    }
+    // Regular format: just filename with arrow
+    return snprintf(buffer, space, "--> %s\n", file->filename);
 }
 
 /**
@@ -164,260 +579,219 @@ int search_get_file_list(const char* username, int flags, char* out_buffer, int
 
     // If -l flag requested, refresh metadata from Storage Servers first.
     if (flags & VIEW_FLAG_LONG) {
-        // Collect file list (filenames + ss_index) while holding trie lock
-        int max_files = MAX_STORAGE_SERVERS * MAX_FILES_PER_SERVER;
+        // Collect file list (filenames + ss_index) while holding index_lock
+        int max_files = ss_registry_capacity * MAX_FILES_PER_SERVER;
         FileEntry* entries = malloc(sizeof(FileEntry) * max_files);
         int entry_count = 0;
         if (entries) {
-            pthread_mutex_lock(&trie_mutex);
-            collect_files_recursive(root, entries, &entry_count, max_files);
-            pthread_mutex_unlock(&trie_mutex);
-
-            // For each file, query corresponding SS for metadata and update trie
-            for (int i = 0; i < entry_count; i++) {
-                FileEntry *e = &entries[i];
-                StorageServerInfo* ss = get_ss_by_index(e->ss_index);
-                if (ss == NULL || !ss->is_active) continue;
-
-                // Build internal metadata request
-                MessageHeader meta_req;
-                memset(&meta_req, 0, sizeof(meta_req));
-                meta_req.msg_type = MSG_INTERNAL_GET_METADATA;
-                meta_req.source_component = COMPONENT_NAME_SERVER;
-                strncpy(meta_req.filename, e->filename, MAX_FILENAME - 1);
-
-                SSMetadataPayload meta_payload;
-                memset(&meta_payload, 0, sizeof(meta_payload));
-
-                // Contact SS to get metadata
-                write_log("DEBUG", "[VIEW_REFRESH] Refreshing metadata for '%s' from SS %d", e->filename, e->ss_index);
-                pthread_mutex_lock(&ss->socket_mutex);
-                int ss_sock = ss->ss_socket_fd;
-                if (send_header(ss_sock, &meta_req) == 0) {
-                    MessageHeader resp;
-                    if (recv_header(ss_sock, &resp) == 0 && resp.msg_type == MSG_INTERNAL_METADATA_RESP) {
-                        if (recv_all(ss_sock, &meta_payload, sizeof(meta_payload)) == 0) {
-                            // Update trie record with fresh metadata
-                            search_update_file_metadata(e->filename, &meta_payload);
-                            write_log("DEBUG", "[VIEW_REFRESH] Got metadata for '%s' (words=%ld, chars=%ld)",
-                                      e->filename, meta_payload.word_count, meta_payload.char_count);
-                        } else {
-                            write_log("WARN", "[VIEW_REFRESH] Failed to recv metadata payload for '%s' from SS %d",
-                                      e->filename, e->ss_index);
-                        }
-                    } else {
-                        write_log("WARN", "[VIEW_REFRESH] Bad metadata response header for '%s' from SS %d",
-                                  e->filename, e->ss_index);
-                    }
-                } else {
-                    write_log("WARN", "[VIEW_REFRESH] Failed to send metadata request for '%s' to SS %d",
-                              e->filename, e->ss_index);
-                }
-                pthread_mutex_unlock(&ss->socket_mutex);
-            }
+            pthread_rwlock_rdlock(&index_lock);
+            collect_stale_files(NULL, entries, &entry_count, max_files);
+            pthread_rwlock_unlock(&index_lock);
+
+            // Query the owning SSs for fresh metadata and update the index
+            refresh_metadata_batched(entries, entry_count);
             free(entries);
         }
     }
 
-    // Instead of traversing the entire trie, VIEW should list the immediate
+    // Instead of listing every file, VIEW should list the immediate
     // top-level entries (folders and files in root). Build that list here.
-    pthread_mutex_lock(&trie_mutex);
-
-    // 1) Add top-level folders (those without a '/')
-    for (int i = 0; i < folder_count; i++) {
-        const char* fname = folder_registry[i].foldername;
-        if (strchr(fname, '/') == NULL) {
-            int chars_written = 0;
-            if (data.flags & VIEW_FLAG_LONG) {
-                // TYPE D for directory. table: | D | name | - | - | - | owner |
-                chars_written = snprintf(data.buffer + data.current_offset,
-                                         data.buffer_size - data.current_offset,
-                                         "| D | %-10s | %5s | %5s | %16s | %-5s |\n",
-                                         fname, "-", "-", "-", folder_registry[i].owner_username);
-            } else {
-                chars_written = snprintf(data.buffer + data.current_offset,
-                                         data.buffer_size - data.current_offset,
-                                         "[D] %s\n", fname);
-            }
-            if (data.current_offset + chars_written >= data.buffer_size) {
-                write_log("ERROR", "[SEARCH_VIEW] File list buffer too small when adding folders!");
-                pthread_mutex_unlock(&trie_mutex);
-                return data.current_offset;
-            }
-            data.current_offset += chars_written;
+    pthread_rwlock_rdlock(&index_lock);
+
+    // 1) Add top-level folders
+    for (int i = 0; i < folder_root.child_count; i++) {
+        const FolderNode* child = folder_root.children[i];
+        if (!child->registered) continue;
+        int chars_written = format_folder_line(child, data.flags,
+                                               data.buffer + data.current_offset,
+                                               data.buffer_size - data.current_offset);
+        if (data.current_offset + chars_written >= data.buffer_size) {
+            write_log("ERROR", "[SEARCH_VIEW] File list buffer too small when adding folders!");
+            pthread_rwlock_unlock(&index_lock);
+            return data.current_offset;
         }
+        data.current_offset += chars_written;
     }
 
-    // 2) Add files that are in the root (file->folder is empty)
-    {
-        TrieNode* stack[4096]; int sp = 0; stack[sp++] = root;
-        while (sp > 0) {
-            TrieNode* node = stack[--sp];
-            if (node->file_info) {
-                FileRecord* file = node->file_info;
-                const char* ffolder = file->folder;
-                if (ffolder == NULL || ffolder[0] == '\0') {
-                    int has_permission = 0;
-                    if (data.flags & VIEW_FLAG_ALL) has_permission = 1;
-                    else if (strcmp(file->owner_username, data.username) == 0) has_permission = 1;
-                    else {
-                        for (int a = 0; a < file->acl_count; a++) {
-                            if (strcmp(file->acl[a].username, data.username) == 0 && file->acl[a].permission >= PERM_READ) { has_permission = 1; break; }
-                        }
-                    }
-                    if (has_permission) {
-                        int chars_written = 0;
-                        if (data.flags & VIEW_FLAG_LONG) {
-                            char time_str[30]; strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M", localtime(&file->last_accessed));
-                            chars_written = snprintf(data.buffer + data.current_offset, data.buffer_size - data.current_offset,
-                                                     "| F | %-10s | %5ld | %5ld | %16s | %-5s |\n",
-                                                     file->filename, file->word_count, file->char_count,
-                                                     time_str, file->owner_username);
-                        } else {
-                            chars_written = snprintf(data.buffer + data.current_offset, data.buffer_size - data.current_offset, "--> %s\n", file->filename);
-                        }
-                        if (data.current_offset + chars_written >= data.buffer_size) {
-                            write_log("ERROR", "[SEARCH_VIEW] File list buffer too small when adding files!");
-                            pthread_mutex_unlock(&trie_mutex);
-                            return data.current_offset;
-                        }
-                        data.current_offset += chars_written;
-                    }
-                }
-            }
-            for (int i = 0; i < TRIE_CHAR_SET_SIZE; i++) if (node->children[i]) stack[sp++] = node->children[i];
+    // 2) Add files that are in the root
+    int listed = 0;
+    FileRecord** files = collect_listed_files(&folder_root, data.username, data.flags, &listed);
+    for (int i = 0; i < listed; i++) {
+        int chars_written = format_file_line(files[i], data.flags,
+                                             data.buffer + data.current_offset,
+                                             data.buffer_size - data.current_offset);
+        if (data.current_offset + chars_written >= data.buffer_size) {
+            write_log("ERROR", "[SEARCH_VIEW] File list buffer too small when adding files!");
+            break;
         }
+        data.current_offset += chars_written;
     }
+    free(files);
 
-    pthread_mutex_unlock(&trie_mutex);
+    pthread_rwlock_unlock(&index_lock);
 
     return data.current_offset; // Total bytes written
 }
 
-// -------------------- Folder helpers --------------------
-
-static int starts_with(const char* s, const char* prefix) {
-    if (!s || !prefix) return 0;
-    size_t lp = strlen(prefix);
-    if (lp == 0) return 1;
-    return strncmp(s, prefix, lp) == 0;
-}
+// -------------------- Folder API --------------------
 
 int search_add_folder(const char* foldername, const char* owner_username) {
     if (!foldername || strlen(foldername) == 0) return -1;
-    pthread_mutex_lock(&trie_mutex);
-    for (int i = 0; i < folder_count; i++) {
-        if (strcmp(folder_registry[i].foldername, foldername) == 0) {
-            pthread_mutex_unlock(&trie_mutex);
-            return -1; // already exists
-        }
+    pthread_rwlock_wrlock(&index_lock);
+    FolderNode* node = folder_lookup(foldername);
+    if (node && node->registered) {
+        pthread_rwlock_unlock(&index_lock);
+        return -1; // already exists
     }
-    if (folder_count >= MAX_FOLDERS) {
-        pthread_mutex_unlock(&trie_mutex);
+    // An implied folder (files were moved into it first) is simply claimed.
+    if (node == NULL) node = folder_create_path(foldername);
+    if (node == NULL) {
+        pthread_rwlock_unlock(&index_lock);
+        write_log("FATAL", "[SEARCH] Out of memory adding folder '%s'", foldername);
         return -1;
     }
-    strncpy(folder_registry[folder_count].foldername, foldername, MAX_FILENAME - 1);
-    strncpy(folder_registry[folder_count].owner_username, owner_username, 64 - 1);
-    folder_count++;
-    pthread_mutex_unlock(&trie_mutex);
+    node->registered = 1;
+    node->owner_username = file_index_intern(owner_username);
+    pthread_rwlock_unlock(&index_lock);
     write_log("SEARCH", "Added folder '%s' (owner=%s)", foldername, owner_username);
     return 0;
 }
 
 int search_find_folder(const char* foldername) {
     if (!foldername) return -1;
-    int idx = -1;
-    pthread_mutex_lock(&trie_mutex);
-    for (int i = 0; i < folder_count; i++) {
-        if (strcmp(folder_registry[i].foldername, foldername) == 0) { idx = i; break; }
-    }
-    pthread_mutex_unlock(&trie_mutex);
-    return idx;
+    pthread_rwlock_rdlock(&index_lock);
+    FolderNode* node = folder_lookup(foldername);
+    int found = (node && node->registered) ? 0 : -1;
+    pthread_rwlock_unlock(&index_lock);
+    return found;
 }
 
 int search_set_file_folder(const char* filename, const char* foldername, const char* owner_username) {
     if (!filename) return -1;
-    pthread_mutex_lock(&trie_mutex);
-    TrieNode* current = root;
-    for (int i = 0; filename[i] != '\0'; i++) {
-        int index = (int)filename[i];
-        if (index < 0 || index >= TRIE_CHAR_SET_SIZE || current->children[index] == NULL) {
-            pthread_mutex_unlock(&trie_mutex);
-            return -1; // Not found
-        }
-        current = current->children[index];
-    }
-    if (current->file_info == NULL) {
-        pthread_mutex_unlock(&trie_mutex);
-        return -1;
+    pthread_rwlock_wrlock(&index_lock);
+    FileRecord* file = find_file_record(filename);
+    if (file == NULL) {
+        pthread_rwlock_unlock(&index_lock);
+        return -1; // Not found
     }
-    if (strcmp(current->file_info->owner_username, owner_username) != 0) {
-        pthread_mutex_unlock(&trie_mutex);
+    if (strcmp(file->owner_username, owner_username) != 0) {
+        pthread_rwlock_unlock(&index_lock);
         return -2; // Access denied
     }
 
-    if (foldername && strlen(foldername) > 0)
-        strncpy(current->file_info->folder, foldername, MAX_FILENAME - 1);
-    else
-        current->file_info->folder[0] = '\0';
+    FolderNode* target = folder_create_path(foldername ? foldername : "");
+    if (target == NULL) {
+        pthread_rwlock_unlock(&index_lock);
+        write_log("FATAL", "[SEARCH] Out of memory moving '%s'", filename);
+        return -1;
+    }
+    FolderNode* previous = folder_detach_file(file);
+    if (folder_attach_file(target, file) == -1) {
+        write_log("FATAL", "[SEARCH] Out of memory moving '%s'", filename);
+    }
+    folder_prune(previous);
 
-    int ss_index = current->file_info->ss_index;
-    pthread_mutex_unlock(&trie_mutex);
+    int ss_index = file->ss_index;
+    pthread_rwlock_unlock(&index_lock);
     write_log("SEARCH", "Moved file '%s' to folder '%s'", filename, foldername ? foldername : "");
     return ss_index;
 }
 
-int search_move_folder(const char* src, const char* dst, const char* owner_username, MoveFileUpdate* out_updates, int max_updates) {
-    if (!src || !dst) return -1;
-    pthread_mutex_lock(&trie_mutex);
-    int src_idx = -1;
-    for (int i = 0; i < folder_count; i++) if (strcmp(folder_registry[i].foldername, src) == 0) { src_idx = i; break; }
-    if (src_idx == -1) { pthread_mutex_unlock(&trie_mutex); return -1; }
-    if (strcmp(folder_registry[src_idx].owner_username, owner_username) != 0) { pthread_mutex_unlock(&trie_mutex); return -1; }
+/**
+ * @brief Length of the longest folder path in a subtree.
+ */
+static size_t longest_subtree_path(const FolderNode* node) {
+    size_t longest = strlen(node->name);
+    for (int i = 0; i < node->child_count; i++) {
+        size_t length = longest_subtree_path(node->children[i]);
+        if (length > longest) longest = length;
+    }
+    return longest;
+}
 
-    // Ensure dst does not already exist
-    for (int i = 0; i < folder_count; i++) if (strcmp(folder_registry[i].foldername, dst) == 0) { pthread_mutex_unlock(&trie_mutex); return -1; }
+/**
+ * @brief Re-keys a folder subtree under a new path, rewriting the folder
+ * of every file in it and recording each change for the SSs. The caller
+ * has checked that every new path fits in MAX_FILENAME.
+ */
+static void rename_subtree(FolderNode* node, const char* new_path, MoveFileUpdate* out_updates,
+                           int max_updates, int* out_i, int* updated) {
+    folder_map_remove(node);
+    set_folder_name(node, new_path);
+    folder_map_insert(node);
+
+    const char* interned = file_index_intern(node->name);
+    for (int i = 0; i < node->file_count; i++) {
+        FileRecord* file = node->files[i];
+        file->folder = interned;
+        if (out_updates && *out_i < max_updates) {
+            strncpy(out_updates[*out_i].filename, file->filename, MAX_FILENAME - 1);
+            strncpy(out_updates[*out_i].folder, file->folder, MAX_FILENAME - 1);
+            out_updates[*out_i].ss_index = file->ss_index;
+            (*out_i)++;
+        }
+        (*updated)++;
+    }
 
-    // Rename folder entry (src -> dst)
-    strncpy(folder_registry[src_idx].foldername, dst, MAX_FILENAME - 1);
+    for (int i = 0; i < node->child_count; i++) {
+        FolderNode* child = node->children[i];
+        char child_path[MAX_FILENAME];
+        int length = snprintf(child_path, sizeof(child_path), "%s/%s", node->name, child->basename);
+        if (length < 0 || (size_t)length >= sizeof(child_path)) continue;
+        rename_subtree(child, child_path, out_updates, max_updates, out_i, updated);
+    }
+}
 
-    int updated = 0;
-    int out_i = 0;
-    // Walk trie and update
-    TrieNode* stack[4096];
-    int sp = 0;
-    stack[sp++] = root;
+int search_move_folder(const char* src, const char* dst, const char* owner_username, MoveFileUpdate* out_updates, int max_updates) {
+    if (!src || !dst || dst[0] == '\0') return -1;
+    pthread_rwlock_wrlock(&index_lock);
+    FolderNode* node = folder_lookup(src);
+    if (node == NULL || !node->registered) { pthread_rwlock_unlock(&index_lock); return -1; }
+    if (strcmp(node->owner_username, owner_username) != 0) { pthread_rwlock_unlock(&index_lock); return -1; }
+
+    // A folder cannot be moved into itself
     size_t src_len = strlen(src);
+    if (strcmp(src, dst) == 0 || (strncmp(dst, src, src_len) == 0 && dst[src_len] == '/')) {
+        pthread_rwlock_unlock(&index_lock);
+        return -1;
+    }
 
-    while (sp > 0) {
-        TrieNode* node = stack[--sp];
-        if (node->file_info) {
-            if (starts_with(node->file_info->folder, src)) {
-                char new_folder[MAX_FILENAME] = {0};
-                if (src_len == 0) {
-                    strncpy(new_folder, dst, MAX_FILENAME - 1);
-                } else {
-                    const char* rest = node->file_info->folder + src_len;
-                    if (rest[0] == '/') rest++;
-                    if (strlen(rest) > 0)
-                        snprintf(new_folder, MAX_FILENAME, "%s/%s", dst, rest);
-                    else
-                        snprintf(new_folder, MAX_FILENAME, "%s", dst);
-                }
-                strncpy(node->file_info->folder, new_folder, MAX_FILENAME - 1);
-                if (out_updates && out_i < max_updates) {
-                    strncpy(out_updates[out_i].filename, node->file_info->filename, MAX_FILENAME - 1);
-                    strncpy(out_updates[out_i].folder, node->file_info->folder, MAX_FILENAME - 1);
-                    out_updates[out_i].ss_index = node->file_info->ss_index;
-                    out_i++;
-                }
-                updated++;
-            }
-        }
-        for (int i = 0; i < TRIE_CHAR_SET_SIZE; i++) if (node->children[i]) stack[sp++] = node->children[i];
+    // Ensure dst does not already exist. An empty implied node is in the way
+    // only by name, so it is dropped.
+    FolderNode* existing = folder_lookup(dst);
+    if (existing && (existing->registered || existing->file_count > 0 || existing->child_count > 0)) {
+        pthread_rwlock_unlock(&index_lock);
+        return -1;
+    }
+    // Every folder below keeps its path relative to src, so the deepest one must still fit
+    if (longest_subtree_path(node) - strlen(node->name) + strlen(dst) >= MAX_FILENAME) {
+        pthread_rwlock_unlock(&index_lock);
+        return -1;
     }
+    if (existing) folder_free(existing);
+
+    char parent_path[MAX_FILENAME];
+    strncpy(parent_path, dst, MAX_FILENAME - 1);
+    parent_path[MAX_FILENAME - 1] = '\0';
+    char* slash = strrchr(parent_path, '/');
+    if (slash) *slash = '\0';
+    else parent_path[0] = '\0';
+
+    FolderNode* old_parent = node->parent;
+    FolderNode* new_parent = folder_create_path(parent_path);
+    if (new_parent == NULL || folder_add_child(new_parent, node) == -1) {
+        pthread_rwlock_unlock(&index_lock);
+        write_log("FATAL", "[SEARCH] Out of memory moving folder '%s'", src);
+        return -1;
+    }
+    folder_remove_child(old_parent, node);
+
+    int updated = 0;
+    int out_i = 0;
+    rename_subtree(node, dst, out_updates, max_updates, &out_i, &updated);
+    folder_prune(old_parent);
 
-    pthread_mutex_unlock(&trie_mutex);
+    pthread_rwlock_unlock(&index_lock);
     write_log("SEARCH", "Moved folder '%s' -> '%s' and updated %d files", src, dst, updated);
     return out_i; // number of updates written to out_updates
 }
@@ -433,215 +807,99 @@ int search_get_files_in_folder(const char* foldername, const char* username, int
 
     // If -l flag requested, refresh metadata for files in this folder
     if (flags & VIEW_FLAG_LONG) {
-        int max_files = MAX_STORAGE_SERVERS * MAX_FILES_PER_SERVER;
+        int max_files = ss_registry_capacity * MAX_FILES_PER_SERVER;
         FileEntry* entries = malloc(sizeof(FileEntry) * max_files);
         int entry_count = 0;
         if (entries) {
-            pthread_mutex_lock(&trie_mutex);
-            TrieNode* stack[4096]; int sp = 0; stack[sp++] = root;
-            while (sp > 0 && entry_count < max_files) {
-                TrieNode* node = stack[--sp];
-                if (node->file_info) {
-                    if (strcmp(node->file_info->folder, foldername ? foldername : "") == 0) {
-                        strncpy(entries[entry_count].filename, node->file_info->filename, MAX_FILENAME - 1);
-                        entries[entry_count].ss_index = node->file_info->ss_index;
-                        entry_count++;
-                    }
-                }
-                for (int i = 0; i < TRIE_CHAR_SET_SIZE; i++) if (node->children[i]) stack[sp++] = node->children[i];
-            }
-            pthread_mutex_unlock(&trie_mutex);
-
-            for (int i = 0; i < entry_count; i++) {
-                FileEntry *e = &entries[i];
-                StorageServerInfo* ss = get_ss_by_index(e->ss_index);
-                if (ss == NULL || !ss->is_active) continue;
-                MessageHeader meta_req;
-                memset(&meta_req, 0, sizeof(meta_req));
-                meta_req.msg_type = MSG_INTERNAL_GET_METADATA;
-                meta_req.source_component = COMPONENT_NAME_SERVER;
-                strncpy(meta_req.filename, e->filename, MAX_FILENAME - 1);
-
-                SSMetadataPayload meta_payload;
-                memset(&meta_payload, 0, sizeof(meta_payload));
-
-                pthread_mutex_lock(&ss->socket_mutex);
-                int ss_sock = ss->ss_socket_fd;
-                if (send_header(ss_sock, &meta_req) == 0) {
-                    MessageHeader resp;
-                    if (recv_header(ss_sock, &resp) == 0 && resp.msg_type == MSG_INTERNAL_METADATA_RESP) {
-                        if (recv_all(ss_sock, &meta_payload, sizeof(meta_payload)) == 0) {
-                            search_update_file_metadata(e->filename, &meta_payload);
-                        }
-                    }
-                }
-                pthread_mutex_unlock(&ss->socket_mutex);
-            }
+            pthread_rwlock_rdlock(&index_lock);
+            FolderNode* folder = folder_lookup(foldername);
+            if (folder) collect_stale_files(folder, entries, &entry_count, max_files);
+            pthread_rwlock_unlock(&index_lock);
+
+            refresh_metadata_batched(entries, entry_count);
             free(entries);
         }
     }
 
-    // Build listing: immediate subfolders then files
-    pthread_mutex_lock(&trie_mutex);
-    int base_len = foldername ? strlen(foldername) : 0;
-    for (int i = 0; i < folder_count; i++) {
-        const char* fname = folder_registry[i].foldername;
-        if (base_len == 0) {
-            if (strchr(fname, '/') == NULL) {
-                int chars_written = 0;
-                if (flags & VIEW_FLAG_LONG) {
-                    chars_written = snprintf(out_buffer + data.current_offset, data.buffer_size - data.current_offset,
-                                             "| D | %-10s | %5s | %5s | %16s | %-5s |\n",
-                                             fname, "-", "-", "-", folder_registry[i].owner_username);
-                } else {
-                    chars_written = snprintf(out_buffer + data.current_offset, data.buffer_size - data.current_offset, "[D] %s\n", fname);
-                }
-                if (data.current_offset + chars_written < data.buffer_size) data.current_offset += chars_written;
-            }
-        } else {
-            char prefix[MAX_FILENAME]; snprintf(prefix, sizeof(prefix), "%s/", foldername);
-            if (starts_with(fname, prefix)) {
-                const char* rest = fname + strlen(prefix);
-                if (strchr(rest, '/') == NULL) {
-                    int chars_written = 0;
-                    if (flags & VIEW_FLAG_LONG) {
-                        chars_written = snprintf(out_buffer + data.current_offset, data.buffer_size - data.current_offset,
-                                                 "| D | %-10s | %5s | %5s | %16s | %-5s |\n",
-                                                 rest, "-", "-", "-", folder_registry[i].owner_username);
-                    } else {
-                        chars_written = snprintf(out_buffer + data.current_offset, data.buffer_size - data.current_offset, "[D] %s\n", rest);
-                    }
-                    if (data.current_offset + chars_written < data.buffer_size) data.current_offset += chars_written;
-                }
-            }
-        }
+    // Build listing: immediate subfolders then files.
+    // Looked up again: the folder may have moved while the lock was dropped.
+    pthread_rwlock_rdlock(&index_lock);
+    FolderNode* folder = folder_lookup(foldername);
+    if (folder == NULL) {
+        pthread_rwlock_unlock(&index_lock);
+        return 0;
+    }
+    for (int i = 0; i < folder->child_count; i++) {
+        const FolderNode* child = folder->children[i];
+        if (!child->registered) continue;
+        int chars_written = format_folder_line(child, flags, out_buffer + data.current_offset,
+                                               data.buffer_size - data.current_offset);
+        if (data.current_offset + chars_written < data.buffer_size) data.current_offset += chars_written;
     }
 
     // Files in this folder
-    TrieNode* stack2[4096]; int sp2 = 0; stack2[sp2++] = root;
-    while (sp2 > 0) {
-        TrieNode* node = stack2[--sp2];
-        if (node->file_info) {
-            const char* ffolder = node->file_info->folder;
-            if (((foldername == NULL || strlen(foldername) == 0) && (ffolder == NULL || strlen(ffolder) == 0))
-                || (ffolder && foldername && strcmp(ffolder, foldername) == 0)) {
-                int has_permission = 0;
-                if (flags & VIEW_FLAG_ALL) has_permission = 1;
-                else if (strcmp(node->file_info->owner_username, username) == 0) has_permission = 1;
-                else {
-                    for (int a = 0; a < node->file_info->acl_count; a++) {
-                        if (strcmp(node->file_info->acl[a].username, username) == 0 && node->file_info->acl[a].permission >= PERM_READ) { has_permission = 1; break; }
-                    }
-                }
-                if (has_permission) {
-                    int chars_written = 0;
-                    if (flags & VIEW_FLAG_LONG) {
-                        char time_str[30]; strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M", localtime(&node->file_info->last_accessed));
-                        chars_written = snprintf(out_buffer + data.current_offset, data.buffer_size - data.current_offset,
-                                                 "| F | %-10s | %5ld | %5ld | %16s | %-5s |\n",
-                                                 node->file_info->filename, node->file_info->word_count, node->file_info->char_count,
-                                                 time_str, node->file_info->owner_username);
-                    } else {
-                        chars_written = snprintf(out_buffer + data.current_offset, data.buffer_size - data.current_offset, "--> %s\n", node->file_info->filename);
-                    }
-                    if (data.current_offset + chars_written < data.buffer_size) data.current_offset += chars_written;
-                }
-            }
-        }
-        for (int i = 0; i < TRIE_CHAR_SET_SIZE; i++) if (node->children[i]) stack2[sp2++] = node->children[i];
+    int listed = 0;
+    FileRecord** files = collect_listed_files(folder, username, flags, &listed);
+    for (int i = 0; i < listed; i++) {
+        int chars_written = format_file_line(files[i], flags, out_buffer + data.current_offset,
+                                             data.buffer_size - data.current_offset);
+        if (data.current_offset + chars_written < data.buffer_size) data.current_offset += chars_written;
     }
+    free(files);
 
-    pthread_mutex_unlock(&trie_mutex);
+    pthread_rwlock_unlock(&index_lock);
     return data.current_offset;
 }
 
-/**
- * @brief Creates and initializes a new TrieNode.
- */
-static TrieNode* create_node() {
-    TrieNode* node = (TrieNode*)malloc(sizeof(TrieNode));
-    if (node) {
-        node->file_info = NULL;
-        for (int i = 0; i < TRIE_CHAR_SET_SIZE; i++) {
-            node->children[i] = NULL;
-        }
-    }
-    return node;
-}
-
-/**
- * @brief Internal helper to find a file record.
- * Returns a pointer to the record or NULL if not found.
- * NOTE: This function assumes the trie_mutex is already locked.
- */
-static FileRecord* find_file_record(const char* filename) {
-    TrieNode* current = root;
-    for (int i = 0; filename[i] != '\0'; i++) {
-        int index = (int)filename[i];
-        if (index < 0 || index >= TRIE_CHAR_SET_SIZE) continue; // Skip invalid chars
-
-        if (current->children[index] == NULL) {
-            return NULL; // Path does not exist
-        }
-        current = current->children[index];
-    }
-    
-    // At the end of the string, check if it's a file
-    return current->file_info; // Will be NULL if not a file
-}
-
 // =========================================================================
 //  PUBLIC API FUNCTIONS
 // =========================================================================
 
 void init_search_trie() {
-    root = create_node();
-    pthread_mutex_init(&trie_mutex, NULL);
-    write_log("INIT", "File Search (Trie) initialized.");
+    if (file_index_init(&file_index, FILE_INDEX_INITIAL_CAPACITY) == -1) {
+        write_log("FATAL", "Failed to allocate the file index.");
+    }
+    pthread_rwlock_init(&index_lock, NULL);
+    set_folder_name(&folder_root, "");
+    folder_root.owner_username = "";
+    write_log("INIT", "File Search (hash index) initialized.");
 }
 
 /**
  * @brief Adds a file to the Trie.
  */
 void search_add_file(const char* filename, int ss_index, const char* owner) {
-    pthread_mutex_lock(&trie_mutex);
+    pthread_rwlock_wrlock(&index_lock);
 
-    TrieNode* current = root;
-    for (int i = 0; filename[i] != '\0'; i++) {
-        int index = (int)filename[i];
-        if (index < 0 || index >= TRIE_CHAR_SET_SIZE) continue;
-
-        if (current->children[index] == NULL) {
-            current->children[index] = create_node();
-        }
-        current = current->children[index];
-    }
-
-    // At the end of the path
-    if (current->file_info != NULL) {
+    if (find_file_record(filename) != NULL) {
         write_log("WARN", "[SEARCH] File '%s' already exists. (Not adding)", filename);
     } else {
         // Create new FileRecord
-        FileRecord* new_record = (FileRecord*)malloc(sizeof(FileRecord));
+        FileRecord* new_record = (FileRecord*)calloc(1, sizeof(FileRecord));
+        if (new_record == NULL) {
+            pthread_rwlock_unlock(&index_lock);
+            write_log("FATAL", "[SEARCH] Out of memory adding '%s'", filename);
+            return;
+        }
         strncpy(new_record->filename, filename, MAX_FILENAME- 1);
-        strncpy(new_record->owner_username, owner, 64 - 1);
+        new_record->owner_username = file_index_intern(owner);
         new_record->ss_index = ss_index;
-    new_record->folder[0] = '\0';
-    new_record->word_count = 0;
-    new_record->char_count = 0;
-    new_record->created = 0;
-    new_record->modified = 0;
-    new_record->last_accessed = 0;
-    new_record->last_accessed_by[0] = '\0';
-        new_record->acl_count = 0;
-        
-        current->file_info = new_record; // Link it to the trie
-
-        write_log("SEARCH", "Added file '%s' to records (on SS index %d, Owner: %s)", 
-                  filename, ss_index, owner);
+        new_record->folder = "";
+        new_record->last_accessed_by = "";
+        new_record->metadata_synced = 0; // The SS pushes real values once it has the file
+        new_record->content_version = 1;
+
+        if (file_index_insert(&file_index, new_record) == -1) {
+            free(new_record);
+            write_log("FATAL", "[SEARCH] File index full; could not add '%s'", filename);
+        } else {
+            folder_attach_file(&folder_root, new_record);
+            write_log("SEARCH", "Added file '%s' to records (on SS index %d, Owner: %s)", 
+                      filename, ss_index, owner);
+        }
     }
 
-    pthread_mutex_unlock(&trie_mutex);
+    pthread_rwlock_unlock(&index_lock);
 }
 
 /**
@@ -654,24 +912,26 @@ int search_find_file(const char* filename) {
         return cached_index; // Cache Hit!
     }
 
-    // --- 2. CACHE MISS: Search the Trie ---
-    pthread_mutex_lock(&trie_mutex);
+    // --- 2. CACHE MISS: Search the index ---
+    pthread_rwlock_rdlock(&index_lock);
 
     FileRecord* record = find_file_record(filename);
     int ss_index = -1;
 
     if (record != NULL) {
         ss_index = record->ss_index;
+        // --- 3. ADD TO CACHE ---
+        // Still under index_lock, so a concurrent delete cannot slip in
+        // between its invalidation and this add.
+        cache_add(filename, ss_index);
     }
 
-    pthread_mutex_unlock(&trie_mutex);
+    pthread_rwlock_unlock(&index_lock);
 
-    // --- 3. ADD TO CACHE (if found) ---
     if (ss_index != -1) {
-        write_log("SEARCH", "Search for '%s'... found on SS index %d (Trie)", filename, ss_index);
-        cache_add(filename, ss_index);
+        write_log("SEARCH", "Search for '%s'... found on SS index %d (index)", filename, ss_index);
     } else {
-        write_log("SEARCH", "Search for '%s'... NOT FOUND (Trie)", filename);
+        write_log("SEARCH", "Search for '%s'... NOT FOUND (index)", filename);
     }
 
     return ss_index;
@@ -681,33 +941,36 @@ int search_find_file(const char* filename) {
  * @brief Checks if a user has a specific permission for a file.
  */
 int search_check_permission(const char* filename, const char* username, PermissionType permission) {
-    pthread_mutex_lock(&trie_mutex);
+    // Every client command asks this first, so decisions are cached.
+    int cached = cache_lookup_permission(filename, username, permission);
+    if (cached != -1) {
+        return cached;
+    }
+
+    pthread_rwlock_rdlock(&index_lock);
     
     FileRecord* record = find_file_record(filename);
     if (record == NULL) {
-        pthread_mutex_unlock(&trie_mutex);
+        pthread_rwlock_unlock(&index_lock);
         return 0; // File doesn't exist, so no permission
     }
 
-    // 1. Check if user is the owner (owner has all permissions)
+    // Resolve the user's highest permission once, and cache that
+    PermissionType level = PERM_NONE;
     if (strcmp(record->owner_username, username) == 0) {
-        pthread_mutex_unlock(&trie_mutex);
-        return 1; // Owner can do anything
-    }
-
-    // 2. Check the ACL
-    for (int i = 0; i < record->acl_count; i++) {
-        if (strcmp(record->acl[i].username, username) == 0) {
-            if (record->acl[i].permission >= permission) {
-                pthread_mutex_unlock(&trie_mutex);
-                return 1; // Access granted
+        level = PERM_WRITE; // Owner can do anything
+    } else {
+        for (int i = 0; i < record->acl_count; i++) {
+            if (strcmp(record->acl[i].username, username) == 0 && record->acl[i].permission > level) {
+                level = record->acl[i].permission;
             }
         }
     }
+    // Added under index_lock: ACL changes invalidate under it exclusive.
+    cache_add_permission(filename, record->ss_index, username, level);
 
-    // 3. No match
-    pthread_mutex_unlock(&trie_mutex);
-    return 0; // Access denied
+    pthread_rwlock_unlock(&index_lock);
+    return level >= permission;
 }
 
 /**
@@ -716,17 +979,17 @@ int search_check_permission(const char* filename, const char* username, Permissi
 int search_grant_permission(const char* filename, const char* owner_username, 
                             const char* target_username, PermissionType permission) {
     
-    pthread_mutex_lock(&trie_mutex);
+    pthread_rwlock_wrlock(&index_lock);
     
     FileRecord* record = find_file_record(filename);
     if (record == NULL) {
-        pthread_mutex_unlock(&trie_mutex);
+        pthread_rwlock_unlock(&index_lock);
         return -1; // File not found
     }
 
     // 1. Check if the user making the request is the owner
     if (strcmp(record->owner_username, owner_username) != 0) {
-        pthread_mutex_unlock(&trie_mutex);
+        pthread_rwlock_unlock(&index_lock);
         return -1; // Not the owner, access denied
     }
 
@@ -743,16 +1006,17 @@ int search_grant_permission(const char* filename, const char* owner_username,
         record->acl[found_index].permission = permission;
     } else {
         if (record->acl_count >= MAX_ACL_ENTRIES) {
-            pthread_mutex_unlock(&trie_mutex);
+            pthread_rwlock_unlock(&index_lock);
             return -1; // ACL is full
         }
         int new_index = record->acl_count;
-        strncpy(record->acl[new_index].username, target_username, 64 - 1);
+        record->acl[new_index].username = file_index_intern(target_username);
         record->acl[new_index].permission = permission;
         record->acl_count++;
     }
+    cache_invalidate(filename); // Drop cached permission decisions
 
-    pthread_mutex_unlock(&trie_mutex);
+    pthread_rwlock_unlock(&index_lock);
     write_log("SEARCH", "User '%s' granted permission %d for file '%s' to user '%s'",
               owner_username, permission, filename, target_username);
     return 0; // Success
@@ -764,16 +1028,16 @@ int search_grant_permission(const char* filename, const char* owner_username,
 int search_remove_permission(const char* filename, const char* owner_username, 
                              const char* target_username) {
 
-    pthread_mutex_lock(&trie_mutex);
+    pthread_rwlock_wrlock(&index_lock);
     
     FileRecord* record = find_file_record(filename);
     if (record == NULL) {
-        pthread_mutex_unlock(&trie_mutex);
+        pthread_rwlock_unlock(&index_lock);
         return -1; // File not found
     }
 
     if (strcmp(record->owner_username, owner_username) != 0) {
-        pthread_mutex_unlock(&trie_mutex);
+        pthread_rwlock_unlock(&index_lock);
         return -1; // Not the owner
     }
 
@@ -789,55 +1053,44 @@ int search_remove_permission(const char* filename, const char* owner_username,
         int last_index = record->acl_count - 1;
         record->acl[found_index] = record->acl[last_index]; // Swap with last
         record->acl_count--;
+        cache_invalidate(filename); // Drop cached permission decisions
     }
 
-    pthread_mutex_unlock(&trie_mutex);
+    pthread_rwlock_unlock(&index_lock);
     write_log("SEARCH", "User '%s' removed access for file '%s' from user '%s'",
               owner_username, filename, target_username);
     return 0; // Success
 }
 
 /**
- * @brief Deletes a file record from the Trie.
- * For simplicity, we find the node, free the FileRecord,
- * and set the pointer to NULL. (A full implementation
- * would also prune parent nodes if they become empty).
+ * @brief Deletes a file record from the index.
  */
 int search_delete_file(const char* filename, const char* username) {
-    pthread_mutex_lock(&trie_mutex);
-
-    TrieNode* current = root;
-    for (int i = 0; filename[i] != '\0'; i++) {
-        int index = (int)filename[i];
-        if (index < 0 || index >= TRIE_CHAR_SET_SIZE || current->children[index] == NULL) {
-            pthread_mutex_unlock(&trie_mutex);
-            write_log("SEARCH", "User '%s' failed to delete '%s': File Not Found.", username, filename);
-            return -1; // Not Found
-        }
-        current = current->children[index];
-    }
+    pthread_rwlock_wrlock(&index_lock);
 
-    // We found the node. Now check file_info and ownership.
-    if (current->file_info == NULL) {
-        pthread_mutex_unlock(&trie_mutex);
+    FileRecord* file = find_file_record(filename);
+    if (file == NULL) {
+        pthread_rwlock_unlock(&index_lock);
         write_log("SEARCH", "User '%s' failed to delete '%s': File Not Found.", username, filename);
         return -1; // Not Found
     }
 
-    if (strcmp(current->file_info->owner_username, username) != 0) {
-        pthread_mutex_unlock(&trie_mutex);
+    if (strcmp(file->owner_username, username) != 0) {
+        pthread_rwlock_unlock(&index_lock);
         write_log("SEARCH", "User '%s' failed to delete '%s': Access Denied (Not Owner).", username, filename);
         return -2; // Access Denied
     }
 
     // --- Access Granted ---
-    int ss_index = current->file_info->ss_index;
+    int ss_index = file->ss_index;
     
-    // Free the record and unlink it from the trie
-    free(current->file_info);
-    current->file_info = NULL;
+    // Unlink the record from the index and its folder, and free it
+    file_index_remove(&file_index, filename);
+    folder_prune(folder_detach_file(file));
+    free(file);
+    cache_invalidate(filename);
 
-    pthread_mutex_unlock(&trie_mutex);
+    pthread_rwlock_unlock(&index_lock);
     
     write_log("SEARCH", "User '%s' successfully deleted file '%s' (from SS %d).", 
               username, filename, ss_index);
@@ -849,12 +1102,12 @@ int search_delete_file(const char* filename, const char* username) {
  * @brief Gets a copy of a file's details.
  */
 int search_get_file_details(const char* filename, FileRecord* record_copy) {
-    pthread_mutex_lock(&trie_mutex);
+    pthread_rwlock_rdlock(&index_lock);
     
     FileRecord* record_in_trie = find_file_record(filename);
     
     if (record_in_trie == NULL) {
-        pthread_mutex_unlock(&trie_mutex);
+        pthread_rwlock_unlock(&index_lock);
         return -1; // Not Found
     }
     
@@ -863,38 +1116,182 @@ int search_get_file_details(const char* filename, FileRecord* record_copy) {
     // pointer to the live trie data.
     memcpy(record_copy, record_in_trie, sizeof(FileRecord));
     
-    pthread_mutex_unlock(&trie_mutex);
+    pthread_rwlock_unlock(&index_lock);
     return 0; // Success
 }
 
-// --- Internal recursive helper for purging ---
-static void recursive_purge_by_ss(TrieNode* node, int dead_ss_index) {
-    if (node == NULL) {
-        return;
+// =========================================================================
+//  REPLICAS
+// =========================================================================
+
+int search_get_read_servers(const char* filename, const char* username, int* out, int max, int* replica_count) {
+    pthread_rwlock_rdlock(&index_lock);
+    FileRecord* file = find_file_record(filename);
+    if (file == NULL) {
+        pthread_rwlock_unlock(&index_lock);
+        return -1;
     }
+    int count = 0;
+    if (max > 0) out[count++] = file->ss_index;
+    *replica_count = file->replica_count;
+
+    // Until a replica has caught up, a writer could read its own write back
+    // stale. A stale read beats none when the primary is away, though.
+    int own_write = !file->suspect && file->last_writer != NULL && strcmp(file->last_writer, username) == 0 &&
+                    time(NULL) - file->last_write <= NS_READ_YOUR_WRITES_SEC;
+    for (int i = 0; !own_write && i < file->replica_count && count < max; i++) {
+        if (replica_is_current(file, &file->replicas[i])) out[count++] = file->replicas[i].ss_index;
+    }
+    pthread_rwlock_unlock(&index_lock);
+    return count;
+}
 
-    // Check if the current node is a file
-    FileRecord* file = node->file_info;
-    if (file != NULL) {
-        // This node is a file. Does it belong to the dead server?
-        if (file->ss_index == dead_ss_index) {
-            write_log("SEARCH", "Purging file '%s' (was on dead SS %d)", 
-                      file->filename, dead_ss_index);
-            
-            // Invalidate from cache
-            cache_invalidate(file->filename);
-            
-            // Free the record and unlink it from the trie
-            free(node->file_info);
-            node->file_info = NULL;
+void search_note_writer(const char* filename, const char* username) {
+    pthread_rwlock_wrlock(&index_lock);
+    FileRecord* file = find_file_record(filename);
+    if (file) {
+        file->last_writer = file_index_intern(username);
+        file->last_write = time(NULL);
+    }
+    pthread_rwlock_unlock(&index_lock);
+}
+
+int search_get_copies(const char* filename, int* out, int max) {
+    pthread_rwlock_rdlock(&index_lock);
+    FileRecord* file = find_file_record(filename);
+    if (file == NULL) {
+        pthread_rwlock_unlock(&index_lock);
+        return -1;
+    }
+    int count = 0;
+    if (max > 0) out[count++] = file->ss_index;
+    for (int i = 0; i < file->replica_count && count < max; i++) {
+        out[count++] = file->replicas[i].ss_index;
+    }
+    pthread_rwlock_unlock(&index_lock);
+    return count;
+}
+
+int search_add_replica(const char* filename, int ss_index) {
+    pthread_rwlock_wrlock(&index_lock);
+    FileRecord* file = find_file_record(filename);
+    if (file == NULL || file->ss_index == ss_index || replica_find(file, ss_index) != -1 ||
+        file->replica_count >= NS_MAX_REPLICAS) {
+        pthread_rwlock_unlock(&index_lock);
+        return -1;
+    }
+    ReplicaRef* replica = &file->replicas[file->replica_count++];
+    replica->ss_index = ss_index;
+    replica->version = 0; // Behind until the first copy lands
+    replica->suspect = 0;
+    queue_replication_locked(file);
+    pthread_rwlock_unlock(&index_lock);
+    write_log("SEARCH", "Added a replica of '%s' on SS %d", filename, ss_index);
+    return 0;
+}
+
+int search_begin_replication(const char* filename, ReplicaSyncJob* job) {
+    memset(job, 0, sizeof(*job));
+    pthread_rwlock_wrlock(&index_lock);
+    FileRecord* file = find_file_record(filename);
+    if (file == NULL) {
+        pthread_rwlock_unlock(&index_lock);
+        return -1;
+    }
+    file->replication_queued = 0; // A change from here on queues it again
+    job->primary = file->ss_index;
+    job->version = file->content_version;
+    for (int i = 0; i < file->replica_count && !file->provisional; i++) {
+        const ReplicaRef* replica = &file->replicas[i];
+        if (!replica->suspect && replica->version != file->content_version) {
+            job->targets[job->target_count++] = replica->ss_index;
+        }
+    }
+
+    SSReplicaPayload* state = &job->state;
+    strncpy(state->owner_username, file->owner_username, sizeof(state->owner_username) - 1);
+    state->acl_count = file->acl_count;
+    for (int i = 0; i < file->acl_count; i++) {
+        strncpy(state->acl[i].username, file->acl[i].username, sizeof(state->acl[i].username) - 1);
+        state->acl[i].permission = file->acl[i].permission;
+    }
+    strncpy(state->folder, file->folder, MAX_FILENAME - 1);
+    state->created = file->created;
+    state->modified = file->modified;
+    pthread_rwlock_unlock(&index_lock);
+    return job->target_count;
+}
+
+void search_replica_synced(const char* filename, int ss_index, unsigned int version) {
+    pthread_rwlock_wrlock(&index_lock);
+    FileRecord* file = find_file_record(filename);
+    int i = file ? replica_find(file, ss_index) : -1;
+    if (i != -1) file->replicas[i].version = version;
+    pthread_rwlock_unlock(&index_lock);
+}
+
+void search_server_ready(int ss_index) {
+    if (ss_index < 0 || ss_index >= ss_registry_capacity) return;
+    FileEntry* announce = NULL;
+    int announce_count = 0;
+    pthread_rwlock_wrlock(&index_lock);
+    size_t cursor = 0;
+    FileRecord* file;
+    while ((file = file_index_next(&file_index, &cursor)) != NULL) {
+        if (file->ss_index == ss_index) {
+            if (file->announce_primary) {
+                if (announce == NULL) announce = malloc(sizeof(FileEntry) * file_index.count);
+                if (announce == NULL) continue; // Told on its next registration
+                file->announce_primary = 0;
+                collect_entry(file, announce, &announce_count);
+            }
+            queue_replication_locked(file);
+        } else if (replica_find(file, ss_index) != -1) {
+            queue_replication_locked(file);
         }
     }
+    pthread_rwlock_unlock(&index_lock);
 
-    // Continue recursion for all children
-    for (int i = 0; i < TRIE_CHAR_SET_SIZE; i++) {
-        // CORRECTED RECURSIVE CALL:
-        recursive_purge_by_ss(node->children[i], dead_ss_index);
+    for (int i = 0; i < announce_count; i++) {
+        replication_promoted(announce[i].filename, ss_index);
     }
+    free(announce);
+}
+
+// --- Internal helper for purging ---
+// Files with a replica elsewhere are promoted rather than purged; those
+// whose new primary is reachable are added to 'promoted' (sized for
+// every record).
+// NOTE: index_lock must be held exclusive.
+static void purge_records_by_ss(int dead_ss_index, FileEntry* promoted, int* promoted_count) {
+    // Collect first: removal shifts slots, which would upset the walk.
+    if (file_index.count == 0) return;
+    FileRecord** victims = malloc(sizeof(FileRecord*) * file_index.count);
+    if (victims == NULL) {
+        write_log("FATAL", "Out of memory purging SS %d", dead_ss_index);
+        return;
+    }
+    int victim_count = 0;
+    size_t cursor = 0;
+    FileRecord* file;
+    while ((file = file_index_next(&file_index, &cursor)) != NULL) {
+        int r = replica_find(file, dead_ss_index);
+        if (r != -1) replica_remove_at(file, r);
+        if (file->ss_index != dead_ss_index) continue;
+        if (file->replica_count > 0) promote_replica_locked(file, promoted, promoted_count);
+        else victims[victim_count++] = file;
+    }
+
+    for (int i = 0; i < victim_count; i++) {
+        write_log("SEARCH", "Purging file '%s' (was on dead SS %d)", 
+                  victims[i]->filename, dead_ss_index);
+        
+        // Unlink the record from the index and its folder, and free it
+        file_index_remove(&file_index, victims[i]->filename);
+        folder_prune(folder_detach_file(victims[i]));
+        free(victims[i]);
+    }
+    free(victims);
 }
 
 
@@ -902,73 +1299,188 @@ static void recursive_purge_by_ss(TrieNode* node, int dead_ss_index) {
  * @brief Public API to purge all files from a dead SS.
  */
 void search_purge_by_ss(int ss_index) {
-    if (ss_index < 0 || ss_index >= MAX_STORAGE_SERVERS) {
+    if (ss_index < 0 || ss_index >= ss_registry_capacity) {
         return;
     }
     
     write_log("SEARCH", "Purging all files for dead SS index %d...", ss_index);
     
-    // Lock the trie for the entire traversal
-    pthread_mutex_lock(&trie_mutex);
-    recursive_purge_by_ss(root, ss_index);
-    pthread_mutex_unlock(&trie_mutex);
+    // Lock the index for the entire traversal
+    pthread_rwlock_wrlock(&index_lock);
+    FileEntry* promoted = file_index.count ? malloc(sizeof(FileEntry) * file_index.count) : NULL;
+    int promoted_count = 0;
+    purge_records_by_ss(ss_index, promoted, &promoted_count);
+    cache_invalidate_ss(ss_index); // One pass over the cache, not one per file
+    pthread_rwlock_unlock(&index_lock);
+
+    for (int i = 0; i < promoted_count; i++) {
+        replication_promoted(promoted[i].filename, promoted[i].ss_index);
+    }
+    free(promoted);
     
     write_log("SEARCH", "Purge complete for SS index %d.", ss_index);
 }
 
-// ... (at the bottom)
+int search_mark_ss_suspect(int ss_index) {
+    if (ss_index < 0 || ss_index >= ss_registry_capacity) return 0;
+    int marked = 0;
+    pthread_rwlock_wrlock(&index_lock);
+    size_t cursor = 0;
+    FileRecord* file;
+    while ((file = file_index_next(&file_index, &cursor)) != NULL) {
+        if (file->ss_index == ss_index) {
+            file->suspect = 1;
+            marked++;
+        }
+        int r = replica_find(file, ss_index);
+        if (r != -1) file->replicas[r].suspect = 1;
+    }
+    cache_invalidate_ss(ss_index); // Nothing should redirect to it meanwhile
+    pthread_rwlock_unlock(&index_lock);
+    write_log("SEARCH", "Marked %d files of SS index %d suspect.", marked, ss_index);
+    return marked;
+}
 
-void search_rebuild_add_file(int ss_index, SSFileRecordPayload* file_payload) {
-    pthread_mutex_lock(&trie_mutex);
+void search_finish_resync(int ss_index, int delta) {
+    if (ss_index < 0 || ss_index >= ss_registry_capacity) return;
+    pthread_rwlock_wrlock(&index_lock);
+    FileRecord** stale = NULL;
+    FileEntry* promoted = NULL;
+    int stale_count = 0, promoted_count = 0;
+    if (!delta && file_index.count > 0) {
+        // Collect first: removal shifts slots, which would upset the walk.
+        stale = malloc(sizeof(FileRecord*) * file_index.count);
+        promoted = malloc(sizeof(FileEntry) * file_index.count);
+        if (stale == NULL) write_log("FATAL", "Out of memory purging stale files of SS %d", ss_index);
+    }
+    size_t cursor = 0;
+    FileRecord* file;
+    while ((file = file_index_next(&file_index, &cursor)) != NULL) {
+        // A full sync re-reported every replica it still has
+        int r = replica_find(file, ss_index);
+        if (r != -1 && file->replicas[r].suspect) {
+            if (delta) file->replicas[r].suspect = 0;
+            else replica_remove_at(file, r);
+        }
+        if (file->ss_index != ss_index || !file->suspect) continue;
+        if (delta) file->suspect = 0; // Unchanged since the last sync
+        else if (file->replica_count > 0) promote_replica_locked(file, promoted, &promoted_count);
+        else if (stale != NULL) stale[stale_count++] = file;
+    }
+    for (int i = 0; i < stale_count; i++) {
+        write_log("SEARCH", "Purging file '%s' (SS %d no longer has it)", stale[i]->filename, ss_index);
+        file_index_remove(&file_index, stale[i]->filename);
+        folder_prune(folder_detach_file(stale[i]));
+        free(stale[i]);
+    }
+    free(stale);
+    pthread_rwlock_unlock(&index_lock);
 
-    TrieNode* current = root;
-    const char* filename = file_payload->filename;
+    for (int i = 0; i < promoted_count; i++) {
+        replication_promoted(promoted[i].filename, promoted[i].ss_index);
+    }
+    free(promoted);
+}
 
-    for (int i = 0; filename[i] != '\0'; i++) {
-        int index = (int)filename[i];
-        if (index < 0 || index >= TRIE_CHAR_SET_SIZE) continue;
+// ... (at the bottom)
 
-        if (current->children[index] == NULL) {
-            current->children[index] = create_node();
-        }
-        current = current->children[index];
-    }
+/**
+ * @brief Adds or refreshes one record from a registering SS.
+ * NOTE: index_lock must be HELD exclusive.
+ * @return 1 if added, 0 if an older copy was refreshed, -1 if rejected.
+ */
+static int rebuild_add_file_locked(int ss_index, const SSFileRecordPayload* file_payload) {
+    const char* filename = file_payload->filename;
+    FileRecord* existing = find_file_record(filename);
+    FolderNode* previous_folder = NULL;
+    cache_invalidate(filename); // Owner or ACL may have changed while the SS was away
+    int added = 1;
+    FileRecord kept; // Replica state carried over from the record being replaced
+    memset(&kept, 0, sizeof(kept));
+    kept.content_version = 1;
+    kept.provisional = file_payload->replica;
 
     // --- NEW FIX: Check for conflicts before adding ---
-    if (current->file_info != NULL) {
+    if (existing != NULL) {
         
-        if (current->file_info->ss_index == ss_index) {
+        if (existing->ss_index == ss_index) {
             // This is fine, the SS is just reconnecting with its own file.
             // We'll "refresh" the record.
-            write_log("SEARCH", "[REBUILD] File '%s' from SS %d already in Trie. (Refreshing)", 
-                      filename, ss_index);
-            free(current->file_info);
+            kept = *existing;
+            // The index knows whether this copy is the primary now; if the
+            // SS still thinks it holds a replica, tell it once it is ready.
+            kept.provisional = existing->provisional && file_payload->replica;
+            if (file_payload->replica && !kept.provisional) kept.announce_primary = 1;
+            kept.content_version++; // Reported again because it changed, or after a restart
+            file_index_remove(&file_index, filename);
+            previous_folder = folder_detach_file(existing);
+            free(existing);
+            added = 0;
             
+        } else if (file_payload->replica) {
+            // A copy of a file whose primary is elsewhere; recopied, as it
+            // may have missed writes while its SS was away.
+            int r = replica_find(existing, ss_index);
+            if (r == -1) {
+                if (existing->replica_count >= NS_MAX_REPLICAS) {
+                    write_log("WARN", "[REBUILD] Replica of '%s' on SS %d rejected: set is full.",
+                              filename, ss_index);
+                    return -1;
+                }
+                r = existing->replica_count++;
+                existing->replicas[r].ss_index = ss_index;
+            }
+            existing->replicas[r].version = 0;
+            existing->replicas[r].suspect = 0;
+            queue_replication_locked(existing);
+            return 0;
+
+        } else if (existing->provisional) {
+            // The primary is back; the replica that stood in for it steps down
+            kept = *existing;
+            kept.replica_count = 0;
+            for (int i = 0; i < existing->replica_count; i++) {
+                if (existing->replicas[i].ss_index != ss_index) kept.replicas[kept.replica_count++] = existing->replicas[i];
+            }
+            if (kept.replica_count < NS_MAX_REPLICAS) {
+                ReplicaRef* replica = &kept.replicas[kept.replica_count++];
+                replica->ss_index = existing->ss_index;
+                replica->version = 0;
+                replica->suspect = existing->suspect;
+            }
+            kept.provisional = 0;
+            kept.content_version++;
+            write_log("SEARCH", "[REBUILD] '%s': primary SS %d is back; SS %d holds a replica again.",
+                      filename, ss_index, existing->ss_index);
+            file_index_remove(&file_index, filename);
+            previous_folder = folder_detach_file(existing);
+            free(existing);
+            added = 0;
+
         } else {
             // This is a conflict. The file already exists on a DIFFERENT SS.
             write_log("WARN", "[REBUILD] CONFLICT: File '%s' from SS %d rejected. "
                               "It already exists on SS %d.",
-                      filename, ss_index, current->file_info->ss_index);
+                      filename, ss_index, existing->ss_index);
             
             // Reject the file by simply returning.
-            pthread_mutex_unlock(&trie_mutex);
-            return; 
+            return -1; 
         }
-
-    } else {
-        // No conflict, this is a new file.
-        write_log("SEARCH", "[REBUILD] Added file '%s' to records (on SS %d, Owner: %s)", 
-                  filename, ss_index, file_payload->owner_username);
     }
     // --- END FIX ---
 
 
     // Create new FileRecord and copy ALL data from the payload
-    FileRecord* new_record = (FileRecord*)malloc(sizeof(FileRecord));
+    FileRecord* new_record = (FileRecord*)calloc(1, sizeof(FileRecord));
+    if (new_record == NULL) {
+        folder_prune(previous_folder);
+        write_log("FATAL", "[REBUILD] Out of memory adding '%s'", filename);
+        return -1;
+    }
     
     // Copy file info
     strncpy(new_record->filename, file_payload->filename, MAX_FILENAME - 1);
-    strncpy(new_record->owner_username, file_payload->owner_username, 64 - 1);
+    new_record->owner_username = file_index_intern(file_payload->owner_username);
     new_record->ss_index = ss_index;
     
     // Copy timestamps and counts
@@ -977,22 +1489,64 @@ void search_rebuild_add_file(int ss_index, SSFileRecordPayload* file_payload) {
     new_record->created = file_payload->created;
     new_record->modified = file_payload->modified;
     new_record->last_accessed = file_payload->last_accessed;
-    strncpy(new_record->last_accessed_by, file_payload->last_accessed_by, 64 - 1);
+    new_record->last_accessed_by = file_index_intern(file_payload->last_accessed_by);
+    new_record->metadata_synced = time(NULL);
     
     // Copy ACL
     new_record->acl_count = file_payload->acl_count;
+    if (new_record->acl_count > MAX_ACL_ENTRIES) new_record->acl_count = MAX_ACL_ENTRIES;
     for (int i = 0; i < new_record->acl_count; i++) {
-        strncpy(new_record->acl[i].username, file_payload->acl[i].username, 64 - 1);
+        new_record->acl[i].username = file_index_intern(file_payload->acl[i].username);
         new_record->acl[i].permission = (PermissionType)file_payload->acl[i].permission;
     }
-    // Copy folder if present
-    if (file_payload->folder[0] != '\0') {
-        strncpy(new_record->folder, file_payload->folder, MAX_FILENAME - 1);
+    // Folder if present ("" = root). Folders are not persisted on the NS,
+    // so the file's path recreates any it needs.
+    new_record->folder = "";
+
+    memcpy(new_record->replicas, kept.replicas, sizeof(kept.replicas));
+    new_record->replica_count = kept.replica_count;
+    new_record->content_version = kept.content_version;
+    new_record->provisional = kept.provisional;
+    new_record->announce_primary = kept.announce_primary;
+    new_record->last_writer = kept.last_writer;
+    new_record->last_write = kept.last_write;
+    
+    if (file_index_insert(&file_index, new_record) == -1) {
+        write_log("FATAL", "[REBUILD] File index full; could not add '%s'", filename);
+        free(new_record);
+        added = -1;
     } else {
-        new_record->folder[0] = '\0';
+        FolderNode* folder = folder_create_path(file_payload->folder);
+        if (folder == NULL || folder_attach_file(folder, new_record) == -1) {
+            write_log("FATAL", "[REBUILD] Out of memory filing '%s' under its folder", filename);
+            new_record->folder = file_index_intern(file_payload->folder);
+        }
+        queue_replication_locked(new_record);
     }
-    
-    current->file_info = new_record; // Link it to the trie
+    folder_prune(previous_folder);
+    return added;
+}
 
-    pthread_mutex_unlock(&trie_mutex);
-}
\ No newline at end of file
+void search_rebuild_add_file(int ss_index, SSFileRecordPayload* file_payload) {
+    pthread_rwlock_wrlock(&index_lock);
+    int added = rebuild_add_file_locked(ss_index, file_payload);
+    pthread_rwlock_unlock(&index_lock);
+
+    if (added == 1) {
+        write_log("SEARCH", "[REBUILD] Added file '%s' to records (on SS %d, Owner: %s)",
+                  file_payload->filename, ss_index, file_payload->owner_username);
+    } else if (added == 0) {
+        write_log("SEARCH", "[REBUILD] File '%s' from SS %d already in index. (Refreshing)",
+                  file_payload->filename, ss_index);
+    }
+}
+
+int search_rebuild_add_files(int ss_index, const SSFileRecordPayload* records, int count) {
+    int accepted = 0;
+    pthread_rwlock_wrlock(&index_lock);
+    for (int i = 0; i < count; i++) {
+        if (rebuild_add_file_locked(ss_index, &records[i]) != -1) accepted++;
+    }
+    pthread_rwlock_unlock(&index_lock);
+    return accepted;
+}
@@ -0,0 +1,338 @@
+#include "ss_channel.h"
+#include "storage_manager.h"
+#include "search.h"
+#include "replication.h"
+#include "logger.h"
+#include "metrics.h"
+
+#include <sys/socket.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// =========================================================================
+//  REFERENCE COUNTING
+// =========================================================================
+
+static void channel_release(SSChannel* ch) {
+    pthread_mutex_lock(&ch->pending_mutex);
+    int remaining = --ch->refcount;
+    pthread_mutex_unlock(&ch->pending_mutex);
+
+    if (remaining == 0) {
+        // Nobody can be sending on the fd any more, so it is safe to close
+        // it (and let the number be reused) only now.
+        close(ch->sock_fd);
+        pthread_mutex_destroy(&ch->send_mutex);
+        pthread_mutex_destroy(&ch->pending_mutex);
+        write_log("SS_CHANNEL", "Channel for SS %d (socket %d) released.",
+                  ch->ss_index, ch->sock_fd);
+        free(ch);
+    }
+}
+
+/**
+ * @brief Takes a reference on the channel of a registry slot.
+ * @return The channel, or NULL if the SS is not (or no longer) usable.
+ */
+static SSChannel* channel_acquire(StorageServerInfo* ss) {
+    SSChannel* ch = NULL;
+    pthread_mutex_lock(&ss_registry_mutex);
+    if (ss->is_active && ss->channel) {
+        SSChannel* candidate = ss->channel;
+        pthread_mutex_lock(&candidate->pending_mutex);
+        if (!candidate->dead) {
+            candidate->refcount++;
+            ch = candidate;
+        }
+        pthread_mutex_unlock(&candidate->pending_mutex);
+    }
+    pthread_mutex_unlock(&ss_registry_mutex);
+    return ch;
+}
+
+// =========================================================================
+//  READER THREAD
+// =========================================================================
+
+/**
+ * @brief Unlinks and returns the pending call with this ID.
+ * NOTE: pending_mutex must be HELD.
+ */
+static SSPendingCall* take_pending(SSChannel* ch, uint32_t request_id) {
+    SSPendingCall** link = &ch->pending;
+    while (*link) {
+        if ((*link)->request_id == request_id) {
+            SSPendingCall* call = *link;
+            *link = call->next;
+            call->next = NULL;
+            return call;
+        }
+        link = &(*link)->next;
+    }
+    return NULL;
+}
+
+static void* channel_reader_thread(void* arg) {
+    SSChannel* ch = (SSChannel*)arg;
+    MessageHeader header;
+
+    while (recv_header(ch->sock_fd, &header) == 0) {
+        if (header.payload_length > SS_MAX_RESPONSE_BYTES) {
+            write_log("ERROR", "SS %d: Response payload of %u bytes is out of range. Dropping link.",
+                      ch->ss_index, header.payload_length);
+            break;
+        }
+
+        // Read the payload first so a caller never sees a half-filled reply.
+        char* payload = malloc(header.payload_length + 1);
+        if (payload == NULL) {
+            write_log("FATAL", "SS %d: Out of memory for %u byte response.",
+                      ch->ss_index, header.payload_length);
+            break;
+        }
+        if (header.payload_length > 0 &&
+            recv_all(ch->sock_fd, payload, header.payload_length) == -1) {
+            free(payload);
+            break;
+        }
+        payload[header.payload_length] = '\0';
+
+        if (header.request_id == 0 && header.msg_type == MSG_INTERNAL_METADATA_DELTA) {
+            // Pushed by the SS whenever a record changes: the raw struct
+            // from a v1 SS, else encode_metadata_delta()'s compact form.
+            SSMetadataDeltaPayload delta;
+            int ok = 0;
+            if (header.payload_length == sizeof(delta)) {
+                memcpy(&delta, payload, sizeof(delta));
+                delta.filename[MAX_FILENAME - 1] = '\0';
+                ok = 1;
+            } else {
+                ok = decode_metadata_delta((const uint8_t*)payload, header.payload_length, &delta) == 0;
+            }
+            if (ok) {
+                int behind[NS_MAX_REPLICAS];
+                int behind_count = search_apply_delta(ch->ss_index, &delta, behind, NS_MAX_REPLICAS);
+                if (behind_count > 0) replication_notify_behind(delta.filename, behind, behind_count);
+            }
+            free(payload);
+            continue;
+        }
+        if (header.request_id == 0 && header.msg_type == MSG_SS_HEARTBEAT) {
+            // Load report for placement, every SS_HEARTBEAT_SEC.
+            if (header.payload_length == sizeof(SSHeartbeatPayload)) {
+                storage_manager_record_heartbeat(ch->ss_index, (SSHeartbeatPayload*)payload);
+            }
+            free(payload);
+            continue;
+        }
+
+        pthread_mutex_lock(&ch->pending_mutex);
+        SSPendingCall* call = (header.request_id != 0) ? take_pending(ch, header.request_id) : NULL;
+        if (call) {
+            call->response = header;
+            call->payload = payload;
+            call->state = 1;
+            pthread_cond_signal(&call->cond);
+        }
+        pthread_mutex_unlock(&ch->pending_mutex);
+
+        if (call == NULL) {
+            // Unsolicited, or the caller already gave up (timeout).
+            write_log("DEBUG", "SS %d: Discarding unmatched msg %d (request %u).",
+                      ch->ss_index, header.msg_type, header.request_id);
+            free(payload);
+        }
+    }
+
+    // The link is gone. Fail every waiter, then retire the server.
+    pthread_mutex_lock(&ch->pending_mutex);
+    ch->dead = 1;
+    while (ch->pending) {
+        SSPendingCall* call = ch->pending;
+        ch->pending = call->next;
+        call->next = NULL;
+        call->state = -1;
+        pthread_cond_signal(&call->cond);
+    }
+    pthread_mutex_unlock(&ch->pending_mutex);
+
+    write_log("SS_CHANNEL", "SS %d (socket %d): Control channel closed.", ch->ss_index, ch->sock_fd);
+    remove_storage_server(ch->sock_fd); // No-op if already removed
+    channel_release(ch);
+    return NULL;
+}
+
+// =========================================================================
+//  PUBLIC API
+// =========================================================================
+
+int ss_channel_open(StorageServerInfo* ss, int ss_index, int sock_fd) {
+    SSChannel* ch = calloc(1, sizeof(SSChannel));
+    if (ch == NULL) {
+        return -1;
+    }
+    ch->sock_fd = sock_fd;
+    ch->ss_index = ss_index;
+    ch->refcount = 2; // Registry slot + reader thread
+    ch->next_request_id = 1;
+    pthread_mutex_init(&ch->send_mutex, NULL);
+    pthread_mutex_init(&ch->pending_mutex, NULL);
+
+    pthread_mutex_lock(&ss_registry_mutex);
+    ss->channel = ch;
+    pthread_mutex_unlock(&ss_registry_mutex);
+
+    if (pthread_create(&ch->reader_tid, NULL, channel_reader_thread, ch) != 0) {
+        write_log("ERROR", "SS %d: Failed to start channel reader.", ss_index);
+        pthread_mutex_lock(&ss_registry_mutex);
+        ss->channel = NULL;
+        pthread_mutex_unlock(&ss_registry_mutex);
+        pthread_mutex_destroy(&ch->send_mutex);
+        pthread_mutex_destroy(&ch->pending_mutex);
+        free(ch);
+        return -1;
+    }
+    pthread_detach(ch->reader_tid);
+
+    write_log("SS_CHANNEL", "SS %d (socket %d): Control channel open.", ss_index, sock_fd);
+    return 0;
+}
+
+void ss_channel_shutdown(SSChannel* ch) {
+    if (ch == NULL) return;
+    // Wakes the reader (recv returns 0) and makes further sends fail.
+    shutdown(ch->sock_fd, SHUT_RDWR);
+    channel_release(ch); // Drop the registry's reference
+}
+
+SSPendingCall* ss_call_begin(StorageServerInfo* ss, MessageHeader* req, const void* payload) {
+    SSChannel* ch = channel_acquire(ss);
+    if (ch == NULL) {
+        return NULL;
+    }
+
+    SSPendingCall* call = calloc(1, sizeof(SSPendingCall));
+    if (call == NULL) {
+        channel_release(ch);
+        return NULL;
+    }
+    pthread_cond_init(&call->cond, NULL);
+    call->channel = ch;
+
+    // Register before sending so a fast reply always finds its waiter.
+    pthread_mutex_lock(&ch->pending_mutex);
+    call->request_id = ch->next_request_id++;
+    if (ch->next_request_id == 0) ch->next_request_id = 1; // 0 = unsolicited
+    if (ch->dead) {
+        // Reader already drained the table; fail fast instead of timing out.
+        call->state = -1;
+        pthread_mutex_unlock(&ch->pending_mutex);
+        return call;
+    }
+    call->next = ch->pending;
+    ch->pending = call;
+    pthread_mutex_unlock(&ch->pending_mutex);
+
+    req->request_id = call->request_id;
+    req->source_component = COMPONENT_NAME_SERVER;
+    req->dest_component = COMPONENT_STORAGE_SERVER;
+
+    uint64_t wait_start = metrics_now_us();
+    pthread_mutex_lock(&ch->send_mutex);
+    metrics_observe_wait("ns_ss_send_mutex", metrics_now_us() - wait_start);
+    int rc = send_header(ch->sock_fd, req);
+    if (rc == 0 && req->payload_length > 0 && payload != NULL) {
+        rc = send_all(ch->sock_fd, payload, req->payload_length);
+    }
+    pthread_mutex_unlock(&ch->send_mutex);
+
+    if (rc == -1) {
+        write_log("ERROR", "SS %d: Failed to send msg %d. Closing channel.",
+                  ch->ss_index, req->msg_type);
+        shutdown(ch->sock_fd, SHUT_RDWR); // Reader will fail all waiters
+    }
+    return call;
+}
+
+int ss_call_end(SSPendingCall* call, MessageHeader* resp, void** resp_payload, int timeout_ms) {
+    if (call == NULL) {
+        return -1;
+    }
+    SSChannel* ch = call->channel;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&ch->pending_mutex);
+    while (call->state == 0) {
+        if (pthread_cond_timedwait(&call->cond, &ch->pending_mutex, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    if (call->state == 0) {
+        // Timed out: unlink so a late reply is discarded by the reader.
+        take_pending(ch, call->request_id);
+    }
+    int state = call->state;
+    pthread_mutex_unlock(&ch->pending_mutex);
+
+    int rc = -1;
+    if (state == 1) {
+        if (resp) *resp = call->response;
+        if (resp_payload) {
+            *resp_payload = call->payload;
+            call->payload = NULL;
+        }
+        rc = 0;
+    } else if (state == 0) {
+        write_log("WARN", "SS %d: Request %u timed out after %d ms.",
+                  ch->ss_index, call->request_id, timeout_ms);
+    }
+
+    free(call->payload);
+    pthread_cond_destroy(&call->cond);
+    free(call);
+    channel_release(ch);
+    return rc;
+}
+
+int ss_call(StorageServerInfo* ss, MessageHeader* req, const void* payload,
+            MessageHeader* resp, void** resp_payload) {
+    SSPendingCall* call = ss_call_begin(ss, req, payload);
+    return ss_call_end(call, resp, resp_payload, SS_CALL_TIMEOUT_MS);
+}
+
+int ss_send_oneway(StorageServerInfo* ss, MessageHeader* req, const void* payload) {
+    SSChannel* ch = channel_acquire(ss);
+    if (ch == NULL) {
+        return -1;
+    }
+
+    req->request_id = 0;
+    req->source_component = COMPONENT_NAME_SERVER;
+    req->dest_component = COMPONENT_STORAGE_SERVER;
+
+    uint64_t wait_start = metrics_now_us();
+    pthread_mutex_lock(&ch->send_mutex);
+    metrics_observe_wait("ns_ss_send_mutex", metrics_now_us() - wait_start);
+    int rc = send_header(ch->sock_fd, req);
+    if (rc == 0 && req->payload_length > 0 && payload != NULL) {
+        rc = send_all(ch->sock_fd, payload, req->payload_length);
+    }
+    pthread_mutex_unlock(&ch->send_mutex);
+
+    if (rc == -1) {
+        shutdown(ch->sock_fd, SHUT_RDWR);
+    }
+    channel_release(ch);
+    return rc;
+}
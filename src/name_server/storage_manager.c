@@ -2,24 +2,73 @@
 #include "logger.h"
 #include <string.h>
 #include <unistd.h> // for close()
+#include <stdlib.h>
 #include "search.h"
+#include "ss_channel.h"
+#include "placement.h"
 
 // --- Global Data Definitions ---
-StorageServerInfo ss_registry[MAX_STORAGE_SERVERS];
+StorageServerInfo* ss_registry = NULL;
+int ss_registry_capacity = DEFAULT_MAX_STORAGE_SERVERS;
 pthread_mutex_t ss_registry_mutex;
 
-static int next_ss_index = 0;
+/**
+ * @brief Purges the files of SSes that stayed away past SS_SUSPECT_GRACE_SEC.
+ */
+static void* suspect_reaper_thread(void* arg) {
+    (void)arg;
+    while (1) {
+        sleep(1);
+        time_t now = time(NULL);
+        for (int i = 0; i < ss_registry_capacity; i++) {
+            pthread_mutex_lock(&ss_registry_mutex);
+            int expired = ss_registry[i].is_suspect && now - ss_registry[i].suspect_since >= SS_SUSPECT_GRACE_SEC;
+            if (expired) {
+                ss_registry[i].is_suspect = 0;
+                ss_registry[i].is_reclaiming = 1; // Not reusable until the purge is done
+            }
+            pthread_mutex_unlock(&ss_registry_mutex);
+            if (!expired) continue;
+
+            write_log("STORAGE_MGR", "SS on slot %d did not return within %d s.", i, SS_SUSPECT_GRACE_SEC);
+            search_purge_by_ss(i);
+            pthread_mutex_lock(&ss_registry_mutex);
+            ss_registry[i].is_reclaiming = 0;
+            pthread_mutex_unlock(&ss_registry_mutex);
+        }
+    }
+    return NULL;
+}
+
+void storage_manager_set_capacity(int max_servers) {
+    if (max_servers > 0 && ss_registry == NULL) ss_registry_capacity = max_servers;
+}
+
 /**
  * @brief Initializes the storage server registry and its mutex.
  */
 void init_storage_manager() {
     pthread_mutex_init(&ss_registry_mutex, NULL);
-    for (int i = 0; i < MAX_STORAGE_SERVERS; i++) {
-        ss_registry[i].is_active = 0;
+    ss_registry = calloc(ss_registry_capacity, sizeof(StorageServerInfo));
+    if (ss_registry == NULL) {
+        write_log("FATAL", "Storage Manager: cannot allocate %d registry slots.", ss_registry_capacity);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < ss_registry_capacity; i++) {
+        memset(&ss_registry[i], 0, sizeof(ss_registry[i]));
         ss_registry[i].ss_socket_fd = -1;
-        pthread_mutex_init(&ss_registry[i].socket_mutex, NULL);
+        ss_registry[i].resync = -1;
     }
-    write_log("INIT", "Storage Manager initialized.");
+    if (SS_SUSPECT_GRACE_SEC > 0) {
+        pthread_t reaper;
+        if (pthread_create(&reaper, NULL, suspect_reaper_thread, NULL) == 0) {
+            pthread_detach(reaper);
+        } else {
+            write_log("ERROR", "Could not start the suspect SS reaper; stale files will linger.");
+        }
+    }
+    write_log("INIT", "Storage Manager initialized (%d slots, %s placement).",
+              ss_registry_capacity, placement_policy_name());
 }
 
 /**
@@ -41,16 +90,51 @@ int register_storage_server(int sock_fd, MessageHeader* header) {
         return -1;
     }
 
-    // 3. Lock the registry to find a free slot
+    payload.ip_addr[sizeof(payload.ip_addr) - 1] = '\0';
+
+    // 3. Lock the registry to find a slot: the one this SS left behind if
+    // it is coming back, else a free one, else the longest-suspect one.
     pthread_mutex_lock(&ss_registry_mutex);
 
     int found_slot = -1;
-    for (int i = 0; i < MAX_STORAGE_SERVERS; i++) {
-        if (!ss_registry[i].is_active) {
+    int evict = 0;
+    SSRegistrationAckPayload ack_payload;
+    memset(&ack_payload, 0, sizeof(ack_payload));
+    for (int i = 0; i < ss_registry_capacity; i++) {
+        if (ss_registry[i].is_suspect &&
+            ss_registry[i].client_facing_port == payload.client_facing_port &&
+            strcmp(ss_registry[i].ip_addr, payload.ip_addr) == 0) {
             found_slot = i;
             break;
         }
     }
+    if (found_slot != -1) {
+        StorageServerInfo* ss = &ss_registry[found_slot];
+        // Same metadata, no lost records: the files we kept are current
+        // except for those changed after the epoch we last synced to.
+        ack_payload.delta = ss->instance_id == payload.instance_id &&
+                            payload.epoch >= ss->synced_epoch &&
+                            payload.file_count == ss->suspect_files;
+        ack_payload.since_epoch = ack_payload.delta ? ss->synced_epoch : 0;
+        ss->resync = ack_payload.delta;
+    } else {
+        for (int i = 0; i < ss_registry_capacity; i++) {
+            if (!ss_registry[i].is_active && !ss_registry[i].is_suspect && !ss_registry[i].is_reclaiming) {
+                found_slot = i;
+                break;
+            }
+        }
+        for (int i = 0; found_slot == -1 && i < ss_registry_capacity; i++) {
+            if (ss_registry[i].is_suspect &&
+                (found_slot == -1 || ss_registry[i].suspect_since < ss_registry[found_slot].suspect_since)) {
+                found_slot = i;
+            }
+        }
+        if (found_slot != -1) {
+            evict = ss_registry[found_slot].is_suspect;
+            ss_registry[found_slot].resync = -1;
+        }
+    }
 
     if (found_slot == -1) {
         pthread_mutex_unlock(&ss_registry_mutex);
@@ -60,33 +144,95 @@ int register_storage_server(int sock_fd, MessageHeader* header) {
 
     // 4. Fill the slot with the new server's info
     ss_registry[found_slot].is_active = 1;
+    ss_registry[found_slot].is_suspect = 0;
     ss_registry[found_slot].ss_socket_fd = sock_fd;
+    ss_registry[found_slot].channel = NULL;
     ss_registry[found_slot].client_facing_port = payload.client_facing_port;
     strncpy(ss_registry[found_slot].ip_addr, payload.ip_addr, 64);
-    // TODO: Receive and store the file list
+    ss_registry[found_slot].instance_id = payload.instance_id;
+    ss_registry[found_slot].pending_epoch = payload.epoch;
+    // Until its first heartbeat, placement knows only how many files it has
+    memset(&ss_registry[found_slot].load, 0, sizeof(ss_registry[found_slot].load));
+    ss_registry[found_slot].load.file_count = payload.file_count;
+    ss_registry[found_slot].last_heartbeat = 0;
+    ss_registry[found_slot].placed_since_heartbeat = 0;
+    ss_registry[found_slot].reads_since_heartbeat = 0;
 
     pthread_mutex_unlock(&ss_registry_mutex);
 
-    write_log("INFO", "Storage Server registered successfully on slot %d (Socket %d)",
-              found_slot, sock_fd);
+    if (evict) { // Another SS's leftovers; it is not coming back in time
+        write_log("STORAGE_MGR", "Reclaiming suspect slot %d for a new SS.", found_slot);
+        search_purge_by_ss(found_slot);
+    }
+
+    write_log("INFO", "Storage Server registered successfully on slot %d (Socket %d, %s sync)",
+              found_slot, sock_fd, ack_payload.delta ? "delta" : "full");
     
-    // 5. Send ACK back to the Storage Server
+    // 5. Send ACK back to the Storage Server, saying which records it should send
     MessageHeader ack_header;
     memset(&ack_header, 0, sizeof(ack_header));
     ack_header.msg_type = MSG_ACK;
     ack_header.source_component = COMPONENT_NAME_SERVER;
     ack_header.dest_component = COMPONENT_STORAGE_SERVER;
-    ack_header.payload_length = 0;
+    ack_header.payload_length = sizeof(ack_payload);
+    ack_header.request_id = protocol_accept_offer(header->request_id);
     
-    if (send_header(sock_fd, &ack_header) == -1) {
+    if (send_header(sock_fd, &ack_header) == -1 || send_all(sock_fd, &ack_payload, sizeof(ack_payload)) == -1) {
         write_log("ERROR", "SS %d: Failed to send ACK.", sock_fd);
         // We're registered, but SS might not know. Let's disconnect.
         return -1;
     }
+    // Everything after the ACK, the file list included, uses the agreed framing
+    if (ack_header.request_id == PROTOCOL_V2) protocol_set_version(sock_fd, PROTOCOL_V2);
 
     return found_slot; // Success
 }
 
+/**
+ * @brief Receives one MSG_REGISTER_FILE_BATCH payload and bulk-inserts it.
+ * @return Records accepted, or -1 if the payload is oversized or malformed.
+ */
+static int receive_file_batch(int sock_fd, int ss_index, uint32_t payload_length) {
+    if (payload_length == 0 || payload_length > SS_REGISTER_BATCH_BYTES) return -1;
+    uint8_t* payload = malloc(payload_length);
+    if (payload == NULL) return -1;
+    if (recv_all(sock_fd, payload, payload_length) == -1) {
+        free(payload);
+        return -1;
+    }
+
+    // Decode everything first so the index lock is taken once per batch
+    int capacity = 64, count = 0;
+    SSFileRecordPayload* records = malloc(sizeof(SSFileRecordPayload) * capacity);
+    const uint8_t* cursor = payload;
+    const uint8_t* end = payload + payload_length;
+    while (records != NULL && cursor < end) {
+        if (count == capacity) {
+            capacity *= 2;
+            SSFileRecordPayload* grown = realloc(records, sizeof(SSFileRecordPayload) * capacity);
+            if (grown == NULL) {
+                free(records);
+                records = NULL;
+                break;
+            }
+            records = grown;
+        }
+        if (decode_file_record(&cursor, end, &records[count]) == -1) break;
+        count++;
+    }
+    free(payload);
+    if (records == NULL || cursor != end) {
+        free(records);
+        return -1;
+    }
+
+    int accepted = search_rebuild_add_files(ss_index, records, count);
+    write_log("DEBUG", "Received REGISTER_FILE_BATCH from SS %d: %d records (%u bytes), %d accepted",
+              ss_index, count, payload_length, accepted);
+    free(records);
+    return accepted;
+}
+
 void handle_storage_server_connection(int sock_fd, MessageHeader* initial_header) {
     write_log("SS_HANDLER", "New SS connection on socket %d. Initial msg_type: %d",
               sock_fd, initial_header->msg_type);
@@ -125,6 +271,7 @@ void handle_storage_server_connection(int sock_fd, MessageHeader* initial_header
 
     // 3. File Sync Loop
     MessageHeader file_header;
+    int synced_files = 0;
     while (recv_header(sock_fd, &file_header) == 0) {
         
         if (file_header.msg_type == MSG_REGISTER_FILE) {
@@ -139,9 +286,19 @@ void handle_storage_server_connection(int sock_fd, MessageHeader* initial_header
                       ss_index, file_payload.filename, file_payload.word_count, file_payload.char_count, (long)file_payload.last_accessed);
 
             search_rebuild_add_file(ss_index, &file_payload);
+            synced_files++;
+
+        } else if (file_header.msg_type == MSG_REGISTER_FILE_BATCH) {
+            int accepted = receive_file_batch(sock_fd, ss_index, file_header.payload_length);
+            if (accepted == -1) {
+                write_log("ERROR", "SS %d: Bad payload for MSG_REGISTER_FILE_BATCH. Closing.", sock_fd);
+                goto disconnect;
+            }
+            synced_files += accepted;
 
         } else if (file_header.msg_type == MSG_REGISTER_COMPLETE) {
-            write_log("SS_HANDLER", "SS %d (Slot %d): File list sync complete.", sock_fd, ss_index);
+            write_log("SS_HANDLER", "SS %d (Slot %d): File list sync complete (%d files).",
+                      sock_fd, ss_index, synced_files);
             goto complete; // Exit the loop
         
         } else {
@@ -159,40 +316,74 @@ disconnect:
     return;
 
 complete:
-    // We land here on a successful registration
-    // This thread's job is done. It EXITS, leaving the socket open
-    // and idle in the registry, protected by its mutex.
-    write_log("SS_HANDLER", "SS %d (Slot %d): Registration complete. Thread exiting.", 
+    // We land here on a successful registration.
+    pthread_mutex_lock(&ss_registry_mutex);
+    int resync = ss_registry[ss_index].resync;
+    ss_registry[ss_index].resync = -1;
+    ss_registry[ss_index].synced_epoch = ss_registry[ss_index].pending_epoch;
+    pthread_mutex_unlock(&ss_registry_mutex);
+    if (resync != -1) search_finish_resync(ss_index, resync);
+
+    // From now on the socket is driven by the SS control channel: a
+    // dedicated reader thread demultiplexes replies by request_id, so
+    // callers no longer hold the socket for a whole round trip.
+    if (ss_channel_open(&ss_registry[ss_index], ss_index, sock_fd) == -1) {
+        write_log("SS_HANDLER", "SS %d (Slot %d): Could not open control channel. Closing.",
+                  sock_fd, ss_index);
+        remove_storage_server(sock_fd);
+        close(sock_fd);
+        return;
+    }
+    search_server_ready(ss_index); // Replicas it missed updates on can be copied now
+    write_log("SS_HANDLER", "SS %d (Slot %d): Registration complete.", 
               sock_fd, ss_index);
-
-    
 }
+
 /**
- * @brief Finds an active storage server for a new file (Round-Robin).
- * NOTE: This function MUST be called while the ss_registry_mutex is HELD.
+ * @brief Builds a placement candidate for every active slot not in
+ * 'exclude' and lets the policy choose. Takes ss_registry_mutex.
  */
-static StorageServerInfo* find_next_active_ss(int start_index) {
-    for (int i = 0; i < MAX_STORAGE_SERVERS; i++) {
-        int index = (start_index + i) % MAX_STORAGE_SERVERS;
-        if (ss_registry[index].is_active) {
-            // Found one. Update the next_ss_index for the *next* call.
-            next_ss_index = (index + 1) % MAX_STORAGE_SERVERS;
-            return &ss_registry[index];
-        }
+static StorageServerInfo* place_file(const int* exclude, int exclude_count) {
+    placement_candidate_t* candidates = malloc(sizeof(placement_candidate_t) * ss_registry_capacity);
+    if (candidates == NULL) {
+        write_log("ERROR", "place_file: Out of memory.");
+        return NULL;
     }
-    return NULL; // No active servers
+
+    pthread_mutex_lock(&ss_registry_mutex);
+    time_t now = time(NULL);
+    int count = 0;
+    for (int i = 0; i < ss_registry_capacity; i++) {
+        StorageServerInfo* ss = &ss_registry[i];
+        if (!ss->is_active) continue;
+        int excluded = 0;
+        for (int k = 0; k < exclude_count && !excluded; k++) excluded = exclude[k] == i;
+        if (excluded) continue;
+        placement_candidate_t* c = &candidates[count++];
+        c->ss_index = i;
+        c->has_load = ss->last_heartbeat != 0 && now - ss->last_heartbeat <= SS_HEARTBEAT_STALE_SEC;
+        c->files = (double)ss->load.file_count + ss->placed_since_heartbeat;
+        c->busy = ss->load.worker_threads > 0 ? (double)ss->load.active_clients / ss->load.worker_threads : 0;
+        c->latency_us = ss->load.latency_us;
+        c->free_bytes = (double)ss->load.disk_free_bytes;
+    }
+    int pick = placement_pick(candidates, count);
+    StorageServerInfo* ss = NULL;
+    if (pick >= 0) {
+        ss = &ss_registry[candidates[pick].ss_index];
+        ss->placed_since_heartbeat++;
+    }
+    pthread_mutex_unlock(&ss_registry_mutex);
+    free(candidates);
+    return ss;
 }
 
 /**
- * @brief Public function to get an available SS for a new file.
+ * @brief Public function to get an available SS for a new file, chosen
+ * by the placement policy from the servers' last heartbeats.
  */
 StorageServerInfo* get_ss_for_new_file() {
-    pthread_mutex_lock(&ss_registry_mutex);
-    
-    StorageServerInfo* ss = find_next_active_ss(next_ss_index);
-    
-    pthread_mutex_unlock(&ss_registry_mutex);
-
+    StorageServerInfo* ss = place_file(NULL, 0);
     if (ss == NULL) {
         write_log("ERROR", "get_ss_for_new_file: No active storage servers found!");
     }
@@ -200,11 +391,59 @@ StorageServerInfo* get_ss_for_new_file() {
     return ss;
 }
 
+StorageServerInfo* get_ss_for_replica(const int* exclude, int exclude_count) {
+    return place_file(exclude, exclude_count);
+}
+
+// Sessions plus streams plus reads sent since the last report, per worker
+static double reader_load(const StorageServerInfo* ss) {
+    int workers = ss->load.worker_threads > 0 ? ss->load.worker_threads : 1;
+    return (double)(ss->load.active_clients + ss->load.active_streams + ss->reads_since_heartbeat) / workers;
+}
+
+int storage_manager_pick_reader(const int* ss_indices, int count) {
+    static unsigned int seed = 0;
+    int active[count > 0 ? count : 1];
+    int n = 0;
+
+    pthread_mutex_lock(&ss_registry_mutex);
+    if (seed == 0) seed = (unsigned int)time(NULL) | 1u;
+    for (int i = 0; i < count; i++) {
+        int idx = ss_indices[i];
+        if (idx >= 0 && idx < ss_registry_capacity && ss_registry[idx].is_active) active[n++] = idx;
+    }
+    int pick = -1;
+    if (n == 1) {
+        pick = active[0];
+    } else if (n > 1) {
+        // Two choices: a hot file's readers spread out even between heartbeats
+        int a = active[rand_r(&seed) % n];
+        int b = active[rand_r(&seed) % (n - 1)];
+        if (b == a) b = active[n - 1];
+        pick = reader_load(&ss_registry[a]) <= reader_load(&ss_registry[b]) ? a : b;
+    }
+    if (pick >= 0) ss_registry[pick].reads_since_heartbeat++;
+    pthread_mutex_unlock(&ss_registry_mutex);
+    return pick;
+}
+
+void storage_manager_record_heartbeat(int ss_index, const SSHeartbeatPayload* load) {
+    if (ss_index < 0 || ss_index >= ss_registry_capacity) return;
+    pthread_mutex_lock(&ss_registry_mutex);
+    if (ss_registry[ss_index].is_active) {
+        ss_registry[ss_index].load = *load;
+        ss_registry[ss_index].last_heartbeat = time(NULL);
+        ss_registry[ss_index].placed_since_heartbeat = 0; // Counted in load->file_count now
+        ss_registry[ss_index].reads_since_heartbeat = 0;
+    }
+    pthread_mutex_unlock(&ss_registry_mutex);
+}
+
 /**
  * @brief Gets a pointer to an active storage server by its index.
  */
 StorageServerInfo* get_ss_by_index(int ss_index) {
-    if (ss_index < 0 || ss_index >= MAX_STORAGE_SERVERS) {
+    if (ss_index < 0 || ss_index >= ss_registry_capacity) {
         return NULL;
     }
 
@@ -224,23 +463,36 @@ StorageServerInfo* get_ss_by_index(int ss_index) {
  */
 void remove_storage_server(int sock_fd) {
     int ss_index = -1;
+    struct SSChannel* channel = NULL;
 
     pthread_mutex_lock(&ss_registry_mutex);
 
-    for (int i = 0; i < MAX_STORAGE_SERVERS; i++) {
+    for (int i = 0; i < ss_registry_capacity; i++) {
         if (ss_registry[i].is_active && ss_registry[i].ss_socket_fd == sock_fd) {
             ss_registry[i].is_active = 0;
             ss_registry[i].ss_socket_fd = -1;
+            channel = ss_registry[i].channel;
+            ss_registry[i].channel = NULL;
+            ss_registry[i].resync = -1;
             ss_index = i; 
             write_log("STORAGE_MGR", "Removed Storage Server (socket %d) from slot %d", sock_fd, i);
             break;
         }
     }
+    if (ss_index != -1 && SS_SUSPECT_GRACE_SEC > 0) {
+        // Keep its files listed; marked under the registry lock so a
+        // re-registration of this slot cannot interleave with the marking.
+        ss_registry[ss_index].suspect_files = search_mark_ss_suspect(ss_index);
+        ss_registry[ss_index].is_suspect = 1;
+        ss_registry[ss_index].suspect_since = time(NULL);
+    }
 
     pthread_mutex_unlock(&ss_registry_mutex);
 
-    if (ss_index != -1) {
-        // This is just a CALL to the function.
+    // Wake the channel reader; in-flight calls fail instead of hanging.
+    ss_channel_shutdown(channel);
+
+    if (ss_index != -1 && SS_SUSPECT_GRACE_SEC <= 0) {
         search_purge_by_ss(ss_index); 
     }
 }
@@ -252,7 +504,7 @@ int get_ss_sock_by_address(const char* ip, int port) {
     int sock_fd = -1;
     pthread_mutex_lock(&ss_registry_mutex);
 
-    for (int i = 0; i < MAX_STORAGE_SERVERS; i++) {
+    for (int i = 0; i < ss_registry_capacity; i++) {
         if (ss_registry[i].is_active &&
             ss_registry[i].client_facing_port == port &&
             strcmp(ss_registry[i].ip_addr, ip) == 0) 
@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../../include/doc_cache.h"
+#include "../../include/hash.h"
+
+#define DOC_CACHE_BUCKETS 256 // Power of two
+
+typedef struct doc_cache_entry {
+    char path[512];
+    parsed_doc_t* doc;          // Holds one reference
+    struct doc_cache_entry* hash_next;
+    struct doc_cache_entry* lru_prev; // Towards most recently used
+    struct doc_cache_entry* lru_next;
+} doc_cache_entry_t;
+
+static doc_cache_entry_t* buckets[DOC_CACHE_BUCKETS];
+static doc_cache_entry_t* lru_head = NULL;
+static doc_cache_entry_t* lru_tail = NULL;
+static int entry_count = 0;
+static size_t cached_bytes = 0;
+// Guards the table, the LRU list and every document's refcount.
+// Parsing and disk reads happen outside it.
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// =========================================================================
+//  PARSING
+// =========================================================================
+
+static int is_word_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int is_sentence_delimiter(char c) {
+    return c == '.' || c == '!' || c == '?';
+}
+
+static void free_doc(parsed_doc_t* doc) {
+    free(doc->text);
+    free(doc->tokens);
+    free(doc->words);
+    free(doc->sentences);
+    free(doc);
+}
+
+static int push_sentence(parsed_doc_t* doc, int* capacity, int start, int end, char delimiter) {
+    if (doc->sentence_count == *capacity) {
+        int new_capacity = *capacity ? *capacity * 2 : 16;
+        sentence_info_t* grown = realloc(doc->sentences, sizeof(sentence_info_t) * new_capacity);
+        if (grown == NULL) return -1;
+        doc->sentences = grown;
+        *capacity = new_capacity;
+    }
+    sentence_info_t* s = &doc->sentences[doc->sentence_count++];
+    s->start_word_idx = start;
+    s->end_word_idx = end;
+    s->delimiter = delimiter;
+    return 0;
+}
+
+/**
+ * @brief Splits 'text' (ownership taken) into words and sentences.
+ * A word whose last character is '.', '!' or '?' ends a sentence; trailing
+ * words without one form a final, open sentence.
+ */
+static parsed_doc_t* parse_owned_text(char* text, size_t length) {
+    parsed_doc_t* doc = calloc(1, sizeof(parsed_doc_t));
+    if (doc == NULL) {
+        free(text);
+        return NULL;
+    }
+    doc->text = text;
+    doc->length = length;
+    doc->refcount = 1;
+    doc->tokens = malloc(length + 1);
+    if (doc->tokens == NULL) {
+        free_doc(doc);
+        return NULL;
+    }
+    memcpy(doc->tokens, text, length + 1);
+
+    int word_capacity = 0;
+    int sentence_capacity = 0;
+    int sentence_start = 0;
+    size_t i = 0;
+    while (i < length) {
+        while (i < length && is_word_space(text[i])) doc->tokens[i++] = '\0';
+        if (i >= length) break;
+
+        size_t start = i;
+        while (i < length && !is_word_space(text[i])) i++;
+
+        if (doc->word_count == word_capacity) {
+            word_capacity = word_capacity ? word_capacity * 2 : 64;
+            doc_word_t* grown = realloc(doc->words, sizeof(doc_word_t) * word_capacity);
+            if (grown == NULL) {
+                free_doc(doc);
+                return NULL;
+            }
+            doc->words = grown;
+        }
+        doc_word_t* word = &doc->words[doc->word_count];
+        word->str = doc->tokens + start;
+        word->offset = start;
+        word->length = i - start;
+
+        char last = text[i - 1];
+        if (is_sentence_delimiter(last)) {
+            if (push_sentence(doc, &sentence_capacity, sentence_start, doc->word_count, last) == -1) {
+                free_doc(doc);
+                return NULL;
+            }
+            sentence_start = doc->word_count + 1;
+        }
+        doc->word_count++;
+    }
+    if (sentence_start < doc->word_count &&
+        push_sentence(doc, &sentence_capacity, sentence_start, doc->word_count - 1, '\0') == -1) {
+        free_doc(doc);
+        return NULL;
+    }
+    return doc;
+}
+
+static int read_open_file(int fd, struct stat* st, parsed_doc_t** out) {
+    size_t capacity = st->st_size > 0 ? (size_t)st->st_size + 1 : 4096;
+    size_t length = 0;
+    char* text = malloc(capacity);
+    if (text == NULL) return -1;
+
+    // Read to EOF rather than trusting st_size: the file may still be growing.
+    ssize_t n;
+    while ((n = read(fd, text + length, capacity - length - 1)) > 0) {
+        length += (size_t)n;
+        if (length + 1 == capacity) {
+            char* grown = realloc(text, capacity * 2);
+            if (grown == NULL) {
+                free(text);
+                return -1;
+            }
+            text = grown;
+            capacity *= 2;
+        }
+    }
+    if (n < 0) {
+        free(text);
+        return -1;
+    }
+    text[length] = '\0';
+
+    parsed_doc_t* doc = parse_owned_text(text, length);
+    if (doc == NULL) return -1;
+    doc->ino = st->st_ino;
+    doc->size = st->st_size;
+    doc->mtime = st->st_mtim;
+    *out = doc;
+    return 0;
+}
+
+parsed_doc_t* doc_parse_file(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    parsed_doc_t* doc = NULL;
+    if (fstat(fd, &st) == 0) {
+        read_open_file(fd, &st, &doc);
+    }
+    close(fd);
+    return doc;
+}
+
+int doc_writable_sentences(const parsed_doc_t* doc) {
+    if (doc->length == 0) return 1;
+    if (doc->sentence_count == 0) return 2; // Whitespace only
+    const sentence_info_t* last = &doc->sentences[doc->sentence_count - 1];
+    return doc->sentence_count + (last->delimiter != '\0' ? 1 : 0);
+}
+
+// =========================================================================
+//  CACHE (cache_mutex must be HELD)
+// =========================================================================
+
+static unsigned int bucket_of(const char* path) {
+    return fnv1a_hash(path) & (DOC_CACHE_BUCKETS - 1);
+}
+
+static doc_cache_entry_t* find_entry(const char* path) {
+    for (doc_cache_entry_t* e = buckets[bucket_of(path)]; e; e = e->hash_next) {
+        if (strcmp(e->path, path) == 0) return e;
+    }
+    return NULL;
+}
+
+static void lru_unlink(doc_cache_entry_t* e) {
+    if (e->lru_prev) e->lru_prev->lru_next = e->lru_next;
+    else lru_head = e->lru_next;
+    if (e->lru_next) e->lru_next->lru_prev = e->lru_prev;
+    else lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_front(doc_cache_entry_t* e) {
+    e->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = e;
+    lru_head = e;
+    if (lru_tail == NULL) lru_tail = e;
+}
+
+static void put_doc(parsed_doc_t* doc) {
+    if (--doc->refcount == 0) free_doc(doc);
+}
+
+static void remove_entry(doc_cache_entry_t* e) {
+    doc_cache_entry_t** link = &buckets[bucket_of(e->path)];
+    while (*link && *link != e) link = &(*link)->hash_next;
+    if (*link) *link = e->hash_next;
+    lru_unlink(e);
+    cached_bytes -= e->doc->length;
+    entry_count--;
+    put_doc(e->doc); // Readers still holding it keep it alive
+    free(e);
+}
+
+static int same_version(const parsed_doc_t* doc, const struct stat* st) {
+    return doc->ino == st->st_ino && doc->size == st->st_size &&
+           doc->mtime.tv_sec == st->st_mtim.tv_sec &&
+           doc->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+// =========================================================================
+//  PUBLIC API
+// =========================================================================
+
+parsed_doc_t* doc_cache_acquire(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    doc_cache_entry_t* e = find_entry(path);
+    if (e && same_version(e->doc, &st)) {
+        parsed_doc_t* doc = e->doc;
+        doc->refcount++;
+        lru_unlink(e);
+        lru_push_front(e);
+        pthread_mutex_unlock(&cache_mutex);
+        close(fd);
+        return doc;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+
+    // Miss or stale: parse without blocking other documents.
+    parsed_doc_t* doc = NULL;
+    int rc = read_open_file(fd, &st, &doc);
+    close(fd);
+    if (rc == -1) return NULL;
+    if (doc->length > DOC_CACHE_MAX_BYTES) return doc; // Too big to keep; caller gets it uncached
+
+    pthread_mutex_lock(&cache_mutex);
+    e = find_entry(path);
+    if (e && (e->doc->mtime.tv_sec > doc->mtime.tv_sec ||
+              (e->doc->mtime.tv_sec == doc->mtime.tv_sec && e->doc->mtime.tv_nsec > doc->mtime.tv_nsec))) {
+        // A racing parser already published a newer version; keep it.
+        pthread_mutex_unlock(&cache_mutex);
+        return doc;
+    }
+    if (e) remove_entry(e);
+    e = calloc(1, sizeof(doc_cache_entry_t));
+    if (e) {
+        strncpy(e->path, path, sizeof(e->path) - 1);
+        e->doc = doc;
+        doc->refcount++; // The cache's reference
+        unsigned int b = bucket_of(e->path);
+        e->hash_next = buckets[b];
+        buckets[b] = e;
+        lru_push_front(e);
+        entry_count++;
+        cached_bytes += doc->length;
+        while (lru_tail && lru_tail != e &&
+               (entry_count > DOC_CACHE_MAX_ENTRIES || cached_bytes > DOC_CACHE_MAX_BYTES)) {
+            remove_entry(lru_tail);
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    return doc;
+}
+
+void doc_cache_invalidate(const char* path) {
+    pthread_mutex_lock(&cache_mutex);
+    doc_cache_entry_t* e = find_entry(path);
+    if (e) remove_entry(e);
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+void doc_release(parsed_doc_t* doc) {
+    if (doc == NULL) return;
+    pthread_mutex_lock(&cache_mutex);
+    put_doc(doc);
+    pthread_mutex_unlock(&cache_mutex);
+}
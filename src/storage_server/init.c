@@ -76,19 +76,19 @@ int init_storage_server(int port) {
     // ---- Metadata Persistence ----
     int loaded = load_metadata(meta_path);
     if (loaded > 0) {
-        printf("[INFO] Loaded %d metadata entries from %s/metadata.txt\n", loaded, meta_path);
+        printf("[INFO] Loaded %d metadata entries from %s\n", loaded, meta_path);
 
         FILE *log2 = fopen("server.log", "a");
         if (log2) {
-            fprintf(log2, "[INFO] Loaded %d metadata entries from %s/metadata.txt\n", loaded, meta_path);
+            fprintf(log2, "[INFO] Loaded %d metadata entries from %s\n", loaded, meta_path);
             fclose(log2);
         }
     } else {
-        printf("[INFO] No previous metadata found in %s/metadata.txt — starting fresh.\n", meta_path);
+        printf("[INFO] No previous metadata found in %s — starting fresh.\n", meta_path);
 
         FILE *log3 = fopen("server.log", "a");
         if (log3) {
-            fprintf(log3, "[INFO] No previous metadata found in %s/metadata.txt — starting fresh.\n", meta_path);
+            fprintf(log3, "[INFO] No previous metadata found in %s — starting fresh.\n", meta_path);
             fclose(log3);
         }
     }
@@ -6,7 +6,8 @@
  * 1. Main Thread: Connects to the Name Server, registers,
  * and handles forwarded commands (CREATE, DELETE, etc.).
  * 2. Listener Thread: Listens on its public port for
- * direct client connections (READ, WRITE, STREAM).
+ * direct client connections (READ, WRITE, STREAM) and hands
+ * each session to a fixed pool of worker threads.
  * =================================================================
  */
 
@@ -14,6 +15,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <errno.h>
 #include <arpa/inet.h>
@@ -21,6 +23,11 @@
 #include <signal.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/statvfs.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/time.h>
 #include <time.h>
 #include <unistd.h>  // For usleep() - should already be there
 #include <netinet/tcp.h>  // For TCP_NODELAY
@@ -35,6 +42,14 @@
 // Headers from 'storage_server'
 #include "../../include/storage_server.h"
 #include "../../include/persistence.h"
+#include "../../include/worker_pool.h"
+#include "../../include/doc_cache.h"
+#include "../../include/write_session.h"
+#include "../../include/sentence_lock.h"
+#include "../../include/version_store.h"
+#include "../../include/metrics.h"
+#include "../../include/stream_engine.h"
+#include "../../include/word_index.h"
 
 // --- Defines, Structs, and Globals ---
 
@@ -45,16 +60,11 @@ typedef struct {
     int client_fd;
     struct sockaddr_in client_addr;
     int server_port;
+    char username[128]; // Set by the USER handshake; a session back from a STREAM skips it
+    char in_buf[BUF_SZ]; // Received but not yet consumed, for read_command_line()
+    size_t in_len;
 } client_ctx_t;
 
-// Sentence-level lock tracking
-typedef struct sentence_lock {
-    char filename[256];
-    int sentence_num;
-    int client_fd;
-    struct sentence_lock *next;
-} sentence_lock_t;
-
 // Client list for shutdown
 typedef struct client_node {
     int fd;
@@ -63,24 +73,35 @@ typedef struct client_node {
 
 // --- Globals ---
 static int g_ns_socket = -1;
+static pthread_mutex_t g_ns_send_mutex = PTHREAD_MUTEX_INITIALIZER; // One writer per NS message
+static int g_ns_push_enabled = 0; // Set once registration is done and pushes may flow
 static int g_my_port = 0;
 static char g_my_ip[64] = "127.0.0.1";
 static char g_meta_dir[256];
 static int g_running = 1;
 
-// Globals for Person B's sentence locking
-static sentence_lock_t *sentence_locks = NULL;
-static pthread_mutex_t lock_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Direct-client concurrency limits (optional trailing CLI arguments)
+static int g_worker_threads = DEFAULT_SS_WORKER_THREADS;
+static int g_job_queue_size = DEFAULT_SS_JOB_QUEUE_SIZE;
+static int g_listen_backlog = DEFAULT_LISTEN_BACKLOG;
 
 // Globals for Person B's client list
 static client_node_t *client_list = NULL;
+static int client_count = 0; // Length of client_list, for the heartbeat
 static pthread_mutex_t client_lock = PTHREAD_MUTEX_INITIALIZER;
 
 // --- Function Prototypes (Helpers) ---
 void *client_handler_thread(void *arg);
 int register_with_name_server(const char* ns_ip, int ns_port);
 void handle_ns_commands();
+static int send_to_ns(const MessageHeader* header, const void* payload);
+static int start_ns_readers(void);
+static void push_metadata_delta(const FileMeta* file, int content_changed);
+static void* heartbeat_thread(void* arg);
 void* client_listener_thread(void* arg);
+static void client_session_job(void* job);
+static void client_session_idle(void* job);
+static void stream_finished(void* owner, int fd);
 void handle_sigint(int sig);
 
 // Prototypes for Person B's helper functions
@@ -88,19 +109,17 @@ static void add_client_fd(int fd);
 static void remove_client_fd(int fd);
 static void close_all_clients();
 static void free_client_list();
-static int is_sentence_locked(const char* filename, int sentence_num, int client_fd);
-static void add_sentence_lock(const char* filename, int sentence_num, int client_fd);
-static void remove_sentence_lock(const char* filename, int sentence_num, int client_fd);
-static void remove_client_locks(int client_fd);
-static int get_client_write_info(int client_fd, char* filename, int* sentence_num);
 static int create_file_backup(const char* filename, int server_port, const char* username);
+static long send_read_range(int fd, const char* filepath, const char* range_args);
+static void send_error_reply(int fd, const char* msg, size_t len);
+static const char* direct_op_name(const char* cmd, int in_write_mode);
+static PermissionType direct_permission_needed(const char* cmd);
 static int perform_undo(const char* filename, int server_port, const char* username);
 static void update_file_access_time(const char* meta_dir, const char* filename);
-static int get_sentence_info_simple(const char* filename, int server_port, sentence_info_t sentences[], int max_sentences);
 
 // Add these helper function prototypes after the existing prototypes (around line 80)
 static int create_checkpoint(const char* filename, const char* checkpoint_tag, int server_port, const char* username);
-static int view_checkpoint(const char* filename, const char* checkpoint_tag, int server_port, char* content_buffer, size_t buffer_size);
+static int view_checkpoint(const char* filename, const char* checkpoint_tag, int server_port, char** out_content, size_t* out_length);
 static int revert_to_checkpoint(const char* filename, const char* checkpoint_tag, int server_port, const char* username);
 static int list_checkpoints(const char* filename, int server_port, char* list_buffer, size_t buffer_size);
 
@@ -111,75 +130,13 @@ static int approve_access_request(const char* filename, const char* requester_us
 static int deny_access_request(const char* filename, const char* requester_username, const char* owner_username, int server_port);
 static int check_file_owner(const char* filename, const char* username, int server_port);
 
-// =========================================================================
-//  SENTENCE PARSING HELPER FUNCTION
-// =========================================================================
-
-static int get_sentence_info_simple(const char* filename, int server_port, sentence_info_t sentences[], int max_sentences) {
-    char files_dir[256];
-    snprintf(files_dir, sizeof(files_dir), "data/ss_%d/files", server_port);
-    char filepath[512];
-    snprintf(filepath, sizeof(filepath), "%s/%s", files_dir, filename);
-    
-    FILE* file = fopen(filepath, "r");
-    if (!file) return 0;
-    
-    char content[8192] = {0};
-    size_t bytes_read = fread(content, 1, sizeof(content) - 1, file);
-    fclose(file);
-    content[bytes_read] = '\0';
-    
-    // *** FIXED: Parse sentences - only LAST delimiter in each word creates sentence boundary ***
-    int word_count = 0;
-    int sent_count = 0;
-    int current_sent_start = 0;
-    
-    char words[1024][512];
-    char temp_content[8192];
-    strcpy(temp_content, content);
-    
-    char *token = strtok(temp_content, " \t\n");
-    while (token && word_count < 1024) {
-        strcpy(words[word_count], token);
-        
-        // *** KEY FIX: Only check the LAST character of each word ***
-        int word_len = strlen(words[word_count]);
-        if (word_len > 0) {
-            char last_char = words[word_count][word_len - 1];
-            if (last_char == '.' || last_char == '!' || last_char == '?') {
-                // Found a delimiter at end of word - end current sentence
-                if (sent_count < max_sentences) {
-                    sentences[sent_count].start_word_idx = current_sent_start;
-                    sentences[sent_count].end_word_idx = word_count;
-                    sentences[sent_count].delimiter = last_char;
-                    sent_count++;
-                    current_sent_start = word_count + 1;  // Next sentence starts from next word
-                }
-            }
-        }
-        
-        word_count++;
-        token = strtok(NULL, " \t\n");
-    }
-    
-    // Handle incomplete sentence at the end
-    if (current_sent_start < word_count && sent_count < max_sentences) {
-        sentences[sent_count].start_word_idx = current_sent_start;
-        sentences[sent_count].end_word_idx = word_count - 1;
-        sentences[sent_count].delimiter = '\0';
-        sent_count++;
-    }
-    
-    return sent_count;
-}
-
 // =========================================================================
 //  MAIN FUNCTION (Entry Point)
 // =========================================================================
 
 int main(int argc, char *argv[]) {
-    if (argc != 5) {
-        fprintf(stderr, "Usage: %s <ss_ip> <ss_port> <ns_ip> <ns_port>\n", argv[0]);
+    if (argc < 5 || argc > 8) {
+        fprintf(stderr, "Usage: %s <ss_ip> <ss_port> <ns_ip> <ns_port> [workers] [queue_size] [backlog]\n", argv[0]);
         fprintf(stderr, "Example: %s 127.0.0.1 9001 127.0.0.1 5000\n", argv[0]);
         exit(EXIT_FAILURE);
     }
@@ -202,6 +159,15 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    // Optional direct-client limits
+    if (argc > 5) g_worker_threads = atoi(argv[5]);
+    if (argc > 6) g_job_queue_size = atoi(argv[6]);
+    if (argc > 7) g_listen_backlog = atoi(argv[7]);
+    if (g_worker_threads <= 0 || g_job_queue_size <= 0 || g_listen_backlog <= 0) {
+        fprintf(stderr, "Error: workers, queue_size and backlog must be positive.\n");
+        exit(EXIT_FAILURE);
+    }
+
     signal(SIGPIPE, SIG_IGN); // Ignore broken pipe signals
     signal(SIGINT, handle_sigint);
 
@@ -209,10 +175,27 @@ int main(int argc, char *argv[]) {
     init_storage_server(g_my_port);
     init_logger(g_my_ip, g_my_port);
     snprintf(g_meta_dir, sizeof(g_meta_dir), "data/ss_%d/metadata", g_my_port);
-    load_metadata(g_meta_dir);
-    write_log("INFO", "SS started on %s:%d. Loaded %d files.", g_my_ip, g_my_port, file_count);
-
-    // 2. Start the Client Listener Thread (Job 1)
+    int loaded_files = load_metadata(g_meta_dir);
+    if (persist_journal_start(g_meta_dir) != 0) {
+        write_log("WARN", "Metadata journal unavailable; rewriting the snapshot on every change.");
+    }
+    write_log("INFO", "SS started on %s:%d. Loaded %d files.", g_my_ip, g_my_port, loaded_files);
+    char files_dir[256];
+    snprintf(files_dir, sizeof(files_dir), "data/ss_%d/files", g_my_port);
+    word_index_start_build(files_dir); // SEARCH reports the index as warming until it finishes
+    // Report the gauges as zero until the first client shows up
+    metrics_gauge_add("connected_clients", 0);
+    metrics_gauge_add("sentence_locks_held", 0);
+
+    // 2. Start the direct-client worker pool and its listener (Job 1)
+    if (init_worker_pool(g_worker_threads, g_job_queue_size, client_session_job, client_session_idle) != 0) {
+        fprintf(stderr, "Error: Failed to start client worker pool.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (stream_engine_init() != 0) {
+        fprintf(stderr, "Error: Failed to start the stream engine.\n");
+        exit(EXIT_FAILURE);
+    }
     pthread_t listener_tid;
     int* port_arg = malloc(sizeof(int));
     *port_arg = g_my_port;
@@ -229,12 +212,27 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    // The NS places new files by the load we report
+    pthread_t heartbeat_tid;
+    if (pthread_create(&heartbeat_tid, NULL, heartbeat_thread, NULL) == 0) {
+        pthread_detach(heartbeat_tid);
+    } else {
+        write_log("WARN", "Failed to start heartbeat thread; the NS will place files without our load.");
+    }
+
+    if (start_ns_readers() == 0) {
+        write_log("WARN", "Failed to start NS reader threads; MSG_INTERNAL_READ is served inline.");
+    }
+
     // 4. Main thread becomes the NS command handler
     write_log("INFO", "Entering main command loop, listening for NS commands.");
     handle_ns_commands(); // This loop blocks until NS disconnects or Ctrl+C
 
     // 5. Cleanup
+    stream_engine_shutdown();
+    shutdown_worker_pool();
     close_all_clients(); // Close all direct client sockets
+    persist_journal_stop();
     close_logger();
     if (g_ns_socket != -1) {
         close(g_ns_socket);
@@ -258,12 +256,13 @@ void* client_listener_thread(void* arg) {
     int opt = 1;
     setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
     bind_socket(listen_fd, port);
-    listen_socket(listen_fd);
+    listen_socket_backlog(listen_fd, g_listen_backlog);
     
-    write_log("INFO", "Client Listener Thread started. Listening on port %d...", port);
+    write_log("INFO", "Client Listener Thread started. Listening on port %d (backlog %d)...",
+              port, g_listen_backlog);
 
     while (g_running) {
-        client_ctx_t *ctx = malloc(sizeof(client_ctx_t));
+        client_ctx_t *ctx = calloc(1, sizeof(client_ctx_t));
         socklen_t addrlen = sizeof(ctx->client_addr);
         
         ctx->client_fd = accept(listen_fd, (struct sockaddr *)&ctx->client_addr, &addrlen);
@@ -276,13 +275,22 @@ void* client_listener_thread(void* arg) {
         }
         ctx->server_port = port;
 
-        pthread_t tid;
-        if (pthread_create(&tid, NULL, client_handler_thread, ctx) != 0) {
-            perror("pthread_create (client)");
+        // Hand the session to the pool. If every worker is busy and the
+        // queue is full, refuse now instead of letting the client hang.
+        if (worker_pool_submit(ctx) != 0) {
+            const char *busy = "ERR_503 SERVER_BUSY\n";
+            send(ctx->client_fd, busy, strlen(busy), MSG_NOSIGNAL);
+            // FIN after the reply, and drop whatever the client already
+            // sent (its USER line) without waiting, so close() doesn't
+            // reset the connection ahead of the reply. Never blocks accept.
+            shutdown(ctx->client_fd, SHUT_WR);
+            char discard[256];
+            while (recv(ctx->client_fd, discard, sizeof(discard), MSG_DONTWAIT) > 0) {}
+            write_log("WARN", "Client queue full (%d waiting). Rejected connection on fd %d.",
+                      g_job_queue_size, ctx->client_fd);
             close(ctx->client_fd);
             free(ctx);
         }
-        pthread_detach(tid);
     }
     
     close(listen_fd);
@@ -290,20 +298,268 @@ void* client_listener_thread(void* arg) {
     return NULL;
 }
 
+// Worker pool entry point: one job is one direct-client session.
+static void client_session_job(void* job) {
+    client_handler_thread(job);
+}
+
+// Runs on the pool's park thread when a parked session sent nothing for
+// SS_DIRECT_IDLE_SEC. Parked sessions are never mid-WRITE, so no locks.
+static void client_session_idle(void* job) {
+    client_ctx_t *ctx = (client_ctx_t *)job;
+    write_log("INFO", "Closing direct session of %s after %d s idle", ctx->username, SS_DIRECT_IDLE_SEC);
+    close(ctx->client_fd);
+    remove_client_fd(ctx->client_fd);
+    free(ctx);
+}
+
+// Runs on the stream engine thread when a STREAM ends: the session goes
+// back to a worker, or is closed if none can take it right now
+static void stream_finished(void* owner, int fd) {
+    client_ctx_t *ctx = (client_ctx_t *)owner;
+    if (worker_pool_submit(ctx) != 0) {
+        write_log("WARN", "No worker free to resume the session of %s after STREAM; closing it", ctx->username);
+        close(fd);
+        remove_client_fd(fd);
+        free(ctx);
+    }
+}
+
 // =========================================================================
 //  JOB 2: MAIN THREAD (Handles Name Server connection)
 // =========================================================================
 
+/**
+ * @brief Sends one message (header + optional payload) to the NS.
+ * The NS multiplexes requests on this socket, so a message must never be
+ * interleaved with another thread's reply.
+ */
+static int send_to_ns(const MessageHeader* header, const void* payload) {
+    if (header->msg_type == MSG_ERROR) metrics_mark_error();
+    uint64_t wait_started = metrics_now_us();
+    pthread_mutex_lock(&g_ns_send_mutex);
+    metrics_observe_wait("ss_ns_send_mutex", metrics_now_us() - wait_started);
+    int rc = send_header(g_ns_socket, (MessageHeader*)header);
+    if (rc == 0 && header->payload_length > 0 && payload != NULL) {
+        rc = send_all(g_ns_socket, payload, header->payload_length);
+    }
+    pthread_mutex_unlock(&g_ns_send_mutex);
+    return rc;
+}
+
+/**
+ * @brief Persistence hook: tells the NS about a changed record so it can
+ * answer INFO and VIEW -l without asking us.
+ */
+static void push_metadata_delta(const FileMeta* file, int content_changed) {
+    if (!g_ns_push_enabled) return; // Registration sends the full table
+
+    SSMetadataDeltaPayload delta;
+    memset(&delta, 0, sizeof(delta));
+    strncpy(delta.filename, file->filename, MAX_FILENAME - 1);
+    delta.meta.char_count = file->size;
+    delta.meta.word_count = file->word_count;
+    delta.meta.created = file->created;
+    delta.meta.last_modified = file->modified;
+    delta.meta.last_accessed = file->last_accessed;
+    strncpy(delta.meta.last_accessed_by, file->last_accessed_by, 64 - 1);
+    delta.content_changed = content_changed;
+
+    MessageHeader header;
+    memset(&header, 0, sizeof(header));
+    header.msg_type = MSG_INTERNAL_METADATA_DELTA;
+    header.source_component = COMPONENT_STORAGE_SERVER;
+    header.dest_component = COMPONENT_NAME_SERVER;
+    header.payload_length = sizeof(delta);
+
+    // One per write, so on a v2 link send the compact form (never larger)
+    uint8_t compact[sizeof(delta)];
+    size_t length = protocol_version(g_ns_socket) == PROTOCOL_V2 ?
+                    encode_metadata_delta(&delta, compact, sizeof(compact)) : 0;
+    if (length > 0) {
+        header.payload_length = (uint32_t)length;
+        send_to_ns(&header, compact);
+    } else {
+        send_to_ns(&header, &delta);
+    }
+}
+
+/**
+ * @brief Reports this SS's load to the NS every SS_HEARTBEAT_SEC, for
+ * CREATE placement. Requests and latency cover the last interval only.
+ */
+static void* heartbeat_thread(void* arg) {
+    (void)arg;
+    char data_dir[128];
+    snprintf(data_dir, sizeof(data_dir), "data/ss_%d", g_my_port);
+    uint64_t last_count = 0, last_sum_us = 0;
+    metrics_surface_totals(METRICS_SS_DIRECT, &last_count, &last_sum_us);
+
+    while (g_running) {
+        sleep(SS_HEARTBEAT_SEC);
+        if (!g_running) break;
+        if (!g_ns_push_enabled) continue;
+
+        SSHeartbeatPayload beat;
+        memset(&beat, 0, sizeof(beat));
+        int files = 0;
+        uint64_t used = 0;
+        persist_usage(&files, &used);
+        beat.file_count = files;
+        beat.disk_used_bytes = used;
+        struct statvfs vfs;
+        if (statvfs(data_dir, &vfs) == 0) {
+            beat.disk_free_bytes = (uint64_t)vfs.f_bavail * vfs.f_frsize;
+        }
+        pthread_mutex_lock(&client_lock);
+        beat.active_clients = client_count;
+        pthread_mutex_unlock(&client_lock);
+        beat.active_streams = stream_engine_active();
+        beat.worker_threads = g_worker_threads;
+
+        uint64_t count = 0, sum_us = 0;
+        metrics_surface_totals(METRICS_SS_DIRECT, &count, &sum_us);
+        beat.requests = (uint32_t)(count - last_count);
+        beat.latency_us = count > last_count ? (uint32_t)((sum_us - last_sum_us) / (count - last_count)) : 0;
+        last_count = count;
+        last_sum_us = sum_us;
+
+        MessageHeader header;
+        memset(&header, 0, sizeof(header));
+        header.msg_type = MSG_SS_HEARTBEAT;
+        header.source_component = COMPONENT_STORAGE_SERVER;
+        header.dest_component = COMPONENT_NAME_SERVER;
+        header.payload_length = sizeof(beat);
+        send_to_ns(&header, &beat); // A dead link is noticed by handle_ns_commands
+    }
+    return NULL;
+}
+
+/**
+ * @brief Discards a payload the handler does not use, keeping the stream in sync.
+ */
+static int drain_ns_payload(uint32_t len) {
+    char scratch[512];
+    while (len > 0) {
+        uint32_t chunk = len < sizeof(scratch) ? len : sizeof(scratch);
+        if (recv_all(g_ns_socket, scratch, chunk) == -1) return -1;
+        len -= chunk;
+    }
+    return 0;
+}
+
+// MSG_INTERNAL_READs waiting for one of the SS_NS_READ_THREADS readers.
+// Unbounded like the NS's own request queue: a job is just its header.
+typedef struct ns_read_job {
+    MessageHeader header;
+    struct ns_read_job* next;
+} ns_read_job_t;
+
+static ns_read_job_t* g_read_head = NULL;
+static ns_read_job_t* g_read_tail = NULL;
+static int g_read_threads = 0;
+static pthread_mutex_t g_read_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_read_cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * @brief Serves MSG_INTERNAL_READ (EXEC, replication) off the command
+ * loop, so a large file does not hold up every other NS request queued
+ * behind it. The content comes from the document cache that direct READs
+ * use, so a hot file is not read from disk again.
+ */
+static void serve_ns_read(const MessageHeader* cmd_header) {
+    uint64_t started = metrics_begin();
+    write_log("INFO", "NS requested file content for '%s'", cmd_header->filename);
+    
+    char filepath[512];
+    snprintf(filepath, sizeof(filepath), "data/ss_%d/files/%s", g_my_port, cmd_header->filename);
+    
+    parsed_doc_t* doc = doc_cache_acquire(filepath);
+    if (doc == NULL) {
+        // File not found, will send no data
+        write_log("WARN", "NS requested '%s', but file not found.", cmd_header->filename);
+    }
+
+    // Send response (ALWAYS send this)
+    MessageHeader resp_header;
+    memset(&resp_header, 0, sizeof(resp_header));
+    resp_header.msg_type = MSG_INTERNAL_DATA; // This is 101
+    resp_header.source_component = COMPONENT_STORAGE_SERVER;
+    resp_header.dest_component = COMPONENT_NAME_SERVER;
+    resp_header.request_id = cmd_header->request_id;
+    resp_header.payload_length = doc ? (uint32_t)doc->length : 0;
+    send_to_ns(&resp_header, doc ? doc->text : NULL); // On failure the NS drops the link
+    if (doc == NULL) metrics_mark_error();
+    metrics_end(METRICS_SS_NS, "INTERNAL_READ", started);
+    
+    if (doc) doc_release(doc);
+}
+
+static void* ns_reader_thread(void* arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&g_read_mutex);
+        while (g_read_head == NULL) pthread_cond_wait(&g_read_cond, &g_read_mutex);
+        ns_read_job_t* job = g_read_head;
+        g_read_head = job->next;
+        if (g_read_head == NULL) g_read_tail = NULL;
+        pthread_mutex_unlock(&g_read_mutex);
+
+        serve_ns_read(&job->header);
+        free(job);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Starts the fixed set of threads that serve MSG_INTERNAL_READ.
+ * @return Threads started; with none, reads are served inline.
+ */
+static int start_ns_readers(void) {
+    for (int i = 0; i < SS_NS_READ_THREADS; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, ns_reader_thread, NULL) != 0) break;
+        pthread_detach(tid);
+        g_read_threads++;
+    }
+    return g_read_threads;
+}
+
+/**
+ * @brief Hands an MSG_INTERNAL_READ to the readers, or serves it inline
+ * if there are none or the job cannot be allocated.
+ */
+static void queue_ns_read(const MessageHeader* cmd_header) {
+    ns_read_job_t* job = g_read_threads > 0 ? malloc(sizeof(ns_read_job_t)) : NULL;
+    if (job == NULL) {
+        serve_ns_read(cmd_header);
+        return;
+    }
+    job->header = *cmd_header;
+    job->next = NULL;
+    pthread_mutex_lock(&g_read_mutex);
+    if (g_read_tail) g_read_tail->next = job; else g_read_head = job;
+    g_read_tail = job;
+    pthread_cond_signal(&g_read_cond);
+    pthread_mutex_unlock(&g_read_mutex);
+}
+
 void handle_ns_commands() {
     MessageHeader cmd_header;
     
     while (g_running && recv_header(g_ns_socket, &cmd_header) == 0) {
+        uint64_t started = metrics_begin();
         
+        // Every reply echoes the request ID so the NS can match it to its caller.
         MessageHeader ack_header;
         memset(&ack_header, 0, sizeof(ack_header));
         ack_header.msg_type = MSG_ACK;
         ack_header.source_component = COMPONENT_STORAGE_SERVER;
         ack_header.dest_component = COMPONENT_NAME_SERVER;
+        ack_header.request_id = cmd_header.request_id;
+
+        MessageHeader err_header = ack_header;
+        err_header.msg_type = MSG_ERROR;
 
         switch (cmd_header.msg_type) {
             
@@ -315,9 +571,13 @@ void handle_ns_commands() {
                 FILE *f = fopen(filepath, "w");
                 if (f) {
                     fclose(f);
+                    doc_cache_invalidate(filepath);
                     add_metadata_entry(g_meta_dir, cmd_header.filename);
-                    send_header(g_ns_socket, &ack_header);
-                } else { /* TODO: Send MSG_ERROR */ }
+                    word_index_update(cmd_header.filename, filepath);
+                    send_to_ns(&ack_header, NULL);
+                } else {
+                    send_to_ns(&err_header, NULL);
+                }
                 break;
             }
                 
@@ -327,9 +587,16 @@ void handle_ns_commands() {
                 char filepath[512];
                 snprintf(filepath, sizeof(filepath), "data/ss_%d/files/%s", g_my_port, cmd_header.filename);
                 if (remove(filepath) == 0) {
+                    char versions_dir[256];
+                    snprintf(versions_dir, sizeof(versions_dir), "data/ss_%d/versions", g_my_port);
+                    doc_cache_invalidate(filepath);
+                    version_store_drop(versions_dir, cmd_header.filename);
                     remove_metadata_entry(g_meta_dir, cmd_header.filename);
-                    send_header(g_ns_socket, &ack_header);
-                } else { /* TODO: Send MSG_ERROR */ }
+                    word_index_remove(cmd_header.filename);
+                    send_to_ns(&ack_header, NULL);
+                } else {
+                    send_to_ns(&err_header, NULL);
+                }
                 break;
             }
 
@@ -341,12 +608,17 @@ void handle_ns_commands() {
                 int result = perform_undo(cmd_header.filename, g_my_port, "NameServer");
                 if (result == 1) {
                     update_metadata_entry(g_meta_dir, cmd_header.filename);
+                    char filepath[512];
+                    snprintf(filepath, sizeof(filepath), "data/ss_%d/files/%s", g_my_port, cmd_header.filename);
+                    word_index_update(cmd_header.filename, filepath);
                     
                     // Invalidate cache after undo
                     // Cache removed for simplicity
                     
-                    send_header(g_ns_socket, &ack_header);
-                } else { /* TODO: Send MSG_ERROR */ }
+                    send_to_ns(&ack_header, NULL);
+                } else {
+                    send_to_ns(&err_header, NULL);
+                }
                 break;
             }
 
@@ -355,26 +627,68 @@ void handle_ns_commands() {
                 write_log("INFO", "NS requested metadata for '%s'", cmd_header.filename);
                 SSMetadataPayload meta_payload;
                 memset(&meta_payload, 0, sizeof(meta_payload));
-                for (int i = 0; i < file_count; i++) {
-                    if (strcmp(file_table[i].filename, cmd_header.filename) == 0) {
-                        meta_payload.char_count = file_table[i].size;
-                        meta_payload.word_count = file_table[i].word_count;
-                        meta_payload.created = file_table[i].created;
-                        meta_payload.last_modified = file_table[i].modified;
-                        meta_payload.last_accessed = file_table[i].last_accessed;
-                        strncpy(meta_payload.last_accessed_by, file_table[i].last_accessed_by, 64 - 1);
-                        break;
-                    }
+                FileMeta file;
+                if (persist_get_file(cmd_header.filename, &file) == 0) {
+                    meta_payload.char_count = file.size;
+                    meta_payload.word_count = file.word_count;
+                    meta_payload.created = file.created;
+                    meta_payload.last_modified = file.modified;
+                    meta_payload.last_accessed = file.last_accessed;
+                    strncpy(meta_payload.last_accessed_by, file.last_accessed_by, 64 - 1);
                 }
 
-                MessageHeader resp_header;
-                memset(&resp_header, 0, sizeof(resp_header));
+                MessageHeader resp_header = ack_header;
                 resp_header.msg_type = MSG_INTERNAL_METADATA_RESP;
-                resp_header.source_component = COMPONENT_STORAGE_SERVER;
                 resp_header.payload_length = sizeof(SSMetadataPayload);
-                
-                send_header(g_ns_socket, &resp_header);
-                send_all(g_ns_socket, &meta_payload, sizeof(meta_payload));
+                send_to_ns(&resp_header, &meta_payload);
+                break;
+            }
+
+            case MSG_INTERNAL_GET_METADATA_BATCH:
+            {
+                uint32_t n = cmd_header.payload_length / MAX_FILENAME;
+                if (cmd_header.payload_length % MAX_FILENAME != 0 || n == 0 || n > SS_METADATA_BATCH_MAX) {
+                    write_log("WARN", "Malformed metadata batch of %u bytes from NS", cmd_header.payload_length);
+                    drain_ns_payload(cmd_header.payload_length);
+                    send_to_ns(&err_header, NULL);
+                    break;
+                }
+                char (*names)[MAX_FILENAME] = malloc(cmd_header.payload_length);
+                SSMetadataBatchEntry* results = calloc(n, sizeof(SSMetadataBatchEntry));
+                if (names == NULL || results == NULL) {
+                    free(names);
+                    free(results);
+                    drain_ns_payload(cmd_header.payload_length);
+                    send_to_ns(&err_header, NULL);
+                    break;
+                }
+                if (recv_all(g_ns_socket, names, cmd_header.payload_length) == -1) {
+                    free(names);
+                    free(results);
+                    break; // Link is gone; the loop exits on the next recv
+                }
+
+                for (uint32_t k = 0; k < n; k++) {
+                    names[k][MAX_FILENAME - 1] = '\0';
+                    FileMeta file;
+                    if (persist_get_file(names[k], &file) == 0) {
+                        results[k].found = 1;
+                        results[k].meta.char_count = file.size;
+                        results[k].meta.word_count = file.word_count;
+                        results[k].meta.created = file.created;
+                        results[k].meta.last_modified = file.modified;
+                        results[k].meta.last_accessed = file.last_accessed;
+                        strncpy(results[k].meta.last_accessed_by, file.last_accessed_by, 64 - 1);
+                    }
+                }
+                write_log("INFO", "NS requested metadata for %u files", n);
+
+                MessageHeader resp_header = ack_header;
+                resp_header.msg_type = MSG_INTERNAL_METADATA_BATCH_RESP;
+                resp_header.payload_length = n * sizeof(SSMetadataBatchEntry);
+                send_to_ns(&resp_header, results);
+                free(names);
+                free(results);
                 break;
             }
 
@@ -391,73 +705,48 @@ void handle_ns_commands() {
                     }
                 } else {
                     write_log("WARN", "MSG_INTERNAL_SET_OWNER with empty or too large payload for '%s'", cmd_header.filename);
+                    drain_ns_payload(cmd_header.payload_length);
                 }
                 // No ACK needed
                 break;
             }
 
-            case MSG_INTERNAL_READ: // This is 100
+            case MSG_INTERNAL_SET_FOLDER:
             {
-                write_log("INFO", "NS requested file content for '%s'", cmd_header.filename);
-                
-                char filepath[512];
-                snprintf(filepath, sizeof(filepath), "data/ss_%d/files/%s", g_my_port, cmd_header.filename);
-                
-                FILE *f = fopen(filepath, "r");
-                long file_size = 0;
-                char* file_content = NULL;
-
-                if (f) {
-                    // File exists, read it
-                    fseek(f, 0, SEEK_END);
-                    file_size = ftell(f);
-                    fseek(f, 0, SEEK_SET);
-
-                    file_content = malloc(file_size + 1); // +1 for safety
-                    if (file_content) {
-                        file_size = fread(file_content, 1, file_size, f);
-                        file_content[file_size] = '\0';
-                    } else {
-                        write_log("ERROR", "Malloc failed for MSG_INTERNAL_READ");
-                        file_size = 0; // Send no data
+                // The payload is the destination folder ("" = root). The NS waits for an ACK.
+                if (cmd_header.payload_length > 0 && cmd_header.payload_length < 256) {
+                    char folder_buf[256];
+                    if (recv_all(g_ns_socket, folder_buf, cmd_header.payload_length) == 0) {
+                        folder_buf[cmd_header.payload_length - 1] = '\0';
+                        persist_set_folder(g_meta_dir, cmd_header.filename, folder_buf);
+                        write_log("INFO", "NS moved '%s' to folder '%s'", cmd_header.filename, folder_buf);
+                        send_to_ns(&ack_header, NULL);
                     }
-                    fclose(f);
                 } else {
-                    // File not found, will send no data
-                    write_log("WARN", "NS requested '%s' for EXEC, but file not found.", cmd_header.filename);
-                    file_size = 0;
-                }
-
-                // Send response header (ALWAYS send this)
-                MessageHeader resp_header;
-                memset(&resp_header, 0, sizeof(resp_header));
-                resp_header.msg_type = MSG_INTERNAL_DATA; // This is 101
-                resp_header.source_component = COMPONENT_STORAGE_SERVER;
-                resp_header.payload_length = file_size;
-                
-                if (send_header(g_ns_socket, &resp_header) == -1) {
-                    // Failed to send header, just free and break
-                    if (file_content) free(file_content);
-                    break; // NS will disconnect
-                }
-
-                // Send payload (if any)
-                if (file_size > 0 && file_content) {
-                    send_all(g_ns_socket, file_content, file_size);
+                    write_log("WARN", "MSG_INTERNAL_SET_FOLDER with empty or too large payload for '%s'", cmd_header.filename);
+                    drain_ns_payload(cmd_header.payload_length);
+                    send_to_ns(&err_header, NULL);
                 }
-                
-                if (file_content) free(file_content);
                 break;
             }
+
+            case MSG_INTERNAL_READ: // This is 100
+                queue_ns_read(&cmd_header);
+                break;
             
             case MSG_INTERNAL_ADD_ACCESS:
             {
                 AccessControlPayload payload;
+                if (cmd_header.payload_length != sizeof(payload)) {
+                    drain_ns_payload(cmd_header.payload_length);
+                    send_to_ns(&err_header, NULL);
+                    break;
+                }
                 if (recv_all(g_ns_socket, &payload, sizeof(payload)) == 0) {
                     persist_set_acl(g_meta_dir, cmd_header.filename, payload.target_username, payload.permission);
                     write_log("INFO", "NS set ACL for '%s': User %s -> Perm %d",
                               cmd_header.filename, payload.target_username, payload.permission);
-                    send_header(g_ns_socket, &ack_header);
+                    send_to_ns(&ack_header, NULL);
                 }
                 break;
             }
@@ -472,16 +761,132 @@ void handle_ns_commands() {
                         persist_remove_acl(g_meta_dir, cmd_header.filename, target_user);
                         write_log("INFO", "NS removed ACL for '%s': User %s",
                                   cmd_header.filename, target_user);
-                        send_header(g_ns_socket, &ack_header);
+                        send_to_ns(&ack_header, NULL);
                     }
                 } else {
                     write_log("WARN", "MSG_INTERNAL_REM_ACCESS with empty or too large payload for '%s'", cmd_header.filename);
+                    drain_ns_payload(cmd_header.payload_length);
+                    send_to_ns(&err_header, NULL);
+                }
+                break;
+            }
+
+            case MSG_INTERNAL_REPLICATE:
+            {
+                // A fresh copy from the primary, written aside and renamed over the old one
+                SSReplicaPayload state;
+                if (cmd_header.payload_length < sizeof(state)) {
+                    drain_ns_payload(cmd_header.payload_length);
+                    send_to_ns(&err_header, NULL);
+                    break;
+                }
+                if (recv_all(g_ns_socket, &state, sizeof(state)) == -1) break;
+                state.owner_username[sizeof(state.owner_username) - 1] = '\0';
+                state.folder[sizeof(state.folder) - 1] = '\0';
+
+                char filepath[512], tmp_path[520];
+                snprintf(filepath, sizeof(filepath), "data/ss_%d/files/%s", g_my_port, cmd_header.filename);
+                snprintf(tmp_path, sizeof(tmp_path), "%s.replica", filepath);
+                FILE *f = fopen(tmp_path, "w");
+                int ok = f != NULL, link_ok = 1;
+                uint32_t remaining = cmd_header.payload_length - sizeof(state);
+                char chunk[8192];
+                while (remaining > 0) {
+                    uint32_t n = remaining < sizeof(chunk) ? remaining : sizeof(chunk);
+                    if (recv_all(g_ns_socket, chunk, n) == -1) { link_ok = 0; break; }
+                    if (f && fwrite(chunk, 1, n, f) != n) ok = 0;
+                    remaining -= n;
+                }
+                if (f && fclose(f) != 0) ok = 0;
+                if (!link_ok) { remove(tmp_path); break; } // The loop sees the link is gone
+
+                if (ok && rename(tmp_path, filepath) == 0) {
+                    doc_cache_invalidate(filepath);
+                    persist_store_replica(g_meta_dir, cmd_header.filename, &state);
+                    word_index_update(cmd_header.filename, filepath);
+                    write_log("INFO", "Stored replica of '%s' (%u bytes)", cmd_header.filename,
+                              cmd_header.payload_length - (uint32_t)sizeof(state));
+                    send_to_ns(&ack_header, NULL);
+                } else {
+                    remove(tmp_path);
+                    write_log("ERROR", "Could not store replica of '%s'", cmd_header.filename);
+                    send_to_ns(&err_header, NULL);
                 }
                 break;
             }
 
+            case MSG_INTERNAL_REPLICA_STATE:
+            {
+                int32_t state;
+                if (cmd_header.payload_length != sizeof(state)) {
+                    drain_ns_payload(cmd_header.payload_length);
+                    break;
+                }
+                if (recv_all(g_ns_socket, &state, sizeof(state)) == 0) {
+                    persist_set_replica_state(g_meta_dir, cmd_header.filename, state);
+                    write_log("INFO", "NS set replica state of '%s' to %d", cmd_header.filename, state);
+                }
+                // No ACK needed
+                break;
+            }
+
+            case MSG_INTERNAL_SEARCH_CONTENT:
+            {
+                // The query is in the filename field; an index lookup, so answered inline
+                drain_ns_payload(cmd_header.payload_length);
+                int warming = !word_index_ready(); // Checked first: the hits can only be fuller
+                size_t length = 0;
+                char* hits = word_index_query(cmd_header.filename, &length);
+                if (hits == NULL) {
+                    send_to_ns(&err_header, NULL);
+                    break;
+                }
+                MessageHeader resp_header = ack_header;
+                resp_header.msg_type = MSG_INTERNAL_SEARCH_RESULT;
+                resp_header.payload_length = (uint32_t)length;
+                if (warming) {
+                    memset(resp_header.filename, 0, sizeof(resp_header.filename));
+                    strcpy(resp_header.filename, SEARCH_INDEX_WARMING);
+                }
+                send_to_ns(&resp_header, hits);
+                free(hits);
+                break;
+            }
+
+            case MSG_STATS:
+            {
+                drain_ns_payload(cmd_header.payload_length);
+                char instance[32];
+                snprintf(instance, sizeof(instance), "ss_%d", g_my_port);
+                size_t length = 0;
+                char* text = metrics_render(instance, &length);
+                if (text == NULL) {
+                    send_to_ns(&err_header, NULL);
+                    break;
+                }
+                MessageHeader resp_header = ack_header;
+                resp_header.msg_type = MSG_STATS_RESPONSE;
+                resp_header.payload_length = (uint32_t)length;
+                send_to_ns(&resp_header, text);
+                free(text);
+                break;
+            }
+
+            case MSG_ACK:
+                // The NS's reply to our registration batch; nothing to do
+                drain_ns_payload(cmd_header.payload_length);
+                break;
+
             default:
                 write_log("WARN", "Received unknown command from NS: %d", cmd_header.msg_type);
+                drain_ns_payload(cmd_header.payload_length);
+                metrics_mark_error();
+        }
+
+        // Reads are timed by the reader that serves them (see serve_ns_read); a stray
+        // ACK (the NS's reply to our registration batch) is not a request
+        if (cmd_header.msg_type != MSG_INTERNAL_READ && cmd_header.msg_type != MSG_ACK) {
+            metrics_end(METRICS_SS_NS, msg_type_name(cmd_header.msg_type), started);
         }
     }
     
@@ -489,12 +894,23 @@ void handle_ns_commands() {
     g_running = 0; // Signal the client listener thread to stop
 }
 
+static int send_register_batch(const uint8_t* batch, size_t length) {
+    MessageHeader file_header;
+    memset(&file_header, 0, sizeof(file_header));
+    file_header.msg_type = MSG_REGISTER_FILE_BATCH;
+    file_header.source_component = COMPONENT_STORAGE_SERVER;
+    file_header.payload_length = (uint32_t)length;
+    if (send_header(g_ns_socket, &file_header) == -1) return -1;
+    return send_all(g_ns_socket, batch, length);
+}
+
 int register_with_name_server(const char* ns_ip, int ns_port) {
     g_ns_socket = create_socket();
     if (connect_socket_no_exit(g_ns_socket, ns_ip, ns_port) == -1) {
         write_log("FATAL", "Could not connect to Name Server at %s:%d. Exiting.", ns_ip, ns_port);
         return -1;
     }
+    protocol_set_version(g_ns_socket, PROTOCOL_V1);
     write_log("INFO", "Connected to Name Server. Registering...");
 
     // 1. Send Registration
@@ -503,11 +919,18 @@ int register_with_name_server(const char* ns_ip, int ns_port) {
     reg_header.msg_type = MSG_REGISTER;
     reg_header.source_component = COMPONENT_STORAGE_SERVER;
     reg_header.payload_length = sizeof(SSRegistrationPayload);
+    reg_header.request_id = PROTOCOL_VERSION; // Offer compact framing
 
     SSRegistrationPayload reg_payload;
     memset(&reg_payload, 0, sizeof(reg_payload));
-    strncpy(reg_payload.ip_addr, g_my_ip, 64);
+    strncpy(reg_payload.ip_addr, g_my_ip, 64 - 1);
     reg_payload.client_facing_port = g_my_port;
+    if (persist_instance_id(g_meta_dir, &reg_payload.instance_id) == -1) {
+        write_log("WARN", "Could not read or create the metadata instance id; the NS will ask for a full sync.");
+    }
+    reg_payload.epoch = persist_metadata_epoch();
+    uint64_t held_bytes = 0;
+    persist_usage(&reg_payload.file_count, &held_bytes);
     
     if (send_header(g_ns_socket, &reg_header) == -1) { close(g_ns_socket); return -1; }
     if (send_all(g_ns_socket, &reg_payload, sizeof(reg_payload)) == -1) { close(g_ns_socket); return -1; }
@@ -519,32 +942,66 @@ int register_with_name_server(const char* ns_ip, int ns_port) {
         close(g_ns_socket);
         return -1;
     }
-    write_log("INFO", "Registration ACK received. Sending file list...");
-
-    // 3. Send File List (from persistence.c's file_table)
+    SSRegistrationAckPayload ack_payload;
+    memset(&ack_payload, 0, sizeof(ack_payload));
+    if (ack_header.payload_length == sizeof(ack_payload)) {
+        if (recv_all(g_ns_socket, &ack_payload, sizeof(ack_payload)) == -1) { close(g_ns_socket); return -1; }
+    } else {
+        drain_ns_payload(ack_header.payload_length); // No delta info: send everything
+    }
+    // An NS without v2 answers 0 and the link stays on v1
+    if (ack_header.request_id == PROTOCOL_V2) protocol_set_version(g_ns_socket, PROTOCOL_V2);
+    if (ack_payload.delta) {
+        write_log("INFO", "Registration ACK received. Sending changes since epoch %llu...",
+                  (unsigned long long)ack_payload.since_epoch);
+    } else {
+        write_log("INFO", "Registration ACK received. Sending file list...");
+    }
+
+    // 3. Send File List (a snapshot of persistence.c's table, so nothing
+    // is held while sending), packed into as few MSG_REGISTER_FILE_BATCH
+    // messages as fit
+    int file_count = 0;
+    FileMeta* files = persist_snapshot_files(&file_count);
+    uint8_t* batch = malloc(SS_REGISTER_BATCH_BYTES);
+    if (batch == NULL) { free(files); close(g_ns_socket); return -1; }
+    size_t batch_used = 0;
+    int batches = 0, sent = 0;
     for (int i = 0; i < file_count; i++) {
+        const FileMeta* file = &files[i];
+        if (ack_payload.delta && file->version <= ack_payload.since_epoch) continue; // NS has it
         SSFileRecordPayload file_payload;
         memset(&file_payload, 0, sizeof(file_payload));
-        strncpy(file_payload.filename, file_table[i].filename, MAX_FILENAME - 1);
-        strncpy(file_payload.owner_username, file_table[i].owner_username, 64 - 1);
-        file_payload.acl_count = file_table[i].acl_count;
-        memcpy(file_payload.acl, file_table[i].acl, sizeof(AclEntryPayload) * file_table[i].acl_count);
-        file_payload.word_count = file_table[i].word_count;
-        file_payload.char_count = file_table[i].size;
-        file_payload.created = file_table[i].created;
-        file_payload.modified = file_table[i].modified;
-        file_payload.last_accessed = file_table[i].last_accessed;
-        strncpy(file_payload.last_accessed_by, file_table[i].last_accessed_by, 64 - 1);
-
-        MessageHeader file_header;
-        memset(&file_header, 0, sizeof(file_header));
-        file_header.msg_type = MSG_REGISTER_FILE;
-        file_header.source_component = COMPONENT_STORAGE_SERVER;
-        file_header.payload_length = sizeof(SSFileRecordPayload);
-        
-        if (send_header(g_ns_socket, &file_header) == -1) { close(g_ns_socket); return -1; }
-        if (send_all(g_ns_socket, &file_payload, sizeof(file_payload)) == -1) { close(g_ns_socket); return -1; }
+        strncpy(file_payload.filename, file->filename, MAX_FILENAME - 1);
+        strncpy(file_payload.owner_username, file->owner_username, 64 - 1);
+        file_payload.acl_count = file->acl_count;
+        memcpy(file_payload.acl, file->acl, sizeof(AclEntryPayload) * file->acl_count);
+        file_payload.word_count = file->word_count;
+        file_payload.char_count = file->size;
+        file_payload.created = file->created;
+        file_payload.modified = file->modified;
+        file_payload.last_accessed = file->last_accessed;
+        strncpy(file_payload.last_accessed_by, file->last_accessed_by, 64 - 1);
+        strncpy(file_payload.folder, file->folder, MAX_FILENAME - 1);
+        file_payload.replica = file->replica;
+
+        size_t written = encode_file_record(&file_payload, batch + batch_used, SS_REGISTER_BATCH_BYTES - batch_used);
+        if (written == 0) { // Batch full: ship it and start the next one with this record
+            if (send_register_batch(batch, batch_used) == -1) { free(batch); free(files); close(g_ns_socket); return -1; }
+            batches++;
+            batch_used = 0;
+            written = encode_file_record(&file_payload, batch, SS_REGISTER_BATCH_BYTES);
+        }
+        batch_used += written;
+        sent++;
+    }
+    if (batch_used > 0) {
+        if (send_register_batch(batch, batch_used) == -1) { free(batch); free(files); close(g_ns_socket); return -1; }
+        batches++;
     }
+    free(batch);
+    free(files);
+    write_log("INFO", "Sent %d of %d file records in %d batches.", sent, file_count, batches);
     
     // 4. Send "Complete"
     MessageHeader complete_header;
@@ -554,6 +1011,8 @@ int register_with_name_server(const char* ns_ip, int ns_port) {
     if (send_header(g_ns_socket, &complete_header) == -1) { close(g_ns_socket); return -1; }
     
     write_log("INFO", "File list sync complete. Registration successful.");
+    persist_set_change_hook(push_metadata_delta);
+    g_ns_push_enabled = 1;
     return 0; // Success
 }
 
@@ -577,262 +1036,182 @@ void handle_sigint(int sig) {
 //  CLIENT HANDLER THREAD
 // =========================================================================
 
+/**
+ * @brief Sends an error reply to a direct client and counts the command
+ * as failed.
+ */
+static void send_error_reply(int fd, const char* msg, size_t len) {
+    metrics_mark_error();
+    send(fd, msg, len, 0);
+}
+
+/**
+ * @brief Names a direct-client command for metrics. Only known command
+ * words are returned, so a client cannot create new series by typing.
+ */
+static const char* direct_op_name(const char* cmd, int in_write_mode) {
+    static const char* const known[] = {
+        "READ", "WRITE", "STREAM", "UNDO", "CHECKPOINT", "VIEWCHECKPOINT", "REVERT",
+        "LISTCHECKPOINTS", "REQUESTACCESS", "VIEWREQUESTS", "APPROVEREQUEST",
+        "DENYREQUEST", "CREATE", "DELETE", "EXIT"
+    };
+    if (in_write_mode) return strncmp(cmd, "ETIRW", 5) == 0 ? "ETIRW" : "WRITE_EDIT";
+
+    size_t length = strcspn(cmd, " \t");
+    for (size_t i = 0; i < sizeof(known) / sizeof(known[0]); i++) {
+        if (strlen(known[i]) == length && strncmp(cmd, known[i], length) == 0) return known[i];
+    }
+    return "UNKNOWN";
+}
+
+/**
+ * @brief Permission the NS checks before redirecting a client to this
+ * command: WRITE needs write, the commands reached through a READ redirect
+ * need read (PERM_NONE = not gated here).
+ */
+static PermissionType direct_permission_needed(const char* cmd) {
+    if (strcmp(cmd, "WRITE") == 0) return PERM_WRITE;
+    if (strcmp(cmd, "READ") == 0 || strcmp(cmd, "STREAM") == 0 || strcmp(cmd, "CHECKPOINT") == 0 ||
+        strcmp(cmd, "VIEWCHECKPOINT") == 0 || strcmp(cmd, "REVERT") == 0 ||
+        strcmp(cmd, "LISTCHECKPOINTS") == 0) {
+        return PERM_READ;
+    }
+    return PERM_NONE;
+}
+
+/**
+ * @brief Next command line from the client, without its '\n'. Reads
+ * through ctx->in_buf, so pipelined commands (or ones TCP coalesced) come
+ * out one at a time and a command split across segments comes out whole.
+ * A line longer than the buffer comes out in buffer-sized pieces.
+ * @return 0 with 'line' filled, -1 once the connection is closed.
+ */
+static int read_command_line(client_ctx_t *ctx, char *line, size_t size) {
+    while (1) {
+        char *nl = memchr(ctx->in_buf, '\n', ctx->in_len);
+        size_t take = nl ? (size_t)(nl - ctx->in_buf) + 1 :
+                      ctx->in_len == sizeof(ctx->in_buf) ? ctx->in_len : 0;
+        if (take > 0) {
+            size_t len = nl ? take - 1 : take;
+            if (len >= size) len = size - 1;
+            memcpy(line, ctx->in_buf, len);
+            line[len] = '\0';
+            ctx->in_len -= take;
+            memmove(ctx->in_buf, ctx->in_buf + take, ctx->in_len);
+            return 0;
+        }
+        ssize_t n = recv(ctx->client_fd, ctx->in_buf + ctx->in_len, sizeof(ctx->in_buf) - ctx->in_len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        ctx->in_len += (size_t)n;
+    }
+}
+
+static int command_line_buffered(const client_ctx_t *ctx) {
+    return memchr(ctx->in_buf, '\n', ctx->in_len) != NULL || ctx->in_len == sizeof(ctx->in_buf);
+}
+
 void *client_handler_thread(void *arg) {
     client_ctx_t *ctx = (client_ctx_t *)arg;
     int fd = ctx->client_fd;
-    add_client_fd(fd);
 
     char client_ip[INET_ADDRSTRLEN];
     inet_ntop(AF_INET, &ctx->client_addr.sin_addr, client_ip, sizeof(client_ip));
     int client_port = ntohs(ctx->client_addr.sin_port);
 
     char buf[BUF_SZ];
-    ssize_t r = recv(fd, buf, sizeof(buf) - 1, 0);
-    if (r <= 0) {
-        close(fd);
-        remove_client_fd(fd);
-        free(ctx);
-        return NULL;
-    }
-    buf[r] = '\0';
-
     char username[128] = "N/A";
-    if (sscanf(buf, "USER %127s", username) == 1) {
+    if (ctx->username[0] != '\0') {
+        // Back from the stream engine or the park thread: same session,
+        // handshake already done
+        strcpy(username, ctx->username);
         set_logger_username(username);
-        write_log("ACTION", "Direct connection from %s:%d USER=%s", client_ip, client_port, username);
     } else {
-        write_log("WARN", "Direct connection from %s:%d without USER handshake", client_ip, client_port);
+        add_client_fd(fd);
+        if (read_command_line(ctx, buf, sizeof(buf)) == -1) {
+            close(fd);
+            remove_client_fd(fd);
+            free(ctx);
+            return NULL;
+        }
+
+        if (sscanf(buf, "USER %127s", username) == 1) {
+            set_logger_username(username);
+            write_log("ACTION", "Direct connection from %s:%d USER=%s", client_ip, client_port, username);
+        } else {
+            write_log("WARN", "Direct connection from %s:%d without USER handshake", client_ip, client_port);
+        }
+        strcpy(ctx->username, username);
+
+        const char *ack = "OK_200 USER_ACCEPTED\n";
+        send(fd, ack, strlen(ack), 0);
+
+        printf("[SERVER %d] Connected: %s:%d (%s)\n", ctx->server_port, client_ip, client_port, username);
     }
 
-    const char *ack = "OK_200 USER_ACCEPTED\n";
-    send(fd, ack, strlen(ack), 0);
+    // This connection's open WRITE, if any (one at a time per connection)
+    write_session_t session;
+    memset(&session, 0, sizeof(session));
 
-    printf("[SERVER %d] Connected: %s:%d (%s)\n", ctx->server_port, client_ip, client_port, username);
+    // The previous command is recorded when the next recv starts, so every
+    // 'continue' below is covered without touching each branch
+    const char* pending_op = NULL;
+    uint64_t op_started = 0;
+    int handed_off = 0; // The stream engine or the park thread took the session
 
     while (g_running) {
+        if (pending_op) metrics_end(METRICS_SS_DIRECT, pending_op, op_started);
+        pending_op = NULL;
+
+        // Client pools park sessions between commands. Once this one goes
+        // quiet it waits on the park thread instead of holding a worker,
+        // unless it is mid-WRITE (the open sentence lives on this stack).
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (!command_line_buffered(ctx)) {
+            char locked_file[256];
+            int locked_sentence;
+            int writing = sentence_lock_held_by(fd, locked_file, sizeof(locked_file), &locked_sentence);
+            if (!writing && poll(&pfd, 1, SS_DIRECT_PARK_MS) == 0 &&
+                worker_pool_park(fd, ctx, SS_DIRECT_IDLE_SEC) == 0) {
+                handed_off = 1; // Back through client_session_job() at the next command
+                break;
+            }
+            if (poll(&pfd, 1, SS_DIRECT_IDLE_SEC * 1000) == 0) {
+                if (writing) continue;
+                write_log("INFO", "Closing direct session of %s after %d s idle", username, SS_DIRECT_IDLE_SEC);
+                break;
+            }
+        }
+
         memset(buf, 0, sizeof(buf));
-        ssize_t n = recv(fd, buf, sizeof(buf) - 1, 0);
-        if (n <= 0) break;
-        buf[n] = '\0';
-        char *nl = strchr(buf, '\n');
-        if (nl) *nl = '\0';
+        if (read_command_line(ctx, buf, sizeof(buf)) == -1) break;
+        op_started = metrics_begin();
 
         write_log("REQUEST", "DIRECT USER=%s CMD=\"%s\"", username, buf);
         
         char current_file[256];
         int current_sentence;
-        int is_in_write_mode = get_client_write_info(fd, current_file, &current_sentence);
+        int is_in_write_mode = sentence_lock_held_by(fd, current_file, sizeof(current_file), &current_sentence);
+        pending_op = direct_op_name(buf, is_in_write_mode);
         
         if (is_in_write_mode && strncmp(buf, "ETIRW", 5) == 0) {
             char files_dir[256], meta_dir[256];
             snprintf(files_dir, sizeof(files_dir), "data/ss_%d/files", ctx->server_port);
             snprintf(meta_dir, sizeof(meta_dir), "data/ss_%d/metadata", ctx->server_port);
             
-            char orig_path[512], swap_path[512];
+            char orig_path[512];
             snprintf(orig_path, sizeof(orig_path), "%s/%s", files_dir, current_file);
-            snprintf(swap_path, sizeof(swap_path), "%s/%s_%d_%d.swap", files_dir, current_file, current_sentence, fd);
 
-            FILE* swap_check = fopen(swap_path, "r");
-            if (swap_check) {
-                fclose(swap_check);
+            if (session.dirty) {
                 create_file_backup(current_file, ctx->server_port, username);
                 
-                // *** FIXED CONCURRENT MERGING LOGIC WITH PROPER DELIMITER HANDLING ***
-                
-                // 1. Read the LATEST state of the original file
-                FILE* current_orig_file = fopen(orig_path, "r");
-                char current_orig_content[8192] = {0};
-                size_t current_orig_bytes = 0;
-                
-                if (current_orig_file) {
-                    current_orig_bytes = fread(current_orig_content, 1, sizeof(current_orig_content) - 1, current_orig_file);
-                    fclose(current_orig_file);
-                    current_orig_content[current_orig_bytes] = '\0';
-                }
-                
-                // 2. Read this client's swap content
-                FILE* swap_file = fopen(swap_path, "r");
-                char swap_content[8192] = {0};
-                size_t swap_bytes = fread(swap_content, 1, sizeof(swap_content) - 1, swap_file);
-                fclose(swap_file);
-                swap_content[swap_bytes] = '\0';
-                
-                // 3. Parse CURRENT original file into words and sentences WITH FIXED LOGIC
-                char current_words[1024][512];
-                int current_word_count = 0;
-                sentence_info_t current_sentences[256];
-                int current_sentence_count = 0;
-                
-                if (current_orig_bytes > 0) {
-                    char temp[8192];
-                    strcpy(temp, current_orig_content);
-                    
-                    // Tokenize current content
-                    char *token = strtok(temp, " \t\n");
-                    while (token && current_word_count < 1024) {
-                        strcpy(current_words[current_word_count], token);
-                        current_word_count++;
-                        token = strtok(NULL, " \t\n");
-                    }
-                    
-                    // *** FIXED: Parse current sentence boundaries with SPACE-SEPARATED delimiter handling ***
-                    int sent_start = 0;
-                    for (int i = 0; i < current_word_count; i++) {
-                        int len = strlen(current_words[i]);
-                        if (len > 0) {
-                            char last_char = current_words[i][len - 1];
-                            if (last_char == '.' || last_char == '!' || last_char == '?') {
-                                // Found a delimiter at end of word - end current sentence
-                                if (current_sentence_count < 256) {
-                                    current_sentences[current_sentence_count].start_word_idx = sent_start;
-                                    current_sentences[current_sentence_count].end_word_idx = i;
-                                    current_sentences[current_sentence_count].delimiter = last_char;
-                                    current_sentence_count++;
-                                    sent_start = i + 1;  // Next sentence starts from next word
-                                }
-                            }
-                        }
-                    }
-                    
-                    // Handle incomplete sentence at end
-                    if (sent_start < current_word_count && current_sentence_count < 256) {
-                        current_sentences[current_sentence_count].start_word_idx = sent_start;
-                        current_sentences[current_sentence_count].end_word_idx = current_word_count - 1;
-                        current_sentences[current_sentence_count].delimiter = '\0';
-                        current_sentence_count++;
-                    }
-                }
-                
-                // 4. Parse SWAP content into words and sentences WITH FIXED LOGIC
-                char swap_words[1024][512];
-                int swap_word_count = 0;
-                sentence_info_t swap_sentences[256];
-                int swap_sentence_count = 0;
-                
-                if (swap_bytes > 0) {
-                    char temp[8192];
-                    strcpy(temp, swap_content);
-                    
-                    // Tokenize swap content
-                    char *token = strtok(temp, " \t\n");
-                    while (token && swap_word_count < 1024) {
-                        strcpy(swap_words[swap_word_count], token);
-                        swap_word_count++;
-                        token = strtok(NULL, " \t\n");
-                    }
-                    
-                    // *** FIXED: Parse swap sentence boundaries with SPACE-SEPARATED delimiter handling ***
-                    int sent_start = 0;
-                    for (int i = 0; i < swap_word_count; i++) {
-                        int len = strlen(swap_words[i]);
-                        if (len > 0) {
-                            char last_char = swap_words[i][len - 1];
-                            if (last_char == '.' || last_char == '!' || last_char == '?') {
-                                // Found a delimiter at end of word - end current sentence
-                                if (swap_sentence_count < 256) {
-                                    swap_sentences[swap_sentence_count].start_word_idx = sent_start;
-                                    swap_sentences[swap_sentence_count].end_word_idx = i;
-                                    swap_sentences[swap_sentence_count].delimiter = last_char;
-                                    swap_sentence_count++;
-                                    sent_start = i + 1;  // Next sentence starts from next word
-                                }
-                            }
-                        }
-                    }
-                    
-                    if (sent_start < swap_word_count && swap_sentence_count < 256) {
-                        swap_sentences[swap_sentence_count].start_word_idx = sent_start;
-                        swap_sentences[swap_sentence_count].end_word_idx = swap_word_count - 1;
-                        swap_sentences[swap_sentence_count].delimiter = '\0';
-                        swap_sentence_count++;
-                    }
-                }
-                
-                // 5. *** SMART MERGE: Replace ONLY the target sentence ***
-                char final_content[8192] = "";
-                
-                if (current_sentence_count == 0) {
-                    // No sentences in current file, use entire swap content
-                    strcpy(final_content, swap_content);
-                } else if (current_sentence > current_sentence_count) {
-                    // Adding new sentence beyond existing ones
-                    strcpy(final_content, current_orig_content);
-                    if (strlen(final_content) > 0) {
-                        strcat(final_content, " ");
-                    }
-                    
-                    // Find the target sentence in swap content (should be the last one)
-                    if (swap_sentence_count > 0) {
-                        int target_sent_in_swap = swap_sentence_count - 1; // Last sentence
-                        for (int w = swap_sentences[target_sent_in_swap].start_word_idx; 
-                             w <= swap_sentences[target_sent_in_swap].end_word_idx; w++) {
-                            if (w > swap_sentences[target_sent_in_swap].start_word_idx) {
-                                strcat(final_content, " ");
-                            }
-                            strcat(final_content, swap_words[w]);
-                        }
-                    }
-                } else {
-                    // Replace specific sentence in existing content
-                    
-                    // Add sentences BEFORE target sentence from CURRENT file
-                    for (int s = 0; s < current_sentence - 1; s++) {
-                        if (strlen(final_content) > 0) {
-                            strcat(final_content, " ");
-                        }
-                        
-                        for (int w = current_sentences[s].start_word_idx; 
-                             w <= current_sentences[s].end_word_idx; w++) {
-                            if (w > current_sentences[s].start_word_idx) {
-                                strcat(final_content, " ");
-                            }
-                            strcat(final_content, current_words[w]);
-                        }
-                    }
-                    
-                    // Add the MODIFIED sentence from SWAP content
-                    // Find corresponding sentence in swap (should be at same index)
-                    int target_sent_in_swap = current_sentence - 1;
-                    if (target_sent_in_swap < swap_sentence_count) {
-                        if (strlen(final_content) > 0) {
-                            strcat(final_content, " ");
-                        }
-                        
-                        for (int w = swap_sentences[target_sent_in_swap].start_word_idx; 
-                             w <= swap_sentences[target_sent_in_swap].end_word_idx; w++) {
-                            if (w > swap_sentences[target_sent_in_swap].start_word_idx) {
-                                strcat(final_content, " ");
-                            }
-                            strcat(final_content, swap_words[w]);
-                        }
-                    }
-                    
-                    // Add sentences AFTER target sentence from CURRENT file
-                    for (int s = current_sentence; s < current_sentence_count; s++) {
-                        if (strlen(final_content) > 0) {
-                            strcat(final_content, " ");
-                        }
-                        
-                        for (int w = current_sentences[s].start_word_idx; 
-                             w <= current_sentences[s].end_word_idx; w++) {
-                            if (w > current_sentences[s].start_word_idx) {
-                                strcat(final_content, " ");
-                            }
-                            strcat(final_content, current_words[w]);
-                        }
-                    }
-                }
-                
-                // 6. Write the final merged content
-                FILE* final_file = fopen(orig_path, "w");
-                if (final_file) {
-                    fprintf(final_file, "%s", final_content);
-                    fclose(final_file);
-                    remove(swap_path);
-                    
-                    // Cache removed for simplicity
-                    update_metadata_entry(meta_dir, current_file);
-                    send(fd, "OK_200 WRITE COMPLETED\n", 24, 0);
+                // Splice ONLY the target sentence into the LATEST state of the
+                // file, so concurrent commits to other sentences survive
+                long size_delta = 0, word_delta = 0;
+                if (write_session_commit(&session, orig_path, &size_delta, &word_delta) == 0) {
+                    persist_adjust_counts(meta_dir, current_file, size_delta, word_delta);
+                    word_index_update(current_file, orig_path); // Re-indexes just the changed sentences
+                    send(fd, "OK_200 WRITE COMPLETED\n", 23, 0);
                     
                     printf("[SERVER %d] WRITE completed for %s [Sentence %d] by %s (MERGED WITH CONCURRENT CHANGES)\n",
                            ctx->server_port, current_file, current_sentence, username);
@@ -841,17 +1220,18 @@ void *client_handler_thread(void *arg) {
                              current_file, current_sentence, username);
                 } else {
                     write_log("ERROR", "WRITE failed: Could not finalize merged changes to %s", current_file);
-                    send(fd, "ERR_500 Could not finalize changes\n", 35, 0);
+                    send_error_reply(fd, "ERR_500 Could not finalize changes\n", 35);
                 }
             } else {
                 // No changes were made, just release lock
                 write_log("INFO", "WRITE completed without changes to %s sentence %d", current_file, current_sentence);
-                send(fd, "OK_200 WRITE COMPLETED\n", 24, 0);
+                send(fd, "OK_200 WRITE COMPLETED\n", 23, 0);
             }
 
             printf("[SERVER %d] Released WRITE lock for %s [Sentence %d] by %s\n",
                    ctx->server_port, current_file, current_sentence, username);
-            remove_sentence_lock(current_file, current_sentence, fd);
+            write_session_end(&session);
+            sentence_lock_release(current_file, current_sentence, fd);
             continue;
         }
 
@@ -861,280 +1241,24 @@ void *client_handler_thread(void *arg) {
             
             if (sscanf(buf, "%d %2047[^\n]", &word_idx, new_content) == 2) {
                 if (word_idx < 1) {
-                    send(fd, "ERR_400 Word index must be positive (1-based)\n", 46, 0);
-                    continue;
-                }
-
-                char files_dir[256];
-                snprintf(files_dir, sizeof(files_dir), "data/ss_%d/files", ctx->server_port);
-                char orig_path[512], swap_path[512];
-                snprintf(orig_path, sizeof(orig_path), "%s/%s", files_dir, current_file);
-                snprintf(swap_path, sizeof(swap_path), "%s/%s_%d_%d.swap", files_dir, current_file, current_sentence, fd);
-
-                // Read current state (from swap file if exists, otherwise original)
-                FILE *current_file_ptr = fopen(swap_path, "r");
-                if (!current_file_ptr) {
-                    current_file_ptr = fopen(orig_path, "r");
-                }
-                
-                if (!current_file_ptr) {
-                    send(fd, "ERR_404 File not found during update\n", 37, 0);
-                    continue;
-                }
-
-                char content[8192] = {0};
-                size_t bytes_read = fread(content, 1, sizeof(content) - 1, current_file_ptr);
-                fclose(current_file_ptr);
-                content[bytes_read] = '\0';
-
-                // Handle empty file case
-                if (bytes_read == 0 && current_sentence == 1) {
-                    if (word_idx == 1) {
-                        FILE *swap = fopen(swap_path, "w");
-                        if (!swap) {
-                            send(fd, "ERR_500 Could not create temporary file\n", 40, 0);
-                            continue;
-                        }
-                        fprintf(swap, "%s", new_content);
-                        fclose(swap);
-                        send(fd, "OK_200 CONTENT INSERTED\n", 24, 0);
-                        continue;
-                    } else {
-                        send(fd, "ERR_404 Empty file: only word index 1 allowed\n", 46, 0);
-                        continue;
-                    }
-                }
-
-                // *** FIXED WORD INSERTION LOGIC ***
-                
-                // 1. Tokenize content into words
-                char all_words[1024][512];
-                int total_word_count = 0;
-                char temp_content[8192];
-                strcpy(temp_content, content);
-                
-                char *token = strtok(temp_content, " \t\n");
-                while (token && total_word_count < 1024) {
-                    strcpy(all_words[total_word_count], token);
-                    total_word_count++;
-                    token = strtok(NULL, " \t\n");
-                }
-
-                // 2. Parse sentence boundaries using FIXED logic
-                sentence_info_t sentence_info[256];
-                int total_sentences = 0;
-                int current_sent_start = 0;
-                
-                for (int i = 0; i < total_word_count; i++) {
-                    int word_len = strlen(all_words[i]);
-                    if (word_len > 0) {
-                        char last_char = all_words[i][word_len - 1];
-                        if (last_char == '.' || last_char == '!' || last_char == '?') {
-                            if (total_sentences < 256) {
-                                sentence_info[total_sentences].start_word_idx = current_sent_start;
-                                sentence_info[total_sentences].end_word_idx = i;
-                                sentence_info[total_sentences].delimiter = last_char;
-                                total_sentences++;
-                                current_sent_start = i + 1;
-                            }
-                        }
-                    }
-                }
-                
-                // Handle incomplete sentence at the end
-                if (current_sent_start < total_word_count && total_sentences < 256) {
-                    sentence_info[total_sentences].start_word_idx = current_sent_start;
-                    sentence_info[total_sentences].end_word_idx = total_word_count - 1;
-                    sentence_info[total_sentences].delimiter = '\0';
-                    total_sentences++;
-                }
-
-                // Handle case where there are no complete sentences but content exists
-                if (total_sentences == 0 && total_word_count > 0) {
-                    sentence_info[0].start_word_idx = 0;
-                    sentence_info[0].end_word_idx = total_word_count - 1;
-                    sentence_info[0].delimiter = '\0';
-                    total_sentences = 1;
-                }
-
-                // 3. Handle writing to new sentence beyond existing ones
-                if (current_sentence > total_sentences) {
-                    if (word_idx == 1) {
-                        char updated_content[8192];
-                        if (bytes_read > 0) {
-                            snprintf(updated_content, sizeof(updated_content), "%s %s", content, new_content);
-                        } else {
-                            strcpy(updated_content, new_content);
-                        }
-                        
-                        FILE *swap = fopen(swap_path, "w");
-                        if (!swap) {
-                            send(fd, "ERR_500 Could not create temporary file\n", 40, 0);
-                            continue;
-                        }
-                        fprintf(swap, "%s", updated_content);
-                        fclose(swap);
-                        send(fd, "OK_200 CONTENT INSERTED\n", 24, 0);
-                        continue;
-                    } else {
-                        send(fd, "ERR_404 New sentence: only word index 1 allowed\n", 48, 0);
-                        continue;
-                    }
-                }
-
-                // 4. Get current sentence boundaries
-                int sent_start = sentence_info[current_sentence - 1].start_word_idx;
-                int sent_end = sentence_info[current_sentence - 1].end_word_idx;
-                int original_sentence_word_count = sent_end - sent_start + 1;
-
-                // 5. Validate word index within sentence
-                if (word_idx > original_sentence_word_count + 1) {
-                    char err_msg[256];
-                    snprintf(err_msg, sizeof(err_msg), 
-                            "ERR_404 Word index %d out of range. Sentence %d has %d words (positions 1-%d available)\n", 
-                            word_idx, current_sentence, original_sentence_word_count, original_sentence_word_count + 1);
-                    send(fd, err_msg, strlen(err_msg), 0);
-                    continue;
-                }
-
-                // 6. *** CORRECTED INSERTION LOGIC ***
-                char new_all_words[1024][512];
-                int new_total_words = 0;
-                
-                // Copy words BEFORE the target sentence
-                for (int i = 0; i < sent_start; i++) {
-                    strcpy(new_all_words[new_total_words], all_words[i]);
-                    new_total_words++;
-                }
-                
-                // Process the target sentence with insertion
-                // *** KEY FIX: Handle delimiter separation properly ***
-
-                // First, let's separate the delimiter from the last word of the sentence if it exists
-                char sentence_words[256][512];
-                int adjusted_sentence_word_count = 0;  // *** RENAMED to avoid conflict ***
-                char sentence_delimiter = '\0';
-
-                for (int i = sent_start; i <= sent_end; i++) {
-                    strcpy(sentence_words[adjusted_sentence_word_count], all_words[i]);
-                    
-                    // Check if this is the last word and has a delimiter
-                    if (i == sent_end) {
-                        int word_len = strlen(sentence_words[adjusted_sentence_word_count]);
-                        if (word_len > 0) {
-                            char last_char = sentence_words[adjusted_sentence_word_count][word_len - 1];
-                            if (last_char == '.' || last_char == '!' || last_char == '?') {
-                                // Remove delimiter from word and store it separately
-                                sentence_delimiter = last_char;
-                                sentence_words[adjusted_sentence_word_count][word_len - 1] = '\0';
-                                
-                                // If word becomes empty after removing delimiter, don't add it
-                                if (strlen(sentence_words[adjusted_sentence_word_count]) > 0) {
-                                    adjusted_sentence_word_count++;
-                                }
-                            } else {
-                                adjusted_sentence_word_count++;
-                            }
-                        } else {
-                            adjusted_sentence_word_count++;
-                        }
-                    } else {
-                        adjusted_sentence_word_count++;
-                    }
-                }
-
-                // Validate word index within the adjusted sentence
-                if (word_idx > adjusted_sentence_word_count + 1) {
-                    char err_msg[256];
-                    snprintf(err_msg, sizeof(err_msg), 
-                            "ERR_404 Word index %d out of range. Sentence %d has %d words (positions 1-%d available)\n", 
-                            word_idx, current_sentence, adjusted_sentence_word_count, adjusted_sentence_word_count + 1);
-                    send(fd, err_msg, strlen(err_msg), 0);
+                    send_error_reply(fd, "ERR_400 Word index must be positive (1-based)\n", 46);
                     continue;
                 }
 
-                // Now insert the new content at the correct position
-                for (int i = 0; i < adjusted_sentence_word_count; i++) {
-                    int position_in_sentence = i + 1; // 1-based position
-                    
-                    // If this is the insertion point, insert new content first
-                    if (position_in_sentence == word_idx) {
-                        // Split new content into words and add them
-                        char temp_new_content[2048];
-                        strcpy(temp_new_content, new_content);
-                        
-                        char *new_token = strtok(temp_new_content, " \t");
-                        while (new_token) {
-                            strcpy(new_all_words[new_total_words], new_token);
-                            new_total_words++;
-                            new_token = strtok(NULL, " \t");
-                        }
-                    }
-                    
-                    // Add the original word at this position
-                    strcpy(new_all_words[new_total_words], sentence_words[i]);
-                    new_total_words++;
-                }
-
-                // Handle insertion at the very end of the sentence (after last word but before delimiter)
-                if (word_idx > adjusted_sentence_word_count) {
-                    // Insert new content at the end
-                    char temp_new_content[2048];
-                    strcpy(temp_new_content, new_content);
-                    
-                    char *new_token = strtok(temp_new_content, " \t");
-                    while (new_token) {
-                        strcpy(new_all_words[new_total_words], new_token);
-                        new_total_words++;
-                        new_token = strtok(NULL, " \t");
-                    }
-                }
-
-                // Add the delimiter back to the last word of this sentence if it existed
-                if (sentence_delimiter != '\0' && new_total_words > 0) {
-                    // Find the last word that belongs to this sentence
-                    int last_sentence_word_idx = new_total_words - 1;
-                    
-                    // Add delimiter to the last word
-                    int current_len = strlen(new_all_words[last_sentence_word_idx]);
-                    if (current_len < 511) { // Make sure we have space
-                        new_all_words[last_sentence_word_idx][current_len] = sentence_delimiter;
-                        new_all_words[last_sentence_word_idx][current_len + 1] = '\0';
-                    }
-                }
-
-                // Copy words AFTER the target sentence
-                for (int i = sent_end + 1; i < total_word_count; i++) {
-                    strcpy(new_all_words[new_total_words], all_words[i]);
-                    new_total_words++;
-                }
-
-                // 7. Reconstruct the final content
-                char final_content[8192] = "";
-                for (int i = 0; i < new_total_words; i++) {
-                    if (i > 0) {
-                        strcat(final_content, " ");
-                    }
-                    strcat(final_content, new_all_words[i]);
-                }
-
-                // 8. Write to swap file
-                FILE *swap = fopen(swap_path, "w");
-                if (!swap) {
-                    send(fd, "ERR_500 Could not create temporary file\n", 40, 0);
+                // The sentence lives in memory for the whole session
+                char err_msg[256];
+                if (write_session_insert(&session, word_idx, new_content, err_msg, sizeof(err_msg)) == -1) {
+                    send_error_reply(fd, err_msg, strlen(err_msg));
                     continue;
                 }
-                fprintf(swap, "%s", final_content);
-                fclose(swap);
 
-                // 9. Send response
                 send(fd, "OK_200 CONTENT INSERTED\n", 24, 0);
                 write_log("INFO", "Content '%s' inserted at position %d in %s [Sentence %d] by user %s", 
                          new_content, word_idx, current_file, current_sentence, username);
                 printf("[SERVER %d] Inserted content '%s' at position %d in %s [Sentence %d] by %s\n",
                        ctx->server_port, new_content, word_idx, current_file, current_sentence, username);
             } else {
-                send(fd, "ERR_400 Invalid format. Use: <word_index> <content>\n", 52, 0);
+                send_error_reply(fd, "ERR_400 Invalid format. Use: <word_index> <content>\n", 52);
             }
             continue;
         }
@@ -1147,16 +1271,35 @@ void *client_handler_thread(void *arg) {
         snprintf(files_dir, sizeof(files_dir), "data/ss_%d/files", ctx->server_port);
         snprintf(meta_dir, sizeof(meta_dir), "data/ss_%d/metadata", ctx->server_port);
 
+        // Clients may skip the NS with a cached redirect, so check what it would have
+        PermissionType needed = direct_permission_needed(cmd);
+        if (matched >= 2 && needed != PERM_NONE && !persist_check_access(fname, username, needed)) {
+            send_error_reply(fd, "ERR_403 Access denied\n", 22);
+            write_log("WARN", "DIRECT %s on %s denied for user %s", cmd, fname, username);
+            continue;
+        }
+        // A replica only serves reads, and only while it matches its primary;
+        // the NS hands out the primary for anything else
+        int replica_state = matched >= 2 ? persist_replica_state(fname) : 0;
+        if (replica_state == 2 || (replica_state == 1 && strcmp(cmd, "READ") != 0 && strcmp(cmd, "STREAM") != 0)) {
+            // Its own code, so clients retry on the primary only for this
+            const char* refusal = replica_state == 2 ? ERR_421 " Replica out of date\n" : ERR_421 " Read-only replica\n";
+            send_error_reply(fd, refusal, strlen(refusal));
+            continue;
+        }
+
         // CREATE
         if (matched >= 1 && strcmp(cmd, "CREATE") == 0 && matched >= 2) {
             char filepath[512];
             snprintf(filepath, sizeof(filepath), "%s/%s", files_dir, fname);
             FILE *f = fopen(filepath, "w");
             if (!f) {
-                send(fd, "ERR_500\n", 8, 0);
+                send_error_reply(fd, "ERR_500\n", 8);
             } else {
                 fclose(f);
+                doc_cache_invalidate(filepath);
                 add_metadata_entry(meta_dir, fname);
+                word_index_update(fname, filepath);
                 send(fd, "OK_201 CREATED\n", 15, 0);
                  printf("[SERVER %d] File created: %s\n", ctx->server_port, fname);
             }
@@ -1167,284 +1310,132 @@ void *client_handler_thread(void *arg) {
             char filepath[512];
             snprintf(filepath, sizeof(filepath), "%s/%s", files_dir, fname);
             
-            // Check if file exists
-            FILE *f = fopen(filepath, "r");
-            if (!f) {
-                send(fd, "ERR_404 File not found\n", 23, 0);
-                write_log("WARN", "READ failed: File %s not found", fname);
-                printf("[SERVER %d] READ failed: File %s not found (requested by %s)\n", 
-                       ctx->server_port, fname, username);
-            } else {
-                // Get file size for logging
-                fseek(f, 0, SEEK_END);
-                long file_size = ftell(f);
-                fseek(f, 0, SEEK_SET);
-                
-                if (file_size == 0) {
-                    // Handle empty file
-                    send(fd, "OK_200 EMPTY_FILE\n", 18, 0);
-                    write_log("INFO", "READ: Empty file %s sent to user %s", fname, username);
-                    printf("[SERVER %d] READ: Empty file %s sent to %s\n", 
-                           ctx->server_port, fname, username);
-                } else {
-                    // Send file contents
-                    send(fd, "OK_200 FILE_CONTENT\n", 20, 0);
-                    
-                    char buffer[1024];
-                    size_t bytes_read;
-                    size_t total_sent = 0;
-                    
-                    while ((bytes_read = fread(buffer, 1, sizeof(buffer), f)) > 0) {
-                        if (send(fd, buffer, bytes_read, 0) == -1) {
-                            write_log("ERROR", "Failed to send file content for %s to user %s", fname, username);
-                            break;
-                        }
-                        total_sent += bytes_read;
-                    }
-                    
-                    // Send end marker
-                    send(fd, "\nEND_OF_FILE\n", 13, 0);
-                    
-                    write_log("INFO", "READ: File %s (%ld bytes) sent to user %s", fname, file_size, username);
-                    printf("[SERVER %d] READ: File %s (%zu bytes sent) to %s\n", 
-                           ctx->server_port, fname, total_sent, username);
+            // READ <file> <start> <count> [BYTES]: just a window of the file
+            if (matched == 3) {
+                long sent = send_read_range(fd, filepath, rest);
+                if (sent >= 0) {
+                    write_log("INFO", "READ: Range \"%s\" of %s (%ld bytes) sent to user %s", rest, fname, sent, username);
+                    persist_update_last_accessed(meta_dir, fname, username);
                 }
-                
-                fclose(f);
-                
-                // Update access metadata with username
-                persist_update_last_accessed(meta_dir, fname, username);
+                continue;
             }
-        }
-
-        // STREAM command
-        else if (matched >= 1 && strcmp(cmd, "STREAM") == 0 && matched >= 2) {
-            char filepath[512];
-            snprintf(filepath, sizeof(filepath), "%s/%s", files_dir, fname);
             
-            // Check if file exists
-            FILE *f = fopen(filepath, "r");
-            if (!f) {
-                send(fd, "ERR_404 File not found\n", 23, 0);
-                write_log("WARN", "STREAM failed: File %s not found", fname);
-                printf("[SERVER %d] STREAM failed: File %s not found (requested by %s)\n", 
+            // Check if file exists. Commits replace the file by rename, so
+            // this descriptor keeps one consistent version for the whole send.
+            int file_fd = open(filepath, O_RDONLY);
+            struct stat st;
+            if (file_fd < 0 || fstat(file_fd, &st) != 0) {
+                if (file_fd >= 0) close(file_fd);
+                send_error_reply(fd, "ERR_404 File not found\n", 23);
+                write_log("WARN", "READ failed: File %s not found", fname);
+                printf("[SERVER %d] READ failed: File %s not found (requested by %s)\n", 
                        ctx->server_port, fname, username);
             } else {
-                // Get file size for logging
-                fseek(f, 0, SEEK_END);
-                long file_size = ftell(f);
-                fseek(f, 0, SEEK_SET);
+                long file_size = (long)st.st_size;
                 
                 if (file_size == 0) {
                     // Handle empty file
-                    send(fd, "OK_200 EMPTY_FILE_STREAM\n", 25, 0);
-                    write_log("INFO", "STREAM: Empty file %s streamed to user %s", fname, username);
-                    printf("[SERVER %d] STREAM: Empty file %s streamed to %s\n", 
-                           ctx->server_port, fname, username);
-                } else {
-                    // Send stream start confirmation
-                    send(fd, "OK_200 STREAM_START\n", 20, 0);
-                    
-                    // Sleep for 0.1 seconds
-                    struct timespec ts;
-                    ts.tv_sec = 0;
-                    ts.tv_nsec = 100000000L; // 100 million nanoseconds = 0.1 seconds
-                    nanosleep(&ts, NULL);   
-                                        
-                    // Read entire file content
-                    char content[8192] = {0};
-                    size_t bytes_read = fread(content, 1, sizeof(content) - 1, f);
-                    content[bytes_read] = '\0';
-                    
-                    // Tokenize content into words
-                    char words[1024][512];
-                    int word_count = 0;
-                    char temp_content[8192];
-                    strcpy(temp_content, content);
-                    
-                    char *token = strtok(temp_content, " \t\n\r");
-                    while (token && word_count < 1024) {
-                        // Clean up the word (remove extra whitespace)
-                        int len = strlen(token);
-                        if (len > 0 && len < 512) {
-                            strcpy(words[word_count], token);
-                            word_count++;
-                        }
-                        token = strtok(NULL, " \t\n\r");
-                    }
-                    
-                    write_log("INFO", "STREAM: Starting to stream %d words from %s to user %s", 
-                             word_count, fname, username);
-                    printf("[SERVER %d] STREAM: Starting to stream %d words from %s to %s\n", 
-                           ctx->server_port, word_count, fname, username);
-                    
-                    // Stream words one by one with delay
-                    int streaming_active = 1;
-                    for (int i = 0; i < word_count && streaming_active; i++) {
-                        // Send each word on its own line for easier client parsing
-                        char word_packet[1024];
-                        snprintf(word_packet, sizeof(word_packet), "%s", words[i]);
-                        
-                        ssize_t sent = send(fd, word_packet, strlen(word_packet), 0);
-                        if (sent == -1) {
-                            write_log("ERROR", "Failed to send word %d of %s to user %s", i + 1, fname, username);
-                            streaming_active = 0;
-                            break;
-                        }
-                        
-                        // Force immediate send
-                        int flag = 1;
-                        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *) &flag, sizeof(int));
-                        
-                        // 0.1 second delay (100,000 microseconds)
-                        struct timespec sleep_time;
-                        sleep_time.tv_sec = 0;
-                        sleep_time.tv_nsec = 100000000L; // 100 million nanoseconds = 0.1 seconds
-                        nanosleep(&sleep_time, NULL);
-                        
-                        // Check if client is still connected or wants to stop
-                        char check_buf[64];
-                        ssize_t check_result = recv(fd, check_buf, sizeof(check_buf) - 1, MSG_DONTWAIT | MSG_PEEK);
-                        if (check_result == 0) {
-                            // Client disconnected
-                            write_log("WARN", "Client disconnected during STREAM of %s at word %d", fname, i + 1);
-                            streaming_active = 0;
+                    send(fd, "OK_200 EMPTY_FILE\n", 18, 0);
+                    write_log("INFO", "READ: Empty file %s sent to user %s", fname, username);
+                    printf("[SERVER %d] READ: Empty file %s sent to %s\n", 
+                           ctx->server_port, fname, username);
+                } else {
+                    // Length-prefixed reply: "OK_200 FILE_CONTENT <bytes>\n" then
+                    // exactly that many bytes straight from the page cache
+                    char header[64];
+                    int header_len = snprintf(header, sizeof(header), "OK_200 FILE_CONTENT %ld\n", file_size);
+                    send(fd, header, header_len, MSG_MORE);
+                    
+                    off_t offset = 0;
+                    while (offset < st.st_size) {
+                        ssize_t sent = sendfile(fd, file_fd, &offset, st.st_size - offset);
+                        if (sent <= 0) {
+                            if (sent < 0 && errno == EINTR) continue;
                             break;
-                        } else if (check_result > 0) {
-                            // Client sent data - check for control commands
-                            ssize_t control_recv = recv(fd, check_buf, sizeof(check_buf) - 1, MSG_DONTWAIT);
-                            if (control_recv > 0) {
-                                check_buf[control_recv] = '\0';
-                                if (strncmp(check_buf, "STOP", 4) == 0) {
-                                    send(fd, "STREAM_STOPPED\n", 15, 0);
-                                    write_log("INFO", "STREAM stopped for %s at word %d by user request", fname, i + 1);
-                                    streaming_active = 0;
-                                    break;
-                                } else if (strncmp(check_buf, "PAUSE", 5) == 0) {
-                                    send(fd, "STREAM_PAUSED\n", 14, 0);
-                                    write_log("INFO", "STREAM paused for %s at word %d", fname, i + 1);
-                                    // Wait for resume or stop command
-                                    char resume_buf[64];
-                                    ssize_t resume_recv = recv(fd, resume_buf, sizeof(resume_buf) - 1, 0);
-                                    if (resume_recv > 0) {
-                                        resume_buf[resume_recv] = '\0';
-                                        if (strncmp(resume_buf, "RESUME", 6) == 0) {
-                                            send(fd, "STREAM_RESUMED\n", 15, 0);
-                                            continue;
-                                        } else {
-                                            streaming_active = 0;
-                                            break;
-                                        }
-                                    }
-                                }
-                            }
                         }
-                        
-                        // Re-enable Nagle's algorithm
-                        flag = 0;
-                        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *) &flag, sizeof(int));
                     }
-                    
-                    // Send definitive stream end marker
-                    if (streaming_active) {
-                        send(fd, "STREAM_COMPLETE\n", 16, 0);
-                        write_log("INFO", "STREAM: Completed streaming %s (%d words) to user %s", 
-                                 fname, word_count, username);
-                        printf("[SERVER %d] STREAM: Completed streaming %s (%d words) to %s\n", 
-                               ctx->server_port, fname, word_count, username);
+                    if (offset < st.st_size) {
+                        // The promised length can no longer be met; drop the
+                        // connection rather than leave the client waiting
+                        write_log("ERROR", "Failed to send file content for %s to user %s", fname, username);
+                        shutdown(fd, SHUT_RDWR);
                     }
+                    
+                    write_log("INFO", "READ: File %s (%ld bytes) sent to user %s", fname, file_size, username);
+                    printf("[SERVER %d] READ: File %s (%ld bytes sent) to %s\n", 
+                           ctx->server_port, fname, (long)offset, username);
                 }
                 
-                fclose(f);
+                close(file_fd);
                 
                 // Update access metadata with username
                 persist_update_last_accessed(meta_dir, fname, username);
             }
         }
 
+        // STREAM command: STREAM <file> [ms_between_words]
+        else if (matched >= 1 && strcmp(cmd, "STREAM") == 0 && matched >= 2) {
+            char filepath[512];
+            snprintf(filepath, sizeof(filepath), "%s/%s", files_dir, fname);
+            int interval_ms = matched >= 3 ? atoi(rest) : STREAM_DEFAULT_INTERVAL_MS;
+            
+            // Check if file exists (the parse is shared with other readers)
+            parsed_doc_t* doc = doc_cache_acquire(filepath);
+            if (!doc) {
+                send_error_reply(fd, "ERR_404 File not found\n", 23);
+                write_log("WARN", "STREAM failed: File %s not found", fname);
+                printf("[SERVER %d] STREAM failed: File %s not found (requested by %s)\n", 
+                       ctx->server_port, fname, username);
+            } else if (doc->length == 0) {
+                // Handle empty file
+                send(fd, "OK_200 EMPTY_FILE_STREAM\n", 25, 0);
+                write_log("INFO", "STREAM: Empty file %s streamed to user %s", fname, username);
+                printf("[SERVER %d] STREAM: Empty file %s streamed to %s\n", 
+                       ctx->server_port, fname, username);
+                doc_release(doc);
+                persist_update_last_accessed(meta_dir, fname, username);
+            } else {
+                int word_count = doc->word_count;
+                if (stream_engine_start(fd, doc, interval_ms, fname, username,
+                                        ctx->in_buf, &ctx->in_len, sizeof(ctx->in_buf),
+                                        stream_finished, ctx) != 0) {
+                    doc_release(doc);
+                    send_error_reply(fd, "ERR_503 Too many active streams\n", 32);
+                } else {
+                    // The engine owns the socket, the document reference and
+                    // ctx now; stream_finished() gives the session back
+                    write_log("INFO", "STREAM: Starting to stream %d words from %s to user %s", 
+                             word_count, fname, username);
+                    printf("[SERVER %d] STREAM: Starting to stream %d words from %s to %s\n", 
+                           g_my_port, word_count, fname, username);
+                    persist_update_last_accessed(meta_dir, fname, username);
+                    handed_off = 1;
+                    break;
+                }
+            }
+        }
+
         // WRITE command
         else if (strncmp(cmd, "WRITE", 5) == 0) {
             char fname_write[256];
             int sentence_num;
+            int wait_ms = 0; // Optional: how long to queue behind another writer
             
-            if (sscanf(buf, "WRITE %s %d", fname_write, &sentence_num) == 2) {
+            if (sscanf(buf, "WRITE %255s %d %d", fname_write, &sentence_num, &wait_ms) >= 2) {
                 char filepath[512];
                 snprintf(filepath, sizeof(filepath), "%s/%s", files_dir, fname_write);
                 
-                FILE* check_file = fopen(filepath, "r");
-                if (!check_file) {
-                    send(fd, "ERR_404 File not found\n", 23, 0);
+                parsed_doc_t* doc = doc_cache_acquire(filepath);
+                if (!doc) {
+                    send_error_reply(fd, "ERR_404 File not found\n", 23);
                     continue;
                 }
-                
-                char content[8192] = {0};
-                size_t bytes_read = fread(content, 1, sizeof(content) - 1, check_file);
-                fclose(check_file);
-                content[bytes_read] = '\0';
-                
-                int available_sentences = 0;
-                
-                if (bytes_read == 0) {
-                    available_sentences = 1;
-                } else {
-                    // Use cached sentence info - this is the key optimization!
-                    sentence_info_t cached_sentences[256];
-                    int total_sentences = get_sentence_info_simple(fname_write, ctx->server_port, cached_sentences, 256);
-                    
-                    if (total_sentences == 0) {
-                        available_sentences = 2;
-                    } else {
-                        available_sentences = total_sentences;
-                        
-                        // Check if last sentence is complete (only when needed)
-                        if (total_sentences > 0) {
-                            int last_sentence_end = cached_sentences[total_sentences - 1].end_word_idx;
-                            
-                            // Only tokenize to count words if we need to check completeness
-                            char temp_content_for_counting[8192];
-                            strcpy(temp_content_for_counting, content);
-                            int total_content_words = 0;
-                            
-                            char *token = strtok(temp_content_for_counting, " \t\n");
-                            while (token && total_content_words < 1024) {
-                                total_content_words++;
-                                token = strtok(NULL, " \t\n");
-                            }
-                            
-                            if (last_sentence_end < total_content_words - 1) {
-                                available_sentences = total_sentences + 1;
-                            } else if (total_content_words > 0) {
-                                // Check if last word has sentence delimiter
-                                char temp_check[8192];
-                                strcpy(temp_check, content);
-                                char *check_token = strtok(temp_check, " \t\n");
-                                char last_word[512] = "";
-                                
-                                for (int i = 0; i < total_content_words && check_token; i++) {
-                                    if (i == last_sentence_end) {
-                                        strcpy(last_word, check_token);
-                                        break;
-                                    }
-                                    check_token = strtok(NULL, " \t\n");
-                                }
-                                
-                                int word_len = strlen(last_word);
-                                if (word_len > 0) {
-                                    char last_char = last_word[word_len - 1];
-                                    if (last_char == '.' || last_char == '!' || last_char == '?') {
-                                        available_sentences = total_sentences + 1;
-                                    } else {
-                                        available_sentences = total_sentences;
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
+                int available_sentences = doc_writable_sentences(doc);
+                doc_release(doc);
                 
                 // Validation
                 if (sentence_num < 1) {
-                    send(fd, "ERR_404 Sentence number must be positive\n", 41, 0);
+                    send_error_reply(fd, "ERR_404 Sentence number must be positive\n", 41);
                     continue;
                 }
                 
@@ -1459,19 +1450,31 @@ void *client_handler_thread(void *arg) {
                             "ERR_404 Sentence %d not available. File allows sentences 1-%d.\n", 
                             sentence_num, available_sentences);
                     }
-                    send(fd, err_msg, strlen(err_msg), 0);
+                    send_error_reply(fd, err_msg, strlen(err_msg));
                     write_log("WARN", "WRITE failed: Sentence %d out of range (1-%d) for file %s", 
                              sentence_num, available_sentences, fname_write);
                     continue;
                 }
                 
                 // Locking logic
-                if (is_sentence_locked(fname_write, sentence_num, fd)) {
-                    send(fd, "ERR_409 This sentence is currently being edited by another user\n", 64, 0);
+                int lock_result = sentence_lock_acquire(fname_write, sentence_num, fd, wait_ms);
+                if (lock_result == -1) {
+                    send_error_reply(fd, "ERR_409 This sentence is currently being edited by another user\n", 64);
                     write_log("WARN", "WRITE blocked: %s sentence %d already locked by another user", fname_write, sentence_num);
+                } else if (lock_result == -2) {
+                    send_error_reply(fd, "ERR_500 Could not lock sentence\n", 32);
                 } else {
-                    add_sentence_lock(fname_write, sentence_num, fd);
-                    send(fd, "OK_200 WRITE MODE ENABLED\n", 27, 0);
+                    // Load the sentence only once it is ours, so a queued writer
+                    // starts from the previous holder's committed text
+                    char swap_path[512];
+                    snprintf(swap_path, sizeof(swap_path), "%s/%s_%d_%d.swap", files_dir, fname_write, sentence_num, fd);
+                    if (write_session_begin(&session, filepath, fname_write, sentence_num, swap_path) == -1) {
+                        sentence_lock_release(fname_write, sentence_num, fd);
+                        send_error_reply(fd, "ERR_500 Could not open file for writing\n", 40);
+                        write_log("ERROR", "WRITE failed: Could not load %s sentence %d", fname_write, sentence_num);
+                        continue;
+                    }
+                    send(fd, "OK_200 WRITE MODE ENABLED\n", 26, 0);
                     write_log("INFO", "WRITE lock acquired on %s [Sentence %d] by user %s (Available: 1-%d)", 
                              fname_write, sentence_num, username, available_sentences);
                     printf("[SERVER %d] WRITE lock on %s [Sentence %d] by %s (Available: 1-%d)\n",
@@ -1482,20 +1485,10 @@ void *client_handler_thread(void *arg) {
 
         // UNDO command
         else if (matched >= 1 && strcmp(cmd, "UNDO") == 0 && matched >= 2) {
-            int file_locked = 0;
-            pthread_mutex_lock(&lock_mutex);
-            sentence_lock_t *curr = sentence_locks;
-            while (curr) {
-                if (strcmp(curr->filename, fname) == 0) {
-                    file_locked = 1;
-                    break;
-                }
-                curr = curr->next;
-            }
-            pthread_mutex_unlock(&lock_mutex);
+            int file_locked = sentence_lock_file_busy(fname);
             
             if (file_locked) {
-                send(fd, "ERR_409 Cannot undo: file is currently being edited\n", 52, 0);
+                send_error_reply(fd, "ERR_409 Cannot undo: file is currently being edited\n", 52);
                 write_log("WARN", "UNDO blocked: file %s is currently being edited", fname);
                 continue;
             }
@@ -1505,7 +1498,7 @@ void *client_handler_thread(void *arg) {
             
             FILE* check_file = fopen(filepath, "r");
             if (!check_file) {
-                send(fd, "ERR_404 File not found\n", 23, 0);
+                send_error_reply(fd, "ERR_404 File not found\n", 23);
                 write_log("ERROR", "UNDO failed: File %s not found", fname);
                 continue;
             }
@@ -1517,6 +1510,7 @@ void *client_handler_thread(void *arg) {
                 char meta_dir_undo[256];
                 snprintf(meta_dir_undo, sizeof(meta_dir_undo), "data/ss_%d/metadata", ctx->server_port);
                 update_metadata_entry(meta_dir_undo, fname);
+                word_index_update(fname, filepath);
                 
                 // Invalidate cache after undo
                 // Cache removed for simplicity
@@ -1526,10 +1520,10 @@ void *client_handler_thread(void *arg) {
                 printf("[SERVER %d] UNDO completed for file %s by %s\n", 
                        ctx->server_port, fname, username);
             } else if (undo_result == 0) {
-                send(fd, "ERR_404 No undo history available for this file\n", 48, 0);
+                send_error_reply(fd, "ERR_404 No undo history available for this file\n", 48);
                 write_log("WARN", "UNDO failed: No history available for file %s", fname);
             } else {
-                send(fd, "ERR_500 UNDO operation failed\n", 30, 0);
+                send_error_reply(fd, "ERR_500 UNDO operation failed\n", 30);
                 write_log("ERROR", "UNDO operation failed for file %s", fname);
             }
         }
@@ -1539,20 +1533,10 @@ void *client_handler_thread(void *arg) {
             char checkpoint_tag[256];
             if (sscanf(buf, "CHECKPOINT %255s %255s", fname, checkpoint_tag) == 2) {
                 // Check if file is currently being edited
-                int file_locked = 0;
-                pthread_mutex_lock(&lock_mutex);
-                sentence_lock_t *curr = sentence_locks;
-                while (curr) {
-                    if (strcmp(curr->filename, fname) == 0) {
-                        file_locked = 1;
-                        break;
-                    }
-                    curr = curr->next;
-                }
-                pthread_mutex_unlock(&lock_mutex);
+                int file_locked = sentence_lock_file_busy(fname);
                 
                 if (file_locked) {
-                    send(fd, "ERR_409 Cannot create checkpoint: file is currently being edited\n", 65, 0);
+                    send_error_reply(fd, "ERR_409 Cannot create checkpoint: file is currently being edited\n", 65);
                     write_log("WARN", "CHECKPOINT blocked: file %s is currently being edited", fname);
                     continue;
                 }
@@ -1562,7 +1546,7 @@ void *client_handler_thread(void *arg) {
                 snprintf(filepath, sizeof(filepath), "%s/%s", files_dir, fname);
                 FILE* check_file = fopen(filepath, "r");
                 if (!check_file) {
-                    send(fd, "ERR_404 File not found\n", 23, 0);
+                    send_error_reply(fd, "ERR_404 File not found\n", 23);
                     write_log("ERROR", "CHECKPOINT failed: File %s not found", fname);
                     continue;
                 }
@@ -1571,19 +1555,19 @@ void *client_handler_thread(void *arg) {
                 int result = create_checkpoint(fname, checkpoint_tag, ctx->server_port, username);
                 
                 if (result == 1) {
-                    send(fd, "OK_200 CHECKPOINT CREATED\n", 27, 0);
+                    send(fd, "OK_200 CHECKPOINT CREATED\n", 26, 0);
                     write_log("INFO", "CHECKPOINT '%s' created for file %s by user %s", checkpoint_tag, fname, username);
                     printf("[SERVER %d] CHECKPOINT '%s' created for file %s by %s\n", 
                            ctx->server_port, checkpoint_tag, fname, username);
                 } else if (result == -2) {
-                    send(fd, "ERR_409 Checkpoint tag already exists\n", 38, 0);
+                    send_error_reply(fd, "ERR_409 Checkpoint tag already exists\n", 38);
                     write_log("WARN", "CHECKPOINT failed: Tag '%s' already exists for file %s", checkpoint_tag, fname);
                 } else {
-                    send(fd, "ERR_500 Failed to create checkpoint\n", 36, 0);
+                    send_error_reply(fd, "ERR_500 Failed to create checkpoint\n", 36);
                     write_log("ERROR", "CHECKPOINT creation failed for file %s", fname);
                 }
             } else {
-                send(fd, "ERR_400 Invalid format. Use: CHECKPOINT <filename> <tag>\n", 58, 0);
+                send_error_reply(fd, "ERR_400 Invalid format. Use: CHECKPOINT <filename> <tag>\n", 57);
             }
         }
 
@@ -1591,18 +1575,18 @@ void *client_handler_thread(void *arg) {
         else if (matched >= 1 && strcmp(cmd, "VIEWCHECKPOINT") == 0 && matched >= 3) {
             char checkpoint_tag[256];
             if (sscanf(buf, "VIEWCHECKPOINT %255s %255s", fname, checkpoint_tag) == 2) {
-                char content_buffer[8192];
-                int result = view_checkpoint(fname, checkpoint_tag, ctx->server_port, content_buffer, sizeof(content_buffer));
+                char* content_buffer = NULL;
+                size_t content_len = 0;
+                int result = view_checkpoint(fname, checkpoint_tag, ctx->server_port, &content_buffer, &content_len);
                 
                 if (result == 1) {
-                    if (strlen(content_buffer) == 0) {
+                    if (content_len == 0) {
                         send(fd, "OK_200 EMPTY_CHECKPOINT\n", 24, 0);
                         write_log("INFO", "VIEWCHECKPOINT: Empty checkpoint '%s' for file %s viewed by user %s", checkpoint_tag, fname, username);
                     } else {
                         send(fd, "OK_200 CHECKPOINT_CONTENT\n", 26, 0);
                         
                         // Send content in chunks
-                        size_t content_len = strlen(content_buffer);
                         size_t sent = 0;
                         const size_t chunk_size = 1024;
                         
@@ -1621,12 +1605,13 @@ void *client_handler_thread(void *arg) {
                     }
                     printf("[SERVER %d] VIEWCHECKPOINT: Checkpoint '%s' for file %s viewed by %s\n", 
                            ctx->server_port, checkpoint_tag, fname, username);
+                    free(content_buffer);
                 } else {
-                    send(fd, "ERR_404 Checkpoint not found\n", 29, 0);
+                    send_error_reply(fd, "ERR_404 Checkpoint not found\n", 29);
                     write_log("WARN", "VIEWCHECKPOINT failed: Checkpoint '%s' not found for file %s", checkpoint_tag, fname);
                 }
             } else {
-                send(fd, "ERR_400 Invalid format. Use: VIEWCHECKPOINT <filename> <tag>\n", 62, 0);
+                send_error_reply(fd, "ERR_400 Invalid format. Use: VIEWCHECKPOINT <filename> <tag>\n", 61);
             }
         }
 
@@ -1635,20 +1620,10 @@ void *client_handler_thread(void *arg) {
             char checkpoint_tag[256];
             if (sscanf(buf, "REVERT %255s %255s", fname, checkpoint_tag) == 2) {
                 // Check if file is currently being edited
-                int file_locked = 0;
-                pthread_mutex_lock(&lock_mutex);
-                sentence_lock_t *curr = sentence_locks;
-                while (curr) {
-                    if (strcmp(curr->filename, fname) == 0) {
-                        file_locked = 1;
-                        break;
-                    }
-                    curr = curr->next;
-                }
-                pthread_mutex_unlock(&lock_mutex);
+                int file_locked = sentence_lock_file_busy(fname);
                 
                 if (file_locked) {
-                    send(fd, "ERR_409 Cannot revert: file is currently being edited\n", 54, 0);
+                    send_error_reply(fd, "ERR_409 Cannot revert: file is currently being edited\n", 54);
                     write_log("WARN", "REVERT blocked: file %s is currently being edited", fname);
                     continue;
                 }
@@ -1658,7 +1633,7 @@ void *client_handler_thread(void *arg) {
                 snprintf(filepath, sizeof(filepath), "%s/%s", files_dir, fname);
                 FILE* check_file = fopen(filepath, "r");
                 if (!check_file) {
-                    send(fd, "ERR_404 File not found\n", 23, 0);
+                    send_error_reply(fd, "ERR_404 File not found\n", 23);
                     write_log("ERROR", "REVERT failed: File %s not found", fname);
                     continue;
                 }
@@ -1672,14 +1647,14 @@ void *client_handler_thread(void *arg) {
                     printf("[SERVER %d] REVERT: File %s reverted to checkpoint '%s' by %s\n", 
                            ctx->server_port, fname, checkpoint_tag, username);
                 } else if (result == 0) {
-                    send(fd, "ERR_404 Checkpoint not found\n", 29, 0);
+                    send_error_reply(fd, "ERR_404 Checkpoint not found\n", 29);
                     write_log("WARN", "REVERT failed: Checkpoint '%s' not found for file %s", checkpoint_tag, fname);
                 } else {
-                    send(fd, "ERR_500 REVERT operation failed\n", 32, 0);
+                    send_error_reply(fd, "ERR_500 REVERT operation failed\n", 32);
                     write_log("ERROR", "REVERT operation failed for file %s", fname);
                 }
             } else {
-                send(fd, "ERR_400 Invalid format. Use: REVERT <filename> <tag>\n", 54, 0);
+                send_error_reply(fd, "ERR_400 Invalid format. Use: REVERT <filename> <tag>\n", 53);
             }
         }
 
@@ -1718,11 +1693,13 @@ void *client_handler_thread(void *arg) {
             char filepath[512];
             snprintf(filepath, sizeof(filepath), "%s/%s", files_dir, fname);
             if (remove(filepath) == 0) {
+                doc_cache_invalidate(filepath);
                 remove_metadata_entry(meta_dir, fname);
+                word_index_remove(fname);
                 send(fd, "OK_200 DELETED\n", 15, 0);
                 printf("[SERVER %d] Deleted: %s\n", ctx->server_port, fname);
             } else {
-                send(fd, "ERR_404\n", 8, 0);
+                send_error_reply(fd, "ERR_404\n", 8);
             }
         }
 
@@ -1739,7 +1716,7 @@ void *client_handler_thread(void *arg) {
             if (sscanf(buf, "REQUESTACCESS %255s %7s", fname, permission) == 2) {
                 // Validate permission
                 if (strcmp(permission, "-R") != 0 && strcmp(permission, "-W") != 0) {
-                    send(fd, "ERR_400 Invalid permission. Use -R for read or -W for write\n", 61, 0);
+                    send_error_reply(fd, "ERR_400 Invalid permission. Use -R for read or -W for write\n", 60);
                     continue;
                 }
                 
@@ -1748,7 +1725,7 @@ void *client_handler_thread(void *arg) {
                 snprintf(filepath, sizeof(filepath), "%s/%s", files_dir, fname);
                 FILE* check_file = fopen(filepath, "r");
                 if (!check_file) {
-                    send(fd, "ERR_404 File not found\n", 23, 0);
+                    send_error_reply(fd, "ERR_404 File not found\n", 23);
                     write_log("ERROR", "REQUESTACCESS failed: File %s not found", fname);
                     continue;
                 }
@@ -1756,30 +1733,28 @@ void *client_handler_thread(void *arg) {
                 
                 // Check if user is the owner
                 if (check_file_owner(fname, username, ctx->server_port)) {
-                    send(fd, "ERR_400 You already own this file\n", 34, 0);
+                    send_error_reply(fd, "ERR_400 You already own this file\n", 34);
                     write_log("WARN", "REQUESTACCESS failed: %s already owns file %s", username, fname);
                     continue;
                 }
                 
                 // Check if user already has access
                 int has_access = 0;
-                for (int i = 0; i < file_count; i++) {
-                    if (strcmp(file_table[i].filename, fname) == 0) {
-                        for (int j = 0; j < file_table[i].acl_count; j++) {
-                            if (strcmp(file_table[i].acl[j].username, username) == 0) {
-                                int required_perm = (strcmp(permission, "-W") == 0) ? PERM_WRITE : PERM_READ;
-                                if (file_table[i].acl[j].permission >= required_perm) {
-                                    has_access = 1;
-                                    break;
-                                }
+                FileMeta file;
+                if (persist_get_file(fname, &file) == 0) {
+                    for (int j = 0; j < file.acl_count; j++) {
+                        if (strcmp(file.acl[j].username, username) == 0) {
+                            int required_perm = (strcmp(permission, "-W") == 0) ? PERM_WRITE : PERM_READ;
+                            if (file.acl[j].permission >= required_perm) {
+                                has_access = 1;
+                                break;
                             }
                         }
-                        break;
                     }
                 }
                 
                 if (has_access) {
-                    send(fd, "ERR_409 You already have the requested access to this file\n", 59, 0);
+                    send_error_reply(fd, "ERR_409 You already have the requested access to this file\n", 59);
                     write_log("WARN", "REQUESTACCESS failed: %s already has access to file %s", username, fname);
                     continue;
                 }
@@ -1792,14 +1767,14 @@ void *client_handler_thread(void *arg) {
                     printf("[SERVER %d] Access request: %s requesting %s access to %s\n", 
                            ctx->server_port, username, permission, fname);
                 } else if (result == -2) {
-                    send(fd, "ERR_409 Access request already exists\n", 38, 0);
+                    send_error_reply(fd, "ERR_409 Access request already exists\n", 38);
                     write_log("WARN", "REQUESTACCESS failed: Request already exists for %s on file %s", username, fname);
                 } else {
-                    send(fd, "ERR_500 Failed to submit access request\n", 40, 0);
+                    send_error_reply(fd, "ERR_500 Failed to submit access request\n", 40);
                     write_log("ERROR", "REQUESTACCESS failed for %s on file %s", username, fname);
                 }
             } else {
-                send(fd, "ERR_400 Invalid format. Use: REQUESTACCESS <filename> <-R/-W>\n", 63, 0);
+                send_error_reply(fd, "ERR_400 Invalid format. Use: REQUESTACCESS <filename> <-R/-W>\n", 62);
             }
         }
 
@@ -1811,7 +1786,7 @@ void *client_handler_thread(void *arg) {
                 
                 // Check if user owns the specified file
                 if (!check_file_owner(target_file, username, ctx->server_port)) {
-                    send(fd, "ERR_403 You can only view requests for files you own\n", 53, 0);
+                    send_error_reply(fd, "ERR_403 You can only view requests for files you own\n", 53);
                     write_log("WARN", "VIEWREQUESTS failed: %s does not own file %s", username, target_file);
                     continue;
                 }
@@ -1858,13 +1833,13 @@ void *client_handler_thread(void *arg) {
             if (parse_result == 3) {
                 // Validate permission
                 if (strcmp(permission, "-R") != 0 && strcmp(permission, "-W") != 0) {
-                    send(fd, "ERR_400 Invalid permission. Use -R for read or -W for write\n", 61, 0);
+                    send_error_reply(fd, "ERR_400 Invalid permission. Use -R for read or -W for write\n", 60);
                     continue;
                 }
                 
                 // Check if user owns the file
                 if (!check_file_owner(fname, username, ctx->server_port)) {
-                    send(fd, "ERR_403 You can only approve requests for files you own\n", 56, 0);
+                    send_error_reply(fd, "ERR_403 You can only approve requests for files you own\n", 56);
                     write_log("WARN", "APPROVEREQUEST failed: %s does not own file %s", username, fname);
                     continue;
                 }
@@ -1878,14 +1853,14 @@ void *client_handler_thread(void *arg) {
                     printf("[SERVER %d] Access approved: %s granted %s access to %s by %s\n", 
                            ctx->server_port, requester_user, permission, fname, username);
                 } else if (result == 0) {
-                    send(fd, "ERR_404 Access request not found\n", 33, 0);
+                    send_error_reply(fd, "ERR_404 Access request not found\n", 33);
                     write_log("WARN", "APPROVEREQUEST failed: Request not found for %s on file %s", requester_user, fname);
                 } else {
-                    send(fd, "ERR_500 Failed to approve access request\n", 41, 0);
+                    send_error_reply(fd, "ERR_500 Failed to approve access request\n", 41);
                     write_log("ERROR", "APPROVEREQUEST failed for %s on file %s", requester_user, fname);
                 }
             } else {
-                send(fd, "ERR_400 Invalid format. Use: APPROVEREQUEST <filename> <username> <-R/-W>\n", 75, 0);
+                send_error_reply(fd, "ERR_400 Invalid format. Use: APPROVEREQUEST <filename> <username> <-R/-W>\n", 74);
             }
         }
 
@@ -1898,7 +1873,7 @@ void *client_handler_thread(void *arg) {
             if (parse_result == 2) {
                 // Check if user owns the file
                 if (!check_file_owner(fname, username, ctx->server_port)) {
-                    send(fd, "ERR_403 You can only deny requests for files you own\n", 53, 0);
+                    send_error_reply(fd, "ERR_403 You can only deny requests for files you own\n", 53);
                     write_log("WARN", "DENYREQUEST failed: %s does not own file %s", username, fname);
                     continue;
                 }
@@ -1912,24 +1887,27 @@ void *client_handler_thread(void *arg) {
                     printf("[SERVER %d] Access denied: %s denied access to %s by %s\n", 
                            ctx->server_port, requester_user, fname, username);
                 } else if (result == 0) {
-                    send(fd, "ERR_404 Access request not found\n", 33, 0);
+                    send_error_reply(fd, "ERR_404 Access request not found\n", 33);
                     write_log("WARN", "DENYREQUEST failed: Request not found for %s on file %s", requester_user, fname);
                 } else {
-                    send(fd, "ERR_500 Failed to deny access request\n", 38, 0);
+                    send_error_reply(fd, "ERR_500 Failed to deny access request\n", 38);
                     write_log("ERROR", "DENYREQUEST failed for %s on file %s", requester_user, fname);
                 }
             } else {
-                send(fd, "ERR_400 Invalid format. Use: DENYREQUEST <filename> <username>\n", 64, 0);
+                send_error_reply(fd, "ERR_400 Invalid format. Use: DENYREQUEST <filename> <username>\n", 63);
             }
         }
 
         // UNKNOWN
         else {
-            send(fd, "ERR_400 UNKNOWN_CMD\n", 20, 0);
+            send_error_reply(fd, "ERR_400 UNKNOWN_CMD\n", 20);
         }
     }
 
-    remove_client_locks(fd);
+    write_session_end(&session);
+    if (pending_op) metrics_end(METRICS_SS_DIRECT, pending_op, op_started);
+    if (handed_off) return NULL;
+    sentence_lock_release_client(fd);
     close(fd);
     remove_client_fd(fd);
     printf("[SERVER %d] Closed connection from %s:%d (%s)\n",
@@ -1939,475 +1917,356 @@ void *client_handler_thread(void *arg) {
 }
 
 
-static int is_sentence_locked(const char* filename, int sentence_num, int client_fd) {
-    pthread_mutex_lock(&lock_mutex);
-    sentence_lock_t *curr = sentence_locks;
-    while (curr) {
-        if (strcmp(curr->filename, filename) == 0 && 
-            curr->sentence_num == sentence_num && 
-            curr->client_fd != client_fd) {
-            pthread_mutex_unlock(&lock_mutex);
-            return 1; // Locked by another client
+/**
+ * @brief Serves "READ <file> <start> <count> [BYTES]".
+ * Without BYTES, start/count select 1-based sentences, located through the
+ * document's word offsets; with BYTES they are a byte offset and length.
+ * The reply uses the same framing as a full READ.
+ * @return Bytes of content sent, or -1 if an error reply was sent instead.
+ */
+static long send_read_range(int fd, const char* filepath, const char* range_args) {
+    long start = 0, count = 0;
+    char unit[16] = "";
+    if (sscanf(range_args, "%ld %ld %15s", &start, &count, unit) < 2 || count <= 0 ||
+        (unit[0] != '\0' && strcasecmp(unit, "BYTES") != 0)) {
+        const char* usage = "ERR_400 Invalid range. Use: READ <file> <start> <count> [BYTES]\n";
+        send_error_reply(fd, usage, strlen(usage));
+        return -1;
+    }
+
+    parsed_doc_t* doc = doc_cache_acquire(filepath);
+    if (!doc) {
+        send_error_reply(fd, "ERR_404 File not found\n", 23);
+        return -1;
+    }
+
+    size_t from = 0, to = 0;
+    if (unit[0] != '\0') {
+        if (start < 0) start = 0;
+        from = (size_t)start < doc->length ? (size_t)start : doc->length;
+        to = (size_t)count < doc->length - from ? from + (size_t)count : doc->length;
+    } else {
+        if (start < 1 || start > doc->sentence_count) {
+            char err_msg[128];
+            snprintf(err_msg, sizeof(err_msg), "ERR_404 Sentence %ld not available. File has %d sentences.\n",
+                     start, doc->sentence_count);
+            send_error_reply(fd, err_msg, strlen(err_msg));
+            doc_release(doc);
+            return -1;
         }
-        curr = curr->next;
+        long last = start + count - 1;
+        if (last > doc->sentence_count) last = doc->sentence_count;
+        const doc_word_t* end_word = &doc->words[doc->sentences[last - 1].end_word_idx];
+        from = doc->words[doc->sentences[start - 1].start_word_idx].offset;
+        to = end_word->offset + end_word->length;
     }
-    pthread_mutex_unlock(&lock_mutex);
-    return 0; // Not locked
-}
 
-static void add_sentence_lock(const char* filename, int sentence_num, int client_fd) {
-    pthread_mutex_lock(&lock_mutex);
-    sentence_lock_t *new_lock = malloc(sizeof(sentence_lock_t));
-    if (!new_lock) {
-        perror("malloc failed in add_sentence_lock");
-        pthread_mutex_unlock(&lock_mutex);
-        return;
+    if (to == from) {
+        send(fd, "OK_200 EMPTY_FILE\n", 18, 0);
+    } else {
+        char header[64];
+        int header_len = snprintf(header, sizeof(header), "OK_200 FILE_CONTENT %zu\n", to - from);
+        send(fd, header, header_len, MSG_MORE);
+        size_t off = from;
+        while (off < to) {
+            ssize_t sent = send(fd, doc->text + off, to - off, 0);
+            if (sent <= 0) {
+                if (sent < 0 && errno == EINTR) continue;
+                shutdown(fd, SHUT_RDWR); // Cannot honour the announced length
+                break;
+            }
+            off += sent;
+        }
+        to = off;
     }
-    strcpy(new_lock->filename, filename);
-    new_lock->sentence_num = sentence_num;
-    new_lock->client_fd = client_fd;
-    new_lock->next = sentence_locks;
-    sentence_locks = new_lock;
-    pthread_mutex_unlock(&lock_mutex);
+    doc_release(doc);
+    return (long)(to - from);
 }
 
-static void remove_sentence_lock(const char* filename, int sentence_num, int client_fd) {
-    pthread_mutex_lock(&lock_mutex);
-    sentence_lock_t *prev = NULL, *curr = sentence_locks;
-    while (curr) {
-        if (strcmp(curr->filename, filename) == 0 && 
-            curr->sentence_num == sentence_num && 
-            curr->client_fd == client_fd) {
-            if (prev) {
-                prev->next = curr->next;
-            } else {
-                sentence_locks = curr->next;
-            }
-            free(curr);
-            break;
+// =========================================================================
+//  VERSION HISTORY (undo stack and checkpoints, see version_store.h)
+// =========================================================================
+
+// Serializes the one-time import of a file's pre-pack history
+static pthread_mutex_t legacy_import_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+    long timestamp;
+    version_kind_t kind;
+    char tag[256];
+    char user[128];
+    char path[768];
+    int used;              // Already undone: only its file is removed
+} legacy_version_t;
+
+static int compare_legacy_versions(const void* a, const void* b) {
+    long ta = ((const legacy_version_t*)a)->timestamp;
+    long tb = ((const legacy_version_t*)b)->timestamp;
+    return (ta > tb) - (ta < tb);
+}
+
+static char* read_whole_file(const char* path, size_t* out_length) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+    char* data = NULL;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        long size = ftell(f);
+        rewind(f);
+        data = size >= 0 ? malloc((size_t)size + 1) : NULL;
+        if (data) {
+            *out_length = fread(data, 1, (size_t)size, f);
+            data[*out_length] = '\0';
         }
-        prev = curr;
-        curr = curr->next;
     }
-    pthread_mutex_unlock(&lock_mutex);
+    fclose(f);
+    return data;
 }
 
-static void remove_client_locks(int client_fd) {
-    pthread_mutex_lock(&lock_mutex);
-    sentence_lock_t *prev = NULL, *curr = sentence_locks;
-    while (curr) {
-        if (curr->client_fd == client_fd) {
-            sentence_lock_t *to_remove = curr;
-            if (prev) {
-                prev->next = curr->next;
+/**
+ * @brief Moves a file's history from the old layout (one .bak per edit
+ * listed in undo/<file>.undo, one copy per checkpoint listed in
+ * checkpoint_meta/<file>.meta) into its version pack, then deletes it.
+ * Entries already undone are dropped. No-op once the file has a pack.
+ */
+static void import_legacy_history(const char* filename, int server_port) {
+    char base[64], undo_log[512], checkpoint_log[512], versions_dir[256];
+    snprintf(base, sizeof(base), "data/ss_%d", server_port);
+    snprintf(undo_log, sizeof(undo_log), "%s/undo/%s.undo", base, filename);
+    snprintf(checkpoint_log, sizeof(checkpoint_log), "%s/checkpoint_meta/%s.meta", base, filename);
+    snprintf(versions_dir, sizeof(versions_dir), "%s/versions", base);
+    if (access(undo_log, F_OK) != 0 && access(checkpoint_log, F_OK) != 0) return;
+
+    pthread_mutex_lock(&legacy_import_lock);
+    if (version_store_exists(versions_dir, filename)) {
+        pthread_mutex_unlock(&legacy_import_lock);
+        return;
+    }
+
+    legacy_version_t* entries = NULL;
+    int count = 0, capacity = 0;
+    char line[1024];
+    for (int pass = 0; pass < 2; pass++) {
+        FILE* log = fopen(pass == 0 ? undo_log : checkpoint_log, "r");
+        if (!log) continue;
+        while (fgets(line, sizeof(line), log)) {
+            legacy_version_t e;
+            char name[256];
+            memset(&e, 0, sizeof(e));
+            if (pass == 0) {
+                if (sscanf(line, "%ld|%255[^|]|%127[^|\n]|%d", &e.timestamp, name, e.user, &e.used) < 3) continue;
+                e.kind = VERSION_UNDO;
+                snprintf(e.path, sizeof(e.path), "%s/%s", versions_dir, name);
             } else {
-                sentence_locks = curr->next;
+                if (sscanf(line, "%ld|%255[^|]|%127[^|\n]", &e.timestamp, e.tag, e.user) < 3) continue;
+                e.kind = VERSION_CHECKPOINT;
+                snprintf(e.path, sizeof(e.path), "%s/checkpoints/%s_%s.checkpoint", base, filename, e.tag);
             }
-            curr = curr->next;
-            free(to_remove);
+            if (count == capacity) {
+                int new_capacity = capacity ? capacity * 2 : 16;
+                legacy_version_t* grown = realloc(entries, sizeof(*entries) * new_capacity);
+                if (!grown) break;
+                entries = grown;
+                capacity = new_capacity;
+            }
+            entries[count++] = e;
+        }
+        fclose(log);
+    }
+
+    // Oldest first, so the newest backup ends up on top of the undo stack
+    qsort(entries, count, sizeof(*entries), compare_legacy_versions);
+    int imported = 0, failed = 0;
+    for (int i = 0; i < count; i++) {
+        if (entries[i].used) continue;
+        size_t length;
+        char* content = read_whole_file(entries[i].path, &length);
+        if (!content) continue;
+        if (version_store_push(versions_dir, filename, entries[i].kind, entries[i].tag, entries[i].user,
+                               content, length, (time_t)entries[i].timestamp) == -1) {
+            failed++;
         } else {
-            prev = curr;
-            curr = curr->next;
+            imported++;
         }
+        free(content);
     }
-    pthread_mutex_unlock(&lock_mutex);
+    if (failed == 0) {
+        for (int i = 0; i < count; i++) remove(entries[i].path);
+        remove(undo_log);
+        remove(checkpoint_log);
+    }
+    free(entries);
+    pthread_mutex_unlock(&legacy_import_lock);
+
+    write_log("INFO", "Imported %d legacy versions of %s into its version pack%s",
+              imported, filename, failed ? " (old files kept after errors)" : "");
 }
 
-static int get_client_write_info(int client_fd, char* filename, int* sentence_num) {
-    pthread_mutex_lock(&lock_mutex);
-    sentence_lock_t *curr = sentence_locks;
-    while (curr) {
-        if (curr->client_fd == client_fd) {
-            strcpy(filename, curr->filename);
-            *sentence_num = curr->sentence_num;
-            pthread_mutex_unlock(&lock_mutex);
-            return 1; // Found
-        }
-        curr = curr->next;
-    }
-    pthread_mutex_unlock(&lock_mutex);
-    return 0; // Not found
+/**
+ * @brief Replaces a file's contents via a temporary file and rename.
+ */
+static int restore_file_content(const char* path, const char* content, size_t length) {
+    char temp_path[600];
+    snprintf(temp_path, sizeof(temp_path), "%s.restore", path);
+    FILE* f = fopen(temp_path, "wb");
+    if (!f) return -1;
+    int rc = (fwrite(content, 1, length, f) == length) ? 0 : -1;
+    if (fclose(f) != 0) rc = -1;
+    if (rc == 0 && rename(temp_path, path) != 0) rc = -1;
+    if (rc != 0) remove(temp_path);
+    doc_cache_invalidate(path);
+    return rc;
 }
 
-static int create_file_backup(const char* filename, int server_port, const char* username) {
-    char files_dir[256], versions_dir[256];
-    snprintf(files_dir, sizeof(files_dir), "data/ss_%d/files", server_port);
+/**
+ * @brief Pushes a file's current contents as a new version.
+ * @return version_store_push()'s result, or 0 if the file cannot be read.
+ */
+static int push_current_version(const char* filename, int server_port, version_kind_t kind,
+                                const char* tag, const char* username) {
+    char path[512], versions_dir[256];
+    snprintf(path, sizeof(path), "data/ss_%d/files/%s", server_port, filename);
     snprintf(versions_dir, sizeof(versions_dir), "data/ss_%d/versions", server_port);
-    
-    char source_path[512];
-    snprintf(source_path, sizeof(source_path), "%s/%s", files_dir, filename);
-    
-    FILE* source = fopen(source_path, "r");
-    if (!source) {
-        return 0; 
-    }
-    
-    char content[8192] = {0};
-    size_t bytes_read = fread(content, 1, sizeof(content) - 1, source);
-    fclose(source);
-    content[bytes_read] = '\0';
-    
-    time_t now = time(NULL);
-    char backup_filename[512];
-    snprintf(backup_filename, sizeof(backup_filename), "%s_%ld.bak", filename, now);
-    
-    char backup_path[512];
-    snprintf(backup_path, sizeof(backup_path), "%s/%s", versions_dir, backup_filename);
-    
-    FILE* backup = fopen(backup_path, "w");
-    if (!backup) {
+    import_legacy_history(filename, server_port);
+
+    parsed_doc_t* doc = doc_cache_acquire(path);
+    if (!doc) return 0;
+    int result = version_store_push(versions_dir, filename, kind, tag, username, doc->text, doc->length, 0);
+    doc_release(doc);
+    return result;
+}
+
+static int create_file_backup(const char* filename, int server_port, const char* username) {
+    int result = push_current_version(filename, server_port, VERSION_UNDO, NULL, username);
+    if (result == 1) {
+        write_log("INFO", "Saved undo version of file %s by user %s", filename, username);
+    } else if (result == -1) {
         write_log("ERROR", "Failed to create backup for %s", filename);
-        return -1;
-    }
-    
-    fprintf(backup, "%s", content);
-    fclose(backup);
-    
-    char undo_dir[256];
-    snprintf(undo_dir, sizeof(undo_dir), "data/ss_%d/undo", server_port);
-    char undo_meta_path[512];
-    snprintf(undo_meta_path, sizeof(undo_meta_path), "%s/%s.undo", undo_dir, filename);
-    
-    FILE* undo_meta = fopen(undo_meta_path, "a");
-    if (undo_meta) {
-        fprintf(undo_meta, "%ld|%s|%s\n", now, backup_filename, username);
-        fclose(undo_meta);
     }
-    
-    write_log("INFO", "Created backup %s for file %s by user %s", backup_filename, filename, username);
-    return 1;
+    return result;
 }
 
 static int perform_undo(const char* filename, int server_port, const char* username) {
-    char undo_dir[256], versions_dir[256], files_dir[256];
-    snprintf(undo_dir, sizeof(undo_dir), "data/ss_%d/undo", server_port);
+    char versions_dir[256], current_path[512];
     snprintf(versions_dir, sizeof(versions_dir), "data/ss_%d/versions", server_port);
-    snprintf(files_dir, sizeof(files_dir), "data/ss_%d/files", server_port);
-    
-    char undo_meta_path[512];
-    snprintf(undo_meta_path, sizeof(undo_meta_path), "%s/%s.undo", undo_dir, filename);
-    
-    FILE* undo_meta = fopen(undo_meta_path, "r");
-    if (!undo_meta) {
-        // Log undo history failure - ADD this missing functionality
-        write_log("INFO", "No undo history found for file %s", filename);
-        return 0; // No undo history available - FIX: Don't close NULL pointer
-    }
-    
-    typedef struct backup_entry {
-        long timestamp;
-        char backup_name[256];
-        char user[128];
-        int used; 
-    } backup_entry_t;
-    
-    backup_entry_t backups[1000];
-    int backup_count = 0;
-    
-    char line[1024];
-    while (fgets(line, sizeof(line), undo_meta) && backup_count < 1000) {
-        char backup_name[256], user[128];
-        long timestamp;
-        int used = 0;
-        
-        // Try to parse with used flag (newer format)
-        if (sscanf(line, "%ld|%255[^|]|%127[^|]|%d", &timestamp, backup_name, user, &used) >= 3) {
-            backups[backup_count].timestamp = timestamp;
-            strcpy(backups[backup_count].backup_name, backup_name);
-            strcpy(backups[backup_count].user, user);
-            backups[backup_count].used = used;
-            backup_count++;
-        }
-    }
-    fclose(undo_meta); // Now it's safe to close
-    
-    if (backup_count == 0) {
-        write_log("INFO", "No backup entries found for file %s", filename);
-        return 0; 
-    }
-    
-    // Sort backups by timestamp (newest first)
-    for (int i = 0; i < backup_count - 1; i++) {
-        for (int j = i + 1; j < backup_count; j++) {
-            if (backups[i].timestamp < backups[j].timestamp) {
-                backup_entry_t temp = backups[i];
-                backups[i] = backups[j];
-                backups[j] = temp;
-            }
-        }
-    }
-    
-    // Find the next unused backup (going backwards in time)
-    int target_backup_idx = -1;
-    for (int i = 0; i < backup_count; i++) {
-        if (!backups[i].used) {
-            target_backup_idx = i;
-            break;
-        }
-    }
-    
-    if (target_backup_idx == -1) {
-        write_log("INFO", "No more unused backups available for file %s", filename);
-        return 0; // No more unused backups available
-    }
-    
-    backup_entry_t* target_backup = &backups[target_backup_idx];
-    
-    // Restore from the target backup
-    char backup_path[512], current_path[512];
-    snprintf(backup_path, sizeof(backup_path), "%s/%s", versions_dir, target_backup->backup_name);
-    snprintf(current_path, sizeof(current_path), "%s/%s", files_dir, filename);
-    
-    FILE* backup_file = fopen(backup_path, "r");
-    if (!backup_file) {
-        write_log("ERROR", "Backup file %s not found during undo", target_backup->backup_name);
+    snprintf(current_path, sizeof(current_path), "data/ss_%d/files/%s", server_port, filename);
+    import_legacy_history(filename, server_port);
+
+    char* content = NULL;
+    size_t length = 0;
+    char author[128] = "";
+    int result = version_store_undo(versions_dir, filename, &content, &length, author, sizeof(author));
+    if (result == 0) {
+        write_log("INFO", "No undo history available for file %s", filename);
+        return 0;
+    }
+    if (result == -1) {
+        write_log("ERROR", "Could not load the previous version of %s during undo", filename);
         return -1;
     }
-    
-    char backup_content[8192] = {0};
-    size_t backup_bytes = fread(backup_content, 1, sizeof(backup_content) - 1, backup_file);
-    fclose(backup_file);
-    backup_content[backup_bytes] = '\0';
-    
-    FILE* current_file = fopen(current_path, "w");
-    if (!current_file) {
-        write_log("ERROR", "Failed to open current file %s for undo", filename);
+
+    if (restore_file_content(current_path, content, length) == -1) {
+        write_log("ERROR", "Failed to rewrite file %s for undo", filename);
+        free(content);
         return -1;
     }
-    
-    fprintf(current_file, "%s", backup_content);
-    fclose(current_file);
-    
-    // Mark this backup as used instead of deleting it
-    target_backup->used = 1;
-    
-    // Rewrite the undo metadata file with updated used flags
-    FILE* new_undo_meta = fopen(undo_meta_path, "w");
-    if (new_undo_meta) {
-        for (int i = 0; i < backup_count; i++) {
-            fprintf(new_undo_meta, "%ld|%s|%s|%d\n", 
-                   backups[i].timestamp, 
-                   backups[i].backup_name, 
-                   backups[i].user,
-                   backups[i].used);
-        }
-        fclose(new_undo_meta);
-    }
-    
-    write_log("INFO", "UNDO completed for %s by %s (restored from %s by %s)", 
-             filename, username, target_backup->backup_name, target_backup->user);
-    
-    // Check if there are more unused backups available
-    int remaining_undos = 0;
-    for (int i = 0; i < backup_count; i++) {
-        if (!backups[i].used) {
-            remaining_undos++;
-        }
-    }
-    
-    if (remaining_undos > 0) {
-        write_log("INFO", "File %s has %d more undo operations available", filename, remaining_undos);
-    } else {
-        write_log("INFO", "File %s has reached the beginning of its history", filename);
-    }
-    
-    return 1; // Success
-}
+    free(content);
 
-// Add checkpoint helper functions at the end of the file (before the client list functions)
+    write_log("INFO", "UNDO completed for %s by %s (restored version saved by %s)",
+              filename, username, author);
+    return 1;
+}
 
 static int create_checkpoint(const char* filename, const char* checkpoint_tag, int server_port, const char* username) {
-    char files_dir[256], checkpoints_dir[256];
-    snprintf(files_dir, sizeof(files_dir), "data/ss_%d/files", server_port);
-    snprintf(checkpoints_dir, sizeof(checkpoints_dir), "data/ss_%d/checkpoints", server_port);
-    
-    // Create checkpoints directory if it doesn't exist
-    mkdir(checkpoints_dir, 0755);
-    
-    char source_path[512];
-    snprintf(source_path, sizeof(source_path), "%s/%s", files_dir, filename);
-    
-    FILE* source = fopen(source_path, "r");
-    if (!source) {
+    int result = push_current_version(filename, server_port, VERSION_CHECKPOINT, checkpoint_tag, username);
+    if (result == 1) {
+        write_log("INFO", "Created checkpoint '%s' for file %s by user %s", checkpoint_tag, filename, username);
+    } else if (result == 0) {
         write_log("ERROR", "CHECKPOINT failed: Source file %s not found", filename);
-        return 0; // File not found
-    }
-    
-    char content[8192] = {0};
-    size_t bytes_read = fread(content, 1, sizeof(content) - 1, source);
-    fclose(source);
-    content[bytes_read] = '\0';
-    
-    // Create checkpoint filename: filename_tag.checkpoint
-    char checkpoint_filename[512];
-    snprintf(checkpoint_filename, sizeof(checkpoint_filename), "%s_%s.checkpoint", filename, checkpoint_tag);
-    
-    char checkpoint_path[512];
-    snprintf(checkpoint_path, sizeof(checkpoint_path), "%s/%s", checkpoints_dir, checkpoint_filename);
-    
-    // Check if checkpoint already exists
-    FILE* existing_check = fopen(checkpoint_path, "r");
-    if (existing_check) {
-        fclose(existing_check);
+    } else if (result == -2) {
         write_log("WARN", "CHECKPOINT failed: Checkpoint %s already exists for file %s", checkpoint_tag, filename);
-        return -2; // Checkpoint already exists
-    }
-    
-    FILE* checkpoint = fopen(checkpoint_path, "w");
-    if (!checkpoint) {
-        write_log("ERROR", "Failed to create checkpoint file for %s", filename);
-        return -1; // Failed to create checkpoint file
-    }
-    
-    fprintf(checkpoint, "%s", content);
-    fclose(checkpoint);
-    
-    // Update checkpoint metadata
-    char checkpoint_meta_dir[256];
-    snprintf(checkpoint_meta_dir, sizeof(checkpoint_meta_dir), "data/ss_%d/checkpoint_meta", server_port);
-    mkdir(checkpoint_meta_dir, 0755);
-    
-    char checkpoint_meta_path[512];
-    snprintf(checkpoint_meta_path, sizeof(checkpoint_meta_path), "%s/%s.meta", checkpoint_meta_dir, filename);
-    
-    FILE* meta_file = fopen(checkpoint_meta_path, "a");
-    if (meta_file) {
-        time_t now = time(NULL);
-        fprintf(meta_file, "%ld|%s|%s|%zu\n", now, checkpoint_tag, username, bytes_read);
-        fclose(meta_file);
+    } else {
+        write_log("ERROR", "Failed to create checkpoint for %s", filename);
     }
-    
-    write_log("INFO", "Created checkpoint '%s' for file %s by user %s", checkpoint_tag, filename, username);
-    return 1; // Success
+    return result;
 }
 
-static int view_checkpoint(const char* filename, const char* checkpoint_tag, int server_port, char* content_buffer, size_t buffer_size) {
-    char checkpoints_dir[256];
-    snprintf(checkpoints_dir, sizeof(checkpoints_dir), "data/ss_%d/checkpoints", server_port);
-    
-    char checkpoint_filename[512];
-    snprintf(checkpoint_filename, sizeof(checkpoint_filename), "%s_%s.checkpoint", filename, checkpoint_tag);
-    
-    char checkpoint_path[512];
-    snprintf(checkpoint_path, sizeof(checkpoint_path), "%s/%s", checkpoints_dir, checkpoint_filename);
-    
-    FILE* checkpoint = fopen(checkpoint_path, "r");
-    if (!checkpoint) {
+static int view_checkpoint(const char* filename, const char* checkpoint_tag, int server_port,
+                           char** out_content, size_t* out_length) {
+    char versions_dir[256];
+    snprintf(versions_dir, sizeof(versions_dir), "data/ss_%d/versions", server_port);
+    import_legacy_history(filename, server_port);
+
+    int result = version_store_checkpoint(versions_dir, filename, checkpoint_tag, out_content, out_length);
+    if (result == 1) {
+        write_log("INFO", "Viewed checkpoint '%s' for file %s (%zu bytes)", checkpoint_tag, filename, *out_length);
+    } else {
         write_log("WARN", "VIEWCHECKPOINT failed: Checkpoint %s not found for file %s", checkpoint_tag, filename);
-        return 0; // Checkpoint not found
     }
-    
-    size_t bytes_read = fread(content_buffer, 1, buffer_size - 1, checkpoint);
-    fclose(checkpoint);
-    content_buffer[bytes_read] = '\0';
-    
-    write_log("INFO", "Viewed checkpoint '%s' for file %s (%zu bytes)", checkpoint_tag, filename, bytes_read);
-    return 1; // Success
+    return result;
 }
 
 static int revert_to_checkpoint(const char* filename, const char* checkpoint_tag, int server_port, const char* username) {
-    char files_dir[256], checkpoints_dir[256];
-    snprintf(files_dir, sizeof(files_dir), "data/ss_%d/files", server_port);
-    snprintf(checkpoints_dir, sizeof(checkpoints_dir), "data/ss_%d/checkpoints", server_port);
-    
-    char checkpoint_filename[512];
-    snprintf(checkpoint_filename, sizeof(checkpoint_filename), "%s_%s.checkpoint", filename, checkpoint_tag);
-    
-    char checkpoint_path[512];
-    snprintf(checkpoint_path, sizeof(checkpoint_path), "%s/%s", checkpoints_dir, checkpoint_filename);
-    
-    FILE* checkpoint = fopen(checkpoint_path, "r");
-    if (!checkpoint) {
+    char current_path[512];
+    snprintf(current_path, sizeof(current_path), "data/ss_%d/files/%s", server_port, filename);
+
+    char* content = NULL;
+    size_t length = 0;
+    int result = view_checkpoint(filename, checkpoint_tag, server_port, &content, &length);
+    if (result != 1) {
         write_log("ERROR", "REVERT failed: Checkpoint %s not found for file %s", checkpoint_tag, filename);
-        return 0; // Checkpoint not found
+        return result;
     }
-    
-    char checkpoint_content[8192] = {0};
-    size_t bytes_read = fread(checkpoint_content, 1, sizeof(checkpoint_content) - 1, checkpoint);
-    fclose(checkpoint);
-    checkpoint_content[bytes_read] = '\0';
-    
-    // Create backup before reverting
+
+    // The reverted-from state goes on the undo stack, so UNDO takes the revert back
     create_file_backup(filename, server_port, username);
-    
-    // Write checkpoint content to current file
-    char current_path[512];
-    snprintf(current_path, sizeof(current_path), "%s/%s", files_dir, filename);
-    
-    FILE* current_file = fopen(current_path, "w");
-    if (!current_file) {
-        write_log("ERROR", "REVERT failed: Could not open current file %s for writing", filename);
-        return -1; // Failed to open current file
+
+    if (restore_file_content(current_path, content, length) == -1) {
+        write_log("ERROR", "REVERT failed: Could not rewrite file %s", filename);
+        free(content);
+        return -1;
     }
-    
-    fprintf(current_file, "%s", checkpoint_content);
-    fclose(current_file);
-    
-    // Update metadata
+    free(content);
+
     char meta_dir[256];
     snprintf(meta_dir, sizeof(meta_dir), "data/ss_%d/metadata", server_port);
     update_metadata_entry(meta_dir, filename);
-    
+    word_index_update(filename, current_path);
+
     write_log("INFO", "Reverted file %s to checkpoint '%s' by user %s", filename, checkpoint_tag, username);
-    return 1; // Success
+    return 1;
 }
 
 static int list_checkpoints(const char* filename, int server_port, char* list_buffer, size_t buffer_size) {
-    char checkpoint_meta_dir[256];
-    snprintf(checkpoint_meta_dir, sizeof(checkpoint_meta_dir), "data/ss_%d/checkpoint_meta", server_port);
-    
-    char checkpoint_meta_path[512];
-    snprintf(checkpoint_meta_path, sizeof(checkpoint_meta_path), "%s/%s.meta", checkpoint_meta_dir, filename);
-    
-    FILE* meta_file = fopen(checkpoint_meta_path, "r");
-    if (!meta_file) {
+    char versions_dir[256];
+    snprintf(versions_dir, sizeof(versions_dir), "data/ss_%d/versions", server_port);
+    import_legacy_history(filename, server_port);
+
+    version_info_t* checkpoints = NULL;
+    int total = version_store_list(versions_dir, filename, VERSION_CHECKPOINT, &checkpoints);
+    if (total <= 0) {
         write_log("INFO", "LISTCHECKPOINTS: No checkpoints found for file %s", filename);
-        strncpy(list_buffer, "No checkpoints available", buffer_size - 1);
-        list_buffer[buffer_size - 1] = '\0';
-        return 0; // No checkpoints found
+        snprintf(list_buffer, buffer_size, "No checkpoints available");
+        return 0;
     }
-    
-    char line[1024];
-    char temp_buffer[8192] = "";
+
+    size_t used = (size_t)snprintf(list_buffer, buffer_size, "Checkpoints for file: %s\n", filename);
     int checkpoint_count = 0;
-    
-    strcat(temp_buffer, "Checkpoints for file: ");
-    strcat(temp_buffer, filename);
-    strcat(temp_buffer, "\n");
-    
-    while (fgets(line, sizeof(line), meta_file)) {
-        long timestamp;
-        char tag[256], user[128];
-        size_t size;
-        
-        if (sscanf(line, "%ld|%255[^|]|%127[^|]|%zu", &timestamp, tag, user, &size) == 4) {
-            char entry[512];
-            struct tm* timeinfo = localtime(&timestamp);
-            char time_str[64];
-            strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", timeinfo);
-            
-            snprintf(entry, sizeof(entry), "  Tag: %s | Created: %s | By: %s | Size: %zu bytes\n", 
-                    tag, time_str, user, size);
-            
-            if (strlen(temp_buffer) + strlen(entry) < sizeof(temp_buffer) - 1) {
-                strcat(temp_buffer, entry);
-                checkpoint_count++;
-            }
-        }
-    }
-    fclose(meta_file);
-    
-    if (checkpoint_count == 0) {
-        strcat(temp_buffer, "  No valid checkpoints found\n");
-    } else {
-        char count_str[64];
-        snprintf(count_str, sizeof(count_str), "Total checkpoints: %d\n", checkpoint_count);
-        strcat(temp_buffer, count_str);
-    }
-    
-    strncpy(list_buffer, temp_buffer, buffer_size - 1);
-    list_buffer[buffer_size - 1] = '\0';
-    
+    for (int i = 0; i < total; i++) {
+        char time_str[64];
+        struct tm* timeinfo = localtime(&checkpoints[i].created);
+        strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", timeinfo);
+
+        char entry[512];
+        int n = snprintf(entry, sizeof(entry), "  Tag: %s | Created: %s | By: %s | Size: %zu bytes\n",
+                         checkpoints[i].tag, time_str, checkpoints[i].user, checkpoints[i].size);
+        if (used + n + 64 >= buffer_size) break; // Leave room for the total line
+        memcpy(list_buffer + used, entry, n + 1);
+        used += n;
+        checkpoint_count++;
+    }
+    free(checkpoints);
+    snprintf(list_buffer + used, buffer_size - used, "Total checkpoints: %d\n", checkpoint_count);
+
     write_log("INFO", "Listed %d checkpoints for file %s", checkpoint_count, filename);
     return checkpoint_count;
 }
@@ -2420,7 +2279,9 @@ static void add_client_fd(int fd) {
     node->fd = fd;
     node->next = client_list;
     client_list = node;
+    client_count++;
     pthread_mutex_unlock(&client_lock);
+    metrics_gauge_add("connected_clients", 1);
 }
 
 static void remove_client_fd(int fd) {
@@ -2433,6 +2294,8 @@ static void remove_client_fd(int fd) {
             else
                 client_list = curr->next;
             free(curr);
+            client_count--;
+            metrics_gauge_add("connected_clients", -1);
             break;
         }
         prev = curr;
@@ -2480,11 +2343,10 @@ static int check_file_owner(const char* filename, const char* username, int serv
     char meta_dir[256];
     snprintf(meta_dir, sizeof(meta_dir), "data/ss_%d/metadata", server_port);
     
-    // Check the file_table for ownership
-    for (int i = 0; i < file_count; i++) {
-        if (strcmp(file_table[i].filename, filename) == 0) {
-            return strcmp(file_table[i].owner_username, username) == 0 ? 1 : 0;
-        }
+    // Check the metadata record for ownership
+    FileMeta file;
+    if (persist_get_file(filename, &file) == 0) {
+        return strcmp(file.owner_username, username) == 0 ? 1 : 0;
     }
     return 0; // File not found or not owner
 }
@@ -2578,10 +2440,12 @@ static int list_access_requests(const char* filename, const char* owner_username
         // List all requests for files owned by this user
         strcat(temp_buffer, "All pending access requests for your files:\n");
         
+        int file_count = 0;
+        FileMeta* files = persist_snapshot_files(&file_count);
         for (int i = 0; i < file_count; i++) {
-            if (strcmp(file_table[i].owner_username, owner_username) == 0) {
+            if (strcmp(files[i].owner_username, owner_username) == 0) {
                 char request_file_path[512];
-                snprintf(request_file_path, sizeof(request_file_path), "%s/%s.requests", requests_dir, file_table[i].filename);
+                snprintf(request_file_path, sizeof(request_file_path), "%s/%s.requests", requests_dir, files[i].filename);
                 
                 FILE* request_file = fopen(request_file_path, "r");
                 if (request_file) {
@@ -2595,7 +2459,7 @@ static int list_access_requests(const char* filename, const char* owner_username
                             if (strcmp(status, "PENDING") == 0) {
                                 if (!file_has_requests) {
                                     char file_header[256];
-                                    snprintf(file_header, sizeof(file_header), "\nFile: %s\n", file_table[i].filename);
+                                    snprintf(file_header, sizeof(file_header), "\nFile: %s\n", files[i].filename);
                                     strcat(temp_buffer, file_header);
                                     file_has_requests = 1;
                                 }
@@ -2619,6 +2483,7 @@ static int list_access_requests(const char* filename, const char* owner_username
                 }
             }
         }
+        free(files);
     }
     
     if (total_requests == 0 && strlen(temp_buffer) < 100) {
@@ -1,12 +1,43 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <time.h>
 #include "../../include/persistence.h"
+#include "../../include/hash.h"
 
-FileMeta file_table[MAX_FILES];
-int file_count = 0;
+static FileMeta **file_table = NULL;
+static int file_count = 0;
+static int file_capacity = 0;
+static FileMeta **file_index = NULL;  // Filename hash chains over file_table
+static unsigned int index_buckets = 0;
+
+static metadata_change_hook change_hook = NULL;
+
+// Every mutation below happens under journal_mutex, which also guards the
+// journal itself, so the flusher never sees a half-updated table.
+static pthread_mutex_t journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Serializes writers of metadata.bin.tmp; taken alone by compaction, or
+// with journal_mutex held by everything else (never the other way round)
+static pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE* journal = NULL;          // NULL until persist_journal_start()
+static char journal_meta_dir[256];
+static int journal_unsynced = 0;      // Appends since the last fdatasync
+static int journal_records = 0;       // Records since the last compaction
+static uint64_t metadata_epoch = 0;   // Highest version handed out (persisted in metadata.bin)
+static time_t last_access_flush = 0;
+static int journal_running = 0;
+static pthread_t journal_tid;
+
+void persist_set_change_hook(metadata_change_hook hook) {
+    change_hook = hook;
+}
 
 // Internal helper to get file size
 static long get_file_size(const char *path) {
@@ -22,11 +53,11 @@ static long get_file_size(const char *path) {
 static long count_words_in_file(const char *path) {
     FILE *f = fopen(path, "r");
     if (!f) return 0;
-    
+
     long word_count = 0;
     int c;
     int in_word = 0;
-    
+
     while ((c = fgetc(f)) != EOF) {
         if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
             if (in_word) {
@@ -37,295 +68,1065 @@ static long count_words_in_file(const char *path) {
             in_word = 1;
         }
     }
-    
+
     // Count last word if file doesn't end with whitespace
     if (in_word) {
         word_count++;
     }
-    
+
     fclose(f);
     return word_count;
 }
 
-int load_metadata(const char *meta_dir) {
-    char path[512];
-    snprintf(path, sizeof(path), "%s/metadata.txt", meta_dir);
+// =========================================================================
+//  TABLE HELPERS (journal_mutex must be HELD)
+// =========================================================================
 
-    FILE *f = fopen(path, "r");
-    if (!f) return 0; // no metadata yet
+static int rehash_index(unsigned int buckets) {
+    FileMeta **grown = calloc(buckets, sizeof(FileMeta *));
+    if (!grown) return -1;
+    for (int i = 0; i < file_count; i++) {
+        FileMeta *e = file_table[i];
+        unsigned int b = fnv1a_hash(e->filename) & (buckets - 1);
+        e->hash_next = grown[b];
+        grown[b] = e;
+    }
+    free(file_index);
+    file_index = grown;
+    index_buckets = buckets;
+    return 0;
+}
 
+static FileMeta *find_entry(const char *filename) {
+    if (index_buckets == 0) return NULL;
+    FileMeta *e = file_index[fnv1a_hash(filename) & (index_buckets - 1)];
+    while (e && strcmp(e->filename, filename) != 0) e = e->hash_next;
+    return e;
+}
+
+static int find_index(const char *filename) {
+    FileMeta *e = find_entry(filename);
+    return e ? e->slot : -1;
+}
+
+/**
+ * @brief Appends a zeroed record for 'filename' (which must not exist yet).
+ * @return The new record, or NULL if memory ran out.
+ */
+static FileMeta *append_entry(const char *filename) {
+    if (file_count == file_capacity) {
+        int capacity = file_capacity ? file_capacity * 2 : FILE_TABLE_INITIAL_BUCKETS;
+        FileMeta **grown = realloc(file_table, sizeof(FileMeta *) * capacity);
+        if (!grown) return NULL;
+        file_table = grown;
+        file_capacity = capacity;
+    }
+    // Keep the load factor at or below one chain entry per bucket
+    if ((unsigned int)file_count >= index_buckets &&
+        rehash_index(index_buckets ? index_buckets * 2 : FILE_TABLE_INITIAL_BUCKETS) != 0) {
+        return NULL;
+    }
+    FileMeta *e = calloc(1, sizeof(FileMeta));
+    if (!e) return NULL;
+    strncpy(e->filename, filename, sizeof(e->filename) - 1);
+    unsigned int b = fnv1a_hash(e->filename) & (index_buckets - 1);
+    e->hash_next = file_index[b];
+    file_index[b] = e;
+    e->slot = file_count;
+    file_table[file_count++] = e;
+    return e;
+}
+
+static void upsert_entry(const FileMeta *record) {
+    FileMeta *e = find_entry(record->filename);
+    if (!e && !(e = append_entry(record->filename))) return;
+    FileMeta *next = e->hash_next;
+    int slot = e->slot;
+    *e = *record;
+    e->hash_next = next;
+    e->slot = slot;
+}
+
+// O(1): unlinks the record and moves the last one into its slot
+static void remove_index(int i) {
+    FileMeta *e = file_table[i];
+    FileMeta **link = &file_index[fnv1a_hash(e->filename) & (index_buckets - 1)];
+    while (*link != e) link = &(*link)->hash_next;
+    *link = e->hash_next;
+    file_table[i] = file_table[--file_count];
+    file_table[i]->slot = i;
+    free(e);
+}
+
+static void clear_table(void) {
+    for (int i = 0; i < file_count; i++) free(file_table[i]);
     file_count = 0;
-    // New metadata format per-line:
-    // filename,size,word_count,created,modified,last_accessed,last_accessed_by,owner,acl_count,acl_entries
-    // where acl_entries is of the form: user1:perm;user2:perm;... (semicolon separated)
-    char line[2048];
-    while (fgets(line, sizeof(line), f) && file_count < MAX_FILES) {
-        // Trim newline
-        char *nl = strchr(line, '\n'); if (nl) *nl = '\0';
+    if (index_buckets) memset(file_index, 0, sizeof(FileMeta *) * index_buckets);
+}
 
-        // Use strtok to split by commas
-        char *saveptr = NULL;
-        char *tok = strtok_r(line, ",", &saveptr);
-        if (!tok) continue;
-        strncpy(file_table[file_count].filename, tok, 255);
+// =========================================================================
+//  RECORD FORMAT
+// =========================================================================
 
-        tok = strtok_r(NULL, ",", &saveptr);
-        if (!tok) continue;
-        file_table[file_count].size = atol(tok);
+// Per-line text record format (journal and legacy metadata.txt):
+// filename,size,word_count,created,modified,last_accessed,last_accessed_by,owner,folder,acl_count,acl_entries
+// where acl_entries is of the form: user1:perm;user2:perm;... (semicolon separated)
 
-        tok = strtok_r(NULL, ",", &saveptr);
-        if (!tok) continue;
-        file_table[file_count].word_count = atol(tok);
+/**
+ * @brief Parses one record line (modified in place).
+ * @return 0 on success, -1 if the line is truncated.
+ */
+static int parse_record(char *line, FileMeta *out) {
+    memset(out, 0, sizeof(*out));
 
-        tok = strtok_r(NULL, ",", &saveptr);
-        if (!tok) continue;
-        file_table[file_count].created = (time_t)atol(tok);
+    // Use strtok to split by commas
+    char *saveptr = NULL;
+    char *tok = strtok_r(line, ",", &saveptr);
+    if (!tok) return -1;
+    strncpy(out->filename, tok, 255);
 
-        tok = strtok_r(NULL, ",", &saveptr);
-        if (!tok) continue;
-        file_table[file_count].modified = (time_t)atol(tok);
+    tok = strtok_r(NULL, ",", &saveptr);
+    if (!tok) return -1;
+    out->size = atol(tok);
 
-        tok = strtok_r(NULL, ",", &saveptr);
-        if (!tok) continue;
-        file_table[file_count].last_accessed = (time_t)atol(tok);
+    tok = strtok_r(NULL, ",", &saveptr);
+    if (!tok) return -1;
+    out->word_count = atol(tok);
 
-        // last_accessed_by
-        tok = strtok_r(NULL, ",", &saveptr);
-        if (tok && strcmp(tok, "-") != 0) {
-            strncpy(file_table[file_count].last_accessed_by, tok, 64 - 1);
-        } else {
-            file_table[file_count].last_accessed_by[0] = '\0';
-        }
+    tok = strtok_r(NULL, ",", &saveptr);
+    if (!tok) return -1;
+    out->created = (time_t)atol(tok);
 
-        // Owner
-        tok = strtok_r(NULL, ",", &saveptr);
-        if (tok && strcmp(tok, "-") != 0) {
-            strncpy(file_table[file_count].owner_username, tok, 64 - 1);
-        } else {
-            file_table[file_count].owner_username[0] = '\0';
-        }
+    tok = strtok_r(NULL, ",", &saveptr);
+    if (!tok) return -1;
+    out->modified = (time_t)atol(tok);
 
-        // Folder (new field)
-        tok = strtok_r(NULL, ",", &saveptr);
-        if (tok && strcmp(tok, "-") != 0) {
-            strncpy(file_table[file_count].folder, tok, 255);
-        } else {
-            file_table[file_count].folder[0] = '\0';
-        }
+    tok = strtok_r(NULL, ",", &saveptr);
+    if (!tok) return -1;
+    out->last_accessed = (time_t)atol(tok);
+
+    // last_accessed_by
+    tok = strtok_r(NULL, ",", &saveptr);
+    if (tok && strcmp(tok, "-") != 0) {
+        strncpy(out->last_accessed_by, tok, 64 - 1);
+    }
+
+    // Owner
+    tok = strtok_r(NULL, ",", &saveptr);
+    if (tok && strcmp(tok, "-") != 0) {
+        strncpy(out->owner_username, tok, 64 - 1);
+    }
+
+    // Folder (new field)
+    tok = strtok_r(NULL, ",", &saveptr);
+    if (tok && strcmp(tok, "-") != 0) {
+        strncpy(out->folder, tok, 255);
+    }
+
+    // ACL count
+    tok = strtok_r(NULL, ",", &saveptr);
+    int acl_count = 0;
+    if (tok) acl_count = atoi(tok);
 
-        // ACL count
-        tok = strtok_r(NULL, ",", &saveptr);
-        int acl_count = 0;
-        if (tok) acl_count = atoi(tok);
-        file_table[file_count].acl_count = 0;
-
-        // ACL entries (rest of the line)
-        tok = strtok_r(NULL, "", &saveptr); // get remaining string (may be NULL)
-        if (tok && acl_count > 0) {
-            // tok contains something like: user1:1;user2:2;...
-            char *acl_save = NULL;
-            char *acl_tok = strtok_r(tok, ";", &acl_save);
-            while (acl_tok && file_table[file_count].acl_count < MAX_ACL_ENTRIES) {
-                char *sep = strchr(acl_tok, ':');
-                if (sep) {
-                    *sep = '\0';
-                    const char *uname = acl_tok;
-                    int perm = atoi(sep + 1);
-                    strncpy(file_table[file_count].acl[file_table[file_count].acl_count].username, uname, 64 - 1);
-                    file_table[file_count].acl[file_table[file_count].acl_count].permission = perm;
-                    file_table[file_count].acl_count++;
-                }
-                acl_tok = strtok_r(NULL, ";", &acl_save);
+    // ACL entries (rest of the line)
+    tok = strtok_r(NULL, "", &saveptr); // get remaining string (may be NULL)
+    if (tok && acl_count > 0) {
+        // tok contains something like: user1:1;user2:2;...
+        char *acl_save = NULL;
+        char *acl_tok = strtok_r(tok, ";", &acl_save);
+        while (acl_tok && out->acl_count < MAX_ACL_ENTRIES) {
+            char *sep = strchr(acl_tok, ':');
+            if (sep) {
+                *sep = '\0';
+                strncpy(out->acl[out->acl_count].username, acl_tok, 64 - 1);
+                out->acl[out->acl_count].permission = atoi(sep + 1);
+                out->acl_count++;
             }
+            acl_tok = strtok_r(NULL, ";", &acl_save);
         }
+    }
+    return 0;
+}
+
+static void write_record(FILE *f, const FileMeta *file) {
+    fprintf(f, "%s,%ld,%ld,%ld,%ld,%ld,",
+            file->filename,
+            file->size,
+            file->word_count,
+            (long)file->created,
+            (long)file->modified,
+            (long)file->last_accessed);
 
-        file_count++;
+    fprintf(f, "%s,", file->last_accessed_by[0] != '\0' ? file->last_accessed_by : "-");
+    fprintf(f, "%s,", file->owner_username[0] != '\0' ? file->owner_username : "-");
+    fprintf(f, "%s,", file->folder[0] != '\0' ? file->folder : "-");
+    fprintf(f, "%d,", file->acl_count);
+
+    // ACL entries as user:perm;user:perm;...
+    for (int j = 0; j < file->acl_count; j++) {
+        fprintf(f, "%s:%d;", file->acl[j].username, file->acl[j].permission);
     }
-    fclose(f);
-    printf("[INFO] Loaded %d metadata entries from %s\n", file_count, path);
-    return file_count;
+    fprintf(f, "\n");
 }
 
-int save_metadata(const char *meta_dir) {
+// =========================================================================
+//  BINARY SNAPSHOT (metadata.bin)
+// =========================================================================
+
+// Fixed-width on-disk layout, independent of FileMeta's in-memory padding.
+// Bump METADATA_BIN_VERSION whenever it changes. Fields are only ever
+// appended, so an older file is read as a prefix of the current layout
+// (using its own record_size) and the next snapshot rewrites it.
+#define METADATA_BIN_MAGIC   "SSMETA\0\0"
+#define METADATA_BIN_VERSION 3
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;   // sizeof(MetaDiskRecord) when written
+    uint32_t record_count;
+    uint32_t checksum;      // CRC-32 of the record area
+    uint64_t epoch;         // v2: metadata_epoch when written
+} MetaDiskHeader;
+
+#define METADATA_BIN_V1_HEADER_SIZE offsetof(MetaDiskHeader, epoch)
+
+typedef struct {
+    char username[64];
+    int32_t permission;
+} MetaDiskAcl;
+
+typedef struct {
+    char filename[256];
+    int64_t size;
+    int64_t word_count;
+    int64_t created;
+    int64_t modified;
+    int64_t last_accessed;
+    char last_accessed_by[64];
+    char owner_username[64];
+    char folder[256];
+    int32_t acl_count;
+    MetaDiskAcl acl[MAX_ACL_ENTRIES];
+    uint64_t version;       // v2
+    int32_t replica;        // v3
+} MetaDiskRecord;
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void init_crc_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+// Compaction checksums outside journal_mutex, so the table is built once
+static uint32_t crc32_update(uint32_t crc, const void *data, size_t length) {
+    pthread_once(&crc_table_once, init_crc_table);
+    const unsigned char *p = data;
+    crc = ~crc;
+    while (length--) crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void to_disk_record(const FileMeta *file, MetaDiskRecord *rec) {
+    memset(rec, 0, sizeof(*rec));
+    memcpy(rec->filename, file->filename, sizeof(rec->filename));
+    rec->size = file->size;
+    rec->word_count = file->word_count;
+    rec->created = (int64_t)file->created;
+    rec->modified = (int64_t)file->modified;
+    rec->last_accessed = (int64_t)file->last_accessed;
+    memcpy(rec->last_accessed_by, file->last_accessed_by, sizeof(rec->last_accessed_by));
+    memcpy(rec->owner_username, file->owner_username, sizeof(rec->owner_username));
+    memcpy(rec->folder, file->folder, sizeof(rec->folder));
+    rec->acl_count = file->acl_count;
+    for (int j = 0; j < file->acl_count && j < MAX_ACL_ENTRIES; j++) {
+        memcpy(rec->acl[j].username, file->acl[j].username, sizeof(rec->acl[j].username));
+        rec->acl[j].permission = file->acl[j].permission;
+    }
+    rec->version = file->version;
+    rec->replica = file->replica;
+}
+
+static void from_disk_record(const MetaDiskRecord *rec, FileMeta *file) {
+    memset(file, 0, sizeof(*file));
+    memcpy(file->filename, rec->filename, sizeof(file->filename) - 1);
+    file->size = (long)rec->size;
+    file->word_count = (long)rec->word_count;
+    file->created = (time_t)rec->created;
+    file->modified = (time_t)rec->modified;
+    file->last_accessed = (time_t)rec->last_accessed;
+    memcpy(file->last_accessed_by, rec->last_accessed_by, sizeof(file->last_accessed_by) - 1);
+    memcpy(file->owner_username, rec->owner_username, sizeof(file->owner_username) - 1);
+    memcpy(file->folder, rec->folder, sizeof(file->folder) - 1);
+    file->acl_count = rec->acl_count < 0 ? 0 :
+                      rec->acl_count > MAX_ACL_ENTRIES ? MAX_ACL_ENTRIES : rec->acl_count;
+    for (int j = 0; j < file->acl_count; j++) {
+        memcpy(file->acl[j].username, rec->acl[j].username, sizeof(file->acl[j].username) - 1);
+        file->acl[j].permission = rec->acl[j].permission;
+    }
+    file->version = rec->version;
+    file->replica = rec->replica != 0;
+    file->replica_behind = file->replica; // Until the NS sends a fresh copy
+}
+
+/**
+ * @brief Maps metadata.bin and loads it into file_table if it validates.
+ * @return Records loaded, or -1 if the file is missing, stale or corrupt.
+ */
+static int load_binary_snapshot(const char *meta_dir) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/metadata.bin", meta_dir);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < METADATA_BIN_V1_HEADER_SIZE) {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    const MetaDiskHeader *header = map;
+    size_t header_size = 0, record_size = 0;
+    if (memcmp(header->magic, METADATA_BIN_MAGIC, sizeof(header->magic)) == 0) {
+        if (header->version == METADATA_BIN_VERSION) {
+            header_size = sizeof(MetaDiskHeader);
+            record_size = sizeof(MetaDiskRecord);
+        } else if (header->version == 2) {
+            header_size = sizeof(MetaDiskHeader);
+            record_size = offsetof(MetaDiskRecord, replica);
+        } else if (header->version == 1) {
+            header_size = METADATA_BIN_V1_HEADER_SIZE;
+            record_size = offsetof(MetaDiskRecord, version);
+        }
+    }
+    int loaded = -1;
+    if (header_size > 0 && (size_t)st.st_size >= header_size &&
+        header->record_size == record_size &&
+        (size_t)st.st_size - header_size == (size_t)header->record_count * record_size &&
+        crc32_update(0, (const char *)map + header_size, (size_t)st.st_size - header_size) == header->checksum) {
+        clear_table();
+        if (header->version >= 2 && header->epoch > metadata_epoch) {
+            metadata_epoch = header->epoch;
+        }
+        MetaDiskRecord disk;
+        FileMeta record;
+        for (uint32_t i = 0; i < header->record_count; i++) {
+            memset(&disk, 0, sizeof(disk)); // Fields an older version lacks read as zero
+            memcpy(&disk, (const char *)map + header_size + (size_t)i * record_size, record_size);
+            from_disk_record(&disk, &record);
+            if (record.version > metadata_epoch) metadata_epoch = record.version;
+            upsert_entry(&record);
+        }
+        loaded = file_count;
+    }
+    munmap(map, st.st_size);
+    if (loaded < 0) {
+        // Keep it for inspection rather than letting the next snapshot overwrite it
+        char aside[520];
+        snprintf(aside, sizeof(aside), "%s.corrupt", path);
+        rename(path, aside);
+        fprintf(stderr, "[WARN] Invalid metadata snapshot moved to %s\n", aside);
+    }
+    return loaded;
+}
+
+/**
+ * @brief Parses the legacy text snapshot (metadata.txt) into file_table.
+ * @return Records loaded, or -1 if there is none.
+ */
+static int load_text_snapshot(const char *meta_dir) {
     char path[512];
     snprintf(path, sizeof(path), "%s/metadata.txt", meta_dir);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
 
-    FILE *f = fopen(path, "w");
+    clear_table();
+    char line[2048];
+    FileMeta record;
+    while (fgets(line, sizeof(line), f)) {
+        char *nl = strchr(line, '\n'); if (nl) *nl = '\0';
+        if (parse_record(line, &record) == 0) {
+            upsert_entry(&record);
+        }
+    }
+    fclose(f);
+    return file_count;
+}
+
+/**
+ * @brief Copies the table into its on-disk form (journal_mutex must be HELD).
+ * Only memory is touched, so compaction can write the copy unlocked.
+ * @return malloc'd records (header.record_count of them), or NULL if memory ran out.
+ */
+static MetaDiskRecord *copy_snapshot_locked(MetaDiskHeader *header) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, METADATA_BIN_MAGIC, sizeof(header->magic));
+    header->version = METADATA_BIN_VERSION;
+    header->record_size = sizeof(MetaDiskRecord);
+    header->record_count = (uint32_t)file_count;
+    header->epoch = metadata_epoch;
+
+    MetaDiskRecord *records = calloc(file_count > 0 ? file_count : 1, sizeof(MetaDiskRecord));
+    if (!records) return NULL;
+    for (int i = 0; i < file_count; i++) {
+        to_disk_record(file_table[i], &records[i]);
+    }
+    return records;
+}
+
+/**
+ * @brief Writes a copied table to metadata.bin via a synced temp file and
+ * rename, and frees 'records'. Once that succeeds a legacy metadata.txt
+ * is obsolete and is removed. Takes snapshot_mutex only.
+ */
+static int write_snapshot(const char *meta_dir, MetaDiskHeader *header, MetaDiskRecord *records) {
+    char path[512], tmp_path[520];
+    snprintf(path, sizeof(path), "%s/metadata.bin", meta_dir);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    uint32_t count = header->record_count;
+    header->checksum = crc32_update(0, records, (size_t)count * sizeof(MetaDiskRecord));
+
+    pthread_mutex_lock(&snapshot_mutex);
+    FILE *f = fopen(tmp_path, "w");
     if (!f) {
+        pthread_mutex_unlock(&snapshot_mutex);
         perror("save_metadata fopen");
+        free(records);
         return -1;
     }
+    int ok = fwrite(header, sizeof(*header), 1, f) == 1 &&
+             (count == 0 || fwrite(records, sizeof(MetaDiskRecord), count, f) == count);
+    free(records);
+    if (ok) ok = fflush(f) == 0 && fsync(fileno(f)) == 0;
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || rename(tmp_path, path) != 0) {
+        perror("save_metadata rename");
+        remove(tmp_path);
+        pthread_mutex_unlock(&snapshot_mutex);
+        return -1;
+    }
+    pthread_mutex_unlock(&snapshot_mutex);
+
+    char text_path[512];
+    snprintf(text_path, sizeof(text_path), "%s/metadata.txt", meta_dir);
+    remove(text_path);
+    return 0;
+}
+
+// Without a journal (startup, or it could not be opened) every change
+// rewrites the snapshot in place, under the lock
+static int save_snapshot_locked(const char *meta_dir) {
+    MetaDiskHeader header;
+    MetaDiskRecord *records = copy_snapshot_locked(&header);
+    if (!records) return -1;
+    return write_snapshot(meta_dir, &header, records);
+}
+
+/**
+ * @brief Records the current state of one file: a journal append when the
+ * journal is running, a full snapshot otherwise.
+ */
+static void commit_entry_locked(const char *meta_dir, FileMeta *file) {
+    file->version = ++metadata_epoch;
+    if (journal == NULL) {
+        save_snapshot_locked(meta_dir);
+        return;
+    }
+    // A replica's record is tagged C (copy); the fields are the same
+    fprintf(journal, "%c,%llu,", file->replica ? 'C' : 'R', (unsigned long long)file->version);
+    write_record(journal, file);
+    fflush(journal); // In the kernel now; durable at the next group sync
+    journal_unsynced++;
+    journal_records++;
+}
+
+static void commit_delete_locked(const char *meta_dir, const char *filename) {
+    if (journal == NULL) {
+        save_snapshot_locked(meta_dir);
+        return;
+    }
+    fprintf(journal, "D,%s\n", filename);
+    fflush(journal);
+    journal_unsynced++;
+    journal_records++;
+}
+
+// =========================================================================
+//  LOAD / SAVE
+// =========================================================================
+
+/**
+ * @brief Replays one journal segment over the table (journal_mutex must be HELD).
+ * Records are whole-file states, so replaying one already in the
+ * snapshot is harmless. A torn final append is cut off, so the next
+ * append starts on a line of its own.
+ * @return Records replayed, or -1 if the segment does not exist.
+ */
+static int replay_journal_locked(const char *path) {
+    FILE *j = fopen(path, "r");
+    if (!j) return -1;
+    int replayed = 0;
+    long complete = 0; // Bytes up to the end of the last whole line
+    char line[2048];
+    FileMeta record;
+    while (fgets(line, sizeof(line), j)) {
+        char *nl = strchr(line, '\n');
+        if (!nl) break; // Torn final append
+        complete = ftell(j);
+        *nl = '\0';
+        char *body = NULL;
+        unsigned long long version = 0;
+        if (strncmp(line, "R,", 2) == 0 || strncmp(line, "C,", 2) == 0) { // R|C,<version>,<record>
+            version = strtoull(line + 2, &body, 10);
+            body = (*body == ',') ? body + 1 : NULL;
+        } else if (strncmp(line, "U,", 2) == 0) { // Unversioned (older journals)
+            body = line + 2;
+        }
+        if (body && parse_record(body, &record) == 0) {
+            record.version = version;
+            record.replica = record.replica_behind = line[0] == 'C';
+            // Count it even if a later D, drops the record, so versions are never reissued
+            if (version > metadata_epoch) metadata_epoch = version;
+            upsert_entry(&record);
+            replayed++;
+        } else if (strncmp(line, "D,", 2) == 0) {
+            int i = find_index(line + 2);
+            if (i != -1) remove_index(i);
+            replayed++;
+        }
+    }
+    fseek(j, 0, SEEK_END);
+    int torn = ftell(j) > complete;
+    fclose(j);
+    if (torn && truncate(path, complete) != 0) perror("replay_journal truncate");
+    return replayed;
+}
+
+int load_metadata(const char *meta_dir) {
+    pthread_mutex_lock(&journal_mutex);
+    clear_table();
+    // Prefer the binary snapshot; fall back to (and later migrate) the text one
+    const char *source = "metadata.bin";
+    int snapshot = load_binary_snapshot(meta_dir);
+    if (snapshot < 0) {
+        source = "metadata.txt";
+        snapshot = load_text_snapshot(meta_dir);
+        if (snapshot >= 0) journal_records = METADATA_COMPACT_RECORDS; // Migrate at the first compaction
+    }
+    if (snapshot < 0) clear_table();
+
+    // Replay mutations made since that snapshot: first the segment a
+    // compaction was folding in when it stopped (if any), then the live one
+    char journal_path[512], rotated_path[520];
+    snprintf(journal_path, sizeof(journal_path), "%s/metadata.journal", meta_dir);
+    snprintf(rotated_path, sizeof(rotated_path), "%s.old", journal_path);
+    int rotated = replay_journal_locked(rotated_path);
+    int live = replay_journal_locked(journal_path);
+    int replayed = (rotated > 0 ? rotated : 0) + (live > 0 ? live : 0);
+    if (rotated >= 0) journal_records = METADATA_COMPACT_RECORDS; // Finish that compaction
+    int loaded = file_count;
+    pthread_mutex_unlock(&journal_mutex);
+
+    if (snapshot < 0 && rotated < 0 && live < 0) return 0; // no metadata yet
+    printf("[INFO] Loaded %d metadata entries from %s/%s (%d journal records)\n",
+           loaded, meta_dir, snapshot >= 0 ? source : "metadata.journal", replayed);
+    return loaded;
+}
+
+int save_metadata(const char *meta_dir) {
+    pthread_mutex_lock(&journal_mutex);
+    int rc = save_snapshot_locked(meta_dir);
+    pthread_mutex_unlock(&journal_mutex);
+    return rc;
+}
+
+// =========================================================================
+//  JOURNAL (group commit + compaction)
+// =========================================================================
+
+/**
+ * @brief Journals every coalesced access time (journal_mutex must be HELD).
+ * @return malloc'd copies of the flushed records for the change hook,
+ * run once the lock is dropped (NULL if none or no hook).
+ */
+static FileMeta *flush_access_times_locked(int *out_count) {
+    FileMeta *flushed = NULL;
+    int count = 0, capacity = 0;
     for (int i = 0; i < file_count; i++) {
-        // Write: filename,size,word_count,created,modified,last_accessed,last_accessed_by,owner,acl_count,acl_entries
-        fprintf(f, "%s,%ld,%ld,%ld,%ld,%ld,",
-                file_table[i].filename,
-                file_table[i].size,
-                file_table[i].word_count,
-                (long)file_table[i].created,
-                (long)file_table[i].modified,
-                (long)file_table[i].last_accessed);
-        
-        if (file_table[i].last_accessed_by[0] != '\0') {
-            fprintf(f, "%s,", file_table[i].last_accessed_by);
-        } else {
-            fprintf(f, "-,");
+        if (file_table[i]->access_dirty) {
+            file_table[i]->access_dirty = 0;
+            commit_entry_locked(journal_meta_dir, file_table[i]);
+            if (change_hook == NULL) continue;
+            if (count == capacity) {
+                int grown_capacity = capacity ? capacity * 2 : 16;
+                FileMeta *grown = realloc(flushed, sizeof(FileMeta) * grown_capacity);
+                if (!grown) continue; // The NS just misses this access time
+                flushed = grown;
+                capacity = grown_capacity;
+            }
+            flushed[count++] = *file_table[i];
         }
+    }
+    last_access_flush = time(NULL);
+    *out_count = count;
+    return flushed;
+}
 
-        if (file_table[i].owner_username[0] != '\0') {
-            fprintf(f, "%s,", file_table[i].owner_username);
-        } else {
-            fprintf(f, "-,");
+/**
+ * @brief Folds the journal into metadata.bin. Only the table copy and the
+ * switch to a fresh journal segment happen under journal_mutex; the
+ * snapshot is written and synced with the lock released, while new
+ * changes go to the fresh segment.
+ *
+ * On disk: metadata.journal is renamed to metadata.journal.old, which the
+ * new snapshot covers and which is only removed once that snapshot is
+ * in place. A crash anywhere replays snapshot, .old, then the live
+ * segment. If .old is still there (its snapshot failed), the journal is
+ * left alone and only the snapshot is retried.
+ */
+static void compact(void) {
+    char journal_path[512], rotated_path[520];
+    snprintf(journal_path, sizeof(journal_path), "%s/metadata.journal", journal_meta_dir);
+    snprintf(rotated_path, sizeof(rotated_path), "%s.old", journal_path);
+
+    pthread_mutex_lock(&journal_mutex);
+    FILE *retired = NULL;
+    int rotate = access(rotated_path, F_OK) != 0;
+    if (rotate) {
+        fflush(journal);
+        FILE *fresh = NULL;
+        if (rename(journal_path, rotated_path) == 0) {
+            fresh = fopen(journal_path, "a");
+            if (!fresh) rename(rotated_path, journal_path); // Keep appending to the old one
         }
-        // Folder
-        if (file_table[i].folder[0] != '\0') {
-            fprintf(f, "%s,", file_table[i].folder);
-        } else {
-            fprintf(f, "-,");
+        if (!fresh) {
+            pthread_mutex_unlock(&journal_mutex);
+            return;
         }
-        
-        fprintf(f, "%d,", file_table[i].acl_count);
+        retired = journal;
+        journal = fresh;
+        journal_unsynced = 0;
+    }
+    MetaDiskHeader header;
+    MetaDiskRecord *records = copy_snapshot_locked(&header);
+    int previous_records = journal_records;
+    journal_records = 0;
+    pthread_mutex_unlock(&journal_mutex);
+
+    if (retired) {
+        fdatasync(fileno(retired)); // Its tail, in case the snapshot below fails
+        fclose(retired);
+    }
+    if (records && write_snapshot(journal_meta_dir, &header, records) == 0) {
+        remove(rotated_path); // Everything in it is in the snapshot now
+        return;
+    }
+    pthread_mutex_lock(&journal_mutex);
+    journal_records += previous_records; // Try again at the next tick
+    pthread_mutex_unlock(&journal_mutex);
+}
+
+static void* journal_thread(void* arg) {
+    (void)arg;
+    struct timespec pause = { 0, METADATA_JOURNAL_SYNC_MS * 1000000L };
+    while (1) {
+        nanosleep(&pause, NULL);
 
-        // ACL entries as user:perm;user:perm;...
-        for (int j = 0; j < file_table[i].acl_count; j++) {
-            fprintf(f, "%s:%d;", file_table[i].acl[j].username, file_table[i].acl[j].permission);
+        pthread_mutex_lock(&journal_mutex);
+        int running = journal_running;
+        FileMeta *accessed = NULL;
+        int accessed_count = 0;
+        if (METADATA_ACCESS_FLUSH_SEC > 0 &&
+            (!running || time(NULL) - last_access_flush >= METADATA_ACCESS_FLUSH_SEC)) {
+            accessed = flush_access_times_locked(&accessed_count);
         }
-        fprintf(f, "\n");
+        int fd = -1;
+        if (journal_unsynced > 0) {
+            fd = fileno(journal);
+            journal_unsynced = 0;
+        }
+        metadata_change_hook hook = change_hook;
+        pthread_mutex_unlock(&journal_mutex);
+
+        // One batch of access-time deltas per flush, however many reads
+        for (int i = 0; hook && i < accessed_count; i++) hook(&accessed[i], 0);
+        free(accessed);
+
+        // One sync covers every append made since the last one
+        if (fd != -1) fdatasync(fd);
+
+        pthread_mutex_lock(&journal_mutex);
+        int full = journal_records >= METADATA_COMPACT_RECORDS;
+        pthread_mutex_unlock(&journal_mutex);
+        if (full || !running) compact();
+        if (!running) break;
     }
-    fclose(f);
-    return 0;
+    return NULL;
 }
 
-void add_metadata_entry(const char *meta_dir, const char *filename) {
-    for (int i = 0; i < file_count; i++) {
-        if (strcmp(file_table[i].filename, filename) == 0) return; // already exists
+int persist_journal_start(const char *meta_dir) {
+    char journal_path[512];
+    snprintf(journal_path, sizeof(journal_path), "%s/metadata.journal", meta_dir);
+
+    pthread_mutex_lock(&journal_mutex);
+    if (journal != NULL) {
+        pthread_mutex_unlock(&journal_mutex);
+        return 0;
     }
-    if (file_count >= MAX_FILES) return;
+    journal = fopen(journal_path, "a");
+    if (journal == NULL) {
+        pthread_mutex_unlock(&journal_mutex);
+        perror("persist_journal_start fopen");
+        return -1;
+    }
+    strncpy(journal_meta_dir, meta_dir, sizeof(journal_meta_dir) - 1);
+    last_access_flush = time(NULL);
+    journal_records += METADATA_COMPACT_RECORDS; // Fold whatever was replayed at the first tick
+    journal_running = 1;
+    pthread_mutex_unlock(&journal_mutex);
+
+    if (pthread_create(&journal_tid, NULL, journal_thread, NULL) != 0) {
+        pthread_mutex_lock(&journal_mutex);
+        fclose(journal);
+        journal = NULL;
+        journal_running = 0;
+        pthread_mutex_unlock(&journal_mutex);
+        return -1;
+    }
+    return 0;
+}
+
+void persist_journal_stop(void) {
+    pthread_mutex_lock(&journal_mutex);
+    int was_running = journal_running;
+    journal_running = 0;
+    pthread_mutex_unlock(&journal_mutex);
+    if (!was_running) return;
 
-    strncpy(file_table[file_count].filename, filename, 255);
+    pthread_join(journal_tid, NULL); // Final access flush, sync and compaction
+    pthread_mutex_lock(&journal_mutex);
+    fclose(journal);
+    journal = NULL;
+    pthread_mutex_unlock(&journal_mutex);
+}
+
+// =========================================================================
+//  MUTATIONS
+// =========================================================================
+
+void add_metadata_entry(const char *meta_dir, const char *filename) {
     char filepath[512];
     snprintf(filepath, sizeof(filepath), "%s/../files/%s", meta_dir, filename);
-    file_table[file_count].size = get_file_size(filepath);
-    file_table[file_count].word_count = count_words_in_file(filepath);
+    long size = get_file_size(filepath);
+    long word_count = count_words_in_file(filepath);
+
+    pthread_mutex_lock(&journal_mutex);
+    FileMeta *file = NULL;
+    if (find_entry(filename) != NULL || (file = append_entry(filename)) == NULL) { // already exists / no memory
+        pthread_mutex_unlock(&journal_mutex);
+        return;
+    }
+    file->size = size;
+    file->word_count = word_count;
     time_t now = time(NULL);
-    file_table[file_count].created = now;
-    file_table[file_count].modified = now;
-    file_table[file_count].last_accessed = now;
-    file_table[file_count].last_accessed_by[0] = '\0';
-    file_table[file_count].owner_username[0] = '\0';
-    file_table[file_count].folder[0] = '\0';
-    file_table[file_count].acl_count = 0;
-    file_count++;
-    save_metadata(meta_dir);
+    file->created = now;
+    file->modified = now;
+    file->last_accessed = now;
+    commit_entry_locked(meta_dir, file);
+    pthread_mutex_unlock(&journal_mutex);
+    // No hook: the NS creates its own record from CREATE's reply, and a
+    // delta sent before then would reach it for a file it does not know
 }
 
 void remove_metadata_entry(const char *meta_dir, const char *filename) {
-    for (int i = 0; i < file_count; i++) {
-        if (strcmp(file_table[i].filename, filename) == 0) {
-            for (int j = i; j < file_count - 1; j++)
-                file_table[j] = file_table[j + 1];
-            file_count--;
-            save_metadata(meta_dir);
-            return;
-        }
+    pthread_mutex_lock(&journal_mutex);
+    int i = find_index(filename);
+    if (i != -1) {
+        remove_index(i);
+        commit_delete_locked(meta_dir, filename);
     }
+    pthread_mutex_unlock(&journal_mutex);
 }
 
 void update_metadata_entry(const char *meta_dir, const char *filename) {
-    for (int i = 0; i < file_count; i++) {
-        if (strcmp(file_table[i].filename, filename) == 0) {
-            char filepath[512];
-            snprintf(filepath, sizeof(filepath), "%s/../files/%s", meta_dir, filename);
-            file_table[i].size = get_file_size(filepath);
-            file_table[i].word_count = count_words_in_file(filepath);
-            file_table[i].modified = time(NULL);
-            save_metadata(meta_dir);
-            return;
-        }
+    char filepath[512];
+    snprintf(filepath, sizeof(filepath), "%s/../files/%s", meta_dir, filename);
+    long size = get_file_size(filepath);
+    long word_count = count_words_in_file(filepath);
+
+    pthread_mutex_lock(&journal_mutex);
+    FileMeta *file = find_entry(filename);
+    FileMeta changed;
+    if (file) {
+        file->size = size;
+        file->word_count = word_count;
+        file->modified = time(NULL);
+        commit_entry_locked(meta_dir, file);
+        changed = *file; // The record may be freed once we unlock
+    }
+    pthread_mutex_unlock(&journal_mutex);
+    if (file && change_hook) change_hook(&changed, 1);
+}
+
+/**
+ * @brief Applies a known change in size and word count without rereading the file.
+ */
+void persist_adjust_counts(const char *meta_dir, const char *filename, long size_delta, long word_delta) {
+    pthread_mutex_lock(&journal_mutex);
+    FileMeta *file = find_entry(filename);
+    FileMeta changed;
+    if (file) {
+        file->size += size_delta;
+        file->word_count += word_delta;
+        if (file->size < 0) file->size = 0;
+        if (file->word_count < 0) file->word_count = 0;
+        file->modified = time(NULL);
+        commit_entry_locked(meta_dir, file);
+        changed = *file;
     }
+    pthread_mutex_unlock(&journal_mutex);
+    if (file && change_hook) change_hook(&changed, 1);
 }
 
 /**
  * @brief Update last accessed time and user for a file.
+ * With the journal running and METADATA_ACCESS_FLUSH_SEC > 0 the change
+ * stays in memory and is journaled by the next periodic access flush,
+ * which is also when the change hook hears of it: a read must not cost
+ * a message to the NS.
  */
 void persist_update_last_accessed(const char *meta_dir, const char *filename, const char *username) {
-    FileMeta* file = persist_find_file(filename);
+    pthread_mutex_lock(&journal_mutex);
+    FileMeta *file = find_entry(filename);
     if (file) {
         file->last_accessed = time(NULL);
         if (username) {
             strncpy(file->last_accessed_by, username, 64 - 1);
         }
-        save_metadata(meta_dir);
+        if (journal != NULL && METADATA_ACCESS_FLUSH_SEC > 0) {
+            file->access_dirty = 1;
+            file->version = ++metadata_epoch; // Visible to a delta sync before the flush
+        } else {
+            commit_entry_locked(meta_dir, file);
+        }
     }
+    pthread_mutex_unlock(&journal_mutex);
 }
 
 
-/**
- * @brief Finds a pointer to a FileMeta struct in the global table.
- * @return Pointer to the struct, or NULL if not found.
- */
-FileMeta* persist_find_file(const char *filename) {
+int persist_get_file(const char *filename, FileMeta *out) {
+    pthread_mutex_lock(&journal_mutex);
+    FileMeta *file = find_entry(filename);
+    if (file) {
+        *out = *file;
+        out->hash_next = NULL;
+    }
+    pthread_mutex_unlock(&journal_mutex);
+    return file ? 0 : -1;
+}
+
+FileMeta* persist_snapshot_files(int *out_count) {
+    pthread_mutex_lock(&journal_mutex);
+    FileMeta *copy = file_count > 0 ? malloc(sizeof(FileMeta) * file_count) : NULL;
+    int count = copy ? file_count : 0;
+    for (int i = 0; i < count; i++) {
+        copy[i] = *file_table[i];
+        copy[i].hash_next = NULL;
+    }
+    pthread_mutex_unlock(&journal_mutex);
+    *out_count = count;
+    return copy;
+}
+
+int persist_check_access(const char *filename, const char *username, PermissionType needed) {
+    pthread_mutex_lock(&journal_mutex);
+    FileMeta *file = find_entry(filename);
+    int allowed = file == NULL || file->owner_username[0] == '\0' ||
+                  strcmp(file->owner_username, username) == 0;
+    for (int i = 0; file && !allowed && i < file->acl_count; i++) {
+        allowed = strcmp(file->acl[i].username, username) == 0 && file->acl[i].permission >= needed;
+    }
+    pthread_mutex_unlock(&journal_mutex);
+    return allowed;
+}
+
+void persist_usage(int *files, uint64_t *bytes) {
+    pthread_mutex_lock(&journal_mutex);
+    uint64_t total = 0;
     for (int i = 0; i < file_count; i++) {
-        if (strcmp(file_table[i].filename, filename) == 0) {
-            return &file_table[i];
+        if (file_table[i]->size > 0) total += (uint64_t)file_table[i]->size;
+    }
+    *files = file_count;
+    *bytes = total;
+    pthread_mutex_unlock(&journal_mutex);
+}
+
+uint64_t persist_metadata_epoch(void) {
+    pthread_mutex_lock(&journal_mutex);
+    uint64_t epoch = metadata_epoch;
+    pthread_mutex_unlock(&journal_mutex);
+    return epoch;
+}
+
+int persist_instance_id(const char *meta_dir, uint64_t *out_id) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/instance_id", meta_dir);
+    unsigned long long id = 0;
+    FILE *f = fopen(path, "r");
+    if (f) {
+        int ok = fscanf(f, "%llx", &id) == 1 && id != 0;
+        fclose(f);
+        if (ok) {
+            *out_id = id;
+            return 0;
         }
     }
-    return NULL;
+
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        if (read(fd, &id, sizeof(id)) != (ssize_t)sizeof(id)) id = 0;
+        close(fd);
+    }
+    if (id == 0) id = ((unsigned long long)time(NULL) << 20) ^ (unsigned long long)getpid();
+
+    char tmp_path[520];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    f = fopen(tmp_path, "w");
+    if (!f) return -1;
+    int ok = fprintf(f, "%llx\n", id) > 0 && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return -1;
+    }
+    *out_id = id;
+    return 0;
 }
 
 /**
  * @brief Sets the owner of a file and saves.
  */
 void persist_set_owner(const char *meta_dir, const char *filename, const char *owner) {
-    FileMeta* file = persist_find_file(filename);
+    pthread_mutex_lock(&journal_mutex);
+    FileMeta *file = find_entry(filename);
     if (file) {
         strncpy(file->owner_username, owner, 64 - 1);
-        save_metadata(meta_dir);
+        commit_entry_locked(meta_dir, file);
     }
+    pthread_mutex_unlock(&journal_mutex);
+}
+
+void persist_store_replica(const char *meta_dir, const char *filename, const SSReplicaPayload *state) {
+    char filepath[512];
+    snprintf(filepath, sizeof(filepath), "%s/../files/%s", meta_dir, filename);
+    long size = get_file_size(filepath);
+    long word_count = count_words_in_file(filepath);
+
+    pthread_mutex_lock(&journal_mutex);
+    FileMeta *file = find_entry(filename);
+    if (file == NULL) file = append_entry(filename);
+    if (file) {
+        file->size = size;
+        file->word_count = word_count;
+        file->created = (time_t)state->created;
+        file->modified = (time_t)state->modified;
+        if (file->last_accessed == 0) file->last_accessed = file->created;
+        memcpy(file->owner_username, state->owner_username, sizeof(file->owner_username) - 1);
+        memcpy(file->folder, state->folder, sizeof(file->folder) - 1);
+        file->acl_count = state->acl_count < 0 ? 0 :
+                          state->acl_count > MAX_ACL_ENTRIES ? MAX_ACL_ENTRIES : state->acl_count;
+        for (int i = 0; i < file->acl_count; i++) file->acl[i] = state->acl[i];
+        file->replica = 1;
+        file->replica_behind = 0;
+        commit_entry_locked(meta_dir, file);
+    }
+    pthread_mutex_unlock(&journal_mutex);
+}
+
+void persist_set_replica_state(const char *meta_dir, const char *filename, int state) {
+    pthread_mutex_lock(&journal_mutex);
+    FileMeta *file = find_entry(filename);
+    if (file) {
+        int was_replica = file->replica;
+        file->replica = state != REPLICA_STATE_PRIMARY;
+        file->replica_behind = state != REPLICA_STATE_PRIMARY; // A demoted copy waits for a fresh one too
+        if (file->replica != was_replica) commit_entry_locked(meta_dir, file);
+    }
+    pthread_mutex_unlock(&journal_mutex);
+}
+
+int persist_replica_state(const char *filename) {
+    pthread_mutex_lock(&journal_mutex);
+    FileMeta *file = find_entry(filename);
+    int state = file == NULL || !file->replica ? 0 : file->replica_behind ? 2 : 1;
+    pthread_mutex_unlock(&journal_mutex);
+    return state;
 }
 
 void persist_set_folder(const char *meta_dir, const char *filename, const char *foldername) {
-    FileMeta* file = persist_find_file(filename);
+    pthread_mutex_lock(&journal_mutex);
+    FileMeta *file = find_entry(filename);
     if (file) {
         if (foldername && strlen(foldername) > 0)
             strncpy(file->folder, foldername, 255);
         else
             file->folder[0] = '\0';
-        save_metadata(meta_dir);
+        commit_entry_locked(meta_dir, file);
     }
+    pthread_mutex_unlock(&journal_mutex);
 }
 
 /**
  * @brief Adds or updates an ACL entry for a file and saves.
  */
 void persist_set_acl(const char *meta_dir, const char *filename, const char *target_user, PermissionType permission) {
-    FileMeta* file = persist_find_file(filename);
-    if (!file) return;
+    pthread_mutex_lock(&journal_mutex);
+    FileMeta *file = find_entry(filename);
+    if (!file) {
+        pthread_mutex_unlock(&journal_mutex);
+        return;
+    }
 
     // Check if user is already in ACL
+    int found = 0;
     for (int i = 0; i < file->acl_count; i++) {
         if (strcmp(file->acl[i].username, target_user) == 0) {
             file->acl[i].permission = permission; // Update existing
-            save_metadata(meta_dir);
-            return;
+            found = 1;
+            break;
         }
     }
 
     // Add as new entry (if space)
-    if (file->acl_count < MAX_ACL_ENTRIES) {
+    if (!found && file->acl_count < MAX_ACL_ENTRIES) {
         int i = file->acl_count;
         strncpy(file->acl[i].username, target_user, 64 - 1);
         file->acl[i].permission = permission;
         file->acl_count++;
-        save_metadata(meta_dir);
+        found = 1;
     }
+    if (found) commit_entry_locked(meta_dir, file);
+    pthread_mutex_unlock(&journal_mutex);
 }
 
 /**
  * @brief Removes a user from a file's ACL and saves.
  */
 void persist_remove_acl(const char *meta_dir, const char *filename, const char *target_user) {
-    FileMeta* file = persist_find_file(filename);
-    if (!file) return;
+    pthread_mutex_lock(&journal_mutex);
+    FileMeta *file = find_entry(filename);
+    if (!file) {
+        pthread_mutex_unlock(&journal_mutex);
+        return;
+    }
 
     int found_index = -1;
     for (int i = 0; i < file->acl_count; i++) {
@@ -339,6 +1140,7 @@ void persist_remove_acl(const char *meta_dir, const char *filename, const char *
         // Swap with the last ACL entry
         file->acl[found_index] = file->acl[file->acl_count - 1];
         file->acl_count--;
-        save_metadata(meta_dir);
+        commit_entry_locked(meta_dir, file);
     }
-}
\ No newline at end of file
+    pthread_mutex_unlock(&journal_mutex);
+}
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "../../include/sentence_lock.h"
+#include "../../include/metrics.h"
+#include "../../include/hash.h"
+
+// One held sentence. Every sentence of a file hashes to the same bucket,
+// so "is any sentence of this file locked?" is a single-bucket scan.
+typedef struct lock_entry {
+    char filename[256];
+    int sentence_num;
+    int client_fd;
+    struct lock_entry* next;
+} lock_entry_t;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t released;  // Broadcast whenever a lock in the bucket is dropped
+    lock_entry_t* head;
+} lock_bucket_t;
+
+// Reverse index so per-line "is this client writing?" checks never scan
+// the table. Lock order: bucket mutex, then stripe mutex.
+typedef struct fd_entry {
+    int client_fd;
+    char filename[256];
+    int sentence_num;
+    struct fd_entry* next;
+} fd_entry_t;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    fd_entry_t* head;
+} fd_stripe_t;
+
+static lock_bucket_t buckets[SENTENCE_LOCK_BUCKETS];
+static fd_stripe_t stripes[SENTENCE_LOCK_FD_STRIPES];
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+static void init_table(void) {
+    for (int i = 0; i < SENTENCE_LOCK_BUCKETS; i++) {
+        pthread_mutex_init(&buckets[i].mutex, NULL);
+        pthread_cond_init(&buckets[i].released, NULL);
+        buckets[i].head = NULL;
+    }
+    for (int i = 0; i < SENTENCE_LOCK_FD_STRIPES; i++) {
+        pthread_mutex_init(&stripes[i].mutex, NULL);
+        stripes[i].head = NULL;
+    }
+}
+
+static lock_bucket_t* bucket_for(const char* filename) {
+    pthread_once(&table_once, init_table);
+    return &buckets[fnv1a_hash(filename) & (SENTENCE_LOCK_BUCKETS - 1)];
+}
+
+static fd_stripe_t* stripe_for(int client_fd) {
+    pthread_once(&table_once, init_table);
+    return &stripes[(unsigned int)client_fd & (SENTENCE_LOCK_FD_STRIPES - 1)];
+}
+
+// Bucket mutex must be HELD
+static lock_entry_t* find_entry(lock_bucket_t* b, const char* filename, int sentence_num) {
+    for (lock_entry_t* e = b->head; e; e = e->next) {
+        if (e->sentence_num == sentence_num && strcmp(e->filename, filename) == 0) return e;
+    }
+    return NULL;
+}
+
+// =========================================================================
+//  PUBLIC API
+// =========================================================================
+
+int sentence_lock_acquire(const char* filename, int sentence_num, int client_fd, int timeout_ms) {
+    lock_bucket_t* b = bucket_for(filename);
+    if (timeout_ms > SENTENCE_LOCK_MAX_WAIT_MS) timeout_ms = SENTENCE_LOCK_MAX_WAIT_MS;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&b->mutex);
+    lock_entry_t* e;
+    while ((e = find_entry(b, filename, sentence_num)) != NULL && e->client_fd != client_fd) {
+        if (timeout_ms <= 0 ||
+            pthread_cond_timedwait(&b->released, &b->mutex, &deadline) == ETIMEDOUT) {
+            int still_held = (e = find_entry(b, filename, sentence_num)) != NULL && e->client_fd != client_fd;
+            if (still_held) {
+                pthread_mutex_unlock(&b->mutex);
+                return -1;
+            }
+            break;
+        }
+    }
+    if (e != NULL) { // Already ours
+        pthread_mutex_unlock(&b->mutex);
+        return 0;
+    }
+
+    e = malloc(sizeof(lock_entry_t));
+    fd_entry_t* f = malloc(sizeof(fd_entry_t));
+    if (e == NULL || f == NULL) {
+        free(e);
+        free(f);
+        pthread_mutex_unlock(&b->mutex);
+        return -2;
+    }
+    strncpy(e->filename, filename, sizeof(e->filename) - 1);
+    e->filename[sizeof(e->filename) - 1] = '\0';
+    e->sentence_num = sentence_num;
+    e->client_fd = client_fd;
+    e->next = b->head;
+    b->head = e;
+
+    fd_stripe_t* s = stripe_for(client_fd);
+    f->client_fd = client_fd;
+    memcpy(f->filename, e->filename, sizeof(f->filename));
+    f->sentence_num = sentence_num;
+    pthread_mutex_lock(&s->mutex);
+    f->next = s->head;
+    s->head = f;
+    pthread_mutex_unlock(&s->mutex);
+
+    pthread_mutex_unlock(&b->mutex);
+    metrics_gauge_add("sentence_locks_held", 1);
+    return 0;
+}
+
+void sentence_lock_release(const char* filename, int sentence_num, int client_fd) {
+    lock_bucket_t* b = bucket_for(filename);
+    int released = 0;
+    pthread_mutex_lock(&b->mutex);
+    for (lock_entry_t** link = &b->head; *link; link = &(*link)->next) {
+        lock_entry_t* e = *link;
+        if (e->client_fd == client_fd && e->sentence_num == sentence_num &&
+            strcmp(e->filename, filename) == 0) {
+            *link = e->next;
+            free(e);
+            pthread_cond_broadcast(&b->released);
+            released = 1;
+            break;
+        }
+    }
+
+    fd_stripe_t* s = stripe_for(client_fd);
+    pthread_mutex_lock(&s->mutex);
+    for (fd_entry_t** link = &s->head; *link; link = &(*link)->next) {
+        fd_entry_t* f = *link;
+        if (f->client_fd == client_fd && f->sentence_num == sentence_num &&
+            strcmp(f->filename, filename) == 0) {
+            *link = f->next;
+            free(f);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s->mutex);
+    pthread_mutex_unlock(&b->mutex);
+    if (released) metrics_gauge_add("sentence_locks_held", -1);
+}
+
+void sentence_lock_release_client(int client_fd) {
+    char filename[256];
+    int sentence_num;
+    // Only this client's own thread adds locks for its fd, so draining
+    // one at a time cannot race with new ones appearing.
+    while (sentence_lock_held_by(client_fd, filename, sizeof(filename), &sentence_num)) {
+        sentence_lock_release(filename, sentence_num, client_fd);
+    }
+}
+
+int sentence_lock_held_by(int client_fd, char* filename, size_t filename_size, int* sentence_num) {
+    fd_stripe_t* s = stripe_for(client_fd);
+    int found = 0;
+    pthread_mutex_lock(&s->mutex);
+    for (fd_entry_t* f = s->head; f; f = f->next) {
+        if (f->client_fd == client_fd) {
+            strncpy(filename, f->filename, filename_size - 1);
+            filename[filename_size - 1] = '\0';
+            *sentence_num = f->sentence_num;
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s->mutex);
+    return found;
+}
+
+int sentence_lock_file_busy(const char* filename) {
+    lock_bucket_t* b = bucket_for(filename);
+    int busy = 0;
+    pthread_mutex_lock(&b->mutex);
+    for (lock_entry_t* e = b->head; e; e = e->next) {
+        if (strcmp(e->filename, filename) == 0) {
+            busy = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&b->mutex);
+    return busy;
+}
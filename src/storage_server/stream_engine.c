@@ -0,0 +1,549 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "../../include/stream_engine.h"
+#include "../../include/logger.h"
+#include "../../include/metrics.h"
+
+#define WHEEL_MASK (STREAM_WHEEL_SLOTS - 1)
+#define STREAM_MAX_IOV 64 // Words per sendmsg when a stream catches up
+
+typedef struct stream {
+    int fd;
+    parsed_doc_t* doc;
+    int next_word;         // == word_count: STREAM_COMPLETE is next
+    int interval_ticks;
+    int paused;
+    int finishing;         // End once 'out' has drained
+    char filename[256];
+    char username[64];
+    stream_done_fn done;
+    void* owner;
+
+    // The session's input buffer; control lines are taken from it
+    char* in_buf;
+    size_t* in_length;
+    size_t in_capacity;
+
+    // Reply bytes the socket has not taken yet
+    char* out;
+    size_t out_length;
+    size_t out_capacity;
+
+    // Came due while the wheel advanced; sent together afterwards
+    int due_words;         // The words before next_word
+    int due_complete;      // STREAM_COMPLETE after them
+    int on_due_list;
+    struct stream* due_next;
+
+    // Timer wheel links (slot -1 = not scheduled)
+    int slot;
+    int rounds;            // Full laps left before it fires
+    struct stream* prev;
+    struct stream* next;
+} stream_t;
+
+static stream_t* wheel[STREAM_WHEEL_SLOTS];
+static int wheel_now = 0;
+static stream_t* due_list = NULL;
+
+static int epoll_fd = -1;
+static int wake_fd = -1;
+static pthread_t engine_tid;
+static atomic_int engine_running = 0;
+static atomic_int active_streams = 0;
+
+// Streams handed over by workers, adopted by the engine thread
+static pthread_mutex_t incoming_lock = PTHREAD_MUTEX_INITIALIZER;
+static stream_t* incoming = NULL;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+// =========================================================================
+//  TIMER WHEEL (engine thread only)
+// =========================================================================
+
+static void schedule(stream_t* s, int ticks) {
+    if (ticks < 1) ticks = 1;
+    s->slot = (wheel_now + ticks) & WHEEL_MASK;
+    s->rounds = (ticks - 1) / STREAM_WHEEL_SLOTS;
+    s->prev = NULL;
+    s->next = wheel[s->slot];
+    if (s->next) s->next->prev = s;
+    wheel[s->slot] = s;
+}
+
+static void unschedule(stream_t* s) {
+    if (s->slot < 0) return;
+    if (s->prev) s->prev->next = s->next;
+    else wheel[s->slot] = s->next;
+    if (s->next) s->next->prev = s->prev;
+    s->slot = -1;
+    s->prev = s->next = NULL;
+}
+
+// =========================================================================
+//  OUTPUT
+// =========================================================================
+
+// Input until the stream is finishing (what follows is the session's),
+// output while 'out' holds bytes
+static void update_watch(stream_t* s) {
+    struct epoll_event ev = {
+        .events = (s->finishing ? 0 : EPOLLIN) | (s->out_length > 0 ? EPOLLOUT : 0),
+        .data.ptr = s
+    };
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, s->fd, &ev);
+}
+
+/**
+ * @brief Sends what 'out' holds. Returns -1 if the client is gone.
+ */
+static int flush(stream_t* s) {
+    size_t off = 0;
+    while (off < s->out_length) {
+        ssize_t n = send(s->fd, s->out + off, s->out_length - off, MSG_NOSIGNAL);
+        if (n > 0) { off += (size_t)n; continue; }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        return -1;
+    }
+    int was_blocked = s->out_length > 0;
+    memmove(s->out, s->out + off, s->out_length - off);
+    s->out_length -= off;
+    if (was_blocked && s->out_length == 0) update_watch(s);
+    return 0;
+}
+
+static int buffer_reply(stream_t* s, const void* data, size_t length) {
+    if (s->out_length + length > s->out_capacity) {
+        size_t capacity = s->out_capacity * 2 + length;
+        char* grown = realloc(s->out, capacity);
+        if (grown == NULL) return -1;
+        s->out = grown;
+        s->out_capacity = capacity;
+    }
+    memcpy(s->out + s->out_length, data, length);
+    s->out_length += length;
+    return 0;
+}
+
+/**
+ * @brief Sends 'iov' in one sendmsg, keeping whatever the socket will not
+ * take now. Returns -1 if the client is gone or memory ran out.
+ */
+static int queue_iov(stream_t* s, struct iovec* iov, int count) {
+    int i = 0;
+    int was_blocked = s->out_length > 0;
+    if (!was_blocked) {
+        while (i < count) {
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov + i;
+            msg.msg_iovlen = (size_t)(count - i);
+            ssize_t n = sendmsg(s->fd, &msg, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (n <= 0) return -1;
+            size_t sent = (size_t)n;
+            while (i < count && sent >= iov[i].iov_len) sent -= iov[i++].iov_len;
+            if (i < count) {
+                iov[i].iov_base = (char*)iov[i].iov_base + sent;
+                iov[i].iov_len -= sent;
+            }
+        }
+        if (i == count) return 0;
+    }
+    for (; i < count; i++) {
+        if (buffer_reply(s, iov[i].iov_base, iov[i].iov_len) == -1) return -1;
+    }
+    if (!was_blocked) update_watch(s);
+    return 0;
+}
+
+static int queue_reply(stream_t* s, const char* data, size_t length) {
+    struct iovec iov = { .iov_base = (void*)data, .iov_len = length };
+    return queue_iov(s, &iov, 1);
+}
+
+/**
+ * @brief Sends what came due for 's' this pass: every word the wheel fired
+ * (more than one when the engine fell behind) and STREAM_COMPLETE, straight
+ * from the document in as few sendmsg calls as STREAM_MAX_IOV allows.
+ */
+static int send_due(stream_t* s) {
+    struct iovec iov[STREAM_MAX_IOV + 1];
+    int word = s->next_word - s->due_words;
+    int complete = s->due_complete;
+    s->due_words = 0;
+    s->due_complete = 0;
+    while (word < s->next_word || complete) {
+        int count = 0;
+        while (count < STREAM_MAX_IOV && word < s->next_word) {
+            const doc_word_t* w = &s->doc->words[word++];
+            iov[count].iov_base = (void*)w->str;
+            iov[count++].iov_len = w->length;
+        }
+        if (word == s->next_word && complete) {
+            iov[count].iov_base = (void*)"STREAM_COMPLETE\n";
+            iov[count++].iov_len = 16;
+            complete = 0;
+        }
+        if (queue_iov(s, iov, count) == -1) return -1;
+    }
+    return 0;
+}
+
+// =========================================================================
+//  STREAM LIFECYCLE (engine thread only)
+// =========================================================================
+
+static void finish(stream_t* s) {
+    unschedule(s);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s->fd, NULL);
+
+    // Back to how the worker left it
+    int flags = fcntl(s->fd, F_GETFL, 0);
+    if (flags != -1) fcntl(s->fd, F_SETFL, flags & ~O_NONBLOCK);
+    int flag = 0;
+    setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+    doc_release(s->doc);
+    free(s->out);
+    atomic_fetch_sub(&active_streams, 1);
+    metrics_gauge_add("active_streams", -1);
+    s->done(s->owner, s->fd);
+    free(s);
+}
+
+static void client_gone(stream_t* s) {
+    write_log("WARN", "Client %s disconnected during STREAM of %s at word %d",
+              s->username, s->filename, s->next_word);
+    finish(s);
+}
+
+// Marks the next word (or STREAM_COMPLETE) due; send_all_due() sends it
+static void fire(stream_t* s) {
+    if (s->out_length > 0) {
+        schedule(s, s->interval_ticks); // The client is behind: hold the next word back
+        return;
+    }
+    if (s->next_word < s->doc->word_count) {
+        s->next_word++;
+        s->due_words++;
+        schedule(s, s->interval_ticks);
+    } else {
+        s->due_complete = 1;
+        write_log("INFO", "STREAM: Completed streaming %s (%d words) to user %s",
+                  s->filename, s->doc->word_count, s->username);
+        s->finishing = 1;
+    }
+    if (!s->on_due_list) {
+        s->on_due_list = 1;
+        s->due_next = due_list;
+        due_list = s;
+    }
+}
+
+static void send_all_due(void) {
+    stream_t* list = due_list;
+    due_list = NULL;
+    while (list) {
+        stream_t* s = list;
+        list = s->due_next;
+        s->on_due_list = 0;
+        s->due_next = NULL;
+        if (send_due(s) == -1) {
+            client_gone(s);
+        } else if (s->finishing) {
+            if (s->out_length == 0) finish(s);
+            else update_watch(s);
+        }
+    }
+}
+
+static void end_after_reply(stream_t* s, const char* reply, size_t length) {
+    unschedule(s);
+    s->finishing = 1;
+    if (reply && queue_reply(s, reply, length) == -1) {
+        client_gone(s);
+    } else if (s->out_length == 0) {
+        finish(s);
+    } else {
+        update_watch(s);
+    }
+}
+
+/**
+ * @brief One control line: STOP ends the stream, PAUSE holds it until
+ * RESUME; anything else while paused ends it, otherwise it is ignored.
+ * @return 0 to keep taking input, -1 once the stream is finishing or
+ * gone ('s' may have been freed).
+ */
+static int handle_control(stream_t* s, const char* line) {
+    if (strncmp(line, "STOP", 4) == 0) {
+        write_log("INFO", "STREAM stopped for %s at word %d by user request", s->filename, s->next_word);
+        end_after_reply(s, "STREAM_STOPPED\n", 15);
+        return -1;
+    }
+    if (s->paused) {
+        if (strncmp(line, "RESUME", 6) != 0) {
+            end_after_reply(s, NULL, 0);
+            return -1;
+        }
+        s->paused = 0;
+        if (queue_reply(s, "STREAM_RESUMED\n", 15) == -1) {
+            client_gone(s);
+            return -1;
+        }
+        schedule(s, 1);
+    } else if (strncmp(line, "PAUSE", 5) == 0) {
+        write_log("INFO", "STREAM paused for %s at word %d", s->filename, s->next_word);
+        s->paused = 1;
+        unschedule(s);
+        if (queue_reply(s, "STREAM_PAUSED\n", 14) == -1) {
+            client_gone(s);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Acts on the complete lines in the session's input buffer, the
+ * way read_command_line() splits them. Bytes after the line that ends
+ * the stream stay there for the session.
+ */
+static void take_control_lines(stream_t* s) {
+    while (1) {
+        char* nl = memchr(s->in_buf, '\n', *s->in_length);
+        size_t take = nl ? (size_t)(nl - s->in_buf) + 1 :
+                      *s->in_length == s->in_capacity ? *s->in_length : 0;
+        if (take == 0) return;
+        char line[64];
+        size_t length = nl ? take - 1 : take;
+        if (length >= sizeof(line)) length = sizeof(line) - 1;
+        memcpy(line, s->in_buf, length);
+        line[length] = '\0';
+        *s->in_length -= take;
+        memmove(s->in_buf, s->in_buf + take, *s->in_length);
+        if (handle_control(s, line) == -1) return;
+    }
+}
+
+static void handle_input(stream_t* s) {
+    ssize_t n = recv(s->fd, s->in_buf + *s->in_length, s->in_capacity - *s->in_length, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    if (n <= 0) {
+        client_gone(s);
+        return;
+    }
+    *s->in_length += (size_t)n;
+    take_control_lines(s);
+}
+
+static void adopt_incoming(void) {
+    uint64_t count;
+    if (read(wake_fd, &count, sizeof(count)) < 0) { /* Nothing pending */ }
+
+    pthread_mutex_lock(&incoming_lock);
+    stream_t* list = incoming;
+    incoming = NULL;
+    pthread_mutex_unlock(&incoming_lock);
+
+    while (list) {
+        stream_t* s = list;
+        list = list->next;
+        s->next = NULL;
+
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = s };
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, s->fd, &ev) == -1) {
+            write_log("ERROR", "Stream engine: cannot watch fd %d: %s", s->fd, strerror(errno));
+            finish(s);
+            continue;
+        }
+        if (queue_reply(s, "OK_200 STREAM_START\n", 20) == -1) {
+            client_gone(s);
+            continue;
+        }
+        schedule(s, s->interval_ticks);
+        take_control_lines(s); // Sent right behind the STREAM command
+    }
+}
+
+static void advance_wheel(void) {
+    wheel_now = (wheel_now + 1) & WHEEL_MASK;
+    stream_t* due = wheel[wheel_now];
+    wheel[wheel_now] = NULL;
+    while (due) {
+        stream_t* s = due;
+        due = due->next;
+        s->slot = -1;
+        s->prev = s->next = NULL;
+        if (s->rounds > 0) {
+            // Not this lap: back into the same slot
+            s->rounds--;
+            s->slot = wheel_now;
+            s->next = wheel[wheel_now];
+            if (s->next) s->next->prev = s;
+            wheel[wheel_now] = s;
+        } else {
+            fire(s);
+        }
+    }
+}
+
+static void* engine_main(void* arg) {
+    (void)arg;
+    struct epoll_event events[128];
+    uint64_t next_tick = now_ms() + STREAM_TICK_MS;
+
+    while (atomic_load(&engine_running)) {
+        uint64_t now = now_ms();
+        int timeout = next_tick > now ? (int)(next_tick - now) : 0;
+        int n = epoll_wait(epoll_fd, events, 128, timeout);
+        for (int i = 0; i < n; i++) {
+            stream_t* s = events[i].data.ptr;
+            if (s == NULL) {
+                adopt_incoming();
+                continue;
+            }
+            // A stream may end while handling its input, so check output first
+            if ((events[i].events & EPOLLOUT) && flush(s) == -1) {
+                client_gone(s);
+                continue;
+            }
+            if (s->finishing && s->out_length == 0) {
+                finish(s);
+                continue;
+            }
+            if (s->finishing) {
+                if (events[i].events & (EPOLLHUP | EPOLLERR)) client_gone(s);
+            } else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                handle_input(s);
+            }
+        }
+
+        // Every tick that passed, even if the loop fell behind, then one
+        // send per stream for everything that came due
+        for (now = now_ms(); now >= next_tick; next_tick += STREAM_TICK_MS) {
+            advance_wheel();
+        }
+        send_all_due();
+    }
+    return NULL;
+}
+
+// =========================================================================
+//  PUBLIC API
+// =========================================================================
+
+int stream_engine_init(void) {
+    epoll_fd = epoll_create1(0);
+    wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (epoll_fd == -1 || wake_fd == -1) {
+        write_log("FATAL", "Stream engine: epoll/eventfd failed: %s", strerror(errno));
+        return -1;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+
+    for (int i = 0; i < STREAM_WHEEL_SLOTS; i++) wheel[i] = NULL;
+    atomic_store(&engine_running, 1);
+    if (pthread_create(&engine_tid, NULL, engine_main, NULL) != 0) {
+        atomic_store(&engine_running, 0);
+        write_log("FATAL", "Stream engine: failed to start thread");
+        return -1;
+    }
+    metrics_gauge_add("active_streams", 0);
+    return 0;
+}
+
+int stream_engine_start(int fd, parsed_doc_t* doc, int interval_ms,
+                        const char* filename, const char* username,
+                        char* in_buf, size_t* in_length, size_t in_capacity,
+                        stream_done_fn done, void* owner) {
+    if (atomic_fetch_add(&active_streams, 1) >= STREAM_MAX_SESSIONS) {
+        atomic_fetch_sub(&active_streams, 1);
+        return -1;
+    }
+    stream_t* s = calloc(1, sizeof(stream_t));
+    if (s == NULL) {
+        atomic_fetch_sub(&active_streams, 1);
+        return -1;
+    }
+    if (interval_ms > STREAM_MAX_INTERVAL_MS) interval_ms = STREAM_MAX_INTERVAL_MS;
+    s->fd = fd;
+    s->doc = doc;
+    s->interval_ticks = (interval_ms + STREAM_TICK_MS - 1) / STREAM_TICK_MS;
+    if (s->interval_ticks < 1) s->interval_ticks = 1;
+    strncpy(s->filename, filename, sizeof(s->filename) - 1);
+    strncpy(s->username, username, sizeof(s->username) - 1);
+    s->in_buf = in_buf;
+    s->in_length = in_length;
+    s->in_capacity = in_capacity;
+    s->done = done;
+    s->owner = owner;
+    s->slot = -1;
+    metrics_gauge_add("active_streams", 1);
+
+    // One word per segment, without a setsockopt pair per word
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags != -1) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+    pthread_mutex_lock(&incoming_lock);
+    s->next = incoming;
+    incoming = s;
+    pthread_mutex_unlock(&incoming_lock);
+
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) { /* Counter saturated: already awake */ }
+    return 0;
+}
+
+int stream_engine_active(void) {
+    return atomic_load(&active_streams);
+}
+
+void stream_engine_shutdown(void) {
+    if (!atomic_exchange(&engine_running, 0)) return;
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) { /* Already awake */ }
+    pthread_join(engine_tid, NULL);
+
+    // Drop what is left; the sockets are closed with the other clients
+    for (int i = 0; i < STREAM_WHEEL_SLOTS; i++) wheel[i] = NULL;
+    pthread_mutex_lock(&incoming_lock);
+    stream_t* list = incoming;
+    incoming = NULL;
+    pthread_mutex_unlock(&incoming_lock);
+    while (list) {
+        stream_t* s = list;
+        list = list->next;
+        doc_release(s->doc);
+        free(s->out);
+        free(s);
+    }
+    close(wake_fd);
+    close(epoll_fd);
+}
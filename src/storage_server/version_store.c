@@ -0,0 +1,495 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "../../include/version_store.h"
+#include "../../include/hash.h"
+#include "../../include/logger.h"
+
+// <file>.vidx: header, then one fixed-width entry per version, in order.
+// <file>.vpack: content blobs and labels, append-only. The header's
+// entry_count is written last, so a crash mid-push leaves only unreferenced
+// bytes at the end of the pack.
+#define VIDX_MAGIC   "SSVIDX\0\0"
+#define VIDX_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_count;
+    int32_t undo_top;        // Newest VERSION_UNDO entry not yet undone (-1 = none)
+    int32_t checkpoint_top;  // Newest VERSION_CHECKPOINT entry (-1 = none)
+    uint32_t reserved[2];
+} vidx_header_t;
+
+typedef struct {
+    uint64_t hash;           // FNV-1a of the full content
+    uint64_t data_offset;    // Blob in the pack (shared by entries with identical content)
+    uint64_t label_offset;   // "<tag>\0<user>" in the pack
+    int64_t created;
+    uint32_t data_length;
+    uint32_t content_length;
+    int32_t base;            // Entry the blob is a delta against; -1 = blob is the content
+    int32_t prev;            // Next older entry on the same list (undo stack or checkpoints)
+    uint32_t tag_hash;       // Checkpoints: hash of the tag, compared before the label
+    uint16_t label_length;
+    uint16_t depth;          // Deltas between this entry and its whole-stored ancestor
+    uint8_t kind;
+    uint8_t undone;
+    uint8_t pad[6];
+} vidx_entry_t;
+
+typedef struct {
+    int idx_fd;
+    int pack_fd;
+    vidx_header_t header;
+} store_t;
+
+static pthread_mutex_t stripes[VERSION_STORE_STRIPES];
+static pthread_once_t stripes_once = PTHREAD_ONCE_INIT;
+
+static void init_stripes(void) {
+    for (int i = 0; i < VERSION_STORE_STRIPES; i++) pthread_mutex_init(&stripes[i], NULL);
+}
+
+static pthread_mutex_t* stripe_for(const char* filename) {
+    pthread_once(&stripes_once, init_stripes);
+    return &stripes[fnv1a_hash(filename) & (VERSION_STORE_STRIPES - 1)];
+}
+
+// =========================================================================
+//  FILE HELPERS (stripe mutex must be HELD)
+// =========================================================================
+
+static int read_exact(int fd, void* buf, size_t length, off_t offset) {
+    char* p = buf;
+    while (length > 0) {
+        ssize_t n = pread(fd, p, length, offset);
+        if (n <= 0) return -1;
+        p += n;
+        length -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+static int write_exact(int fd, const void* buf, size_t length, off_t offset) {
+    const char* p = buf;
+    while (length > 0) {
+        ssize_t n = pwrite(fd, p, length, offset);
+        if (n <= 0) return -1;
+        p += n;
+        length -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+static void store_paths(const char* dir, const char* filename, char* idx_path, char* pack_path, size_t size) {
+    snprintf(idx_path, size, "%s/%s.vidx", dir, filename);
+    snprintf(pack_path, size, "%s/%s.vpack", dir, filename);
+}
+
+/**
+ * @return 1 if opened, 0 if the file has no store (and 'create' is 0), -1 on error.
+ */
+static int store_open(const char* dir, const char* filename, int create, store_t* st) {
+    char idx_path[600], pack_path[600];
+    store_paths(dir, filename, idx_path, pack_path, sizeof(idx_path));
+    int flags = O_RDWR | (create ? O_CREAT : 0);
+    st->idx_fd = open(idx_path, flags, 0644);
+    if (st->idx_fd < 0) return create ? -1 : 0;
+    st->pack_fd = open(pack_path, flags, 0644);
+    if (st->pack_fd < 0) {
+        close(st->idx_fd);
+        return create ? -1 : 0;
+    }
+
+    struct stat sb;
+    if (fstat(st->idx_fd, &sb) == 0 && sb.st_size == 0 && create) {
+        memset(&st->header, 0, sizeof(st->header));
+        memcpy(st->header.magic, VIDX_MAGIC, sizeof(st->header.magic));
+        st->header.version = VIDX_VERSION;
+        st->header.undo_top = -1;
+        st->header.checkpoint_top = -1;
+        if (write_exact(st->idx_fd, &st->header, sizeof(st->header), 0) == 0) return 1;
+    } else if (read_exact(st->idx_fd, &st->header, sizeof(st->header), 0) == 0 &&
+               memcmp(st->header.magic, VIDX_MAGIC, sizeof(st->header.magic)) == 0 &&
+               st->header.version == VIDX_VERSION) {
+        return 1;
+    }
+    write_log("ERROR", "Version index %s is unreadable", idx_path);
+    close(st->idx_fd);
+    close(st->pack_fd);
+    return -1;
+}
+
+static void store_close(store_t* st) {
+    close(st->idx_fd);
+    close(st->pack_fd);
+}
+
+static int read_entry(store_t* st, int i, vidx_entry_t* e) {
+    if (i < 0 || (uint32_t)i >= st->header.entry_count) return -1;
+    return read_exact(st->idx_fd, e, sizeof(*e), sizeof(vidx_header_t) + (off_t)i * sizeof(*e));
+}
+
+static int write_entry(store_t* st, int i, const vidx_entry_t* e) {
+    return write_exact(st->idx_fd, e, sizeof(*e), sizeof(vidx_header_t) + (off_t)i * sizeof(*e));
+}
+
+static int write_header(store_t* st) {
+    return write_exact(st->idx_fd, &st->header, sizeof(st->header), 0);
+}
+
+/**
+ * @brief Splits an entry's label into its tag and user.
+ */
+static int read_label(store_t* st, const vidx_entry_t* e, char* tag, size_t tag_size,
+                      char* user, size_t user_size) {
+    char label[512];
+    size_t length = e->label_length < sizeof(label) - 1 ? e->label_length : sizeof(label) - 1;
+    if (read_exact(st->pack_fd, label, length, (off_t)e->label_offset) == -1) return -1;
+    label[length] = '\0';
+    const char* user_part = label + strlen(label);
+    if (user_part < label + length) user_part++;
+    if (tag) snprintf(tag, tag_size, "%s", label);
+    if (user) snprintf(user, user_size, "%s", user_part);
+    return 0;
+}
+
+// =========================================================================
+//  DELTAS
+// =========================================================================
+// A delta blob is varint(prefix) varint(suffix) followed by the bytes in
+// between: the new content keeps the base's first 'prefix' and last
+// 'suffix' bytes. A WRITE replaces one sentence, so this stays small.
+
+static size_t put_varint(uint8_t* p, uint64_t v) {
+    size_t n = 0;
+    do {
+        p[n++] = (uint8_t)((v & 0x7f) | (v >= 0x80 ? 0x80 : 0));
+        v >>= 7;
+    } while (v);
+    return n;
+}
+
+static int get_varint(const uint8_t** p, const uint8_t* end, uint64_t* out) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+        uint8_t b = *(*p)++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *out = v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static uint8_t* encode_delta(const char* base, size_t base_length, const char* content, size_t length,
+                             size_t* out_length) {
+    size_t limit = base_length < length ? base_length : length;
+    size_t prefix = 0, suffix = 0;
+    while (prefix < limit && base[prefix] == content[prefix]) prefix++;
+    while (suffix < limit - prefix &&
+           base[base_length - 1 - suffix] == content[length - 1 - suffix]) suffix++;
+
+    size_t middle = length - prefix - suffix;
+    uint8_t* delta = malloc(20 + middle);
+    if (delta == NULL) return NULL;
+    size_t n = put_varint(delta, prefix);
+    n += put_varint(delta + n, suffix);
+    memcpy(delta + n, content + prefix, middle);
+    *out_length = n + middle;
+    return delta;
+}
+
+/**
+ * @brief Rebuilds the full content of entry 'i' from its whole-stored
+ * ancestor and the deltas after it (at most VERSION_KEYFRAME_INTERVAL).
+ * @return A malloc'd, NUL-terminated buffer, or NULL on error.
+ */
+static char* load_content(store_t* st, int i, size_t* out_length) {
+    vidx_entry_t chain[VERSION_KEYFRAME_INTERVAL + 1];
+    int depth = 0;
+    for (int e = i; ; ) {
+        if (depth > VERSION_KEYFRAME_INTERVAL || read_entry(st, e, &chain[depth]) == -1) return NULL;
+        if (chain[depth].base < 0) break;
+        e = chain[depth++].base;
+    }
+
+    const vidx_entry_t* whole = &chain[depth];
+    size_t length = whole->content_length;
+    char* content = malloc(length + 1);
+    if (content == NULL || read_exact(st->pack_fd, content, length, (off_t)whole->data_offset) == -1) {
+        free(content);
+        return NULL;
+    }
+
+    for (int k = depth - 1; k >= 0; k--) {
+        const vidx_entry_t* e = &chain[k];
+        uint8_t* delta = malloc(e->data_length ? e->data_length : 1);
+        char* next = malloc((size_t)e->content_length + 1);
+        uint64_t prefix, suffix;
+        const uint8_t* p = delta;
+        const uint8_t* end = delta + e->data_length;
+        int ok = delta && next &&
+                 read_exact(st->pack_fd, delta, e->data_length, (off_t)e->data_offset) == 0 &&
+                 get_varint(&p, end, &prefix) == 0 && get_varint(&p, end, &suffix) == 0 &&
+                 prefix + suffix <= length &&
+                 prefix + (uint64_t)(end - p) + suffix == e->content_length;
+        if (ok) {
+            memcpy(next, content, prefix);
+            memcpy(next + prefix, p, (size_t)(end - p));
+            memcpy(next + prefix + (end - p), content + length - suffix, suffix);
+        }
+        free(delta);
+        free(content);
+        if (!ok) {
+            free(next);
+            return NULL;
+        }
+        content = next;
+        length = e->content_length;
+    }
+    content[length] = '\0';
+    *out_length = length;
+    return content;
+}
+
+/**
+ * @return Index of the checkpoint called 'tag', or -1.
+ */
+static int find_checkpoint(store_t* st, const char* tag) {
+    uint32_t tag_hash = fnv1a_hash(tag);
+    vidx_entry_t e;
+    for (int i = st->header.checkpoint_top; i >= 0; i = e.prev) {
+        if (read_entry(st, i, &e) == -1) return -1;
+        char found[256];
+        if (e.tag_hash == tag_hash && read_label(st, &e, found, sizeof(found), NULL, 0) == 0 &&
+            strcmp(found, tag) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// =========================================================================
+//  PUBLIC API
+// =========================================================================
+
+int version_store_push(const char* versions_dir, const char* filename, version_kind_t kind,
+                       const char* tag, const char* user, const char* content, size_t length,
+                       time_t created) {
+    pthread_mutex_t* lock = stripe_for(filename);
+    pthread_mutex_lock(lock);
+    store_t st;
+    if (store_open(versions_dir, filename, 1, &st) != 1) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    if (kind != VERSION_CHECKPOINT) tag = "";
+    if (kind == VERSION_CHECKPOINT && find_checkpoint(&st, tag) != -1) {
+        store_close(&st);
+        pthread_mutex_unlock(lock);
+        return -2;
+    }
+
+    int n = (int)st.header.entry_count;
+    vidx_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.hash = fnv1a_hash64(content, length);
+    entry.content_length = (uint32_t)length;
+    entry.created = created ? created : time(NULL);
+    entry.kind = (uint8_t)kind;
+    entry.tag_hash = fnv1a_hash(tag);
+    entry.prev = kind == VERSION_CHECKPOINT ? st.header.checkpoint_top : st.header.undo_top;
+
+    int rc = 0;
+    struct stat sb;
+    off_t pack_end = fstat(st.pack_fd, &sb) == 0 ? sb.st_size : -1;
+    if (pack_end < 0) rc = -1;
+
+    // Identical content (an undo redone by hand, a checkpoint right after
+    // a write) shares the blob already stored.
+    int shared = 0;
+    vidx_entry_t other;
+    for (int j = n - 1; rc == 0 && j >= 0 && j >= n - VERSION_DEDUP_WINDOW; j--) {
+        if (read_entry(&st, j, &other) == -1) {
+            rc = -1;
+        } else if (other.hash == entry.hash && other.content_length == entry.content_length) {
+            entry.data_offset = other.data_offset;
+            entry.data_length = other.data_length;
+            entry.base = other.base;
+            entry.depth = other.depth;
+            shared = 1;
+            break;
+        }
+    }
+
+    if (rc == 0 && !shared) {
+        uint8_t* delta = NULL;
+        size_t delta_length = 0;
+        vidx_entry_t parent;
+        if (n > 0 && read_entry(&st, n - 1, &parent) == 0 && parent.depth + 1 < VERSION_KEYFRAME_INTERVAL) {
+            size_t parent_length;
+            char* parent_content = load_content(&st, n - 1, &parent_length);
+            if (parent_content) {
+                delta = encode_delta(parent_content, parent_length, content, length, &delta_length);
+                free(parent_content);
+            }
+        }
+        entry.data_offset = (uint64_t)pack_end;
+        if (delta && delta_length < length) {
+            entry.base = n - 1;
+            entry.depth = (uint16_t)(parent.depth + 1);
+            entry.data_length = (uint32_t)delta_length;
+            rc = write_exact(st.pack_fd, delta, delta_length, pack_end);
+        } else {
+            entry.base = -1;
+            entry.depth = 0;
+            entry.data_length = (uint32_t)length;
+            rc = write_exact(st.pack_fd, content, length, pack_end);
+        }
+        pack_end += entry.data_length;
+        free(delta);
+    }
+
+    if (rc == 0) {
+        char label[512];
+        int label_length = snprintf(label, sizeof(label), "%s%c%s", tag, '\0', user ? user : "");
+        if (label_length >= (int)sizeof(label)) label_length = sizeof(label) - 1;
+        entry.label_offset = (uint64_t)pack_end;
+        entry.label_length = (uint16_t)label_length;
+        rc = write_exact(st.pack_fd, label, (size_t)label_length, pack_end);
+    }
+    if (rc == 0) rc = write_entry(&st, n, &entry);
+    if (rc == 0) {
+        st.header.entry_count = (uint32_t)n + 1;
+        if (kind == VERSION_CHECKPOINT) st.header.checkpoint_top = n;
+        else st.header.undo_top = n;
+        rc = write_header(&st);
+    }
+    store_close(&st);
+    pthread_mutex_unlock(lock);
+
+    if (rc != 0) {
+        write_log("ERROR", "Could not store a version of %s", filename);
+        return -1;
+    }
+    return 1;
+}
+
+int version_store_undo(const char* versions_dir, const char* filename,
+                       char** out_content, size_t* out_length, char* user, size_t user_size) {
+    pthread_mutex_t* lock = stripe_for(filename);
+    pthread_mutex_lock(lock);
+    store_t st;
+    int opened = store_open(versions_dir, filename, 0, &st);
+    if (opened != 1) {
+        pthread_mutex_unlock(lock);
+        return opened;
+    }
+
+    int rc = 0;
+    int top = st.header.undo_top;
+    vidx_entry_t entry;
+    if (top >= 0) {
+        rc = -1;
+        if (read_entry(&st, top, &entry) == 0 &&
+            (*out_content = load_content(&st, top, out_length)) != NULL) {
+            if (user) read_label(&st, &entry, NULL, 0, user, user_size);
+            entry.undone = 1;
+            st.header.undo_top = entry.prev;
+            if (write_entry(&st, top, &entry) == 0 && write_header(&st) == 0) {
+                rc = 1;
+            } else {
+                free(*out_content);
+                *out_content = NULL;
+            }
+        }
+    }
+    store_close(&st);
+    pthread_mutex_unlock(lock);
+    return rc;
+}
+
+int version_store_checkpoint(const char* versions_dir, const char* filename, const char* tag,
+                             char** out_content, size_t* out_length) {
+    pthread_mutex_t* lock = stripe_for(filename);
+    pthread_mutex_lock(lock);
+    store_t st;
+    int opened = store_open(versions_dir, filename, 0, &st);
+    if (opened != 1) {
+        pthread_mutex_unlock(lock);
+        return opened;
+    }
+    int rc = 0;
+    int i = find_checkpoint(&st, tag);
+    if (i != -1) {
+        *out_content = load_content(&st, i, out_length);
+        rc = *out_content ? 1 : -1;
+    }
+    store_close(&st);
+    pthread_mutex_unlock(lock);
+    return rc;
+}
+
+int version_store_list(const char* versions_dir, const char* filename, version_kind_t kind,
+                       version_info_t** out) {
+    *out = NULL;
+    pthread_mutex_t* lock = stripe_for(filename);
+    pthread_mutex_lock(lock);
+    store_t st;
+    int opened = store_open(versions_dir, filename, 0, &st);
+    if (opened != 1) {
+        pthread_mutex_unlock(lock);
+        return opened;
+    }
+
+    int n = (int)st.header.entry_count;
+    vidx_entry_t* entries = malloc(sizeof(vidx_entry_t) * (n > 0 ? n : 1));
+    version_info_t* infos = malloc(sizeof(version_info_t) * (n > 0 ? n : 1));
+    int count = -1;
+    if (entries && infos &&
+        read_exact(st.idx_fd, entries, sizeof(vidx_entry_t) * n, sizeof(vidx_header_t)) == 0) {
+        count = 0;
+        for (int i = 0; i < n; i++) {
+            if (entries[i].kind != kind) continue;
+            version_info_t* info = &infos[count];
+            if (read_label(&st, &entries[i], info->tag, sizeof(info->tag), info->user, sizeof(info->user)) == -1) continue;
+            info->created = (time_t)entries[i].created;
+            info->size = entries[i].content_length;
+            count++;
+        }
+    }
+    free(entries);
+    store_close(&st);
+    pthread_mutex_unlock(lock);
+
+    if (count <= 0) free(infos);
+    else *out = infos;
+    return count;
+}
+
+int version_store_exists(const char* versions_dir, const char* filename) {
+    char idx_path[600], pack_path[600];
+    store_paths(versions_dir, filename, idx_path, pack_path, sizeof(idx_path));
+    return access(idx_path, F_OK) == 0;
+}
+
+void version_store_drop(const char* versions_dir, const char* filename) {
+    char idx_path[600], pack_path[600];
+    store_paths(versions_dir, filename, idx_path, pack_path, sizeof(idx_path));
+    pthread_mutex_t* lock = stripe_for(filename);
+    pthread_mutex_lock(lock);
+    unlink(idx_path);
+    unlink(pack_path);
+    pthread_mutex_unlock(lock);
+}
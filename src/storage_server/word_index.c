@@ -0,0 +1,642 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "../../include/word_index.h"
+#include "../../include/doc_cache.h"
+#include "../../include/hash.h"
+#include "../../include/persistence.h"
+#include "../../include/logger.h"
+
+#define FILE_BUCKETS     1024 // Power of two
+#define TERM_BUCKETS_MIN 4096 // Power of two; doubles as the vocabulary grows
+
+typedef struct indexed_file indexed_file_t;
+
+// A file containing a term, and in how many of its sentences
+typedef struct {
+    indexed_file_t* file;
+    int sentences;
+} posting_t;
+
+typedef struct term {
+    char* word;              // Folded
+    size_t length;
+    uint64_t hash;
+    uint32_t id;
+    posting_t* postings;     // Sorted by file->id
+    int posting_count;
+    int posting_capacity;
+    struct term* hash_next;
+} term_t;
+
+typedef struct {
+    uint64_t fingerprint;    // Hash of the sentence's text
+    uint32_t* terms;         // Distinct term ids, sorted
+    int term_count;
+} indexed_sentence_t;
+
+struct indexed_file {
+    char filename[256];
+    uint64_t id;                    // Creation order; orders the postings
+    indexed_sentence_t* sentences;  // Sentence N is sentences[N - 1]
+    int sentence_count;
+    int sentence_capacity;
+    indexed_file_t* hash_next;
+};
+
+static indexed_file_t* file_buckets[FILE_BUCKETS];
+static uint64_t next_file_id = 1;
+
+// Terms are never freed, so an id stays valid once handed out
+static term_t** term_buckets = NULL;
+static size_t term_bucket_count = 0;
+static term_t** terms_by_id = NULL;
+static uint32_t term_count = 0;
+static uint32_t term_capacity = 0;
+
+// Queries read-lock, updates write-lock. Parsing, fingerprinting, the
+// diff and folding the changed words happen outside it; the write lock
+// only covers interning and the posting changes.
+static pthread_rwlock_t index_lock = PTHREAD_RWLOCK_INITIALIZER;
+// Serialize one file's updates from parse to apply, so the last change to
+// a file is always the one its entry ends up with. Only the holder of a
+// file's stripe changes that file's entry.
+static pthread_mutex_t update_stripes[WORD_INDEX_UPDATE_STRIPES];
+static pthread_once_t update_stripes_once = PTHREAD_ONCE_INIT;
+
+static atomic_int index_ready = 0; // The startup build has finished
+static char build_files_dir[256];
+
+static void init_update_stripes(void) {
+    for (int i = 0; i < WORD_INDEX_UPDATE_STRIPES; i++) pthread_mutex_init(&update_stripes[i], NULL);
+}
+
+static pthread_mutex_t* update_lock_for(const char* filename) {
+    pthread_once(&update_stripes_once, init_update_stripes);
+    return &update_stripes[fnv1a_hash(filename) & (WORD_INDEX_UPDATE_STRIPES - 1)];
+}
+
+// =========================================================================
+//  WORDS
+// =========================================================================
+
+#define SWAR_ONES  0x0101010101010101ULL
+#define SWAR_HIGHS 0x8080808080808080ULL
+
+// High bit of each byte of 'y' (all bytes < 0x80) set iff lo <= byte <= hi
+static inline uint64_t swar_in_range(uint64_t y, unsigned char lo, unsigned char hi) {
+    uint64_t at_least_lo = (y + SWAR_ONES * (0x80 - lo)) & SWAR_HIGHS;
+    uint64_t above_hi = (y + SWAR_ONES * (0x7F - hi)) & SWAR_HIGHS;
+    return at_least_lo & ~above_hi;
+}
+
+/**
+ * @brief Folds one word for the index: letters to lowercase, digits and
+ * non-ASCII (UTF-8) bytes kept, punctuation dropped.
+ * Eight bytes at a time while they hold nothing to drop (the common case:
+ * punctuation is rare and sits at the ends), a byte at a time otherwise.
+ * @return Length written to 'out' (at most WORD_INDEX_MAX_WORD); 0 if
+ * nothing is left to index.
+ */
+static size_t fold_word(const char* s, size_t length, char* out) {
+    size_t n = 0, i = 0;
+    while (i + 8 <= length && n + 8 <= WORD_INDEX_MAX_WORD) {
+        uint64_t x;
+        memcpy(&x, s + i, 8);
+        uint64_t high = x & SWAR_HIGHS;
+        uint64_t y = x & ~SWAR_HIGHS;
+        uint64_t upper = swar_in_range(y, 'A', 'Z') & ~high;
+        uint64_t keep = high | upper | swar_in_range(y, 'a', 'z') | swar_in_range(y, '0', '9');
+        if (keep != SWAR_HIGHS) break; // Something to drop: finish byte-wise
+        x |= upper >> 2;                // 0x80 >> 2 == 'a' - 'A'
+        memcpy(out + n, &x, 8);
+        n += 8;
+        i += 8;
+    }
+    for (; i < length && n < WORD_INDEX_MAX_WORD; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c >= 'A' && c <= 'Z') {
+            out[n++] = (char)(c + ('a' - 'A'));
+        } else if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0x80) {
+            out[n++] = (char)c;
+        }
+    }
+    return n;
+}
+
+static term_t* find_term(const char* word, size_t length, uint64_t hash) {
+    if (term_bucket_count == 0) return NULL;
+    for (term_t* t = term_buckets[hash & (term_bucket_count - 1)]; t; t = t->hash_next) {
+        if (t->hash == hash && t->length == length && memcmp(t->word, word, length) == 0) return t;
+    }
+    return NULL;
+}
+
+static int grow_term_buckets(void) {
+    size_t count = term_bucket_count ? term_bucket_count * 2 : TERM_BUCKETS_MIN;
+    term_t** grown = calloc(count, sizeof(term_t*));
+    if (grown == NULL) return -1;
+    for (size_t i = 0; i < term_bucket_count; i++) {
+        term_t* t = term_buckets[i];
+        while (t) {
+            term_t* next = t->hash_next;
+            size_t bucket = t->hash & (count - 1);
+            t->hash_next = grown[bucket];
+            grown[bucket] = t;
+            t = next;
+        }
+    }
+    free(term_buckets);
+    term_buckets = grown;
+    term_bucket_count = count;
+    return 0;
+}
+
+static term_t* intern_term(const char* word, size_t length, uint64_t hash) {
+    term_t* t = find_term(word, length, hash);
+    if (t) return t;
+
+    // Past two terms per bucket, rehash; if that fails, chains just get longer
+    if (term_count >= term_bucket_count * 2 && grow_term_buckets() == -1 && term_bucket_count == 0) return NULL;
+    if (term_count == term_capacity) {
+        uint32_t capacity = term_capacity ? term_capacity * 2 : 1024;
+        term_t** grown = realloc(terms_by_id, sizeof(term_t*) * capacity);
+        if (grown == NULL) return NULL;
+        terms_by_id = grown;
+        term_capacity = capacity;
+    }
+    t = calloc(1, sizeof(term_t));
+    if (t == NULL) return NULL;
+    t->word = malloc(length + 1);
+    if (t->word == NULL) {
+        free(t);
+        return NULL;
+    }
+    memcpy(t->word, word, length);
+    t->word[length] = '\0';
+    t->length = length;
+    t->hash = hash;
+    t->id = term_count;
+    terms_by_id[term_count++] = t;
+    size_t bucket = hash & (term_bucket_count - 1);
+    t->hash_next = term_buckets[bucket];
+    term_buckets[bucket] = t;
+    return t;
+}
+
+// =========================================================================
+//  POSTINGS
+// =========================================================================
+
+/**
+ * @brief Position of 'file_id' in the term's postings, or -(insertion point) - 1.
+ */
+static int find_posting(const term_t* t, uint64_t file_id) {
+    int lo = 0, hi = t->posting_count - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        uint64_t id = t->postings[mid].file->id;
+        if (id == file_id) return mid;
+        if (id < file_id) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return -lo - 1;
+}
+
+static void adjust_posting(term_t* t, indexed_file_t* file, int delta) {
+    int at = find_posting(t, file->id);
+    if (at >= 0) {
+        t->postings[at].sentences += delta;
+        if (t->postings[at].sentences <= 0) {
+            memmove(&t->postings[at], &t->postings[at + 1], sizeof(posting_t) * (t->posting_count - at - 1));
+            t->posting_count--;
+        }
+        return;
+    }
+    if (delta <= 0) return;
+    at = -at - 1;
+    if (t->posting_count == t->posting_capacity) {
+        int capacity = t->posting_capacity ? t->posting_capacity * 2 : 4;
+        posting_t* grown = realloc(t->postings, sizeof(posting_t) * capacity);
+        if (grown == NULL) return; // The term misses this file until it changes again
+        t->postings = grown;
+        t->posting_capacity = capacity;
+    }
+    memmove(&t->postings[at + 1], &t->postings[at], sizeof(posting_t) * (t->posting_count - at));
+    t->postings[at].file = file;
+    t->postings[at].sentences = delta;
+    t->posting_count++;
+}
+
+// =========================================================================
+//  SENTENCES AND FILES
+// =========================================================================
+
+static int compare_ids(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int sentence_has_term(const indexed_sentence_t* s, uint32_t id) {
+    return bsearch(&id, s->terms, s->term_count, sizeof(uint32_t), compare_ids) != NULL;
+}
+
+static uint64_t sentence_fingerprint(const parsed_doc_t* doc, const sentence_info_t* info) {
+    const doc_word_t* first = &doc->words[info->start_word_idx];
+    const doc_word_t* last = &doc->words[info->end_word_idx];
+    return fnv1a_hash64(doc->text + first->offset, last->offset + last->length - first->offset);
+}
+
+/**
+ * @brief Counts a sentence's folded words, whose term ids are in
+ * 'ids[0..count)', in the postings: sorts, drops duplicates and keeps the
+ * array as the sentence's term list.
+ */
+static void index_sentence(indexed_file_t* file, indexed_sentence_t* s, uint32_t* ids, int count) {
+    qsort(ids, count, sizeof(uint32_t), compare_ids);
+    int distinct = 0;
+    for (int i = 0; i < count; i++) {
+        if (distinct == 0 || ids[distinct - 1] != ids[i]) ids[distinct++] = ids[i];
+    }
+    s->terms = ids;
+    s->term_count = distinct;
+    for (int i = 0; i < s->term_count; i++) adjust_posting(terms_by_id[s->terms[i]], file, 1);
+}
+
+static void unindex_sentence(indexed_file_t* file, indexed_sentence_t* s) {
+    for (int i = 0; i < s->term_count; i++) adjust_posting(terms_by_id[s->terms[i]], file, -1);
+    free(s->terms);
+    s->terms = NULL;
+    s->term_count = 0;
+}
+
+static unsigned int file_bucket(const char* filename) {
+    return fnv1a_hash(filename) & (FILE_BUCKETS - 1);
+}
+
+static indexed_file_t* find_file(const char* filename) {
+    for (indexed_file_t* f = file_buckets[file_bucket(filename)]; f; f = f->hash_next) {
+        if (strcmp(f->filename, filename) == 0) return f;
+    }
+    return NULL;
+}
+
+static indexed_file_t* add_file(const char* filename) {
+    indexed_file_t* file = calloc(1, sizeof(indexed_file_t));
+    if (file == NULL) return NULL;
+    strncpy(file->filename, filename, sizeof(file->filename) - 1);
+    file->id = next_file_id++;
+    unsigned int bucket = file_bucket(file->filename);
+    file->hash_next = file_buckets[bucket];
+    file_buckets[bucket] = file;
+    return file;
+}
+
+// =========================================================================
+//  UPDATES
+// =========================================================================
+
+// What a new parse changes in a file's entry, worked out before the write
+// lock: the sentences between the longest run of matching fingerprints at
+// the start and the longest at the end, with their words already folded
+// and hashed
+typedef struct {
+    int old_count;
+    int new_count;
+    int prefix;
+    int suffix;
+    uint64_t* prints;         // Fingerprint of every new sentence
+    int* first_word;          // Changed sentence k owns words [first_word[k], first_word[k + 1])
+    char* text;               // Folded words, back to back
+    size_t* offsets;
+    size_t* lengths;
+    uint64_t* hashes;
+} doc_diff_t;
+
+static void free_diff(doc_diff_t* diff) {
+    free(diff->prints);
+    free(diff->first_word);
+    free(diff->text);
+    free(diff->offsets);
+    free(diff->lengths);
+    free(diff->hashes);
+}
+
+/**
+ * @brief Diffs 'doc' against the fingerprints in 'file' (NULL if not yet
+ * indexed) and folds the words of the sentences in between. The caller
+ * holds the file's update stripe, so the entry cannot change meanwhile.
+ * @return 0, or -1 if out of memory.
+ */
+static int diff_doc(const char* filename, const parsed_doc_t* doc, doc_diff_t* diff) {
+    memset(diff, 0, sizeof(*diff));
+    int new_count = doc->sentence_count;
+    diff->new_count = new_count;
+    diff->prints = malloc(sizeof(uint64_t) * (new_count > 0 ? new_count : 1));
+    if (diff->prints == NULL) return -1;
+    for (int i = 0; i < new_count; i++) diff->prints[i] = sentence_fingerprint(doc, &doc->sentences[i]);
+
+    pthread_rwlock_rdlock(&index_lock);
+    const indexed_file_t* file = find_file(filename);
+    int old_count = file ? file->sentence_count : 0;
+    int prefix = 0;
+    while (prefix < old_count && prefix < new_count &&
+           file->sentences[prefix].fingerprint == diff->prints[prefix]) {
+        prefix++;
+    }
+    int suffix = 0;
+    while (suffix < old_count - prefix && suffix < new_count - prefix &&
+           file->sentences[old_count - 1 - suffix].fingerprint == diff->prints[new_count - 1 - suffix]) {
+        suffix++;
+    }
+    pthread_rwlock_unlock(&index_lock);
+    diff->old_count = old_count;
+    diff->prefix = prefix;
+    diff->suffix = suffix;
+
+    int changed = new_count - suffix - prefix;
+    int words = 0;
+    size_t bytes = 0;
+    for (int i = prefix; i < new_count - suffix; i++) {
+        for (int w = doc->sentences[i].start_word_idx; w <= doc->sentences[i].end_word_idx; w++) {
+            size_t length = doc->words[w].length;
+            bytes += length < WORD_INDEX_MAX_WORD ? length : WORD_INDEX_MAX_WORD;
+            words++;
+        }
+    }
+    diff->first_word = malloc(sizeof(int) * (changed + 1));
+    diff->text = malloc(bytes > 0 ? bytes : 1);
+    diff->offsets = malloc(sizeof(size_t) * (words > 0 ? words : 1));
+    diff->lengths = malloc(sizeof(size_t) * (words > 0 ? words : 1));
+    diff->hashes = malloc(sizeof(uint64_t) * (words > 0 ? words : 1));
+    if (!diff->first_word || !diff->text || !diff->offsets || !diff->lengths || !diff->hashes) {
+        free_diff(diff);
+        return -1;
+    }
+
+    int folded_words = 0;
+    size_t used = 0;
+    for (int k = 0; k < changed; k++) {
+        const sentence_info_t* info = &doc->sentences[prefix + k];
+        diff->first_word[k] = folded_words;
+        for (int w = info->start_word_idx; w <= info->end_word_idx; w++) {
+            size_t length = fold_word(doc->words[w].str, doc->words[w].length, diff->text + used);
+            if (length == 0) continue;
+            diff->offsets[folded_words] = used;
+            diff->lengths[folded_words] = length;
+            diff->hashes[folded_words] = fnv1a_hash64(diff->text + used, length);
+            used += length;
+            folded_words++;
+        }
+    }
+    diff->first_word[changed] = folded_words;
+    return 0;
+}
+
+/**
+ * @brief Applies a diff to the file's entry, adding the entry if needed.
+ * Sentence numbers are array positions, so the unchanged tail only moves.
+ * @return Sentences re-indexed, or -1 if out of memory (entry unchanged).
+ */
+static int apply_diff_locked(const char* filename, const doc_diff_t* diff) {
+    indexed_file_t* file = find_file(filename);
+    if (file == NULL) file = add_file(filename);
+    if (file == NULL) return -1;
+
+    int old_count = diff->old_count, new_count = diff->new_count;
+    int prefix = diff->prefix, suffix = diff->suffix;
+    if (new_count > file->sentence_capacity) {
+        int capacity = file->sentence_capacity ? file->sentence_capacity : 16;
+        while (capacity < new_count) capacity *= 2;
+        indexed_sentence_t* grown = realloc(file->sentences, sizeof(indexed_sentence_t) * capacity);
+        if (grown == NULL) return -1;
+        file->sentences = grown;
+        file->sentence_capacity = capacity;
+    }
+
+    for (int i = prefix; i < old_count - suffix; i++) unindex_sentence(file, &file->sentences[i]);
+    memmove(&file->sentences[new_count - suffix], &file->sentences[old_count - suffix],
+            sizeof(indexed_sentence_t) * suffix);
+    file->sentence_count = new_count;
+    for (int i = prefix; i < new_count - suffix; i++) {
+        indexed_sentence_t* s = &file->sentences[i];
+        int first = diff->first_word[i - prefix], last = diff->first_word[i - prefix + 1];
+        s->fingerprint = diff->prints[i];
+        s->terms = NULL;
+        s->term_count = 0;
+        uint32_t* ids = malloc(sizeof(uint32_t) * (last > first ? last - first : 1));
+        if (ids == NULL) {
+            s->fingerprint = 0; // Retried the next time the file changes
+            continue;
+        }
+        int count = 0;
+        for (int w = first; w < last; w++) {
+            term_t* t = intern_term(diff->text + diff->offsets[w], diff->lengths[w], diff->hashes[w]);
+            if (t) ids[count++] = t->id;
+        }
+        index_sentence(file, s, ids, count);
+    }
+    return new_count - suffix - prefix;
+}
+
+// Caller holds the file's update stripe
+static int index_doc(const char* filename, const parsed_doc_t* doc) {
+    doc_diff_t diff;
+    if (diff_doc(filename, doc, &diff) == -1) return -1;
+
+    pthread_rwlock_wrlock(&index_lock);
+    int changed = apply_diff_locked(filename, &diff);
+    pthread_rwlock_unlock(&index_lock);
+
+    free_diff(&diff);
+    return changed;
+}
+
+static void remove_file_locked(const char* filename) {
+    indexed_file_t** link = &file_buckets[file_bucket(filename)];
+    while (*link && strcmp((*link)->filename, filename) != 0) link = &(*link)->hash_next;
+    indexed_file_t* file = *link;
+    if (file == NULL) return;
+    *link = file->hash_next;
+    for (int i = 0; i < file->sentence_count; i++) unindex_sentence(file, &file->sentences[i]);
+    free(file->sentences);
+    free(file);
+}
+
+static void build_index(const char* files_dir) {
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    int files = 0;
+    long sentences = 0;
+    int file_count = 0;
+    FileMeta* records = persist_snapshot_files(&file_count);
+    for (int i = 0; i < file_count; i++) {
+        pthread_mutex_t* lock = update_lock_for(records[i].filename);
+        pthread_mutex_lock(lock);
+        // An update that got here first indexed a newer version
+        pthread_rwlock_rdlock(&index_lock);
+        int indexed_already = find_file(records[i].filename) != NULL;
+        pthread_rwlock_unlock(&index_lock);
+        parsed_doc_t* doc = NULL;
+        if (!indexed_already) {
+            char path[512];
+            snprintf(path, sizeof(path), "%s/%s", files_dir, records[i].filename);
+            doc = doc_parse_file(path); // Not cached: a cold start would flush the cache
+        }
+        int indexed = doc ? index_doc(records[i].filename, doc) : -1;
+        pthread_mutex_unlock(lock);
+        if (doc) doc_release(doc);
+        if (indexed >= 0) {
+            files++;
+            sentences += indexed;
+        }
+    }
+    free(records);
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    long ms = (finished.tv_sec - started.tv_sec) * 1000 + (finished.tv_nsec - started.tv_nsec) / 1000000;
+    write_log("INFO", "Word index built: %d files, %ld sentences, %u distinct words in %ld ms.",
+              files, sentences, term_count, ms);
+    atomic_store(&index_ready, 1);
+}
+
+static void* build_thread(void* arg) {
+    (void)arg;
+    build_index(build_files_dir);
+    return NULL;
+}
+
+// =========================================================================
+//  PUBLIC API
+// =========================================================================
+
+int word_index_start_build(const char* files_dir) {
+    strncpy(build_files_dir, files_dir, sizeof(build_files_dir) - 1);
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, build_thread, NULL) != 0) {
+        write_log("WARN", "Could not start the word index thread; indexing inline.");
+        build_index(build_files_dir);
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+int word_index_ready(void) {
+    return atomic_load(&index_ready);
+}
+
+int word_index_update(const char* filename, const char* path) {
+    pthread_mutex_t* lock = update_lock_for(filename);
+    pthread_mutex_lock(lock);
+    parsed_doc_t* doc = doc_cache_acquire(path);
+    int changed = -1;
+    if (doc) {
+        changed = index_doc(filename, doc);
+        doc_release(doc);
+    } else {
+        pthread_rwlock_wrlock(&index_lock);
+        remove_file_locked(filename);
+        pthread_rwlock_unlock(&index_lock);
+    }
+    pthread_mutex_unlock(lock);
+    return changed;
+}
+
+void word_index_remove(const char* filename) {
+    pthread_mutex_t* lock = update_lock_for(filename);
+    pthread_mutex_lock(lock);
+    pthread_rwlock_wrlock(&index_lock);
+    remove_file_locked(filename);
+    pthread_rwlock_unlock(&index_lock);
+    pthread_mutex_unlock(lock);
+}
+
+/**
+ * @brief Makes room for 'needed' more bytes in a growing answer.
+ */
+static int reserve(char** out, size_t* capacity, size_t length, size_t needed) {
+    if (length + needed <= *capacity) return 0;
+    size_t grown_capacity = *capacity * 2;
+    while (grown_capacity < length + needed) grown_capacity *= 2;
+    char* grown = realloc(*out, grown_capacity);
+    if (grown == NULL) return -1;
+    *out = grown;
+    *capacity = grown_capacity;
+    return 0;
+}
+
+char* word_index_query(const char* query, size_t* out_length) {
+    size_t capacity = 4096, length = 0;
+    char* out = malloc(capacity);
+    if (out == NULL) return NULL;
+    out[0] = '\0';
+    *out_length = 0;
+
+    // Fold the query the way documents are folded
+    char words[WORD_INDEX_MAX_TERMS][WORD_INDEX_MAX_WORD];
+    size_t lengths[WORD_INDEX_MAX_TERMS];
+    int word_count = 0;
+    const char* p = query;
+    while (*p && word_count < WORD_INDEX_MAX_TERMS) {
+        while (*p == ' ' || *p == '\t') p++;
+        const char* start = p;
+        while (*p && *p != ' ' && *p != '\t') p++;
+        size_t folded = fold_word(start, (size_t)(p - start), words[word_count]);
+        if (folded > 0) lengths[word_count++] = folded;
+    }
+    if (word_count == 0) return out;
+
+    pthread_rwlock_rdlock(&index_lock);
+    term_t* terms[WORD_INDEX_MAX_TERMS];
+    int count = 0;
+    for (int i = 0; i < word_count; i++) {
+        term_t* t = find_term(words[i], lengths[i], fnv1a_hash64(words[i], lengths[i]));
+        if (t == NULL || t->posting_count == 0) { // Some word is nowhere: nothing matches
+            pthread_rwlock_unlock(&index_lock);
+            return out;
+        }
+        int seen = 0;
+        for (int k = 0; k < count; k++) seen |= terms[k] == t;
+        if (!seen) terms[count++] = t;
+    }
+
+    // Walk the rarest term's files; the other terms are only looked up
+    int rarest = 0;
+    for (int k = 1; k < count; k++) {
+        if (terms[k]->posting_count < terms[rarest]->posting_count) rarest = k;
+    }
+    int hits = 0;
+    for (int i = 0; i < terms[rarest]->posting_count && hits < WORD_INDEX_MAX_HITS; i++) {
+        indexed_file_t* file = terms[rarest]->postings[i].file;
+        int in_file = 1;
+        for (int k = 0; k < count && in_file; k++) {
+            if (k != rarest && find_posting(terms[k], file->id) < 0) in_file = 0;
+        }
+        if (!in_file) continue;
+
+        int matched = 0;
+        for (int s = 0; s < file->sentence_count && hits < WORD_INDEX_MAX_HITS; s++) {
+            int all = 1;
+            for (int k = 0; k < count && all; k++) all = sentence_has_term(&file->sentences[s], terms[k]->id);
+            if (!all) continue;
+            if (reserve(&out, &capacity, length, sizeof(file->filename) + 16) == -1) break;
+            if (matched == 0) length += (size_t)snprintf(out + length, capacity - length, "%s", file->filename);
+            length += (size_t)snprintf(out + length, capacity - length, " %d", s + 1);
+            matched++;
+            hits++;
+        }
+        if (matched > 0 && reserve(&out, &capacity, length, 2) == 0) {
+            out[length++] = '\n';
+            out[length] = '\0';
+        }
+    }
+    pthread_rwlock_unlock(&index_lock);
+
+    *out_length = length;
+    return out;
+}
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "../../include/worker_pool.h"
+#include "../../include/logger.h"
+
+// --- Pool State ---
+// Jobs live in a fixed ring buffer so memory use is set once at startup.
+static void** job_ring = NULL;
+static int ring_capacity = 0;
+static int ring_head = 0;
+static int ring_count = 0;
+static int pool_running = 0;
+
+static worker_job_fn job_handler = NULL;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+
+// --- Parked Jobs ---
+// Sessions idle between commands wait on one epoll set here instead of
+// each keeping a worker blocked in poll(). park_mutex is taken before
+// pool_mutex, never the other way round.
+typedef struct parked_job {
+    int fd;
+    void* job;
+    time_t deadline;        // Given to the idle handler after this
+    int ready;              // Readable; waiting for room in the queue
+    struct parked_job* prev;
+    struct parked_job* next;
+} parked_job_t;
+
+static worker_job_fn idle_job_handler = NULL;
+static int park_epoll_fd = -1;
+static parked_job_t* parked_head = NULL;
+static pthread_mutex_t park_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void* worker_main(void* arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&pool_mutex);
+        while (ring_count == 0 && pool_running) {
+            pthread_cond_wait(&pool_cond, &pool_mutex);
+        }
+        if (ring_count == 0 && !pool_running) {
+            pthread_mutex_unlock(&pool_mutex);
+            break;
+        }
+        void* job = job_ring[ring_head];
+        ring_head = (ring_head + 1) % ring_capacity;
+        ring_count--;
+        pthread_mutex_unlock(&pool_mutex);
+
+        job_handler(job);
+    }
+    return NULL;
+}
+
+// park_mutex must be HELD
+static void unlink_parked(parked_job_t* p) {
+    if (p->prev) p->prev->next = p->next;
+    else parked_head = p->next;
+    if (p->next) p->next->prev = p->prev;
+}
+
+static void* park_main(void* arg) {
+    (void)arg;
+    struct epoll_event events[64];
+    while (1) {
+        pthread_mutex_lock(&pool_mutex);
+        int running = pool_running;
+        pthread_mutex_unlock(&pool_mutex);
+        if (!running) break;
+
+        int n = epoll_wait(park_epoll_fd, events, 64, SS_PARK_TICK_MS);
+        time_t now = time(NULL);
+        parked_job_t* expired = NULL;
+
+        pthread_mutex_lock(&park_mutex);
+        for (int i = 0; i < n; i++) {
+            parked_job_t* p = events[i].data.ptr;
+            epoll_ctl(park_epoll_fd, EPOLL_CTL_DEL, p->fd, NULL); // Before a worker can close it
+            p->ready = 1;
+        }
+        for (parked_job_t* p = parked_head, *next; p; p = next) {
+            next = p->next;
+            if (p->ready && worker_pool_submit(p->job) == 0) {
+                unlink_parked(p);
+                free(p);
+            } else if (now >= p->deadline) {
+                if (!p->ready) epoll_ctl(park_epoll_fd, EPOLL_CTL_DEL, p->fd, NULL);
+                unlink_parked(p);
+                p->next = expired;
+                expired = p;
+            }
+        }
+        pthread_mutex_unlock(&park_mutex);
+
+        while (expired) {
+            parked_job_t* p = expired;
+            expired = p->next;
+            idle_job_handler(p->job);
+            free(p);
+        }
+    }
+    return NULL;
+}
+
+int init_worker_pool(int num_workers, int queue_capacity, worker_job_fn handler,
+                     worker_job_fn idle_handler) {
+    if (num_workers <= 0 || queue_capacity <= 0 || handler == NULL || idle_handler == NULL) {
+        return -1;
+    }
+
+    job_ring = calloc(queue_capacity, sizeof(void*));
+    if (job_ring == NULL) {
+        write_log("FATAL", "Worker pool: Failed to allocate job queue of %d", queue_capacity);
+        return -1;
+    }
+    ring_capacity = queue_capacity;
+    ring_head = 0;
+    ring_count = 0;
+    job_handler = handler;
+    pool_running = 1;
+
+    for (int i = 0; i < num_workers; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, worker_main, NULL) != 0) {
+            write_log("FATAL", "Worker pool: Failed to start worker %d", i);
+            return -1;
+        }
+        pthread_detach(tid);
+    }
+
+    idle_job_handler = idle_handler;
+    park_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    pthread_t park_tid;
+    if (park_epoll_fd < 0 || pthread_create(&park_tid, NULL, park_main, NULL) != 0) {
+        // Workers still run; idle sessions just keep theirs
+        write_log("WARN", "Worker pool: Could not start the park thread; idle sessions hold their workers");
+        if (park_epoll_fd >= 0) close(park_epoll_fd);
+        park_epoll_fd = -1;
+    } else {
+        pthread_detach(park_tid);
+    }
+
+    write_log("INFO", "Worker pool started: %d workers, queue capacity %d",
+              num_workers, queue_capacity);
+    return 0;
+}
+
+int worker_pool_submit(void* job) {
+    pthread_mutex_lock(&pool_mutex);
+    if (!pool_running || ring_count >= ring_capacity) {
+        pthread_mutex_unlock(&pool_mutex);
+        return -1;
+    }
+    int tail = (ring_head + ring_count) % ring_capacity;
+    job_ring[tail] = job;
+    ring_count++;
+    pthread_cond_signal(&pool_cond);
+    pthread_mutex_unlock(&pool_mutex);
+    return 0;
+}
+
+int worker_pool_park(int fd, void* job, int idle_sec) {
+    if (park_epoll_fd < 0) return -1;
+    parked_job_t* p = calloc(1, sizeof(parked_job_t));
+    if (p == NULL) return -1;
+    p->fd = fd;
+    p->job = job;
+    p->deadline = time(NULL) + idle_sec;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.ptr = p;
+    pthread_mutex_lock(&park_mutex);
+    // Linked first: the park thread only looks at events under park_mutex
+    p->next = parked_head;
+    if (parked_head) parked_head->prev = p;
+    parked_head = p;
+    if (epoll_ctl(park_epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        unlink_parked(p);
+        pthread_mutex_unlock(&park_mutex);
+        free(p);
+        return -1;
+    }
+    pthread_mutex_unlock(&park_mutex);
+    return 0;
+}
+
+void shutdown_worker_pool() {
+    pthread_mutex_lock(&pool_mutex);
+    pool_running = 0;
+    pthread_cond_broadcast(&pool_cond);
+    pthread_mutex_unlock(&pool_mutex);
+}
@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../../include/write_session.h"
+#include "../../include/doc_cache.h"
+#include "../../include/logger.h"
+#include "../../include/hash.h"
+
+// Serialize read-splice-rename per file so two sessions on one file cannot
+// each commit over the other's sentence, while commits (and their fsyncs)
+// to other files go ahead.
+static pthread_mutex_t commit_stripes[WRITE_COMMIT_STRIPES];
+static pthread_once_t commit_stripes_once = PTHREAD_ONCE_INIT;
+
+static void init_commit_stripes(void) {
+    for (int i = 0; i < WRITE_COMMIT_STRIPES; i++) pthread_mutex_init(&commit_stripes[i], NULL);
+}
+
+static pthread_mutex_t* commit_lock_for(const char* path) {
+    pthread_once(&commit_stripes_once, init_commit_stripes);
+    return &commit_stripes[fnv1a_hash(path) & (WRITE_COMMIT_STRIPES - 1)];
+}
+
+static int is_sentence_delimiter(char c) {
+    return c == '.' || c == '!' || c == '?';
+}
+
+static int reserve_words(write_session_t* session, int needed) {
+    if (needed <= session->word_capacity) return 0;
+    int capacity = session->word_capacity ? session->word_capacity : 16;
+    while (capacity < needed) capacity *= 2;
+    char** grown = realloc(session->words, sizeof(char*) * capacity);
+    if (grown == NULL) return -1;
+    session->words = grown;
+    session->word_capacity = capacity;
+    return 0;
+}
+
+/**
+ * @brief Moves a delimiter typed at the end of an open sentence into
+ * 'delimiter', so later inserts at the end land before it (as they do
+ * for a sentence that was already closed).
+ */
+static void normalize_tail(write_session_t* session) {
+    if (session->delimiter != '\0' || session->word_count == 0) return;
+    char* last = session->words[session->word_count - 1];
+    size_t len = strlen(last);
+    if (len > 0 && is_sentence_delimiter(last[len - 1])) {
+        session->delimiter = last[len - 1];
+        last[len - 1] = '\0';
+        if (len == 1) {
+            free(last);
+            session->word_count--;
+        }
+    }
+}
+
+int write_session_begin(write_session_t* session, const char* orig_path, const char* filename,
+                        int sentence_num, const char* swap_path) {
+    write_session_end(session); // A session whose lock was dropped under it
+
+    strncpy(session->filename, filename, sizeof(session->filename) - 1);
+    strncpy(session->swap_path, swap_path, sizeof(session->swap_path) - 1);
+    session->sentence_num = sentence_num;
+
+    parsed_doc_t* doc = doc_cache_acquire(orig_path);
+    if (doc == NULL) return -1;
+
+    if (sentence_num >= 1 && sentence_num <= doc->sentence_count) {
+        const sentence_info_t* sentence = &doc->sentences[sentence_num - 1];
+        int count = sentence->end_word_idx - sentence->start_word_idx + 1;
+        if (reserve_words(session, count) == -1) {
+            doc_release(doc);
+            return -1;
+        }
+        for (int w = sentence->start_word_idx; w <= sentence->end_word_idx; w++) {
+            char* word = strdup(doc->words[w].str);
+            if (word == NULL) {
+                doc_release(doc);
+                write_session_end(session);
+                return -1;
+            }
+            session->words[session->word_count++] = word;
+        }
+        // The delimiter is kept apart from the words while editing
+        session->delimiter = sentence->delimiter;
+        if (session->delimiter != '\0') {
+            char* last = session->words[session->word_count - 1];
+            last[strlen(last) - 1] = '\0';
+            if (last[0] == '\0') {
+                free(last);
+                session->word_count--;
+            }
+        }
+    }
+    doc_release(doc);
+    session->active = 1;
+    return 0;
+}
+
+int write_session_insert(write_session_t* session, int word_idx, const char* content,
+                         char* err, size_t err_size) {
+    if (session->word_count == 0 && word_idx != 1) {
+        snprintf(err, err_size, "ERR_404 New sentence: only word index 1 allowed\n");
+        return -1;
+    }
+    if (word_idx < 1 || word_idx > session->word_count + 1) {
+        snprintf(err, err_size,
+                 "ERR_404 Word index %d out of range. Sentence %d has %d words (positions 1-%d available)\n",
+                 word_idx, session->sentence_num, session->word_count, session->word_count + 1);
+        return -1;
+    }
+
+    char* copy = strdup(content);
+    if (copy == NULL) {
+        snprintf(err, err_size, "ERR_500 Out of memory\n");
+        return -1;
+    }
+    int added = 0;
+    for (char* p = copy; *p; p++) {
+        if ((p == copy || p[-1] == ' ' || p[-1] == '\t') && *p != ' ' && *p != '\t') added++;
+    }
+    if (reserve_words(session, session->word_count + added) == -1) {
+        free(copy);
+        snprintf(err, err_size, "ERR_500 Out of memory\n");
+        return -1;
+    }
+
+    // Open a gap at the insertion point and fill it with the new words
+    int at = word_idx - 1;
+    memmove(&session->words[at + added], &session->words[at],
+            sizeof(char*) * (session->word_count - at));
+    char* saveptr = NULL;
+    int filled = 0;
+    for (char* token = strtok_r(copy, " \t", &saveptr); token && filled < added;
+         token = strtok_r(NULL, " \t", &saveptr)) {
+        session->words[at + filled] = strdup(token);
+        if (session->words[at + filled] == NULL) session->words[at + filled] = strdup("");
+        filled++;
+    }
+    session->word_count += added;
+    free(copy);
+
+    normalize_tail(session);
+    session->dirty = 1;
+    if (WRITE_SWAP_FLUSH_EDITS > 0 && ++session->edits_since_flush >= WRITE_SWAP_FLUSH_EDITS) {
+        write_session_flush(session);
+    }
+    return 0;
+}
+
+char* write_session_render(const write_session_t* session, size_t* out_length) {
+    size_t length = 0;
+    for (int i = 0; i < session->word_count; i++) {
+        length += strlen(session->words[i]) + (i > 0 ? 1 : 0);
+    }
+    if (session->delimiter != '\0') length++;
+
+    char* text = malloc(length + 1);
+    if (text == NULL) return NULL;
+    char* p = text;
+    for (int i = 0; i < session->word_count; i++) {
+        if (i > 0) *p++ = ' ';
+        size_t len = strlen(session->words[i]);
+        memcpy(p, session->words[i], len);
+        p += len;
+    }
+    if (session->delimiter != '\0') *p++ = session->delimiter;
+    *p = '\0';
+    if (out_length) *out_length = length;
+    return text;
+}
+
+void write_session_flush(write_session_t* session) {
+    if (!session->active || session->edits_since_flush == 0) return;
+    size_t length = 0;
+    char* text = write_session_render(session, &length);
+    if (text == NULL) return;
+    FILE* swap = fopen(session->swap_path, "w");
+    if (swap) {
+        fwrite(text, 1, length, swap);
+        fclose(swap);
+        session->edits_since_flush = 0;
+    } else {
+        write_log("WARN", "Could not flush WRITE crash buffer %s", session->swap_path);
+    }
+    free(text);
+}
+
+void write_session_end(write_session_t* session) {
+    for (int i = 0; i < session->word_count; i++) free(session->words[i]);
+    free(session->words);
+    if (session->active) remove(session->swap_path);
+    memset(session, 0, sizeof(*session));
+}
+
+static int write_all(FILE* f, const char* data, size_t length) {
+    return length == 0 || fwrite(data, 1, length, f) == length ? 0 : -1;
+}
+
+/**
+ * @brief Makes a rename in 'path's directory durable.
+ */
+static void sync_parent_dir(const char* path) {
+    char dir[512];
+    strncpy(dir, path, sizeof(dir) - 1);
+    dir[sizeof(dir) - 1] = '\0';
+    char* slash = strrchr(dir, '/');
+    if (slash == NULL) strcpy(dir, ".");
+    else *slash = '\0';
+    int dfd = open(dir, O_RDONLY);
+    if (dfd >= 0) {
+        fsync(dfd);
+        close(dfd);
+    }
+}
+
+int write_session_commit(write_session_t* session, const char* orig_path,
+                         long* size_delta, long* word_delta) {
+    size_t edited_length = 0;
+    char* edited = write_session_render(session, &edited_length);
+    if (edited == NULL) return -1;
+    long edited_words = session->word_count;
+    if (edited_words == 0 && session->delimiter != '\0') edited_words = 1; // A lone delimiter
+
+    pthread_mutex_t* commit_lock = commit_lock_for(orig_path);
+    pthread_mutex_lock(commit_lock);
+    parsed_doc_t* doc = doc_cache_acquire(orig_path);
+    const char* text = doc ? doc->text : "";
+    size_t length = doc ? doc->length : 0;
+    int sentence_count = doc ? doc->sentence_count : 0;
+
+    // Bytes [cut_start, cut_end) of the current file give way to the edit
+    const char* joiner = "";
+    size_t cut_start, cut_end;
+    long removed_words = 0;
+    if (sentence_count == 0) {
+        cut_start = 0; // Empty or whitespace only: the sentence is everything
+        cut_end = length;
+    } else if (session->sentence_num > sentence_count) {
+        cut_start = cut_end = length; // New sentence at the end
+        if (length > 0) joiner = " ";
+    } else {
+        const sentence_info_t* sentence = &doc->sentences[session->sentence_num - 1];
+        const doc_word_t* last = &doc->words[sentence->end_word_idx];
+        cut_start = doc->words[sentence->start_word_idx].offset;
+        cut_end = last->offset + last->length;
+        removed_words = sentence->end_word_idx - sentence->start_word_idx + 1;
+    }
+
+    char temp_path[600];
+    snprintf(temp_path, sizeof(temp_path), "%s.commit", orig_path);
+    int rc = -1;
+    FILE* out = fopen(temp_path, "w");
+    if (out) {
+        rc = write_all(out, text, cut_start);
+        if (rc == 0) rc = write_all(out, joiner, strlen(joiner));
+        if (rc == 0) rc = write_all(out, edited, edited_length);
+        if (rc == 0) rc = write_all(out, text + cut_end, length - cut_end);
+        if (rc == 0 && (fflush(out) != 0 || fsync(fileno(out)) != 0)) rc = -1;
+        if (fclose(out) != 0) rc = -1;
+        if (rc == 0 && rename(temp_path, orig_path) != 0) rc = -1;
+        if (rc == 0) sync_parent_dir(orig_path);
+        else remove(temp_path);
+    }
+    if (rc == 0) {
+        doc_cache_invalidate(orig_path);
+        *size_delta = (long)(strlen(joiner) + edited_length) - (long)(cut_end - cut_start);
+        *word_delta = edited_words - removed_words;
+    } else {
+        write_log("ERROR", "Could not commit %s sentence %d", orig_path, session->sentence_num);
+    }
+    pthread_mutex_unlock(commit_lock);
+
+    doc_release(doc);
+    free(edited);
+    return rc;
+}
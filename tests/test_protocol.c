@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "protocol.h"
+#include "test_util.h"
+
+// Wire framing: v1 and v2 headers survive a round trip over a socket, a
+// v2 frame is only as long as its filename, the receiver follows the
+// sender's framing, and the compact v2 payload encoders decode back to
+// what went in.
+
+static int same_header(const MessageHeader *a, const MessageHeader *b) {
+    return a->msg_type == b->msg_type &&
+           a->source_component == b->source_component &&
+           a->dest_component == b->dest_component &&
+           a->request_id == b->request_id &&
+           a->payload_length == b->payload_length &&
+           strcmp(a->filename, b->filename) == 0;
+}
+
+static MessageHeader make_header(int msg_type, const char *filename, uint32_t request_id, uint32_t payload_length) {
+    MessageHeader h;
+    memset(&h, 0, sizeof(h));
+    h.msg_type = msg_type;
+    h.source_component = COMPONENT_STORAGE_SERVER;
+    h.dest_component = COMPONENT_NAME_SERVER;
+    h.request_id = request_id;
+    h.payload_length = payload_length;
+    strncpy(h.filename, filename, MAX_FILENAME - 1);
+    return h;
+}
+
+static void test_header_round_trip(int version) {
+    int fds[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    protocol_set_version(fds[0], version);
+    protocol_set_version(fds[1], PROTOCOL_V1);
+
+    char longest[MAX_FILENAME];
+    memset(longest, 'n', sizeof(longest) - 1);
+    longest[sizeof(longest) - 1] = '\0';
+    MessageHeader sent[] = {
+        make_header(MSG_READ, "", 0, 0),
+        make_header(MSG_SEARCH_RESPONSE, "INDEX_WARMING", 7, 12345),
+        make_header(MSG_INTERNAL_METADATA_DELTA, "folder/a.txt", 0xfffffffeu, 0xffffffffu),
+        make_header(MSG_REGISTER_CLIENT, longest, PROTOCOL_VERSION, 1),
+    };
+    for (size_t i = 0; i < sizeof(sent) / sizeof(sent[0]); i++) {
+        CHECK(send_header(fds[0], &sent[i]) == 0);
+        if (version == PROTOCOL_V2) {
+            // Only the used bytes of the filename go out
+            char frame[PROTOCOL_V2_HEADER + MAX_FILENAME];
+            size_t expected = PROTOCOL_V2_HEADER + strlen(sent[i].filename);
+            CHECK(recv(fds[1], frame, sizeof(frame), MSG_PEEK) == (ssize_t)expected);
+            CHECK((uint8_t)frame[0] == PROTOCOL_V2_MAGIC);
+        }
+        MessageHeader got;
+        memset(&got, 0xab, sizeof(got));
+        CHECK(recv_header(fds[1], &got) == 0);
+        CHECK(same_header(&got, &sent[i]));
+    }
+    // The receiver answers in the framing it was spoken to in
+    CHECK(protocol_version(fds[1]) == version);
+
+    close(fds[0]);
+    CHECK(recv_header(fds[1], &(MessageHeader){0}) == -1); // Peer gone
+    close(fds[1]);
+}
+
+static void test_offer(void) {
+    CHECK(protocol_accept_offer(0) == 0);
+    CHECK(protocol_accept_offer(PROTOCOL_V2) == PROTOCOL_V2);
+    CHECK(protocol_accept_offer(PROTOCOL_V2 + 1) == PROTOCOL_V2);
+}
+
+static void test_file_record_round_trip(void) {
+    SSFileRecordPayload records[2];
+    memset(records, 0, sizeof(records));
+    strcpy(records[0].filename, "notes.txt");
+    strcpy(records[0].owner_username, "alice");
+    records[0].acl_count = 2;
+    strcpy(records[0].acl[0].username, "bob");
+    records[0].acl[0].permission = PERM_READ;
+    strcpy(records[0].acl[1].username, "carol");
+    records[0].acl[1].permission = PERM_WRITE;
+    records[0].word_count = 300;
+    records[0].char_count = 1 << 20;
+    records[0].created = 1700000000;
+    records[0].modified = 1700000500;
+    records[0].last_accessed = 1700000900;
+    strcpy(records[0].last_accessed_by, "bob");
+    strcpy(records[0].folder, "docs/2024");
+    strcpy(records[1].filename, "empty.txt");
+    records[1].replica = 1;
+
+    uint8_t buf[4096];
+    size_t used = 0;
+    for (int i = 0; i < 2; i++) {
+        size_t n = encode_file_record(&records[i], buf + used, sizeof(buf) - used);
+        CHECK(n > 0 && n < sizeof(SSFileRecordPayload));
+        used += n;
+    }
+    const uint8_t *cursor = buf;
+    for (int i = 0; i < 2; i++) {
+        SSFileRecordPayload got;
+        CHECK(decode_file_record(&cursor, buf + used, &got) == 0);
+        CHECK_STR(got.filename, records[i].filename);
+        CHECK_STR(got.owner_username, records[i].owner_username);
+        CHECK_STR(got.folder, records[i].folder);
+        CHECK_STR(got.last_accessed_by, records[i].last_accessed_by);
+        CHECK(got.acl_count == records[i].acl_count);
+        for (int k = 0; k < got.acl_count && k < records[i].acl_count; k++) {
+            CHECK_STR(got.acl[k].username, records[i].acl[k].username);
+            CHECK(got.acl[k].permission == records[i].acl[k].permission);
+        }
+        CHECK(got.word_count == records[i].word_count);
+        CHECK(got.char_count == records[i].char_count);
+        CHECK(got.created == records[i].created);
+        CHECK(got.modified == records[i].modified);
+        CHECK(got.last_accessed == records[i].last_accessed);
+        CHECK(got.replica == records[i].replica);
+    }
+    CHECK(cursor == buf + used);
+
+    // Every cut short of the whole record is refused
+    size_t first = encode_file_record(&records[0], buf, sizeof(buf));
+    for (size_t cut = 0; cut < first; cut++) {
+        const uint8_t *p = buf;
+        SSFileRecordPayload got;
+        CHECK(decode_file_record(&p, buf + cut, &got) == -1);
+    }
+    CHECK(encode_file_record(&records[0], buf, 4) == 0); // Does not fit
+}
+
+static void test_file_info_round_trip(void) {
+    FileInfoPayload info;
+    memset(&info, 0, sizeof(info));
+    strcpy(info.filename, "report.txt");
+    strcpy(info.owner_username, "alice");
+    strcpy(info.ss_ip, "10.0.0.7");
+    info.ss_port = 9001;
+    info.acl_count = 1;
+    strcpy(info.acl[0].username, "dave");
+    info.acl[0].permission = PERM_WRITE;
+    info.word_count = 42;
+    info.char_count = 210;
+    info.created = 1600000000;
+    info.last_modified = 1600000100;
+    info.last_accessed = 1600000200;
+    strcpy(info.last_accessed_by, "dave");
+
+    uint8_t buf[2048];
+    size_t n = encode_file_info(&info, buf, sizeof(buf));
+    CHECK(n > 0 && n < sizeof(info));
+    FileInfoPayload got;
+    CHECK(decode_file_info(buf, n, &got) == 0);
+    CHECK_STR(got.filename, info.filename);
+    CHECK_STR(got.owner_username, info.owner_username);
+    CHECK_STR(got.ss_ip, info.ss_ip);
+    CHECK(got.ss_port == info.ss_port);
+    CHECK(got.acl_count == 1);
+    CHECK_STR(got.acl[0].username, "dave");
+    CHECK(got.acl[0].permission == PERM_WRITE);
+    CHECK(got.word_count == info.word_count);
+    CHECK(got.char_count == info.char_count);
+    CHECK(got.created == info.created);
+    CHECK(got.last_modified == info.last_modified);
+    CHECK(got.last_accessed == info.last_accessed);
+    CHECK_STR(got.last_accessed_by, info.last_accessed_by);
+    CHECK(decode_file_info(buf, n - 1, &got) == -1);
+}
+
+static void test_metadata_delta_round_trip(void) {
+    SSMetadataDeltaPayload delta;
+    memset(&delta, 0, sizeof(delta));
+    strcpy(delta.filename, "a/b/c.txt");
+    delta.meta.word_count = 7;
+    delta.meta.char_count = 35;
+    delta.meta.created = 1500000000;
+    delta.meta.last_modified = 1500000001;
+    delta.meta.last_accessed = 1500000002;
+    strcpy(delta.meta.last_accessed_by, "erin");
+    delta.content_changed = 1;
+
+    uint8_t buf[1024];
+    size_t n = encode_metadata_delta(&delta, buf, sizeof(buf));
+    CHECK(n > 0 && n < sizeof(delta));
+    SSMetadataDeltaPayload got;
+    CHECK(decode_metadata_delta(buf, n, &got) == 0);
+    CHECK_STR(got.filename, delta.filename);
+    CHECK(got.meta.word_count == delta.meta.word_count);
+    CHECK(got.meta.char_count == delta.meta.char_count);
+    CHECK(got.meta.created == delta.meta.created);
+    CHECK(got.meta.last_modified == delta.meta.last_modified);
+    CHECK(got.meta.last_accessed == delta.meta.last_accessed);
+    CHECK_STR(got.meta.last_accessed_by, delta.meta.last_accessed_by);
+    CHECK(got.content_changed == 1);
+    CHECK(decode_metadata_delta(buf, n - 1, &got) == -1);
+}
+
+int main(void) {
+    test_header_round_trip(PROTOCOL_V1);
+    test_header_round_trip(PROTOCOL_V2);
+    test_offer();
+    test_file_record_round_trip();
+    test_file_info_round_trip();
+    test_metadata_delta_round_trip();
+    TEST_DONE();
+}
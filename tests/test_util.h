@@ -0,0 +1,79 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Minimal checks for the regression tests run by 'make test': a failed
+// CHECK prints where and keeps going, TEST_DONE() sets the exit status.
+
+static int test_failures = 0;
+static int test_checks = 0;
+
+#define CHECK(cond) do { \
+        test_checks++; \
+        if (!(cond)) { \
+            test_failures++; \
+            fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        } \
+    } while (0)
+
+#define CHECK_STR(actual, expected) do { \
+        test_checks++; \
+        if (strcmp((actual), (expected)) != 0) { \
+            test_failures++; \
+            fprintf(stderr, "FAIL %s:%d: \"%s\" != \"%s\"\n", __FILE__, __LINE__, (actual), (expected)); \
+        } \
+    } while (0)
+
+#define TEST_DONE() do { \
+        printf("%s: %d checks, %d failed\n", __FILE__, test_checks, test_failures); \
+        return test_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE; \
+    } while (0)
+
+/**
+ * @brief Writes 'text' to 'path', replacing it.
+ * @return 0 on success, -1 on failure.
+ */
+static inline int write_text_file(const char *path, const char *text) {
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    size_t length = strlen(text);
+    int rc = fwrite(text, 1, length, f) == length ? 0 : -1;
+    if (fclose(f) != 0) rc = -1;
+    return rc;
+}
+
+/**
+ * @brief Whether 'path' exists.
+ */
+static inline int file_exists(const char *path) {
+    return access(path, F_OK) == 0;
+}
+
+/**
+ * @brief Copies 'from' to 'to', replacing it.
+ * @return 0 on success, -1 on failure.
+ */
+static inline int copy_file(const char *from, const char *to) {
+    FILE *in = fopen(from, "rb");
+    if (!in) return -1;
+    FILE *out = fopen(to, "wb");
+    if (!out) {
+        fclose(in);
+        return -1;
+    }
+    char buf[4096];
+    size_t n;
+    int rc = 0;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n) rc = -1;
+    }
+    fclose(in);
+    if (fclose(out) != 0) rc = -1;
+    return rc;
+}
+
+#endif // TEST_UTIL_H
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "word_index.h"
+#include "doc_cache.h"
+#include "persistence.h"
+#include "test_util.h"
+
+// Word index: the background build, incremental updates (only the
+// sentences between the unchanged prefix and suffix are re-indexed, and
+// the tail keeps its numbers), word folding and removal.
+
+static char base_dir[64];
+static char meta_dir[128];
+static char files_dir[128];
+
+static void file_path(char *out, size_t size, const char *name) {
+    snprintf(out, size, "%s/%s", files_dir, name);
+}
+
+static void put_file(const char *name, const char *text) {
+    char path[256];
+    file_path(path, sizeof(path), name);
+    CHECK(write_text_file(path, text) == 0);
+    doc_cache_invalidate(path); // As every SS write path does
+}
+
+// Re-indexes 'name' after a change, the way the SS does after a commit
+static int update(const char *name, const char *text) {
+    char path[256];
+    put_file(name, text);
+    file_path(path, sizeof(path), name);
+    return word_index_update(name, path);
+}
+
+static void check_query(const char *query, const char *expected, int line) {
+    size_t length = 0;
+    char *hits = word_index_query(query, &length);
+    test_checks++;
+    if (hits == NULL || strcmp(hits, expected) != 0 || length != strlen(expected)) {
+        test_failures++;
+        fprintf(stderr, "FAIL %s:%d: query \"%s\" gave \"%s\", expected \"%s\"\n",
+                __FILE__, line, query, hits ? hits : "(null)", expected);
+    }
+    free(hits);
+}
+#define CHECK_QUERY(query, expected) check_query((query), (expected), __LINE__)
+
+static void test_background_build(void) {
+    put_file("a.txt", "Hello world. Goodbye moon.");
+    put_file("c.txt", "Built in the background.");
+    CHECK(load_metadata(meta_dir) == 0);
+    add_metadata_entry(meta_dir, "a.txt");
+    add_metadata_entry(meta_dir, "c.txt");
+
+    // An update that gets in before the build is kept, not indexed twice
+    CHECK(update("a.txt", "Hello world. Goodbye moon.") == 2);
+    CHECK(word_index_start_build(files_dir) == 0);
+    for (int i = 0; i < 500 && !word_index_ready(); i++) usleep(10 * 1000);
+    CHECK(word_index_ready());
+
+    CHECK_QUERY("background", "c.txt 1\n");
+    CHECK_QUERY("world", "a.txt 1\n");
+    CHECK_QUERY("goodbye", "a.txt 2\n");
+}
+
+static void test_incremental_updates(void) {
+    // Insert a sentence in the middle: only it is re-indexed and the tail moves
+    CHECK(update("a.txt", "Hello world. New middle. Goodbye moon.") == 1);
+    CHECK_QUERY("middle", "a.txt 2\n");
+    CHECK_QUERY("goodbye moon", "a.txt 3\n");
+    CHECK_QUERY("hello", "a.txt 1\n");
+
+    // Drop the first sentence: nothing to re-index, numbers shift down
+    CHECK(update("a.txt", "New middle. Goodbye moon.") == 0);
+    CHECK_QUERY("hello", "");
+    CHECK_QUERY("goodbye", "a.txt 2\n");
+
+    // Rewrite one sentence in place
+    CHECK(update("a.txt", "New start. Goodbye moon.") == 1);
+    CHECK_QUERY("middle", "");
+    CHECK_QUERY("new", "a.txt 1\n");
+
+    // Words in two sentences of one file, and across files
+    CHECK(update("b.txt", "The moon rises. Moon again!") == 2);
+    CHECK_QUERY("moon", "a.txt 2\nb.txt 1 2\n");
+    CHECK_QUERY("moon goodbye", "a.txt 2\n");
+    CHECK_QUERY("moon nowhere", "");
+
+    // A file that can no longer be read leaves the index
+    char path[256];
+    file_path(path, sizeof(path), "b.txt");
+    unlink(path);
+    doc_cache_invalidate(path);
+    CHECK(word_index_update("b.txt", path) == -1);
+    CHECK_QUERY("moon", "a.txt 2\n");
+
+    CHECK(update("b.txt", "Back again.") == 1);
+    CHECK_QUERY("again", "b.txt 1\n");
+    word_index_remove("b.txt");
+    CHECK_QUERY("again", "");
+}
+
+static void test_folding(void) {
+    // Long words take the eight-bytes-at-a-time path; punctuation and
+    // case must fold the same either way
+    CHECK(update("f.txt",
+                 "ABCDEFGHIJKLMNOPqrstuvwxyz0123456789 don't-stop-BELIEVING \"Quoted,\" "
+                 "caf\xc3\xa9 "
+                 "Pneumonoultramicroscopicsilicovolcanoconiosispneumonoultramicroscopicsilicovolcanoconiosis.") == 1);
+    CHECK_QUERY("abcdefghijklmnopQRSTUVWXYZ0123456789", "f.txt 1\n");
+    CHECK_QUERY("dontstopbelieving", "f.txt 1\n");
+    CHECK_QUERY("DON'T-STOP-believing!", "f.txt 1\n");
+    CHECK_QUERY("quoted", "f.txt 1\n");
+    CHECK_QUERY("CAF\xc3\xa9", "f.txt 1\n");
+    // Indexed by its first WORD_INDEX_MAX_WORD bytes
+    CHECK_QUERY("pneumonoultramicroscopicsilicovolcanoconiosispneumonoultramicroscopic", "f.txt 1\n");
+    CHECK_QUERY("...", ""); // Folds to nothing
+    CHECK_QUERY("   ", "");
+    word_index_remove("f.txt");
+}
+
+int main(void) {
+    strcpy(base_dir, "/tmp/test_word_index.XXXXXX");
+    if (mkdtemp(base_dir) == NULL) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    snprintf(meta_dir, sizeof(meta_dir), "%s/metadata", base_dir);
+    snprintf(files_dir, sizeof(files_dir), "%s/files", base_dir);
+    mkdir(meta_dir, 0755);
+    mkdir(files_dir, 0755);
+
+    test_background_build();
+    test_incremental_updates();
+    test_folding();
+
+    char command[160];
+    snprintf(command, sizeof(command), "rm -rf %s", base_dir);
+    if (system(command) != 0) fprintf(stderr, "Could not remove %s\n", base_dir);
+    TEST_DONE();
+}